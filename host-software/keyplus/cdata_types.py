@@ -22,6 +22,8 @@ define('MAX_NUM_KEYBOARDS', 64)
 define('MAX_NUM_DEVICES', 64)
 define('AES_KEY_LEN', 16)
 define('NRF_ADDR_LEN', 5)
+define('NUM_KEYBOARD_PIPES', 4)
+define('LAYOUT_SECTION_COUNT', LAYOUT_SECTION_COUNT)
 
 def make_bit_field_variables(class_obj, field_list):
     """
@@ -90,6 +92,17 @@ class scan_plan_t(CStructWithBytes):
     """
 
 
+class scan_governor_settings_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+        uint8_t fast_interval;
+        uint8_t slow_interval;
+        uint16_t fast_timeout;
+        uint8_t low_battery_level;
+        uint8_t _reserved[3];
+    """
+
+
 class settings_header_t(CStructWithBytes):
     __byte_order__ = cstruct.LITTLE_ENDIAN
     __struct__ = """
@@ -98,7 +111,7 @@ class settings_header_t(CStructWithBytes):
     uint8_t timestamp[8];
     uint8_t default_report_mode;
     struct scan_plan_t scan_plan;
-    uint8_t _reserved0[8];
+    struct scan_governor_settings_t scan_governor;
     uint8_t feature_ctrl;
     uint8_t _reserved1[14];
     uint16_t crc; /* total size == 96 */
@@ -142,7 +155,9 @@ class layout_settings_header_t(CStructWithBytes):
         uint8_t number_layouts;
         uint8_t number_devices;
         uint8_t default_layout_id;
-        uint8_t _reserved[29]; /* 32 */
+        uint8_t combo_count;
+        uint16_t combo_table_offset;
+        uint8_t _reserved[26]; /* 32 */
     """
 
 class layout_settings_t(CStructWithBytes):
@@ -151,11 +166,43 @@ class layout_settings_t(CStructWithBytes):
         uint8_t number_layouts;
         uint8_t number_devices;
         uint8_t default_layout_id;
-        uint8_t _reserved[29]; /* 32 */
+        uint8_t combo_count;
+        uint16_t combo_table_offset;
+        uint8_t _reserved[26]; /* 32 */
         struct keyboard_info_t layouts[MAX_NUM_KEYBOARDS];
         struct device_info_t devices[MAX_NUM_DEVICES]; /* 353 bytes */
     """
 
+class layout_section_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+        uint32_t offset;
+        uint32_t size;
+        uint16_t crc;
+        uint8_t _reserved[2];
+    """
+
+class layout_index_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+        uint16_t magic;
+        uint8_t version;
+        uint8_t section_count;
+        struct layout_section_t sections[LAYOUT_SECTION_COUNT];
+        uint8_t _reserved[10];
+        uint16_t crc; /* 64 */
+    """
+
+class layout_table_entry_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+        uint32_t offset;
+        uint8_t matrix_size;
+        uint8_t layer_count;
+        uint8_t flags;
+        uint8_t _reserved;
+    """
+
 class firmware_info_t(CStructWithBytes):
     __byte_order__ = cstruct.LITTLE_ENDIAN
     __struct__ = """
@@ -234,6 +281,39 @@ class rf_settings_t(CStructWithBytes):
     uint8_t dkey[AES_KEY_LEN];
     """
 
+class rf_tx_stats_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+    uint16_t states;
+    uint16_t sent;
+    uint16_t coalesced;
+    uint16_t overflows;
+    uint16_t retries;
+    uint16_t dropped;
+    uint16_t resyncs;
+    uint8_t depth;
+    uint8_t max_depth;
+    """ # size == 16 bytes
+
+class rf_rx_device_stats_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+    uint16_t received;
+    uint16_t rejected;
+    uint16_t resyncs;
+    uint16_t latency_last;
+    uint16_t latency_max;
+    """ # size == 10 bytes
+
+class rf_rx_stats_t(CStructWithBytes):
+    __byte_order__ = cstruct.LITTLE_ENDIAN
+    __struct__ = """
+    uint16_t dropped;
+    uint16_t resumes;
+    uint16_t bad_device_ids;
+    uint16_t num_devices;
+    """ # size == 8 bytes
+
 class settings_t(CStructWithBytes): #
     __byte_order__ = cstruct.LITTLE_ENDIAN
     __struct__ = """
@@ -18,6 +18,7 @@ ERROR_KEY_EVENT_QUEUE_UNLOADED_DEVICE = 5
 ERROR_VENDOR_IN_REPORT_CANT_KEEP_UP = 6
 ERROR_INVALID_KB_ID_USED = 7
 ERROR_MACRO_CMD_ERROR = 8
+ERROR_COMBO_TABLE_TOO_LARGE = 9
 
 # critical errors
 CRITICAL_ERROR_START = 64
@@ -29,6 +30,13 @@ ERROR_MATRIX_PINS_CONFIG_TOO_LARGE = 68
 ERROR_PIN_MAPPING_CONFLICT = 69
 ERROR_NRF24_BAD_SPI_CONNECTION = 70
 ERROR_UNSUPPORTED_SCAN_MODE = 71
+ERROR_MAXIMUM_KEY_NUMBER_EXCEEDED = 72
+ERROR_SETTINGS_INVALID_VALUE = 73
+ERROR_STATIC_LAYOUT_MISMATCH = 74
+ERROR_LAYOUT_FORMAT_INVALID = 75
+ERROR_LAYOUT_SECTION_CRC_MISMATCH = 76
+ERROR_NUM_LAYERS_TOO_LARGE = 77
+ERROR_FLASH_VERIFY_FAILED = 78
 
 ERROR_CODE_MAP = {
     0: "ERROR_EKC_OUT_OF_BOUNDS_ACCESS",
@@ -40,6 +48,7 @@ ERROR_CODE_MAP = {
     6: "ERROR_VENDOR_IN_REPORT_CANT_KEEP_UP",
     7: "ERROR_INVALID_KB_ID_USED",
     8: "ERROR_MACRO_CMD_ERROR",
+    9: "ERROR_COMBO_TABLE_TOO_LARGE",
 
     64: "ERROR_EKC_STORAGE_TOO_LARGE",
     65: "ERROR_NUM_LAYOUTS_TOO_LARGE",
@@ -49,6 +58,13 @@ ERROR_CODE_MAP = {
     69: "ERROR_PIN_MAPPING_CONFLICT",
     70: "ERROR_NRF24_BAD_SPI_CONNECTION",
     71: "ERROR_UNSUPPORTED_SCAN_MODE",
+    72: "ERROR_MAXIMUM_KEY_NUMBER_EXCEEDED",
+    73: "ERROR_SETTINGS_INVALID_VALUE",
+    74: "ERROR_STATIC_LAYOUT_MISMATCH",
+    75: "ERROR_LAYOUT_FORMAT_INVALID",
+    76: "ERROR_LAYOUT_SECTION_CRC_MISMATCH",
+    77: "ERROR_NUM_LAYERS_TOO_LARGE",
+    78: "ERROR_FLASH_VERIFY_FAILED",
 }
 
 
@@ -14,7 +14,24 @@ SETTINGS_RF_INFO_SIZE = 64
 SETTINGS_RF_INFO_HEADER_SIZE = (SETTINGS_RF_INFO_SIZE - AES_KEY_LEN*2)
 SETTINGS_SIZE = 512
 
-LAYOUT_HEADER_SIZE = 1
+# Layout storage format, see `src/core/layout.h`
+LAYOUT_INDEX_MAGIC = 0x504b
+LAYOUT_FORMAT_VERSION = 2
+LAYOUT_INDEX_SIZE = 64
+
+LAYOUT_SECTION_PIN_MAP = 0
+LAYOUT_SECTION_EKC = 1
+LAYOUT_SECTION_LAYOUT_TABLE = 2
+LAYOUT_SECTION_KEYMAPS = 3
+LAYOUT_SECTION_COUNT = 4
+
+LAYOUT_FLAG_HAS_MOUSE_LAYERS = 0x01
+LAYOUT_FLAG_SPARSE_LAYERS = 0x02
+
+LAYOUT_LAYER_SPARSE = 0x80000000
+LAYOUT_LAYER_OFFSET_MASK = 0x7fffffff
+LAYOUT_LAYER_OFFSET_SIZE = 4
+LAYOUT_SPARSE_ROW_SIZE = 3
 
 MAX_NUMBER_KEYBOARDS = 64
 MAX_NUMBER_LAYOUTS = MAX_NUMBER_KEYBOARDS
@@ -61,6 +61,7 @@ INFO_LAYOUT_DATA_2 = 8  # // 186
 INFO_LAYOUT_DATA_3 = 9  # // 248
 INFO_LAYOUT_DATA_4 = 10 # // 310
 INFO_LAYOUT_DATA_5 = 11 # // 372
+INFO_RF_STATS = 12
 INFO_UNSUPPORTED = 0xff
 
 INFO_NUM_LAYOUT_DATA_PAGES = INFO_LAYOUT_DATA_5 - INFO_LAYOUT_DATA_0 + 1
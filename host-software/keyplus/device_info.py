@@ -319,6 +319,44 @@ class KeyboardLayoutInfo(keyplus.cdata_types.layout_settings_t):
 class KeyboardRFInfo(keyplus.cdata_types.rf_settings_t):
     pass
 
+class KeyboardRFStats(object):
+    """
+    RF link counters read from the INFO_RF_STATS pages. Each page starts with
+    the sender and receiver counters, followed by the counters of the next
+    device ids on the receiver.
+    """
+    def __init__(self, raw_data):
+        tx_size = keyplus.cdata_types.rf_tx_stats_t.__size__
+        rx_size = keyplus.cdata_types.rf_rx_stats_t.__size__
+        self.tx = keyplus.cdata_types.rf_tx_stats_t()
+        self.tx.unpack(bytes(raw_data[:tx_size]))
+        self.rx = keyplus.cdata_types.rf_rx_stats_t()
+        self.rx.unpack(bytes(raw_data[tx_size:tx_size+rx_size]))
+        self.devices = []
+        self.add_page(raw_data)
+
+    def has_all_devices(self):
+        return len(self.devices) >= self.rx.num_devices
+
+    def add_page(self, raw_data):
+        """
+        Add the device counters of the next INFO_RF_STATS page, and return
+        how many were added.
+        """
+        device_size = keyplus.cdata_types.rf_rx_device_stats_t.__size__
+        pos = (
+            keyplus.cdata_types.rf_tx_stats_t.__size__ +
+            keyplus.cdata_types.rf_rx_stats_t.__size__
+        )
+        count = 0
+        while pos + device_size <= len(raw_data) and not self.has_all_devices():
+            device = keyplus.cdata_types.rf_rx_device_stats_t()
+            device.unpack(bytes(raw_data[pos:pos+device_size]))
+            self.devices.append(device)
+            pos += device_size
+            count += 1
+        return count
+
 class KeyboardFirmwareInfo(keyplus.cdata_types.firmware_info_t):
     @property
     def timestamp_raw(self):
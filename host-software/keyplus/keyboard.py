@@ -21,11 +21,13 @@ from keyplus.chip_id import get_chip_id_from_name
 from keyplus.error_table import KeyplusErrorTable
 from keyplus.exceptions import *
 from keyplus.device_info import *
-from keyplus.utility import uint24_le
+from keyplus.utility import uint24_le, crc16_bytes
 
 from keyplus.layout import *
+from keyplus.layout.keyboard_layout import sparse_layer_from_bytes
 from keyplus.debug import DEBUG
-from keyplus.cdata_types import layout_settings_t
+from keyplus.cdata_types import layout_settings_t, layout_index_t, \
+    layout_table_entry_t
 
 def _get_similar_serial_number(dev_list, serial_num):
     partial_match = None
@@ -480,17 +482,17 @@ class KeyplusKeyboard(object):
             if total and (count >= total):
                 return count
 
-    def get_info_cmd(self, info_page_number):
+    def get_info_cmd(self, info_page_number, sub_page=0):
         retries = 2
         while retries != 0:
-            response = self.simple_command(CMD_GET_INFO, [info_page_number])
+            response = self.simple_command(CMD_GET_INFO, [info_page_number, sub_page])
             if response[0] == INFO_UNSUPPORTED:
                 raise KeyplusUnsupportedError(
                     "Device doesn't have any data for info page number '{}'"
                     .format(info_page_number)
                 )
             elif response[0] != info_page_number:
-                response = self.simple_command(CMD_GET_INFO, [info_page_number])
+                response = self.simple_command(CMD_GET_INFO, [info_page_number, sub_page])
                 retries -= 1
             else:
                 break
@@ -554,6 +556,20 @@ class KeyplusKeyboard(object):
         self._rf_info_dirty = False
         return rf_info
 
+    def get_rf_stats(self):
+        """
+        Read the RF link counters of the device. The counters of the sender
+        are zero on a receiver and the other way around. A receiver has
+        counters for each device id, which are read a page at a time.
+        """
+        stats = KeyboardRFStats(self.get_info_cmd(INFO_RF_STATS))
+        page = 1
+        while not stats.has_all_devices():
+            if not stats.add_page(self.get_info_cmd(INFO_RF_STATS, page)):
+                break
+            page += 1
+        return stats
+
     def read_settings_section(self):
         """ Reads the settings section from the device and returns it """
         # NOTE: In the future, might support mulitple formats of the settings
@@ -592,61 +608,79 @@ class KeyplusKeyboard(object):
         return result
 
     def _get_layout_data_sections(self):
-        device_target = self.get_device_target()
-
-        if self.firmware_info.internal_scan_method == MATRIX_SCANNER_INTERNAL_NONE:
-            pin_mapping_section = 0
-        elif self.firmware_info.internal_scan_method == MATRIX_SCANNER_INTERNAL_FAST_ROW_COL:
-            header_size = 0
-            header_size += self.firmware_info.scanner_max_rows
-            header_size += device_target.get_io_mapper().get_gpio_count()
-            scan_plan = self.device_info.scan_plan
-            map_size = (scan_plan.max_col_pin_num+1) * scan_plan.rows
-            pin_mapping_section = header_size + map_size
-
         data = self._whole_layout_data
 
-        # ekc_size =
-        external_keycode_table = pin_mapping_section + struct.unpack(
-            "< H",
-            data[pin_mapping_section:pin_mapping_section+2],
-        )[0]
+        index = layout_index_t()
+        index.unpack(bytes(data[:layout_index_t.__size__]))
 
-        pin_map_data = data[:pin_mapping_section]
-        ekc_data = data[pin_mapping_section:external_keycode_table]
-        layout_data = data[external_keycode_table+2:]
+        if (
+            index.magic != LAYOUT_INDEX_MAGIC or
+            index.version != LAYOUT_FORMAT_VERSION or
+            index.crc != crc16_bytes(bytearray(data[:layout_index_t.__size__-2]))
+        ):
+            raise KeyplusSettingsError(
+                "The layout section of the device doesn't start with a valid "
+                "layout index (expected format version {})"
+                .format(LAYOUT_FORMAT_VERSION)
+            )
 
-        return (
-            pin_map_data,
-            ekc_data,
-            layout_data
-        )
+        sections = []
+        for section_id in range(LAYOUT_SECTION_COUNT):
+            section = index.sections[section_id]
+            section_data = data[section.offset:section.offset+section.size]
+            if crc16_bytes(bytearray(section_data)) != section.crc:
+                raise KeyplusSettingsError(
+                    "CRC mismatch in section {} of the device's layout"
+                    .format(section_id)
+                )
+            sections.append(section_data)
 
-    def _get_layout_keycode_arrays(self, layout_data):
+        return sections
+
+    def _get_layout_keycode_arrays(self, layout_table):
         self.get_layout_info()
 
-        result = []
+        data = self._whole_layout_data
 
-        pos = 0
+        result = []
 
         for layout_i in range(self.layout_settings.number_layouts):
-            layout = self.layout_settings.layouts[layout_i]
+            entry = layout_table_entry_t()
+            entry.unpack(bytes(layout_table[
+                layout_i*layout_table_entry_t.__size__ :
+                (layout_i+1)*layout_table_entry_t.__size__
+            ]))
             devices = self.layout_settings.get_layout_device_sizes(layout_i)
-            num_layers = self.layout_settings.layouts[layout_i].layer_count
+            layer_size = 2 * 8 * entry.matrix_size
             layout_keycodes = []
-            for layer_i in range(num_layers):
+            for layer_i in range(entry.layer_count):
+                if entry.flags & LAYOUT_FLAG_SPARSE_LAYERS:
+                    (layer_offset,) = struct.unpack_from(
+                        "<I", data, entry.offset + LAYOUT_LAYER_OFFSET_SIZE*layer_i
+                    )
+                    pos = entry.offset + (layer_offset & LAYOUT_LAYER_OFFSET_MASK)
+                else:
+                    layer_offset = 0
+                    pos = entry.offset + layer_size*layer_i
+
+                if layer_offset & LAYOUT_LAYER_SPARSE:
+                    layer_keycodes = sparse_layer_from_bytes(
+                        data[pos:], entry.matrix_size
+                    )
+                else:
+                    layer_keycodes = list(struct.unpack(
+                        "<" + "H" * (layer_size // 2),
+                        data[pos:pos+layer_size]
+                    ))
+
                 layer = []
+                pos = 0
                 for (offset, size) in devices:
-                    keycodes = struct.unpack(
-                        "<" + "H" * (size // 2),
-                        layout_data[pos:pos+size]
-                    )
-                    layer.append(list(keycodes))
+                    layer.append(layer_keycodes[pos//2:(pos+size)//2])
                     pos += size
                 layout_keycodes.append(layer)
             result.append(layout_keycodes)
 
-
         return result
 
     def unpack_layout_data(self):
@@ -654,7 +688,7 @@ class KeyplusKeyboard(object):
         self.read_whole_layout()
         device_target = self.get_device_target()
 
-        pin_map_data, ekc_table, layout_data = self._get_layout_data_sections()
+        pin_map_data, ekc_table, layout_table, _ = self._get_layout_data_sections()
 
         scan_mode = ScanMode()
         pin_mapping = KeyboardPinMapping()
@@ -677,7 +711,7 @@ class KeyplusKeyboard(object):
         # ekc_table.unpack()
         # hexdump.hexdump(layout_data)
 
-        layout_arrays = self._get_layout_keycode_arrays(layout_data)
+        layout_arrays = self._get_layout_keycode_arrays(layout_table)
 
         result = []
         kp_layout = KeyplusLayout()
@@ -454,6 +454,7 @@ MACRO_CMD_CLEAR_KEYBOARD    = KC_MACRO_CMD_START_ADDR | 0x06
 MACRO_CMD_CLEAR_MOUSE       = KC_MACRO_CMD_START_ADDR | 0x07
 
 MACRO_CMD_SET_CLEAR_RATE    = KC_MACRO_CMD_START_ADDR | 0x08
+MACRO_CMD_SET_BURST         = KC_MACRO_CMD_START_ADDR | 0x09
 
 # macro mouse control commands
 MACRO_CMD_MOUSE_MOVE        = KC_MACRO_CMD_START_ADDR | 0x10
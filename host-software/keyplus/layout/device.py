@@ -7,7 +7,7 @@
 import keyplus.layout.scan_mode
 from keyplus.layout.scan_mode import ScanMode
 from keyplus.layout.parser_info import KeyplusParserInfo
-from keyplus.cdata_types import feature_ctrl_t
+from keyplus.cdata_types import feature_ctrl_t, scan_governor_settings_t
 from keyplus.device_info import KeyboardSettingsInfo
 
 from keyplus.constants import *
@@ -17,6 +17,15 @@ import struct
 DEFAULT_FEATURE_MASK = FEATURE_CTRL_RF_DISABLE | FEATURE_CTRL_RF_MOUSE_DISABLE \
     | FEATURE_CTRL_WIRED_DISABLE;
 
+# Maps yaml field names to `scan_governor_settings_t` fields and their ranges.
+# A value of 0 makes the firmware use its default value.
+SCAN_GOVERNOR_FIELDS = [
+    ("fast_scan_interval", "fast_interval", [0, 254]),
+    ("slow_scan_interval", "slow_interval", [0, 254]),
+    ("fast_scan_timeout", "fast_timeout", [0, 0xfffe]),
+    ("low_battery_level", "low_battery_level", [0, 100]),
+]
+
 class LayoutDevice(object):
     def __init__(self, device_id=0, name="", layout_name=None,
                  scan_mode=None, layout_id=None, split_device_num=0):
@@ -27,6 +36,7 @@ class LayoutDevice(object):
         self.split_device_num = split_device_num
         self.feature_ctrl = feature_ctrl_t()
         self.feature_ctrl.feature_ctrl = DEFAULT_FEATURE_MASK
+        self.scan_governor = scan_governor_settings_t()
         self.layout = None
         self.layout_offset = None
 
@@ -34,6 +44,7 @@ class LayoutDevice(object):
         self.device_id = device_info.device_id
         self.name = device_info.get_name_str()
         self.feature_ctrl.feature_ctrl = device_info.feature_ctrl
+        self.scan_governor = device_info.scan_governor
 
         if pin_mapping:
             self.scan_mode.load_raw_data(device_info.scan_plan, pin_mapping)
@@ -52,6 +63,7 @@ class LayoutDevice(object):
         header.set_device_name(self.name)
         header.scan_plan = self.scan_mode.generate_scan_plan(device_target)
         header.feature_ctrl = self.feature_ctrl.feature_ctrl
+        header.scan_governor = self.scan_governor
 
         # header.
 
@@ -72,6 +84,11 @@ class LayoutDevice(object):
         result["split_device_num"] = self.layout
         result["scan_mode"] = self.scan_mode.to_json()
 
+        for (json_name, field, _) in SCAN_GOVERNOR_FIELDS:
+            value = getattr(self.scan_governor, field)
+            if value not in [0, 0xff, 0xffff]:
+                result[json_name] = value
+
         return result
 
     def parse_json(self, device_name, json_obj=None, parser_info=None):
@@ -147,6 +164,15 @@ class LayoutDevice(object):
         )
 
 
+        self.scan_governor = scan_governor_settings_t()
+        for (json_name, field, field_range) in SCAN_GOVERNOR_FIELDS:
+            setattr(self.scan_governor, field, parser_info.try_get(
+                json_name,
+                default = 0,
+                field_type = int,
+                field_range = field_range,
+            ))
+
         self.studio_kle = parser_info.try_get(
             "studio_kle",
             default = None,
@@ -176,20 +176,24 @@ class EKCHoldKey(EKCData):
 
     HOLD_KEY_ACTIVATE_DELAY     =  (1 << 0)
     HOLD_KEY_ACTIVATE_OTHER_KEY =  (1 << 1)
+    HOLD_KEY_PERMISSIVE_HOLD    =  (1 << 2)
+    HOLD_KEY_RETRO_TAP          =  (1 << 3)
 
     ACTIVATE_TYPE_MAP = {
-        'delay': (1 << 0),
-        'other_key': (1 << 1),
+        'delay': HOLD_KEY_ACTIVATE_DELAY,
+        'other_key': HOLD_KEY_ACTIVATE_OTHER_KEY,
+        'permissive_hold': HOLD_KEY_ACTIVATE_DELAY | HOLD_KEY_PERMISSIVE_HOLD,
     }
 
 
     def __init__(self, tap_key=None, hold_key=None, delay=200,
-                 activate_type=None, kc_map_function=None):
+                 activate_type=None, retro_tap=False, kc_map_function=None):
         self.tap_key = tap_key
         self.hold_key = hold_key
         self.delay = delay
         self.kc_map_function = kc_map_function
         self.activate_type = activate_type or EKCHoldKey.DEFAULT_ACTIVATE_TYPE
+        self.retro_tap = retro_tap
 
     def size(self):
         return self.SIZE
@@ -213,6 +217,9 @@ class EKCHoldKey(EKCData):
 
         option_data |= EKCHoldKey.ACTIVATE_TYPE_MAP[self.activate_type]
 
+        if self.retro_tap:
+            option_data |= EKCHoldKey.HOLD_KEY_RETRO_TAP
+
         # _16(KC_HOLD_KEY), \
         # _16(200), \
         # _16(0), \
@@ -270,6 +277,13 @@ class EKCHoldKey(EKCData):
             default=EKCHoldKey.DEFAULT_ACTIVATE_TYPE,
         )
 
+        # Send the tap key if the key was held, but no other key was pressed
+        self.retro_tap = parser_info.try_get(
+            'retro_tap',
+            field_type=bool,
+            default=False
+        )
+
         # Finish parsing `device_name`
         parser_info.exit()
 
@@ -312,6 +326,7 @@ class EKCMacroKey(EKCData):
             (re.compile("macro_finish\(\)")        , MACRO_CMD_FINISH         , ()                     ),
             (re.compile("set_rate\((\d+)\)")       , MACRO_CMD_SET_RATE       , (UINT,)             ),
             (re.compile("set_clear_rate\((\d+)\)") , MACRO_CMD_SET_CLEAR_RATE , (UINT,)             ),
+            (re.compile("set_burst\((\d+)\)")      , MACRO_CMD_SET_BURST      , (UINT,)             ),
             (re.compile("press\(([^)]+)\)")        , MACRO_CMD_PRESS          , (STR,)                 ),
             (re.compile("release\(([^)]+)\)")      , MACRO_CMD_RELEASE        , (STR,)                 ),
             (re.compile("clear_keyboard\(\)")      , MACRO_CMD_CLEAR_KEYBOARD , ()                     ),
@@ -565,6 +580,71 @@ class EKCMacroRepeatKey(EKCData):
     pass
 
 
+class EKCComboTable(EKCData):
+    # Data: combo_entry_t[number_combos] = {
+    #    0x00: uint8_t layout_id
+    #    0x01: uint8_t term
+    #    0x02: uint8_t keys[4]
+    #    0x06: keycode_t keycode
+    # }
+    ENTRY_SIZE = 8
+    MAX_KEYS = 4
+    # Largest `MAX_NUM_COMBOS` the firmware can be built with. Firmware that
+    # isn't built with the generated config header loads the first
+    # `DEFAULT_MAX_COMBOS`, see `src/core/combo.h`.
+    MAX_COMBOS = 32
+    DEFAULT_MAX_COMBOS = 8
+    MAX_KEY_NUM = 128
+    KEY_NONE = 0xff
+
+    def __init__(self):
+        self.combos = []
+
+    def add_combo(self, layout_id, keys, keycode, term=0):
+        if len(keys) < 2 or len(keys) > self.MAX_KEYS:
+            raise KeyplusSettingsError(
+                "A combo must have between 2 and {} keys, got {}."
+                .format(self.MAX_KEYS, len(keys))
+            )
+        if len(set(keys)) != len(keys):
+            raise KeyplusSettingsError(
+                "A combo can't use the same key more than once: {}"
+                .format(keys)
+            )
+        for key in keys:
+            if key >= self.MAX_KEY_NUM:
+                raise KeyplusSettingsError(
+                    "Key number {} is too large to be used in a combo, the "
+                    "maximum is {}.".format(key, self.MAX_KEY_NUM-1)
+                )
+        if len(self.combos) >= self.MAX_COMBOS:
+            raise KeyplusSettingsError(
+                "Too many combos, at most {} can be used."
+                .format(self.MAX_COMBOS)
+            )
+        self.combos.append((layout_id, term, keys, keycode))
+
+    @property
+    def number_combos(self):
+        return len(self.combos)
+
+    def size(self):
+        return self.ENTRY_SIZE * len(self.combos)
+
+    def to_bytes(self):
+        result = bytearray()
+        for (layout_id, term, keys, keycode) in self.combos:
+            padded_keys = list(keys) + [self.KEY_NONE] * (self.MAX_KEYS - len(keys))
+            result += struct.pack(
+                "< B B 4B H",
+                layout_id,
+                term,
+                *padded_keys,
+                self.kc_map_function(keycode)
+            )
+        return result
+
+
 class EKCDataTable(EKCData):
     # def __init__(self, children=[]):
     def __init__(self):
@@ -590,10 +670,7 @@ class EKCDataTable(EKCData):
 
         result = bytearray(0)
 
-        # first byte is the total size of the data
-        result += struct.pack('<H', total_size)
-
-        # after append all the children
+        # NOTE: the size of the data is stored in the layout index
         for (i, child) in enumerate(self.children):
             result += child.to_bytes()
 
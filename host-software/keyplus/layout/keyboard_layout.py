@@ -10,6 +10,11 @@ import sys
 
 from keyplus.keycodes import *
 from keyplus.exceptions import *
+from keyplus.constants import *
+
+LAYER_STORAGE_AUTO = 'auto'
+LAYER_STORAGE_DENSE = 'dense'
+LAYER_STORAGE_SPARSE = 'sparse'
 
 class LayoutDeviceKeycodes(object):
     def __init__(self, keycodes=None, number_keys=None, keycode_mapper=None):
@@ -97,6 +102,7 @@ class LayoutKeyboard(object):
         self.default_layer = 0
         self.layer_list = []
         self.has_mouse_layer = False
+        self.layer_storage = LAYER_STORAGE_AUTO
 
         if device_sizes != None:
             self.device_sizes = device_sizes
@@ -175,6 +181,15 @@ class LayoutKeyboard(object):
             default = False,
         )
 
+        self.layer_storage = parser_info.try_get(
+            field = 'layer_storage',
+            field_type = str,
+            default = LAYER_STORAGE_AUTO,
+            field_valid_values = [
+                LAYER_STORAGE_AUTO, LAYER_STORAGE_DENSE, LAYER_STORAGE_SPARSE
+            ],
+        )
+
         self.load_keycodes(keycode_table, keycode_type=str)
 
         parser_info.exit()
@@ -234,24 +249,122 @@ class LayoutKeyboard(object):
             result.append(layer.to_keycodes(self.keycode_mapper))
         return result
 
-    def to_bytes(self):
-        result = bytearray()
-
-        # Construct the layout header
-        result += struct.pack("<B", self.has_mouse_layers)
-
-        keycodes = self.to_keycodes()
+    def to_layer_arrays(self):
+        """
+        Returns the keycodes of each layer as a flat list, in the same order
+        that they are stored in the firmware.
+        """
+        result = []
 
         # TODO: Remove requirement that keymaps mast be aligned to 8 byte
         # boundaries ?
-        for layer in keycodes:
+        for layer in self.to_keycodes():
+            layer_keycodes = []
             for device in layer:
-                for keycode in device:
-                    result += struct.pack("<H", keycode)
-                result += struct.pack("<H", KC_NONE) * (-(len(device)%8)%8)
+                layer_keycodes += device
+                layer_keycodes += [KC_NONE] * (-(len(device)%8)%8)
+            result.append(layer_keycodes)
 
         return result
 
+    def to_bytes(self):
+        """
+        Returns the keycode array of the layout. The layout's matrix size,
+        layer count and flags are stored in the layout table.
+        """
+        result = bytearray()
+
+        for layer in self.to_layer_arrays():
+            result += dense_layer_to_bytes(layer)
+
+        return result
+
+    def to_sparse_bytes(self):
+        """
+        Returns the keymap of the layout for `LAYOUT_FLAG_SPARSE_LAYERS`. Each
+        layer is stored sparse if that makes it smaller, see
+        `layout_sparse_row_t` in the firmware.
+        """
+        layers = []
+        for layer in self.to_layer_arrays():
+            dense = dense_layer_to_bytes(layer)
+            sparse = sparse_layer_to_bytes(layer)
+            if len(sparse) < len(dense):
+                layers.append((LAYOUT_LAYER_SPARSE, sparse))
+            else:
+                layers.append((0, dense))
+
+        offset_table = bytearray()
+        result = bytearray()
+        offset = LAYOUT_LAYER_OFFSET_SIZE * len(layers)
+        for (flag, data) in layers:
+            offset_table += struct.pack("<I", offset | flag)
+            result += data
+            offset += len(data)
+
+        return offset_table + result
+
+    def to_keymap_bytes(self):
+        """
+        Returns:
+            (is_sparse, keymap), where keymap is the smaller of `to_bytes()`
+            and `to_sparse_bytes()` unless `layer_storage` picks one.
+        """
+        if self.layer_storage == LAYER_STORAGE_DENSE:
+            return (False, self.to_bytes())
+        elif self.layer_storage == LAYER_STORAGE_SPARSE:
+            return (True, self.to_sparse_bytes())
+
+        dense = self.to_bytes()
+        sparse = self.to_sparse_bytes()
+        if len(sparse) < len(dense):
+            return (True, sparse)
+        else:
+            return (False, dense)
+
+
+def dense_layer_to_bytes(layer):
+    result = bytearray()
+    for keycode in layer:
+        result += struct.pack("<H", keycode)
+    return result
+
+def sparse_layer_to_bytes(layer):
+    """
+    Encode a layer as a `layout_sparse_row_t` for each row of 8 keys, followed
+    by the keycodes that are not transparent.
+    """
+    rows = bytearray()
+    keycodes = bytearray()
+    base = 0
+    for row_start in range(0, len(layer), 8):
+        present = 0
+        for (col, keycode) in enumerate(layer[row_start:row_start+8]):
+            if keycode != KC_TRANSPARENT:
+                present |= (1 << col)
+                keycodes += struct.pack("<H", keycode)
+        rows += struct.pack("<HB", base, present)
+        base += bin(present).count('1')
+    return rows + keycodes
+
+def sparse_layer_from_bytes(data, matrix_size):
+    """Decode a layer encoded by `sparse_layer_to_bytes()`."""
+    keycodes_start = LAYOUT_SPARSE_ROW_SIZE * matrix_size
+    result = []
+    for row in range(matrix_size):
+        (base, present) = struct.unpack_from(
+            "<HB", data, LAYOUT_SPARSE_ROW_SIZE * row
+        )
+        for col in range(8):
+            if present & (1 << col):
+                result.append(struct.unpack_from(
+                    "<H", data, keycodes_start + 2*base
+                )[0])
+                base += 1
+            else:
+                result.append(KC_TRANSPARENT)
+    return result
+
 
 """
 layouts:
@@ -20,10 +20,12 @@ from keyplus.layout.rf_settings import *
 from keyplus.layout.ekc_data import *
 from keyplus.layout.user_keycodes import UserKeycodes
 from keyplus.keycodes.keycode_mapper import KeycodeMapper
-from keyplus.cdata_types import rf_settings_t, settings_t
+from keyplus.cdata_types import rf_settings_t, settings_t, layout_index_t, \
+    layout_table_entry_t
 from keyplus.device_info import KeyboardLayoutInfo
 from keyplus.constants import *
 from keyplus.debug import DEBUG
+from keyplus.utility import crc16_bytes
 
 REPORT_MODE_MAP = {
     'auto_nkro': KEYBOARD_REPORT_MODE_AUTO,
@@ -42,6 +44,7 @@ class KeyplusLayout(object):
 
         self.user_keycodes = UserKeycodes()
         self.ekc_data = EKCDataTable()
+        self.combo_table = None
 
         self.kc_mapper = KeycodeMapper()
         self.kc_mapper.set_user_keycodes(self.user_keycodes)
@@ -230,6 +233,83 @@ class KeyplusLayout(object):
             self.add_layout(layout)
         parser_info.exit()
 
+    def _get_combo_key_number(self, layout, key, parser_info):
+        """
+        Combo keys are given either as a key number in the first split device
+        or as a string 'device:key' for other split devices.
+        """
+        if isinstance(key, int):
+            split_device, key_num = 0, key
+        else:
+            try:
+                split_device, key_num = [int(x) for x in str(key).split(':')]
+            except ValueError:
+                parser_info.raise_exception(
+                    "Invalid combo key '{}', expected a key number or "
+                    "'device:key'".format(key)
+                )
+
+        layer = layout.layer_list[0]
+        if split_device >= layer.number_devices or \
+                key_num >= layer.device_sizes[split_device]:
+            parser_info.raise_exception(
+                "Combo key '{}' is not in layout '{}'".format(key, layout.name)
+            )
+
+        # The firmware numbers keys by their bit position in the layout matrix
+        return 8*layer.get_layout_component_offset(split_device) + key_num
+
+    def _parse_combos(self, parser_info):
+        if not parser_info.has_field('combos'):
+            return
+
+        self.combo_table = EKCComboTable()
+        self.combo_table.set_keycode_map_function(self.kc_mapper.from_string)
+
+        parser_info.enter("combos")
+        for combo_name in parser_info.iter_fields():
+            parser_info.enter(combo_name)
+
+            layout_name = parser_info.try_get(
+                'layout',
+                field_type = str,
+                default = self.default_layout_name,
+            )
+            if layout_name == None:
+                layout = self.get_layout_by_id(self.get_default_layout_id())
+            else:
+                layout = self.get_layout_by_name(layout_name)
+            if layout == None:
+                parser_info.raise_exception(
+                    "Combo uses non-existent layout '{}'".format(layout_name)
+                )
+
+            keys = parser_info.try_get('keys', field_type=list)
+            keycode = parser_info.try_get('keycode', field_type=str)
+            term = parser_info.try_get(
+                'term',
+                field_type = int,
+                field_range = [0, 255],
+                default = 0,
+            )
+
+            key_nums = [
+                self._get_combo_key_number(layout, key, parser_info)
+                for key in keys
+            ]
+
+            try:
+                self.combo_table.add_combo(
+                    layout.layout_id, key_nums, keycode, term
+                )
+            except KeyplusSettingsError as err:
+                parser_info.raise_exception(str(err))
+
+            parser_info.exit()
+        parser_info.exit()
+
+        self.ekc_data.add_child(self.combo_table)
+
     def parse_json(self, layout_json=None, rf_json=None, parser_info=None, rf_parser_info=None):
         if parser_info == None:
             assert(layout_json != None)
@@ -267,6 +347,7 @@ class KeyplusLayout(object):
         self._parse_devices(parser_info)
         self._parse_keycodes(parser_info)
         self._parse_layouts(parser_info)
+        self._parse_combos(parser_info)
 
         parser_info.exit()
 
@@ -332,8 +413,16 @@ class KeyplusLayout(object):
     def pack_settings_data(self, device_target):
         pass
 
-    def _build_layouts(self):
-        result = bytearray()
+    def _build_layouts(self, keymaps_offset):
+        """
+        Build the layout table and keymaps sections. `keymaps_offset` is the
+        offset of the keymaps section from the start of the layout storage.
+
+        Returns:
+            (layout_table, keymaps) as bytearrays
+        """
+        layout_table = bytearray()
+        keymaps = bytearray()
         num_layouts = len(self._layouts)
 
         for layout_id in range(num_layouts):
@@ -341,8 +430,58 @@ class KeyplusLayout(object):
                 raise KeyplusSettingsError(
                     "Layout ids cannot skip values. TODO(remove this requirement)"
                 )
-            result += self._layouts[layout_id].to_bytes()
-        return result
+            layout = self._layouts[layout_id]
+            layers = layout.to_layer_arrays()
+
+            entry = layout_table_entry_t()
+            entry.offset = keymaps_offset + len(keymaps)
+            entry.matrix_size = len(layers[0]) // 8 if layers else 0
+            entry.layer_count = len(layers)
+            if layout.has_mouse_layers:
+                entry.flags |= LAYOUT_FLAG_HAS_MOUSE_LAYERS
+
+            (is_sparse, keymap) = layout.to_keymap_bytes()
+            if is_sparse:
+                entry.flags |= LAYOUT_FLAG_SPARSE_LAYERS
+            layout_table += entry.to_bytes()
+
+            keymaps += keymap
+        return (layout_table, keymaps)
+
+    def get_keymap_size_report(self):
+        """
+        Returns a text report that compares the flash used by the keymap of
+        each layout with dense and with sparse layers.
+        """
+        lines = []
+        lines.append("{:<24} {:>6} {:>10} {:>10}  {}".format(
+            "layout", "layers", "dense", "sparse", "stored as"
+        ))
+
+        total_dense = 0
+        total_sparse = 0
+        total_stored = 0
+        for layout_id in sorted(self._layouts):
+            layout = self._layouts[layout_id]
+            dense_size = len(layout.to_bytes())
+            sparse_size = len(layout.to_sparse_bytes())
+            (is_sparse, keymap) = layout.to_keymap_bytes()
+
+            total_dense += dense_size
+            total_sparse += sparse_size
+            total_stored += len(keymap)
+            lines.append("{:<24} {:>6} {:>10} {:>10}  {}".format(
+                layout.name or str(layout_id),
+                layout.number_layers,
+                dense_size,
+                sparse_size,
+                "sparse" if is_sparse else "dense",
+            ))
+
+        lines.append("{:<24} {:>6} {:>10} {:>10}  {} bytes".format(
+            "total", "", total_dense, total_sparse, total_stored
+        ))
+        return "\n".join(lines)
 
     @property
     def number_layouts(self):
@@ -365,6 +504,10 @@ class KeyplusLayout(object):
         layout_info.number_devices = max(self._devices)+1
         layout_info.default_layout_id = self.get_default_layout_id()
 
+        if self.combo_table != None:
+            layout_info.combo_count = self.combo_table.number_combos
+            layout_info.combo_table_offset = self.combo_table.addr
+
         # struct keyboard_info_t layouts[MAX_NUM_KEYBOARDS];
 
         # Build the layout table
@@ -447,25 +590,283 @@ class KeyplusLayout(object):
         return settings.to_bytes()
 
     def build_layout_section(self, device_target):
-        result = bytearray()
-
         if device_target.is_virtual():
-            device_maps = bytearray()
+            pin_map = bytearray()
             for (dev_id, dev) in self._devices.items():
                 if dev.scan_mode.mode == MATRIX_SCANNER_MODE_VIRTUAL:
-                    device_maps += dev.scan_mode.virtual_device_to_bytes(device_target, dev_id)
-            result += struct.pack("<I", len(device_maps))
-            result += device_maps
+                    pin_map += dev.scan_mode.virtual_device_to_bytes(device_target, dev_id)
         else:
             device = self.get_device(device_target.device_id)
-            pin_map = device.scan_mode.generate_pin_mapping(device_target)
-            result += pin_map.to_bytes()
+            pin_map = device.scan_mode.generate_pin_mapping(device_target).to_bytes()
+
+        ekc_data = self.ekc_data.to_bytes()
 
-        result += self.ekc_data.to_bytes()
-        result += self._build_layouts()
+        keymaps_offset = (
+            LAYOUT_INDEX_SIZE + len(pin_map) + len(ekc_data) +
+            layout_table_entry_t.__size__ * self.number_layouts
+        )
+        layout_table, keymaps = self._build_layouts(keymaps_offset)
+
+        # The sections are stored in the order of their section id
+        sections = [pin_map, ekc_data, layout_table, keymaps]
+
+        index = layout_index_t()
+        index.magic = LAYOUT_INDEX_MAGIC
+        index.version = LAYOUT_FORMAT_VERSION
+        index.section_count = LAYOUT_SECTION_COUNT
+
+        result = bytearray()
+        offset = LAYOUT_INDEX_SIZE
+        for (section_id, data) in enumerate(sections):
+            index.sections[section_id].offset = offset
+            index.sections[section_id].size = len(data)
+            index.sections[section_id].crc = crc16_bytes(data)
+            result += data
+            offset += len(data)
+        index.crc = crc16_bytes(index.to_bytes()[:-2])
+
+        return index.to_bytes() + result
+
+    def get_build_config(self, device_target):
+        """
+        Get the RAM table sizes that the firmware needs for this layout, see
+        `core/build_config.h` in the firmware.
+
+        Returns:
+            A list of (name, value, default, description) tuples.
+        """
+        result = []
+
+        number_layouts = max(1, self.number_layouts)
+        result.append((
+            "MAX_NUM_LAYOUTS", number_layouts, MAX_NUMBER_LAYOUTS,
+            "layouts in the layout file",
+        ))
+        result.append((
+            "MAX_NUM_KEYBOARD_SLOTS", min(number_layouts, 4), 4,
+            "keyboards tracked at once by the matrix interpreter",
+        ))
+
+        max_layers = max(
+            [layout.number_layers for layout in self._layouts.values()] + [1]
+        )
+        result.append((
+            "MAX_NUM_LAYERS", max_layers, 16,
+            "most layers used by a layout",
+        ))
+
+        number_combos = 0
+        if self.combo_table != None:
+            number_combos = self.combo_table.number_combos
+        result.append((
+            "MAX_NUM_COMBOS", max(1, number_combos),
+            EKCComboTable.DEFAULT_MAX_COMBOS,
+            "combos in the layout file",
+        ))
+
+        # Every key position that has a hold key on any layer could be held
+        # down at the same time.
+        hold_keycodes = set(
+            generate_external_keycode(ekc.addr)
+            for ekc in self.ekc_data.children
+            if isinstance(ekc, EKCHoldKey)
+        )
+        hold_positions = 0
+        for layout in self._layouts.values():
+            layers = layout.to_layer_arrays()
+            for key_i in range(len(layers[0]) if layers else 0):
+                if any(layer[key_i] in hold_keycodes for layer in layers):
+                    hold_positions += 1
+        result.append((
+            "MAX_NUM_HOLD_KEYS", max(1, min(hold_positions, 4)), 4,
+            "keys with a hold keycode",
+        ))
+
+        if not device_target.is_virtual() and device_target.device_id in self._devices:
+            device = self.get_device(device_target.device_id)
+            if device.scan_mode.mode != MATRIX_SCANNER_MODE_NO_MATRIX:
+                scan_plan = device.scan_mode.generate_scan_plan(device_target)
+                max_keys = min(8 * int(math.ceil((scan_plan.max_key_num + 1) / 8)), 128)
+                result.append((
+                    "MAX_NUM_KEYS", max_keys, 128,
+                    "highest key number of device {}, rounded up to 8"
+                        .format(device_target.device_id),
+                ))
 
         return result
 
+    @staticmethod
+    def get_build_config_ram(limits):
+        """
+        Get the bytes of RAM used by the tables that each limit sizes, for an
+        8-bit target. These are the tables summed in `core/ram_budget.c`,
+        tables that no limit sizes (e.g. the report queues) are left out.
+
+        Args:
+            limits: a dict of limit name to value, missing limits use the
+                firmware defaults.
+
+        Returns:
+            A dict of limit name to bytes.
+        """
+        def mask_size(bits):
+            if bits <= 8:
+                return 1
+            elif bits <= 16:
+                return 2
+            else:
+                return 4
+
+        layouts = limits.get("MAX_NUM_LAYOUTS", MAX_NUMBER_LAYOUTS)
+        slots = limits.get("MAX_NUM_KEYBOARD_SLOTS", 4)
+        layers = limits.get("MAX_NUM_LAYERS", 16)
+        combos = limits.get("MAX_NUM_COMBOS", EKCComboTable.DEFAULT_MAX_COMBOS)
+        hold_keys = limits.get("MAX_NUM_HOLD_KEYS", 4)
+        keys = limits.get("MAX_NUM_KEYS", 128)
+
+        return {
+            # layout -> slot map
+            "MAX_NUM_LAYOUTS": layouts,
+            # `keyboard_t` without its layer masks, and the slot LRU list
+            "MAX_NUM_KEYBOARD_SLOTS": slots * (70 + 1),
+            # active, default and sticky `layer_mask_t` of each slot, and the
+            # sparse layer offset cache
+            "MAX_NUM_LAYERS": (
+                slots * 3 * mask_size(layers) +
+                2 * (layers + 1) + 2 * mask_size(layers)
+            ),
+            # `combo_entry_t`, combo size and the per key `combo_mask_t` index
+            "MAX_NUM_COMBOS": combos * (8 + 1) + 128 * mask_size(combos),
+            # `hold_event_t`
+            "MAX_NUM_HOLD_KEYS": hold_keys * 6,
+            # debounce time and key number bitmap
+            "MAX_NUM_KEYS": keys + keys // 8,
+        }
+
+    def get_build_config_report(self, device_target):
+        """
+        Returns a text report of the RAM table sizes in the generated config
+        header compared with the defaults the firmware is built with otherwise,
+        and the bytes of RAM the tables use in both cases.
+        """
+        config = self.get_build_config(device_target)
+        default_ram = self.get_build_config_ram(dict(
+            (name, default) for (name, value, default, _) in config
+        ))
+        layout_ram = self.get_build_config_ram(dict(
+            (name, value) for (name, value, default, _) in config
+        ))
+
+        lines = []
+        lines.append("{:<24} {:>8} {:>8} {:>8} {:>8}".format(
+            "limit", "default", "layout", "bytes", "saved"
+        ))
+        total_bytes = 0
+        total_saved = 0
+        for (name, value, default, description) in config:
+            saved = default_ram[name] - layout_ram[name]
+            total_bytes += layout_ram[name]
+            total_saved += saved
+            lines.append("{:<24} {:>8} {:>8} {:>8} {:>8}  {}".format(
+                name, default, value, layout_ram[name], saved, description
+            ))
+        lines.append("{:<24} {:>8} {:>8} {:>8} {:>8}  {}".format(
+            "total", "", "", total_bytes, total_saved,
+            "bytes of RAM on 8-bit targets"
+        ))
+        return "\n".join(lines)
+
+    def build_config_header(self, device_target, source_name=None):
+        """
+        Build the `generated_config.h` header for firmware built with
+        `USE_GENERATED_CONFIG=1` (see `core/build_config.h`).
+        """
+        lines = []
+        lines.append("// Generated by keyplus-cli from '{}', do not edit."
+                     .format(source_name or "<layout>"))
+        lines.append("//")
+        for line in self.get_build_config_report(device_target).splitlines():
+            lines.append("// " + line)
+        lines.append("")
+        lines.append("#pragma once")
+        for (name, value, default, description) in self.get_build_config(device_target):
+            lines.append("")
+            lines.append("/// {}".format(description.capitalize()))
+            lines.append("#ifndef {}".format(name))
+            lines.append("    #define {} {}".format(name, value))
+            lines.append("#endif")
+        lines.append("")
+
+        return "\n".join(lines)
+
+    def build_static_layout_source(self, source_name=None):
+        """
+        Build a C source file with the keymaps of all the layouts, for
+        firmware built with `USE_STATIC_LAYOUT=1` (see `core/static_layout.h`).
+        """
+        KEYCODES_PER_LINE = 8
+        lines = []
+
+        lines.append("// Generated by keyplus-cli from '{}', do not edit."
+                     .format(source_name or "<layout>"))
+        lines.append("")
+        lines.append('#include "core/static_layout.h"')
+
+        layout_entries = []
+        for layout_id in range(self.number_layouts):
+            if layout_id not in self._layouts:
+                raise KeyplusSettingsError(
+                    "Layout ids cannot skip values. TODO(remove this requirement)"
+                )
+            layout = self._layouts[layout_id]
+            layers = layout.to_layer_arrays()
+            layer_len = len(layers[0])
+            name = "s_layout_{}".format(layout_id)
+
+            lines.append("")
+            lines.append("// {}".format(layout.name))
+            lines.append("static const ROM keycode_t {}[{}][{}] = {{".format(
+                name, len(layers), layer_len
+            ))
+            for layer in layers:
+                lines.append("    {")
+                for i in range(0, layer_len, KEYCODES_PER_LINE):
+                    lines.append("        " + " ".join(
+                        "0x{:04x},".format(keycode)
+                        for keycode in layer[i:i+KEYCODES_PER_LINE]
+                    ))
+                lines.append("    },")
+            lines.append("};")
+            lines.append("")
+            lines.append(
+                "static const ROM keycode_t * const ROM {}_layers[{}] = {{"
+                .format(name, len(layers))
+            )
+            for layer_num in range(len(layers)):
+                lines.append("    {}[{}],".format(name, layer_num))
+            lines.append("};")
+
+            layout_entries.append(
+                "    {{ {}_layers, {}, {}, {} }},".format(
+                    name, layer_len // 8, len(layers),
+                    int(bool(layout.has_mouse_layers)),
+                )
+            )
+
+        if not layout_entries:
+            layout_entries.append("    { 0 },")
+
+        lines.append("")
+        lines.append("const ROM static_layout_t g_static_layouts[{}] = {{"
+                     .format(max(self.number_layouts, 1)))
+        lines += layout_entries
+        lines.append("};")
+        lines.append("")
+        lines.append("const ROM uint8_t g_static_layout_count = {};"
+                     .format(self.number_layouts))
+        lines.append("")
+
+        return "\n".join(lines)
 
 
 class OldLayout(object):
@@ -4,6 +4,7 @@
 #include <avr/io.h>
 #include <avr/wdt.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 
 #include "usb_keyboard.h"
@@ -15,16 +16,13 @@
 #include "core/error.h"
 #include "core/flash.h"
 #include "core/hardware.h"
-#include "core/macro.h"
 #include "core/matrix_interpret.h"
 #include "core/matrix_scanner.h"
+#include "core/scheduler.h"
 #include "core/usb_commands.h"
 #include "core/settings.h"
 #include "core/timer.h"
 
-#include "key_handlers/key_hold.h"
-#include "key_handlers/key_mouse.h"
-
 #include "bootloaders/kp_boot_32u4/interface/kp_boot_32u4.h"
 
 #include "io_map/avr_port_util.h"
@@ -59,49 +57,34 @@ void recovery_mode_main_loop(void) {
     }
 }
 
+bit_t scheduler_port_task(void) {
+    return false;
+}
+
+void wait_for_event(uint16_t deadline, bit_t has_deadline) {
+    // Wakes up on the 1ms timer tick, USB interrupts, or a matrix
+    // interrupt, which is soon enough for any deadline.
+    UNREFERENCED_ARGUMENT(deadline);
+    UNREFERENCED_ARGUMENT(has_deadline);
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+}
+
 int main(void) {
     setup_everything();
 
     usb_init();
     sei();
 
-    while (1) {
-        // TODO: Remove this, use idle sleep instead
-        _delay_ms(2);
-
-        bool scan_changed = matrix_scan();
-
-        // TODO: need to clean this up
-        if (scan_changed) {
-            uint8_t matrix_data[32];
-            const uint8_t use_deltas = true;
-            const uint8_t data_size = get_matrix_data(matrix_data, use_deltas);
-
-            keyboard_update_device_matrix(GET_SETTING(device_id), matrix_data);
-        }
+    scheduler_init();
 
-        // passthrough_keycodes_task();
-        interpret_all_keyboard_matrices();
-
-        mouse_key_task();
-        macro_task();
-
-        send_keyboard_report();
-        send_media_report();
-        send_mouse_report();
-        send_vendor_report();
-
-        // usb out reports
-        handle_vendor_out_reports();
-
-        sticky_key_task();
-        hold_key_task(false);
+    while (1) {
+        scheduler_run();
 
         if (has_critical_error()) {
             recovery_mode_main_loop();
         }
 
         wdt_kick();
-
     }
 }
@@ -4,6 +4,7 @@
 #include "core/io_map.h"
 
 #include <string.h>
+#include <avr/interrupt.h>
 
 #include "core/matrix_scanner.h"
 #include "arch/avr/matrix_scanner.h"
@@ -23,6 +24,8 @@ static uint8_t s_bytes_per_row;
 static uint8_t s_parasitic_discharge_delay_idle;
 static uint8_t s_parasitic_discharge_delay_debouncing;
 
+static volatile bool s_has_scan_irq_triggered;
+
 typedef enum {
     COL_PULL_UP = 0,
     COL_PULL_DOWN,
@@ -198,6 +201,77 @@ port_mask_t get_col_mask(uint8_t port_num) {
     return s_col_masks[port_num];
 }
 
+/// make all rows output low
+static void select_all_rows(void) {
+    uint8_t port_num;
+    for (port_num = 0; port_num < IO_PORT_COUNT; ++port_num) {
+        const uint8_t row_mask = s_row_port_masks[port_num];
+        if (row_mask) {
+            io_port_t *const port = IO_MAP_GET_PORT(port_num);
+            port->DDR |= row_mask;
+            port->OUT &= ~row_mask;
+        }
+    }
+}
+
+/// makes all rows floating inputs
+static void unselect_all_rows(void) {
+    uint8_t port_num;
+    for (port_num = 0; port_num < IO_PORT_COUNT; ++port_num) {
+        const uint8_t row_mask = s_row_port_masks[port_num];
+        if (row_mask) {
+            io_port_t *const port = IO_MAP_GET_PORT(port_num);
+            port->DDR &= ~row_mask;
+            port->OUT &= ~row_mask;
+        }
+    }
+}
+
+/// When `select_all_rows()` has been called, this function can be used to
+/// check if any key is down in any row.
+bool matrix_has_active_row(void) {
+    return (~PORT(B).IN & s_col_masks[PORT_B_NUM]) ||
+           (~PORT(C).IN & s_col_masks[PORT_C_NUM]) ||
+           (~PORT(D).IN & s_col_masks[PORT_D_NUM]) ||
+           (~PORT(E).IN & s_col_masks[PORT_E_NUM]) ||
+           (~PORT(F).IN & s_col_masks[PORT_F_NUM]);
+}
+
+// Only the pins on PORTB have pin change interrupts on the atmega32u4. Columns
+// on the other ports are checked with `matrix_has_active_row()` instead, which
+// is cheap compared to a full scan, and the 1ms timer interrupt wakes the mcu
+// often enough for this.
+void matrix_scan_irq_enable(void) {
+    select_all_rows();
+
+    PARASITIC_DISCHARGE_DELAY_FAST_CLOCK(
+        s_parasitic_discharge_delay_idle
+    );
+
+    matrix_scan_irq_clear();
+    PCMSK0 = s_col_masks[PORT_B_NUM];
+    PCIFR = (1 << PCIF0); // clear the interrupt flag
+    PCICR |= (1 << PCIE0);
+}
+
+void matrix_scan_irq_disable(void) {
+    PCICR &= ~(1 << PCIE0);
+    PCMSK0 = 0;
+    unselect_all_rows();
+}
+
+bool matrix_scan_irq_has_triggered(void) {
+    return s_has_scan_irq_triggered || matrix_has_active_row();
+}
+
+void matrix_scan_irq_clear(void) {
+    s_has_scan_irq_triggered = false;
+}
+
+ISR(PCINT0_vect) {
+    s_has_scan_irq_triggered = true;
+}
+
 static inline uint8_t scan_row(uint8_t row) {
     const uint8_t new_row[IO_PORT_COUNT] = {
         ~PORT(B).IN & s_col_masks[PORT_B_NUM],
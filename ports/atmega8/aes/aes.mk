@@ -27,19 +27,24 @@ AES_CRYPTO_LIB_ASM_SRC = \
 	aes/avr-crypto-lib/aes_dec-asm_faster.S \
 	# aes/avr-crypto-lib/aes_dec-asm.S \
 
-AES_TINY128_SRC = aes/tiny_aes128/aes.c
+AES_TINY128_SRC = \
+	aes/aes_tiny128.c \
+	aes/tiny_aes128/aes.c \
+
+ifeq ($(AES_BACKEND), port)
 
 ifeq ($(AES_LIB), tiny-aes128)
-CDEFS += -DAES_TINY128 -DECB=1 -DCBC=0
+CDEFS += -DECB=1 -DCBC=0
 C_SRC +=$(AES_TINY128_SRC)
 endif
 
 ifeq ($(AES_LIB), avr-crypto-lib)
-CDEFS += -DAES_CRYPTO_LIB
+C_SRC += aes/aes_crypto_lib.c
 ASM_SRC += $(AES_CRYPTO_LIB_ASM_SRC)
 endif
 
 ifeq ($(AES_LIB), aes-min)
-CDEFS += -DAES_MIN
-C_SRC +=$(AES_MIN_SRC)
+C_SRC += aes/aes_min.c $(AES_MIN_SRC)
+endif
+
 endif
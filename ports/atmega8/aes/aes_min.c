@@ -0,0 +1,29 @@
+// Copyright 2017 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file aes/aes_min.c
+///
+/// `core/aes.h` implemented with aes-min, used with `AES_LIB = aes-min`.
+
+#include "core/aes.h"
+
+#include <string.h>
+
+// aes-min defines the same block size as `16u`
+#undef AES_BLOCK_SIZE
+#include "aes-min/aes.h"
+
+static uint8_t aes_ekey[AES_KEY_SIZE];
+static uint8_t aes_key_schedule[AES128_KEY_SCHEDULE_SIZE];
+
+void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
+    memcpy(aes_ekey, ekey, AES_KEY_SIZE);
+    aes128_key_schedule(aes_key_schedule, aes_ekey);
+}
+
+void aes_encrypt(uint8_t *block) {
+    aes128_encrypt(block, aes_key_schedule);
+}
+
+void aes_decrypt(uint8_t *block) {
+    aes128_decrypt(block, aes_key_schedule);
+}
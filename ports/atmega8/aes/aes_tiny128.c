@@ -0,0 +1,26 @@
+// Copyright 2017 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file aes/aes_tiny128.c
+///
+/// `core/aes.h` implemented with tiny-aes128, used with
+/// `AES_LIB = tiny-aes128`.
+
+#include "core/aes.h"
+
+#include <string.h>
+
+#include "tiny_aes128/aes.h"
+
+static uint8_t aes_ekey[AES_KEY_SIZE];
+
+void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
+    memcpy(aes_ekey, ekey, AES_KEY_SIZE);
+}
+
+void aes_encrypt(uint8_t *block) {
+    AES128_ECB_encrypt(block, aes_ekey, block);
+}
+
+void aes_decrypt(uint8_t *block) {
+    AES128_ECB_decrypt(block, aes_ekey, block);
+}
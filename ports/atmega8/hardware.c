@@ -4,7 +4,6 @@
 #include <avr/io.h>
 #include <util/delay.h>
 
-#include "core/aes.h"
 #include "core/hardware.h"
 #include "core/nrf24.h"
 
@@ -77,65 +76,6 @@ uint8_t nrf24_spi_send_byte(uint8_t byte) {
 void led_testing_toggle(uint8_t led_num) {
 }
 
-#if defined(AES_TINY128)
-
-#include <string.h>
-#include "aes/tiny_aes128/aes.h"
-
-static uint8_t aes_ekey[AES_KEY_SIZE];
-
-void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
-    memcpy(aes_ekey, ekey, AES_KEY_SIZE);
-}
-
-void aes_encrypt(uint8_t *block) {
-    AES128_ECB_encrypt(block, aes_ekey, block);
-}
-
-void aes_decrypt(uint8_t *block) {
-    AES128_ECB_decrypt(block, aes_ekey, block);
-}
-
-#elif defined(AES_MIN)
-
-#include <string.h>
-#include "aes/aes-min/aes.h"
-
-static uint8_t aes_ekey[AES_KEY_SIZE];
-static uint8_t aes_key_schedule[AES128_KEY_SCHEDULE_SIZE];
-
-void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
-    memcpy(aes_ekey, ekey, AES_KEY_SIZE);
-    aes128_key_schedule(aes_key_schedule, aes_ekey);
-}
-
-void aes_encrypt(uint8_t *block) {
-    aes128_encrypt(block, aes_key_schedule);
-}
-
-void aes_decrypt(uint8_t *block) {
-    aes128_encrypt(block, aes_key_schedule);
-}
-#elif defined(AES_CRYPTO_LIB)
-
-#include <string.h>
-#include "aes/avr-crypto-lib/aes.h"
-
-static aes128_ctx_t aes_ctx;
-
-void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
-    aes128_init(ekey, &aes_ctx);
-}
-
-void aes_encrypt(uint8_t *block) {
-    aes128_enc(block, &aes_ctx);
-}
-
-void aes_decrypt(uint8_t *block) {
-    aes128_dec(block, &aes_ctx);
-}
-#endif
-
 #include "core/flash.h"
 
 uint8_t flash_read_byte(flash_ptr_t addr) {
@@ -205,6 +205,7 @@ int main(void) {
             }
 
             rf_handle_ack_payloads();
+            rf_tx_task();
 
             scan_rate_counter++;
             if (scan_rate_counter == SCAN_RATE) {
@@ -17,15 +17,12 @@
 #include "core/hardware.h"
 #include "core/io_map.h"
 #include "core/keycode.h"
-#include "core/macro.h"
 #include "core/matrix_interpret.h"
+#include "core/scheduler.h"
 #include "core/settings.h"
 #include "core/timer.h"
 #include "core/usb_commands.h"
 
-#include "key_handlers/key_mouse.h"
-#include "key_handlers/key_hold.h"
-
 #include "hid_reports/keyboard_report.h"
 #include "hid_reports/mouse_report.h"
 #include "hid_reports/media_report.h"
@@ -121,46 +118,33 @@ void recovery_mode_main_loop(void) {
     }
 }
 
+bit_t scheduler_port_task(void) {
+    return false;
+}
+
+void wait_for_event(uint16_t deadline, bit_t has_deadline) {
+    // No sleep mode is used on this port, so just wait for the next 1ms timer
+    // tick, which is soon enough for any deadline. The USB interrupt is still
+    // handled while waiting.
+    const uint8_t start_time = timer_read8_ms();
+    UNREFERENCED_ARGUMENT(deadline);
+    UNREFERENCED_ARGUMENT(has_deadline);
+    while (timer_read8_ms() == start_time) {
+    }
+}
+
 void main(void) {
-    uint8_t state = 0;
     setup();
 
-    while (1) {
-        uint8_t scan_changed;
+    scheduler_init();
 
+    while (1) {
         if (has_critical_error()) {
             recovery_mode_main_loop();
         }
 
-        scan_changed = matrix_scan();
-
-        // TODO: need to clean this up
-        if (scan_changed) {
-            XRAM uint8_t matrix_data[32];
-            const uint8_t use_deltas = true;
-            const uint8_t data_size = get_matrix_data(matrix_data, use_deltas);
-
-            keyboard_update_device_matrix(GET_SETTING(device_id), matrix_data);
-        }
-
-        // passthrough_keycodes_task();
-        interpret_all_keyboard_matrices();
-
-        mouse_key_task();
-        macro_task();
-
-        send_keyboard_report();
-        send_media_report();
-        send_mouse_report();
-        send_vendor_report();
-
-        // usb out reports
-        handle_vendor_out_reports();
-
-        sticky_key_task();
-        hold_key_task(false);
+        scheduler_run();
 
         wdt_kick();
-        // efm8_delay_ms(2);
     }
 }
@@ -104,6 +104,61 @@ port_mask_t get_col_mask(uint8_t port_num) {
     return s_col_masks[port_num];
 }
 
+static XRAM uint8_t s_irq_enabled;
+
+/// Drive all rows low, or release them all
+static void set_all_rows(uint8_t selected) {
+    uint8_t row;
+
+    if (
+        g_scan_plan.mode != MATRIX_SCANNER_MODE_COL_ROW &&
+        g_scan_plan.mode != MATRIX_SCANNER_MODE_ROW_COL
+    ) {
+        return;
+    }
+
+    for (row = 0; row < g_scan_plan.rows; ++row) {
+        if (selected) {
+            select_row(row);
+        } else {
+            unselect_row(row);
+        }
+    }
+}
+
+/// When all the rows are selected, this function can be used to check if any
+/// key is down in any row.
+bool matrix_has_active_row(void) {
+    uint8_t port_num;
+    for (port_num = 0; port_num < IO_PORT_COUNT; ++port_num) {
+        if (~efm8_port_read(port_num) & s_col_masks[port_num]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The column pins aren't wired to the port match interrupt, so while the
+// matrix is idle the columns are polled instead. With all the rows driven low
+// this is a single read of each port instead of a full matrix scan.
+void matrix_scan_irq_enable(void) {
+    set_all_rows(true);
+    efm8_delay_us(s_parasitic_discharge_delay_idle);
+    s_irq_enabled = true;
+}
+
+void matrix_scan_irq_disable(void) {
+    s_irq_enabled = false;
+    set_all_rows(false);
+}
+
+bool matrix_scan_irq_has_triggered(void) {
+    return s_irq_enabled && matrix_has_active_row();
+}
+
+void matrix_scan_irq_clear(void) {
+}
+
 static inline uint8_t scan_row(uint8_t row) {
     static XRAM uint8_t new_row[IO_PORT_COUNT];
 
@@ -0,0 +1,224 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file aes_bench.c
+///
+/// Known answer tests and benchmark for the software AES backends in
+/// `core/`. The program is linked once per backend, run all of them with
+/// `make aes-bench`, which also prints the code and table size of each
+/// backend's object file.
+///
+/// The known answers are from FIPS-197 appendix B and C.1, and the ECB-AES128
+/// vectors of NIST SP 800-38A F.1.1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/aes.h"
+#include "core/aes_tables.h"
+
+#include "bench_util.h"
+
+#define BENCH_BLOCKS 200000
+#define ROUND_TRIP_BLOCKS 10000
+
+#define AES_BYTE_ENTRY(s) (s),
+
+static const uint8_t s_sbox[256] = { AES_SBOX_LIST(AES_BYTE_ENTRY) };
+
+typedef struct aes_kat_t {
+    const char *name;
+    const char *key;
+    const char *plain_text;
+    const char *cipher_text;
+} aes_kat_t;
+
+static const aes_kat_t s_kat_list[] = {
+    {
+        "FIPS-197 B",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "3243f6a8885a308d313198a2e0370734",
+        "3925841d02dc09fbdc118597196a0b32",
+    },
+    {
+        "FIPS-197 C.1",
+        "000102030405060708090a0b0c0d0e0f",
+        "00112233445566778899aabbccddeeff",
+        "69c4e0d86a7b0430d8cdb78070b4c55a",
+    },
+    {
+        "SP800-38A #1",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "6bc1bee22e409f96e93d7e117393172a",
+        "3ad77bb40d7a3660a89ecaf32466ef97",
+    },
+    {
+        "SP800-38A #2",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "ae2d8a571e03ac9c9eb76fac45af8e51",
+        "f5d3d58503b9699de785895a96fdbaaf",
+    },
+    {
+        "SP800-38A #3",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "30c81c46a35ce411e5fbc1191a0a52ef",
+        "43b1cd7f598ece23881b00e3ed030688",
+    },
+    {
+        "SP800-38A #4",
+        "2b7e151628aed2a6abf7158809cf4f3c",
+        "f69f2445df4f9b17ad2b417be66c3710",
+        "7b0c785e27e8ad3f8223207104725dd4",
+    },
+};
+
+#define NUM_KATS (sizeof(s_kat_list) / sizeof(s_kat_list[0]))
+
+static void parse_hex(uint8_t *dest, const char *hex) {
+    int i;
+    for (i = 0; i < AES_BLOCK_SIZE; ++i) {
+        unsigned int value;
+        sscanf(hex + 2*i, "%2x", &value);
+        dest[i] = value;
+    }
+}
+
+/// Same as `gen_final_round_key()` in `keyplus/utility/round_keys.py`
+static void gen_final_round_key(uint8_t *dkey, const uint8_t *ekey) {
+    uint8_t rcon = 0x01;
+    int round;
+    int i;
+
+    memcpy(dkey, ekey, AES_KEY_SIZE);
+    for (round = 0; round < AES_NUM_ROUNDS; ++round) {
+        dkey[0] ^= s_sbox[dkey[13]] ^ rcon;
+        dkey[1] ^= s_sbox[dkey[14]];
+        dkey[2] ^= s_sbox[dkey[15]];
+        dkey[3] ^= s_sbox[dkey[12]];
+        for (i = 4; i < AES_KEY_SIZE; ++i) {
+            dkey[i] ^= dkey[i-4];
+        }
+        rcon = AES_MUL2(rcon);
+    }
+}
+
+static void set_key(const uint8_t *ekey) {
+    uint8_t dkey[AES_KEY_SIZE];
+    gen_final_round_key(dkey, ekey);
+    aes_key_init(ekey, dkey);
+}
+
+static int run_kats(void) {
+    int errors = 0;
+    size_t i;
+
+    for (i = 0; i < NUM_KATS; ++i) {
+        const aes_kat_t *kat = &s_kat_list[i];
+        uint8_t key[AES_KEY_SIZE];
+        uint8_t plain_text[AES_BLOCK_SIZE];
+        uint8_t cipher_text[AES_BLOCK_SIZE];
+        uint8_t block[AES_BLOCK_SIZE];
+
+        parse_hex(key, kat->key);
+        parse_hex(plain_text, kat->plain_text);
+        parse_hex(cipher_text, kat->cipher_text);
+        set_key(key);
+
+        memcpy(block, plain_text, AES_BLOCK_SIZE);
+        aes_encrypt(block);
+        if (memcmp(block, cipher_text, AES_BLOCK_SIZE) != 0) {
+            printf("  %-14s encrypt FAILED\n", kat->name);
+            errors++;
+        }
+
+        aes_decrypt(block);
+        if (memcmp(block, plain_text, AES_BLOCK_SIZE) != 0) {
+            printf("  %-14s decrypt FAILED\n", kat->name);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+/// Encrypt then decrypt random blocks with random keys
+static int run_round_trips(void) {
+    int errors = 0;
+    int i;
+
+    for (i = 0; i < ROUND_TRIP_BLOCKS; ++i) {
+        uint8_t key[AES_KEY_SIZE];
+        uint8_t plain_text[AES_BLOCK_SIZE];
+        uint8_t block[AES_BLOCK_SIZE];
+        int j;
+
+        for (j = 0; j < AES_BLOCK_SIZE; ++j) {
+            key[j] = rand();
+            plain_text[j] = rand();
+        }
+        if ((i % 16) == 0) {
+            set_key(key);
+        }
+
+        memcpy(block, plain_text, AES_BLOCK_SIZE);
+        aes_encrypt(block);
+        aes_decrypt(block);
+        if (memcmp(block, plain_text, AES_BLOCK_SIZE) != 0) {
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+typedef struct aes_bench_t {
+    void (*func)(uint8_t *);
+    uint8_t block[AES_BLOCK_SIZE];
+} aes_bench_t;
+
+static void run_blocks(void *ctx) {
+    aes_bench_t *bench = ctx;
+    int i;
+
+    // each block depends on the last, so the calls can't overlap
+    for (i = 0; i < BENCH_BLOCKS; ++i) {
+        bench->func(bench->block);
+    }
+}
+
+static void run_bench(const char *name, void (*func)(uint8_t *)) {
+    aes_bench_t bench = { func, {0} };
+    const bench_time_t best = bench_best_of(run_blocks, &bench);
+
+    printf("  %-8s %8.1f ns/block", name, (double)best.ns / BENCH_BLOCKS);
+#if HAS_CYCLE_COUNTER
+    printf(" %8.1f cycles/block", (double)best.cycles / BENCH_BLOCKS);
+#endif
+    printf(" (%02x)\n", bench.block[0]);
+}
+
+int main(int argc, char *argv[]) {
+    const char *backend = (argc > 1) ? argv[1] : "aes";
+    uint8_t key[AES_KEY_SIZE];
+    int kat_errors;
+    int round_trip_errors;
+
+    printf("%s:\n", backend);
+
+    kat_errors = run_kats();
+    printf("  known answers: %d/%d passed\n",
+           (int)(2*NUM_KATS) - kat_errors, (int)(2*NUM_KATS));
+
+    srand(1);
+    round_trip_errors = run_round_trips();
+    printf("  round trips: %d errors in %d blocks\n",
+           round_trip_errors, ROUND_TRIP_BLOCKS);
+
+    parse_hex(key, s_kat_list[0].key);
+    set_key(key);
+    printf("  %d blocks, best of %d runs:\n", BENCH_BLOCKS, BENCH_RUNS);
+    run_bench("encrypt", aes_encrypt);
+    run_bench("decrypt", aes_decrypt);
+
+    return (kat_errors || round_trip_errors) ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file bench_util.h
+///
+/// Timing shared by the benchmarks of the Linux port. A benchmark passes the
+/// code it measures to `bench_best_of()`, which runs it `BENCH_RUNS` times
+/// and returns the fastest run, so that a run interrupted by another process
+/// doesn't skew the result.
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAS_CYCLE_COUNTER 1
+#else
+    #define HAS_CYCLE_COUNTER 0
+#endif
+
+#ifndef BENCH_RUNS
+    #define BENCH_RUNS 5
+#endif
+
+typedef struct bench_time_t {
+    uint64_t ns;
+    /// CPU cycles, 0 without `HAS_CYCLE_COUNTER`
+    uint64_t cycles;
+} bench_time_t;
+
+/// A timed run, `ctx` is the pointer passed to `bench_best_of()`
+typedef void (*bench_run_func_t)(void *ctx);
+
+static inline uint64_t read_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t read_cycles(void) {
+#if HAS_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// Call `func(ctx)` `BENCH_RUNS` times
+///
+/// @return the time taken by the fastest call
+static inline bench_time_t bench_best_of(bench_run_func_t func, void *ctx) {
+    bench_time_t best = { UINT64_MAX, 0 };
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        const uint64_t start_ns = read_time_ns();
+        const uint64_t start_cycles = read_cycles();
+        uint64_t elapsed_cycles;
+        uint64_t elapsed_ns;
+
+        func(ctx);
+
+        elapsed_cycles = read_cycles() - start_cycles;
+        elapsed_ns = read_time_ns() - start_ns;
+        if (elapsed_ns < best.ns) {
+            best.ns = elapsed_ns;
+            best.cycles = elapsed_cycles;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,130 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file crc_bench.c
+///
+/// Compares the speed of the table driven `crc16_update()` with the bitwise
+/// `crc16_step()` it replaced, after checking both against the
+/// CRC-16/CCITT-FALSE check value. Run it with `make crc-bench`, and with
+/// `make clean crc-bench CRC16_BYTE_TABLE=0` for the nibble table used on
+/// 8-bit parts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/crc.h"
+#include "core/flash.h"
+
+#include "bench_util.h"
+
+#define BENCH_BUFFER_SIZE 4096
+#define BENCH_ROUNDS 2000
+
+/// CRC-16/CCITT-FALSE check value
+#define CHECK_STRING "123456789"
+#define CHECK_CRC 0x29b1
+
+static uint8_t s_buffer[BENCH_BUFFER_SIZE];
+/// Keeps the compiler from dropping the timed calls
+static volatile uint16_t s_sink;
+
+typedef uint16_t (*bench_func_t)(void);
+
+static uint16_t bench_bitwise(void) {
+    uint16_t crc = CRC16_INIT;
+    size_t i;
+    for (i = 0; i < BENCH_BUFFER_SIZE; ++i) {
+        crc = crc16_step(crc, s_buffer[i], 8);
+    }
+    return crc;
+}
+
+static uint16_t bench_table(void) {
+    return crc16_buffer(s_buffer, BENCH_BUFFER_SIZE);
+}
+
+static uint16_t bench_table_flash(void) {
+    return crc16_flash_buffer(LAYOUT_ADDR, BENCH_BUFFER_SIZE);
+}
+
+static void run_rounds(void *ctx) {
+    const bench_func_t func = *(const bench_func_t *)ctx;
+    int i;
+
+    for (i = 0; i < BENCH_ROUNDS; ++i) {
+        s_sink = func();
+    }
+}
+
+/// Time `BENCH_ROUNDS` calls of `func`, and return the CRC from a single
+/// call to it
+static uint16_t run_bench(const char *name, bench_func_t func) {
+    const double num_bytes = (double)BENCH_BUFFER_SIZE * BENCH_ROUNDS;
+    const bench_time_t best = bench_best_of(run_rounds, &func);
+
+    printf("%-14s %8.1f MB/s", name, num_bytes * 1000.0 / best.ns);
+#if HAS_CYCLE_COUNTER
+    printf(" %8.3f bytes/cycle", num_bytes / best.cycles);
+#endif
+    printf("\n");
+
+    return func();
+}
+
+/// Check each implementation against the published check value
+static int check_known_answer(void) {
+    static const char *names[3] = {"bitwise", "table", "table (flash)"};
+    const uint16_t length = sizeof(CHECK_STRING) - 1;
+    uint16_t results[3];
+    uint16_t crc = CRC16_INIT;
+    int errors = 0;
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        crc = crc16_step(crc, CHECK_STRING[i], 8);
+    }
+    results[0] = crc;
+    results[1] = crc16_buffer((const uint8_t *)CHECK_STRING, length);
+    memcpy(&g_virtual_storage[LAYOUT_ADDR], CHECK_STRING, length);
+    results[2] = crc16_flash_buffer(LAYOUT_ADDR, length);
+
+    for (i = 0; i < 3; ++i) {
+        if (results[i] != CHECK_CRC) {
+            printf("error: %s crc16(\"%s\") is 0x%04x, expected 0x%04x\n",
+                   names[i], CHECK_STRING, results[i], CHECK_CRC);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+int main(void) {
+    uint16_t results[3];
+    size_t i;
+
+    if (check_known_answer()) {
+        return 1;
+    }
+    printf("crc16(\"%s\") = 0x%04x\n", CHECK_STRING, CHECK_CRC);
+
+    srand(1);
+    for (i = 0; i < BENCH_BUFFER_SIZE; ++i) {
+        s_buffer[i] = rand();
+        g_virtual_storage[LAYOUT_ADDR + i] = s_buffer[i];
+    }
+
+    printf("crc16 of %d bytes, %s table, best of %d runs\n",
+           BENCH_BUFFER_SIZE, CRC16_BYTE_TABLE ? "byte" : "nibble", BENCH_RUNS);
+
+    results[0] = run_bench("bitwise", bench_bitwise);
+    results[1] = run_bench("table", bench_table);
+    results[2] = run_bench("table (flash)", bench_table_flash);
+
+    if (results[0] != results[1] || results[0] != results[2]) {
+        printf("error: CRC results don't match\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -540,18 +540,18 @@ static int handle_evdev_event(int i) {
 
 /// Check for any device events (input events, or device attach/remove)
 ///
-/// @param
+/// @param timeout_ms how long to wait for an event, or -1 to block until one
+///     arrives
 ///
 /// @return a negative errno on error, a positive integer if a input event was
 ///     detected, otherwise 0.
 /// @return -EIO when reading on the udev_monitor fd fails
-int device_manager_poll(bool block) {
+int device_manager_poll(int timeout_ms) {
     int rc;
     bool has_update = false;
-    int delay_value = block ? -1 : 1;
     int messages_left;
 
-    rc = poll(m_event_fds, m_highest_event_count, delay_value);
+    rc = poll(m_event_fds, m_highest_event_count, timeout_ms);
     if (rc < 0) {
         if (errno != EINTR) {
             KP_CHECK_ERRNO(rc);
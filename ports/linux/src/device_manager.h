@@ -23,4 +23,4 @@ void device_manager_targets_reset(void);
 void device_manager_targets_add(virtual_device_header_t *target);
 
 int device_manager_enumerate(void);
-int device_manager_poll(bool block);
+int device_manager_poll(int timeout_ms);
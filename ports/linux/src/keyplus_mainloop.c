@@ -1,30 +1,24 @@
 // Copyright 2019 jem@seethis.link
 // Licensed under the MIT license (http://opensource.org/licenses/MIT)
 
-#include <unistd.h>
-
 #include "debug.h"
-#include "udev_helpers.h"
 #include "virtual_input.h"
 #include "device_manager.h"
-#include "event_mapper.h"
 #include "settings_loader.h"
-#include "event_codes.h"
 #include "stats.h"
 
 #include "core/error.h"
 #include "core/flash.h"
-#include "core/flash.h"
-#include "core/macro.h"
 #include "core/matrix_interpret.h"
 #include "core/mouse.h"
+#include "core/scheduler.h"
 #include "core/settings.h"
+#include "core/timer.h"
 #include "hid_reports/hid_reports.h"
-#include "key_handlers/key_hold.h"
-#include "key_handlers/key_mouse.h"
 
 static volatile bool g_running = false;
 static volatile bool m_should_stop = false;
+static int m_poll_rc;
 
 void kp_mainloop_stop(void) {
     g_running = false;
@@ -40,6 +34,28 @@ void kp_init_all(void) {
     reset_hid_reports();
 }
 
+bit_t scheduler_port_task(void) {
+    handle_mouse_events();
+    return false;
+}
+
+void wait_for_event(uint16_t deadline, bit_t has_deadline) {
+    // Block until an input event arrives, or until the deadline of a task
+    // that is waiting on a timer.
+    int timeout_ms = -1;
+
+    if (has_deadline) {
+        const int16_t time_left = deadline - timer_read16_ms();
+        timeout_ms = (time_left > 0) ? time_left : 0;
+    }
+
+    m_poll_rc = device_manager_poll(timeout_ms);
+    if (m_poll_rc > 0) {
+        // input events have updated the keyboard matrices
+        scheduler_set_ready(TASK_INTERPRET);
+    }
+}
+
 void load_config(const char* file_name) {
     int rc;
     FILE *config = fopen(file_name, "rb");
@@ -60,34 +76,7 @@ void load_config(const char* file_name) {
 
     storage_pos += rc;
 
-    {
-        const int per_device_storage_size = KEY_MAP_SIZE + sizeof(virtual_device_header_t);
-        uint32_t section_size;
-        uint32_t size = 0;
-
-        rc = fread(storage_pos, 1, sizeof(uint32_t), config);
-        if (rc != sizeof(uint32_t)) {
-            KP_LOG_ERROR("configuration file error reading <section_size>, "
-                            "expected %ld bytes but got %d",
-                            sizeof(uint32_t), rc);
-            exit(EXIT_FAILURE);
-        }
-        section_size = *((uint32_t*)storage_pos);
-        storage_pos += rc;
-
-        for (int i=0; size < section_size; ++i) {
-            rc = fread(storage_pos, 1, per_device_storage_size, config);
-            if (rc != per_device_storage_size) {
-                KP_LOG_ERROR("configuration file error reading <keymap table %d>, "
-                             "expected %d bytes but got %d",
-                             i, per_device_storage_size, rc);
-                exit(EXIT_FAILURE);
-            }
-            size += per_device_storage_size;
-            storage_pos += rc;
-        }
-    }
-
+    // The layout section is checked with its index by `keyboard_layouts_init()`
     {
         int pos = storage_pos - g_virtual_storage;
         int free_space = VIRTUAL_STORAGE_SIZE - pos;
@@ -106,8 +95,6 @@ void load_config(const char* file_name) {
 }
 
 int kp_mainloop(int argc, const char **argv){
-    int rc;
-    bool should_sleep;
     const char *config_file = argv[1];
     const char *stats_file = argv[2];
 
@@ -126,35 +113,19 @@ int kp_mainloop(int argc, const char **argv){
     device_manager_enumerate();
 
     g_running = true;
-    should_sleep = false;
+    scheduler_init();
 
     KP_DEBUG_PRINT(1, "starting kp_mainloop\n");
     while (g_running) {
-        bool busy = false;
+        m_poll_rc = 0;
 
-        rc = device_manager_poll(should_sleep);
+        scheduler_run();
 
-        if (rc == -EINTR) { // received a signal, which indicates we should close
+        if (m_poll_rc == -EINTR) { // received a signal, which indicates we should close
             break;
-        } else if (rc == -EIO) { // fatal error
+        } else if (m_poll_rc == -EIO) { // fatal error
             break;
         }
-
-        handle_mouse_events();
-
-        interpret_all_keyboard_matrices();
-
-        busy |= macro_task();
-        busy |= mouse_key_task();
-
-        send_hid_reports();
-
-        busy |= sticky_key_task();
-        busy |= hold_key_task(false);
-
-        send_hid_reports();
-
-        should_sleep = !busy;
     }
 
     stats_save(NULL);
@@ -0,0 +1,268 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file layout_bench.c
+///
+/// Compares the keycode lookups of the keymap formats: the tables of firmware
+/// built with `USE_STATIC_LAYOUT=1` (see `core/static_layout.h`), a dense
+/// keymap in flash, and a keymap in flash with `LAYOUT_FLAG_SPARSE_LAYERS`
+/// read by `layout_read_sparse_keycode()`. Run it with `make layout-bench`.
+///
+/// The static layout can't be built together with `USE_VIRTUAL_MODE`, so the
+/// lookups are copies of the branches of `get_keycode_from_layer()` in
+/// `core/matrix_interpret.c`, walking the layer mask from the top layer down
+/// until a keycode isn't transparent.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "core/error.h"
+#include "core/flash.h"
+#include "core/keycode.h"
+#include "core/layout.h"
+#include "core/static_layout.h"
+
+#include "bench_util.h"
+
+#define BENCH_MATRIX_SIZE 16
+#define BENCH_KEYS (8 * BENCH_MATRIX_SIZE)
+#define BENCH_LAYERS 4
+#define BENCH_ROUNDS 20000
+
+/// Layers 0, 1 and 3 active, like a base layer with a toggled layer and a
+/// held function layer
+#define BENCH_LAYER_MASK 0x0b
+
+/// The dense keymap is at `LAYOUT_ADDR`, followed by the sparse one where
+/// every layer except the base layer is sparse
+#define DENSE_KEYMAP_ADDR LAYOUT_ADDR
+#define SPARSE_KEYMAP_ADDR (LAYOUT_ADDR + sizeof(keycode_t)*BENCH_LAYERS*BENCH_KEYS)
+
+typedef uint16_t bench_layer_mask_t;
+
+XRAM flash_addr_t g_ekc_storage_ptr;
+XRAM uint32_t g_ekc_storage_size;
+
+void register_error(uint8_t code) {
+    printf("error: register_error(%d)\n", code);
+}
+
+static keycode_t s_keymap[BENCH_LAYERS][BENCH_KEYS];
+static const keycode_t *s_static_layers[BENCH_LAYERS];
+static static_layout_t s_static_layout;
+
+/// Keeps the compiler from dropping the timed lookups
+static volatile keycode_t s_sink;
+
+typedef keycode_t (*lookup_func_t)(bench_layer_mask_t, uint8_t, uint8_t);
+
+static keycode_t lookup_static(bench_layer_mask_t layer_mask, uint8_t row, uint8_t col) {
+    const static_layout_t *layout = &s_static_layout;
+    const uint8_t key_index = 8*row + col;
+    int8_t layer;
+
+    for (layer = 8*sizeof(layer_mask)-1; layer >= 0; --layer) {
+        keycode_t code;
+
+        if (!(layer_mask & (1 << layer)) || layer >= layout->layer_count) {
+            continue;
+        }
+        code = layout->layers[layer][key_index];
+        if (code != KC_TRNS) {
+            return code;
+        }
+    }
+    return KC_NONE;
+}
+
+static keycode_t lookup_flash(bench_layer_mask_t layer_mask, uint8_t row, uint8_t col) {
+    const flash_ptr_t layout = DENSE_KEYMAP_ADDR;
+    const flash_size_t layer_size = sizeof(keycode_t)*8*BENCH_MATRIX_SIZE;
+    const flash_size_t key_offset = sizeof(keycode_t)*(8*row + col);
+    int8_t layer;
+
+    for (layer = 8*sizeof(layer_mask)-1; layer >= 0; --layer) {
+        keycode_t code;
+
+        if (!(layer_mask & (1 << layer))) {
+            continue;
+        }
+        code = flash_read_word(layout + (layer_size * layer + key_offset));
+        if (code != KC_TRNS) {
+            return code;
+        }
+    }
+    return KC_NONE;
+}
+
+static keycode_t lookup_sparse(bench_layer_mask_t layer_mask, uint8_t row, uint8_t col) {
+    int8_t layer;
+
+    for (layer = 8*sizeof(layer_mask)-1; layer >= 0; --layer) {
+        keycode_t code;
+
+        if (!(layer_mask & (1 << layer))) {
+            continue;
+        }
+        code = layout_read_sparse_keycode(
+            SPARSE_KEYMAP_ADDR, BENCH_MATRIX_SIZE, layer, row, col
+        );
+        if (code != KC_TRNS) {
+            return code;
+        }
+    }
+    return KC_NONE;
+}
+
+/// The sparse lookup with the layer offsets read from flash every time, as
+/// when each lookup is for a different keymap
+static keycode_t lookup_sparse_uncached(bench_layer_mask_t layer_mask, uint8_t row, uint8_t col) {
+    layout_sparse_cache_clear();
+    return lookup_sparse(layer_mask, row, col);
+}
+
+static void write_u16(flash_addr_t addr, uint16_t value) {
+    g_virtual_storage[addr + 0] = value & 0xff;
+    g_virtual_storage[addr + 1] = value >> 8;
+}
+
+static void write_u32(flash_addr_t addr, uint32_t value) {
+    write_u16(addr + 0, value & 0xffff);
+    write_u16(addr + 2, value >> 16);
+}
+
+/// Write the keymap at `SPARSE_KEYMAP_ADDR` in the format described by
+/// `layout_sparse_row_t`, with a dense base layer
+static void make_sparse_keymap(void) {
+    flash_addr_t offset = sizeof(uint32_t)*BENCH_LAYERS;
+    int layer;
+
+    for (layer = 0; layer < BENCH_LAYERS; ++layer) {
+        const flash_addr_t layer_addr = SPARSE_KEYMAP_ADDR + offset;
+        uint16_t count = 0;
+        int row;
+        int col;
+
+        if (layer == 0) {
+            write_u32(SPARSE_KEYMAP_ADDR + sizeof(uint32_t)*layer, offset);
+            for (col = 0; col < BENCH_KEYS; ++col) {
+                write_u16(layer_addr + sizeof(keycode_t)*col, s_keymap[layer][col]);
+            }
+            offset += sizeof(keycode_t)*BENCH_KEYS;
+            continue;
+        }
+
+        write_u32(SPARSE_KEYMAP_ADDR + sizeof(uint32_t)*layer, offset | LAYOUT_LAYER_SPARSE);
+        for (row = 0; row < BENCH_MATRIX_SIZE; ++row) {
+            const flash_addr_t row_addr = layer_addr + sizeof(layout_sparse_row_t)*row;
+            uint8_t present = 0;
+
+            write_u16(row_addr + offsetof(layout_sparse_row_t, base), count);
+            for (col = 0; col < 8; ++col) {
+                const keycode_t code = s_keymap[layer][8*row + col];
+                if (code != KC_TRNS) {
+                    write_u16(
+                        layer_addr +
+                        sizeof(layout_sparse_row_t)*BENCH_MATRIX_SIZE +
+                        sizeof(keycode_t)*count,
+                        code
+                    );
+                    present |= 1 << col;
+                    count++;
+                }
+            }
+            g_virtual_storage[row_addr + offsetof(layout_sparse_row_t, present)] = present;
+        }
+        offset += sizeof(layout_sparse_row_t)*BENCH_MATRIX_SIZE + sizeof(keycode_t)*count;
+    }
+}
+
+/// Fill the keymap with a full base layer and upper layers where only one key
+/// in four isn't transparent, in both the static tables and flash
+static void make_keymap(void) {
+    int layer;
+    int key;
+
+    srand(1);
+    for (layer = 0; layer < BENCH_LAYERS; ++layer) {
+        for (key = 0; key < BENCH_KEYS; ++key) {
+            keycode_t code = KC_TRNS;
+            if (layer == 0 || rand() % 4 == 0) {
+                code = KC_A + rand() % 26;
+            }
+            s_keymap[layer][key] = code;
+            write_u16(DENSE_KEYMAP_ADDR + sizeof(keycode_t)*(layer*BENCH_KEYS + key), code);
+        }
+        s_static_layers[layer] = s_keymap[layer];
+    }
+
+    s_static_layout.layers = s_static_layers;
+    s_static_layout.matrix_size = BENCH_MATRIX_SIZE;
+    s_static_layout.layer_count = BENCH_LAYERS;
+    s_static_layout.has_mouse_layers = false;
+
+    make_sparse_keymap();
+}
+
+/// Look up every key `BENCH_ROUNDS` times
+static void run_lookups(void *ctx) {
+    const lookup_func_t lookup = *(const lookup_func_t *)ctx;
+    int round;
+    int key;
+
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        for (key = 0; key < BENCH_KEYS; ++key) {
+            s_sink = lookup(BENCH_LAYER_MASK, key / 8, key % 8);
+        }
+    }
+}
+
+static void run_bench(const char *name, lookup_func_t lookup) {
+    const bench_time_t best = bench_best_of(run_lookups, &lookup);
+
+    printf("%-16s %6.2f ns/lookup\n", name,
+           (double)best.ns / ((double)BENCH_ROUNDS * BENCH_KEYS));
+}
+
+/// Check that the lookups agree on every key, for several layer masks
+static int check_lookups(void) {
+    static const bench_layer_mask_t masks[] = { 0x01, 0x03, 0x0b, 0x0f, 0x08 };
+    int errors = 0;
+    size_t i;
+    int key;
+
+    for (i = 0; i < sizeof(masks)/sizeof(masks[0]); ++i) {
+        for (key = 0; key < BENCH_KEYS; ++key) {
+            const keycode_t expected = lookup_static(masks[i], key / 8, key % 8);
+            if (lookup_flash(masks[i], key / 8, key % 8) != expected) {
+                printf("error: mask 0x%02x key %d: flash lookup doesn't match\n",
+                       masks[i], key);
+                errors++;
+            }
+            if (lookup_sparse(masks[i], key / 8, key % 8) != expected) {
+                printf("error: mask 0x%02x key %d: sparse lookup doesn't match\n",
+                       masks[i], key);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+int main(void) {
+    make_keymap();
+
+    if (check_lookups()) {
+        return 1;
+    }
+
+    printf("%d keys, %d layers, layer mask 0x%02x, best of %d runs\n",
+           BENCH_KEYS, BENCH_LAYERS, BENCH_LAYER_MASK, BENCH_RUNS);
+    run_bench("static", lookup_static);
+    run_bench("flash", lookup_flash);
+    run_bench("sparse", lookup_sparse);
+    run_bench("sparse, uncached", lookup_sparse_uncached);
+
+    return 0;
+}
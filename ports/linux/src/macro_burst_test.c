@@ -0,0 +1,380 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file macro_burst_test.c
+///
+/// Runs burst mode macros from `core/macro.c` into the real keyboard reports,
+/// and decodes the reports the way a host would. Run it with
+/// `make macro-burst-test`.
+///
+/// The sink replaces `port_impl/virtual_report.c`. It turns each report into
+/// key presses like the Linux HID driver does: the new keys of the 6KRO
+/// report in slot order, and the new keys of the NKRO report in ascending
+/// order. The test checks that the host types the text of the macro, in
+/// order, for ordinary text in both report modes, and that the 6KRO report
+/// packs it into fewer reports than one per key.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/flash.h"
+#include "core/keycode.h"
+#include "core/macro.h"
+#include "core/matrix_interpret.h"
+#include "core/mods.h"
+#include "core/settings.h"
+
+#include "hid_reports/keyboard_report.h"
+#include "hid_reports/mouse_report.h"
+#include "hid_reports/virtual_reports.h"
+
+#include "usb/util/hut_keyboard.h"
+
+/// Where the macro programs are placed in the layout storage
+#define TEST_EKC_STORAGE SETTINGS_SIZE
+#define TEST_MACRO_ADDR 0x10
+
+#define MAX_TEXT_LEN 128
+#define MAX_STEPS 10000
+
+/*********************************************************************
+ *                    stubs for the rest of the core                 *
+ *********************************************************************/
+
+XRAM hid_report_mouse_t g_mouse_report;
+bit_t g_report_pending_mouse;
+
+static uint32_t s_time_ms;
+static int s_error_count;
+
+uint32_t timer_read_ms(void) {
+    return s_time_ms;
+}
+
+/// The test calls `macro_task()` itself, it doesn't run on the scheduler
+void scheduler_wake_at(uint16_t time_ms) {
+    UNREFERENCED_ARGUMENT(time_ms);
+}
+
+void register_error(uint8_t code) {
+    printf("error: register_error(%d)\n", code);
+    s_error_count++;
+}
+
+void reset_mouse_report(void) {
+    memset(&g_mouse_report, 0, sizeof(g_mouse_report));
+}
+
+/// Plain keys of a macro that isn't in burst mode go through the matrix
+/// interpreter, which ends up in the same report functions.
+void queue_keycode_event(keycode_t keycode, uint8_t event_type, uint8_t kb_id) {
+    UNREFERENCED_ARGUMENT(kb_id);
+    keyboard_trigger_event(keycode, event_type);
+}
+
+void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT {
+    if (!IS_MODKEY(keycode)) {
+        return;
+    }
+    if (event == EVENT_PRESSED) {
+        add_fake_mods(MODKEY_MODS(keycode));
+        apply_mods();
+        add_keycode((uint8_t)keycode);
+    } else {
+        del_fake_mods(MODKEY_MODS(keycode));
+        apply_mods();
+        del_keycode((uint8_t)keycode);
+    }
+}
+
+bit_t interpret_all_keyboard_matrices(void) {
+    return false;
+}
+
+/*********************************************************************
+ *                          fake report sink                         *
+ *********************************************************************/
+
+static hid_report_boot_keyboard_t s_host_boot;
+static hid_report_nkro_keyboard_t s_host_nkro;
+static char s_typed[MAX_TEXT_LEN];
+static int s_typed_len;
+/// reports sent to the host
+static int s_report_count;
+/// reports that pressed at least one key
+static int s_press_count;
+/// most keys pressed by one report
+static int s_max_presses;
+
+static const char s_lower[] = "abcdefghijklmnopqrstuvwxyz1234567890";
+static const char s_upper[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ!@#$%^&*()";
+
+static char keycode_to_char(uint8_t kc, uint8_t mods) {
+    const bit_t is_shift = (mods & (MOD_LSFT | MOD_RSFT)) != 0;
+    if (kc >= KC_A && kc < KC_A + sizeof(s_lower) - 1) {
+        return is_shift ? s_upper[kc - KC_A] : s_lower[kc - KC_A];
+    }
+    switch (kc) {
+        case KC_SPACEBAR: return ' ';
+        case KC_COMMA: return is_shift ? '<' : ',';
+        case KC_PERIOD: return is_shift ? '>' : '.';
+        default: return '?';
+    }
+}
+
+static keycode_t char_to_keycode(char c) {
+    const char *pos;
+    if ((pos = strchr(s_lower, c)) != NULL) {
+        return KC_A + (pos - s_lower);
+    }
+    if ((pos = strchr(s_upper, c)) != NULL) {
+        return (MODKEY_TAG_LSFT << MODKEY_TAG_OFFSET) | (KC_A + (pos - s_upper));
+    }
+    switch (c) {
+        case ' ': return KC_SPACEBAR;
+        case ',': return KC_COMMA;
+        case '.': return KC_PERIOD;
+        default:
+            printf("error: no keycode for '%c'\n", c);
+            exit(1);
+    }
+}
+
+static void host_type(uint8_t kc, uint8_t mods) {
+    if (s_typed_len < MAX_TEXT_LEN - 1) {
+        s_typed[s_typed_len++] = keycode_to_char(kc, mods);
+    }
+}
+
+static void host_count_report(int presses) {
+    s_report_count++;
+    if (presses) {
+        s_press_count++;
+    }
+    if (presses > s_max_presses) {
+        s_max_presses = presses;
+    }
+}
+
+void kp_virtual_hid_reports_reset(void) {
+    memset(&s_host_boot, 0, sizeof(s_host_boot));
+    memset(&s_host_nkro, 0, sizeof(s_host_nkro));
+    memset(s_typed, 0, sizeof(s_typed));
+    s_typed_len = 0;
+    s_report_count = 0;
+    s_press_count = 0;
+    s_max_presses = 0;
+}
+
+void kp_virtual_hid_boot_keyboard_report_send(void) {
+    const hid_report_boot_keyboard_t *report = &g_boot_keyboard_report;
+    int presses = 0;
+    int i;
+    int j;
+
+    if (memcmp(&s_host_boot, report, sizeof(s_host_boot)) == 0) {
+        return;
+    }
+
+    // the array usages are handled in slot order
+    for (i = 0; i < BOOT_REPORT_KEY_COUNT; ++i) {
+        const uint8_t kc = report->keys[i];
+        if (kc == 0) {
+            continue;
+        }
+        for (j = 0; j < BOOT_REPORT_KEY_COUNT; ++j) {
+            if (s_host_boot.keys[j] == kc) {
+                break;
+            }
+        }
+        if (j == BOOT_REPORT_KEY_COUNT) {
+            host_type(kc, report->modifiers);
+            presses++;
+        }
+    }
+
+    memcpy(&s_host_boot, report, sizeof(s_host_boot));
+    host_count_report(presses);
+}
+
+void kp_virtual_hid_nkro_keyboard_report_send(void) {
+    const hid_report_nkro_keyboard_t *report = &g_nkro_keyboard_report;
+    int presses = 0;
+    int kc;
+
+    if (memcmp(&s_host_nkro, report, sizeof(s_host_nkro)) == 0) {
+        return;
+    }
+
+    // the bitmap is handled in ascending keycode order
+    for (kc = 0; kc < NKRO_REPORT_BYTES * 8; ++kc) {
+        const uint8_t mask = 1 << (kc % 8);
+        if ((report->bitmask[kc / 8] & mask) &&
+            !(s_host_nkro.bitmask[kc / 8] & mask)
+        ) {
+            host_type(kc, report->modifiers);
+            presses++;
+        }
+    }
+
+    memcpy(&s_host_nkro, report, sizeof(s_host_nkro));
+    host_count_report(presses);
+}
+
+void kp_virtual_hid_mouse_report_send(void) {
+}
+
+void kp_virtual_hid_media_report_send(void) {
+}
+
+/*********************************************************************
+ *                               tests                               *
+ *********************************************************************/
+
+static int s_failures;
+
+/// Write `set_burst(1)`, the text, and `finish` to the layout storage.
+///
+/// @return the number of macro instructions
+static int write_burst_macro(const char *text) {
+    uint8_t *storage = g_virtual_storage + TEST_EKC_STORAGE + TEST_MACRO_ADDR;
+    keycode_t program[MAX_TEXT_LEN + 3];
+    int len = 0;
+
+    program[len++] = MACRO_CMD_SET_BURST;
+    program[len++] = 1;
+    while (*text) {
+        program[len++] = char_to_keycode(*text++);
+    }
+    program[len++] = MACRO_CMD_FINISH;
+
+    memcpy(storage, program, len * sizeof(keycode_t));
+    // the operand of `set_burst` isn't an instruction
+    return len - 1;
+}
+
+/// Run the macro until it has finished and its last report has been sent
+static void run_macro(void) {
+    int steps = 0;
+
+    call_macro(TEST_MACRO_ADDR, 0);
+    while ((macro_task() || send_keyboard_report()) && steps < MAX_STEPS) {
+        send_keyboard_report();
+        s_time_ms++;
+        steps++;
+    }
+}
+
+static void check(int condition, const char *test_name, const char *what) {
+    if (!condition) {
+        printf("FAIL %s: %s\n", test_name, what);
+        s_failures++;
+    }
+}
+
+/// Type `text` with a burst macro and check what the host sees.
+///
+/// @param held a key that stays pressed in the 6KRO report during the macro,
+///     or 0
+/// @param max_press_reports the most reports that may press keys, or 0 to
+///     skip this check
+static void test_burst(
+    const char *name,
+    const char *text,
+    keyboard_report_mode_t mode,
+    uint8_t held,
+    int max_press_reports
+) {
+    const int text_len = strlen(text);
+    const int num_instrs = write_burst_macro(text);
+
+    macro_init();
+    reset_mods();
+    reset_keyboard_reports();
+    set_keyboard_report_mode(mode);
+
+    if (held) {
+        // fill the first slots, then free them, so the held key is in the
+        // middle of the report
+        add_keycode(KC_F1);
+        add_keycode(KC_F2);
+        add_keycode(held);
+        del_keycode(KC_F1);
+        del_keycode(KC_F2);
+    }
+    send_keyboard_report();
+    kp_virtual_hid_reports_reset();
+    if (mode == KEYBOARD_REPORT_MODE_NKRO) {
+        memcpy(&s_host_nkro, &g_nkro_keyboard_report, sizeof(s_host_nkro));
+    } else {
+        memcpy(&s_host_boot, &g_boot_keyboard_report, sizeof(s_host_boot));
+    }
+
+    run_macro();
+
+    printf(
+        "%-24s %3d instrs (%s) %3d keys: %3d reports, %3d with presses, "
+        "max %d keys per report\n",
+        name,
+        num_instrs,
+        num_instrs <= MACRO_CACHE_SIZE ? "cache" : "flash",
+        text_len,
+        s_report_count,
+        s_press_count,
+        s_max_presses
+    );
+
+    check(strcmp(s_typed, text) == 0, name, "the host typed the wrong text");
+    if (strcmp(s_typed, text) != 0) {
+        printf("  expected: \"%s\"\n  typed:    \"%s\"\n", text, s_typed);
+    }
+    check(s_max_presses <= MACRO_BURST_MAX_KEYS, name, "too many keys in a report");
+    check(
+        max_press_reports == 0 || s_press_count <= max_press_reports,
+        name,
+        "the text wasn't packed into enough reports"
+    );
+    check(get_keyboard_report_mode() == mode, name, "the report mode changed");
+    if (held) {
+        check(has_keycode(held), name, "the held key was released");
+        check(
+            s_max_presses <= MACRO_BURST_MAX_KEYS - 1,
+            name,
+            "a key replaced the held key"
+        );
+        del_keycode(held);
+    } else {
+        check(
+            memcmp(&s_host_boot, &(hid_report_boot_keyboard_t){0}, sizeof(s_host_boot)) == 0 &&
+            memcmp(&s_host_nkro, &(hid_report_nkro_keyboard_t){0}, sizeof(s_host_nkro)) == 0,
+            name,
+            "keys were left pressed"
+        );
+    }
+}
+
+int main(void) {
+    const char *hello = "hello world";
+    const char *pangram = "The quick brown fox jumps over the lazy dog, 1234567890.";
+
+    g_ekc_storage_ptr = TEST_EKC_STORAGE;
+
+    // `hel` `lo w` `orld`
+    test_burst("6kro hello", hello, KEYBOARD_REPORT_MODE_6KRO, 0, 3);
+    test_burst("auto hello", hello, KEYBOARD_REPORT_MODE_AUTO, 0, 3);
+    // `h` `el` `lo ` `w` `or` `l` `d`
+    test_burst("nkro hello", hello, KEYBOARD_REPORT_MODE_NKRO, 0, 7);
+    test_burst("6kro hello, held key", hello, KEYBOARD_REPORT_MODE_6KRO, KC_F3, 3);
+    test_burst("auto pangram", pangram, KEYBOARD_REPORT_MODE_AUTO, 0, 12);
+    test_burst("nkro pangram", pangram, KEYBOARD_REPORT_MODE_NKRO, 0, 0);
+    test_burst("auto pangram, held key", pangram, KEYBOARD_REPORT_MODE_AUTO, KC_F3, 0);
+
+    check(s_error_count == 0, "all", "errors were registered");
+
+    if (s_failures) {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
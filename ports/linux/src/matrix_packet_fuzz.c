@@ -0,0 +1,209 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file matrix_packet_fuzz.c
+///
+/// Round trip and fuzz checks for the matrix packet encodings in
+/// `core/matrix_packet.h`. Run it with `make matrix-packet-fuzz`.
+///
+/// * Random matrices are encoded and decoded again, both in one packet and
+///   in `PACKET_MATRIX_RAW_PART` parts.
+/// * Random bytes are decoded to check that the decoder never writes outside
+///   of the device's part of the matrix.
+///
+/// It also prints how often the state of a 104 key board fits in one RF
+/// packet, compared with the key list and raw encodings alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/matrix_packet.h"
+
+#define ROUND_TRIPS 200000
+#define FUZZ_ROUNDS 1000000
+
+#define GUARD_SIZE 8
+#define GUARD_BYTE 0xa5
+
+/// Bytes of the 104 key board used for the packet size statistics
+#define STATS_MATRIX_SIZE 13
+#define STATS_ROUNDS 20000
+#define STATS_MAX_KEYS 24
+
+typedef struct guarded_matrix_t {
+    uint8_t before[GUARD_SIZE];
+    uint8_t matrix[KEY_NUMBER_BITMAP_SIZE + GUARD_SIZE];
+} guarded_matrix_t;
+
+static int s_errors;
+
+static void check(int condition, const char *what, uint8_t matrix_size) {
+    if (!condition) {
+        if (s_errors < 10) {
+            printf("  error: %s (matrix_size=%d)\n", what, matrix_size);
+        }
+        s_errors++;
+    }
+}
+
+static void random_matrix(uint8_t *bitmap, uint8_t size, uint8_t num_keys, bool clustered) {
+    const int max_keys = size * 8;
+    const int center = rand() % max_keys;
+    uint8_t i;
+
+    memset(bitmap, 0, size);
+    for (i = 0; i < num_keys; ++i) {
+        int key_num;
+        if (clustered) {
+            key_num = center + (rand() % 17) - 8;
+            if (key_num < 0 || key_num >= max_keys) {
+                continue;
+            }
+        } else {
+            key_num = rand() % max_keys;
+        }
+        bitmap[key_num / 8] |= 1 << (key_num % 8);
+    }
+}
+
+static void fill_guarded(guarded_matrix_t *m) {
+    size_t i;
+    memset(m->before, GUARD_BYTE, GUARD_SIZE);
+    for (i = 0; i < sizeof(m->matrix); ++i) {
+        m->matrix[i] = rand();
+    }
+}
+
+static bool guards_ok(const guarded_matrix_t *m, uint8_t matrix_size) {
+    size_t i;
+    for (i = 0; i < GUARD_SIZE; ++i) {
+        if (m->before[i] != GUARD_BYTE) {
+            return false;
+        }
+    }
+    for (i = matrix_size; i < sizeof(m->matrix); ++i) {
+        if (m->matrix[i] != GUARD_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void set_guard(guarded_matrix_t *m, uint8_t matrix_size) {
+    memset(m->matrix + matrix_size, GUARD_BYTE, sizeof(m->matrix) - matrix_size);
+}
+
+static void run_round_trips(void) {
+    int round;
+
+    for (round = 0; round < ROUND_TRIPS; ++round) {
+        const uint8_t size = 1 + rand() % KEY_NUMBER_BITMAP_SIZE;
+        uint8_t bitmap[KEY_NUMBER_BITMAP_SIZE];
+        uint8_t data[MATRIX_PACKET_MAX_SIZE + GUARD_SIZE];
+        guarded_matrix_t m;
+        uint8_t len;
+        uint8_t offset;
+
+        random_matrix(bitmap, size, rand() % (size*8 + 1), rand() & 1);
+
+        // full state in one packet
+        memset(data, GUARD_BYTE, sizeof(data));
+        len = matrix_packet_encode(data, bitmap, size);
+        check(len <= MATRIX_PACKET_MAX_SIZE, "encoded packet too large", size);
+        check(data[MATRIX_PACKET_MAX_SIZE] == GUARD_BYTE, "encoder overflow", size);
+        check(
+            (data[0] & PACKET_MATRIX_SIZE_MASK) == len - MATRIX_PACKET_HEADER_SIZE,
+            "header size doesn't match the length", size
+        );
+
+        fill_guarded(&m);
+        set_guard(&m, size);
+        matrix_packet_decode(m.matrix, size, data);
+        check(memcmp(m.matrix, bitmap, size) == 0, "round trip mismatch", size);
+        check(guards_ok(&m, size), "decoder wrote outside the matrix", size);
+
+        // the same state sent in parts
+        fill_guarded(&m);
+        set_guard(&m, size);
+        for (offset = 0; offset < size; offset += MATRIX_PACKET_PART_MAX_LEN) {
+            len = matrix_packet_encode_part(data, bitmap, size, offset);
+            check(len <= PACKET_PAYLOAD_LENGTH, "part doesn't fit in a packet", size);
+            matrix_packet_decode(m.matrix, size, data);
+        }
+        check(memcmp(m.matrix, bitmap, size) == 0, "part round trip mismatch", size);
+        check(guards_ok(&m, size), "part decoder wrote outside the matrix", size);
+    }
+}
+
+static void run_fuzz(void) {
+    int round;
+
+    for (round = 0; round < FUZZ_ROUNDS; ++round) {
+        const uint8_t matrix_size = rand() % (KEY_NUMBER_BITMAP_SIZE + 1);
+        // the largest read is a 31 byte row mask with 4 mask bytes
+        uint8_t data[64];
+        guarded_matrix_t m;
+        size_t i;
+
+        for (i = 0; i < sizeof(data); ++i) {
+            data[i] = rand();
+        }
+
+        fill_guarded(&m);
+        set_guard(&m, matrix_size);
+        matrix_packet_decode(m.matrix, matrix_size, data);
+        check(guards_ok(&m, matrix_size), "fuzz decoder wrote outside the matrix", matrix_size);
+    }
+}
+
+static uint8_t old_encoded_size(const uint8_t *bitmap, uint8_t size) {
+    uint8_t num_keys_down = 0;
+    uint8_t i;
+    for (i = 0; i < size; ++i) {
+        num_keys_down += __builtin_popcount(bitmap[i]);
+    }
+    return MATRIX_PACKET_HEADER_SIZE + ((num_keys_down < size) ? num_keys_down : size);
+}
+
+static void print_stats(bool clustered) {
+    uint8_t num_keys;
+
+    printf("\n%s keys on a %d key board, %% of states in one packet:\n",
+           clustered ? "clustered" : "random", STATS_MATRIX_SIZE*8);
+    printf("  keys     old     new\n");
+
+    for (num_keys = 4; num_keys <= STATS_MAX_KEYS; num_keys += 2) {
+        int old_fits = 0;
+        int new_fits = 0;
+        int round;
+
+        for (round = 0; round < STATS_ROUNDS; ++round) {
+            uint8_t bitmap[STATS_MATRIX_SIZE];
+            uint8_t data[MATRIX_PACKET_MAX_SIZE];
+
+            random_matrix(bitmap, STATS_MATRIX_SIZE, num_keys, clustered);
+            old_fits += old_encoded_size(bitmap, STATS_MATRIX_SIZE) <= PACKET_PAYLOAD_LENGTH;
+            new_fits += matrix_packet_encode(data, bitmap, STATS_MATRIX_SIZE) <= PACKET_PAYLOAD_LENGTH;
+        }
+
+        printf("  %4d  %5.1f%%  %5.1f%%\n", num_keys,
+               100.0 * old_fits / STATS_ROUNDS, 100.0 * new_fits / STATS_ROUNDS);
+    }
+}
+
+int main(void) {
+    srand(1);
+
+    run_round_trips();
+    printf("round trips: %d matrices\n", ROUND_TRIPS);
+
+    run_fuzz();
+    printf("fuzz: %d random packets\n", FUZZ_ROUNDS);
+
+    printf("errors: %d\n", s_errors);
+
+    print_stats(false);
+    print_stats(true);
+
+    return s_errors ? 1 : 0;
+}
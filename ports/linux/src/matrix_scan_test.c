@@ -0,0 +1,419 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file matrix_scan_test.c
+///
+/// Replays traces of key presses through `matrix_scan_task()` and the
+/// debouncer of `core/matrix_scanner.c`, then turns the `g_scan_stats`
+/// counters into the latency and current figures of the scanner. Run it with
+/// `make matrix-scan-test`.
+///
+/// A trace is replayed on a model of a port: the main loop wakes up on a 1ms
+/// timer tick, and on ports where the column interrupt ends the sleep, also
+/// as soon as a key is pressed while the scanner is idle. The time taken by a
+/// scan and by an idle check gives the scan duty cycle, and with the active
+/// and sleep currents of the mcu, the average current of the scanner.
+///
+/// The costs and currents of the port models are rough figures for an 8-bit
+/// mcu scanning a full size keyboard, change them to those measured on a
+/// board before comparing it with another port.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/error.h"
+#include "core/flash.h"
+#include "core/io_map.h"
+#include "core/layout.h"
+#include "core/matrix_scanner.h"
+#include "core/timer.h"
+#include "core/usb_commands.h"
+
+#define TICK_US 1000
+#define DEBOUNCE_MS 5
+#define MAX_PRESSES 16
+#define MAX_TRACE_MS 1000
+
+/*********************************************************************
+ *                 model of the matrix and the timer                 *
+ *********************************************************************/
+
+static uint32_t s_now_us;
+/// Keys held down in the trace, one bit per column of a single row
+static uint8_t s_keys_down;
+static bit_t s_irq_armed;
+static bit_t s_irq_triggered;
+
+uint8_t timer_read8_ms(void) {
+    return s_now_us / 1000;
+}
+
+uint16_t timer_read16_ms(void) {
+    return s_now_us / 1000;
+}
+
+bool matrix_scan(void) {
+    return scanner_debounce_row(0, &s_keys_down, 1);
+}
+
+void matrix_scan_irq_enable(void) {
+    s_irq_armed = true;
+    s_irq_triggered = false;
+}
+
+void matrix_scan_irq_disable(void) {
+    s_irq_armed = false;
+}
+
+bool matrix_scan_irq_has_triggered(void) {
+    return s_irq_triggered;
+}
+
+void matrix_scan_irq_clear(void) {
+    s_irq_triggered = false;
+}
+
+bool matrix_has_active_row(void) {
+    return s_keys_down != 0;
+}
+
+/*********************************************************************
+ *                    stubs for the rest of the core                 *
+ *********************************************************************/
+
+bit_t has_critical_error(void) {
+    return false;
+}
+
+void register_error(uint8_t code) {
+    printf("error: register_error(%d)\n", code);
+    exit(EXIT_FAILURE);
+}
+
+bit_t is_passthrough_enabled(void) {
+    return false;
+}
+
+port_mask_t get_col_mask(uint8_t port_num) {
+    UNREFERENCED_ARGUMENT(port_num);
+    return 0xff;
+}
+
+void queue_vendor_in_packet(
+    uint8_t usb_cmd,
+    const XRAM uint8_t *payload,
+    uint8_t payload_length,
+    bool is_variable_length
+) {
+    UNREFERENCED_ARGUMENT(usb_cmd);
+    UNREFERENCED_ARGUMENT(payload);
+    UNREFERENCED_ARGUMENT(payload_length);
+    UNREFERENCED_ARGUMENT(is_variable_length);
+}
+
+/*********************************************************************
+ *                         traces and ports                          *
+ *********************************************************************/
+
+typedef enum trace_event_type_t {
+    /// `value` is the set of keys held down from `time_us` on
+    TRACE_KEYS,
+    /// Noise on a column raises the interrupt, but no key is down
+    TRACE_GLITCH,
+    /// No scans may happen from `time_us` until `end_ms`
+    TRACE_EXPECT_IDLE,
+} trace_event_type_t;
+
+typedef struct trace_event_t {
+    uint8_t type;
+    uint32_t time_us;
+    uint16_t end_ms;
+    uint8_t value;
+} trace_event_t;
+
+typedef struct trace_t {
+    const char *name;
+    uint16_t length_ms;
+    const trace_event_t *events;
+    int num_events;
+    /// Expected `g_scan_stats.wakeups` and `g_scan_stats.false_wakeups`
+    uint16_t wakeups;
+    uint16_t false_wakeups;
+} trace_t;
+
+typedef struct port_model_t {
+    const char *name;
+    /// The column interrupt ends the sleep, otherwise the loop only sees it
+    /// on the next tick
+    bit_t wake_on_irq;
+    uint16_t scan_us;
+    uint16_t check_us;
+    uint16_t active_ua;
+    uint16_t sleep_ua;
+} port_model_t;
+
+#define KEYS(t_us, keys) { TRACE_KEYS, (t_us), 0, (keys) }
+#define GLITCH(t_us) { TRACE_GLITCH, (t_us), 0, 0 }
+#define IDLE(t_ms, end_ms) { TRACE_EXPECT_IDLE, (t_ms) * 1000UL, (end_ms), 0 }
+
+/// Taps between ticks, a held key, a press that bounces, a rollover, and
+/// noise on a column while idle
+static const trace_event_t s_typing_events[] = {
+    IDLE(1, 100),
+
+    KEYS(100300, 0x01),
+    KEYS(180000, 0x00),
+    IDLE(190, 300),
+
+    KEYS(300700, 0x02),
+    KEYS(650000, 0x00),
+    IDLE(660, 700),
+
+    // bounces while the press is locked out
+    KEYS(700200, 0x04),
+    KEYS(700400, 0x00),
+    KEYS(700600, 0x04),
+    KEYS(760000, 0x00),
+    IDLE(770, 800),
+
+    // the second key goes down before the first is released
+    KEYS(800900, 0x08),
+    KEYS(830000, 0x18),
+    KEYS(850000, 0x10),
+    KEYS(880000, 0x00),
+    IDLE(890, 900),
+
+    GLITCH(900400),
+    IDLE(905, 1000),
+};
+
+#define ARRAY_LEN(x) ((int)(sizeof(x)/sizeof((x)[0])))
+
+static const trace_t s_traces[] = {
+    {
+        "typing", 1000, s_typing_events, ARRAY_LEN(s_typing_events),
+        5, 1
+    },
+};
+
+static const port_model_t s_ports[] = {
+    { "irq wakes", true, 120, 2, 8000, 2500 },
+    { "tick wakes", false, 120, 2, 8000, 2500 },
+};
+
+/*********************************************************************
+ *                                test                               *
+ *********************************************************************/
+
+typedef struct replay_result_t {
+    /// Time that the mcu spent in `matrix_scan_task()`
+    uint32_t busy_us;
+    /// Presses made while idle, and the time until their first scan
+    int num_idle_presses;
+    uint32_t wake_latency_us[MAX_PRESSES];
+    /// Presses that weren't registered by a scan within 1ms
+    int missed_presses;
+    uint8_t scanned_at[MAX_TRACE_MS];
+} replay_result_t;
+
+static int s_failures;
+
+static void check(bool ok, const char *test_name, const char *what) {
+    if (!ok) {
+        printf("FAIL %s: %s\n", test_name, what);
+        s_failures++;
+    }
+}
+
+static void setup_scanner(void) {
+    // identity key number map for the single row
+    uint8_t *key_num_map = &g_virtual_storage[LAYOUT_PORT_KEY_NUM_MAP_ADDR];
+    uint8_t col;
+
+    for (col = 0; col < 8; ++col) {
+        key_num_map[col] = col;
+    }
+
+    memset(&g_scan_plan, 0, sizeof(g_scan_plan));
+    g_scan_plan.mode = MATRIX_SCANNER_MODE_ROW_COL;
+    g_scan_plan.rows = 1;
+    g_scan_plan.cols = 8;
+    g_scan_plan.debounce_time_press = DEBOUNCE_MS;
+    g_scan_plan.debounce_time_release = DEBOUNCE_MS;
+    g_scan_plan.max_col_pin_num = 7;
+    g_scan_plan.max_key_num = 7;
+
+    memset(g_matrix, 0, sizeof(g_matrix));
+    s_keys_down = 0;
+    s_irq_armed = false;
+    s_irq_triggered = false;
+    s_now_us = 0;
+
+    init_matrix_scanner_utils();
+}
+
+/// Run the scan task at `s_now_us`, like the scheduler does after each wake
+static void wake_up(
+    const port_model_t *port,
+    replay_result_t *result,
+    uint32_t *press_time_us,
+    bit_t *is_press_pending
+) {
+    const uint32_t scans = g_scan_stats.scans;
+    const bit_t was_idle = matrix_scan_is_idle();
+
+    matrix_scan_task();
+
+    if (g_scan_stats.scans == scans) {
+        result->busy_us += port->check_us;
+        return;
+    }
+
+    result->busy_us += port->scan_us;
+    result->scanned_at[s_now_us / 1000] = true;
+
+    if (*is_press_pending) {
+        const uint32_t latency = s_now_us - *press_time_us;
+        if (was_idle && result->num_idle_presses < MAX_PRESSES) {
+            result->wake_latency_us[result->num_idle_presses++] = latency;
+        }
+        // with no trigger time, the scan that sees a press registers it
+        if (latency > TICK_US || get_matrix_num_keys_down() == 0) {
+            result->missed_presses++;
+        }
+        *is_press_pending = false;
+    }
+}
+
+static void replay_trace(
+    const trace_t *trace,
+    const port_model_t *port,
+    replay_result_t *result
+) {
+    const uint32_t length_us = trace->length_ms * 1000UL;
+    uint32_t next_tick_us = 0;
+    uint32_t press_time_us = 0;
+    bit_t is_press_pending = false;
+    int i = 0;
+
+    memset(result, 0, sizeof(*result));
+    setup_scanner();
+
+    while (next_tick_us < length_us) {
+        const trace_event_t *event = &trace->events[i];
+
+        if (i >= trace->num_events || event->time_us > next_tick_us) {
+            s_now_us = next_tick_us;
+            wake_up(port, result, &press_time_us, &is_press_pending);
+            next_tick_us += TICK_US;
+            continue;
+        }
+
+        i++;
+        if (event->type == TRACE_EXPECT_IDLE) {
+            continue;
+        }
+
+        s_now_us = event->time_us;
+        if (event->type == TRACE_KEYS) {
+            const uint8_t pressed = event->value & ~s_keys_down;
+            s_keys_down = event->value;
+            if (pressed == 0) {
+                continue;
+            }
+            if (!is_press_pending) {
+                press_time_us = s_now_us;
+                is_press_pending = true;
+            }
+        }
+
+        if (s_irq_armed && !s_irq_triggered) {
+            s_irq_triggered = true;
+            if (port->wake_on_irq) {
+                wake_up(port, result, &press_time_us, &is_press_pending);
+            }
+        }
+    }
+}
+
+static void check_trace(const trace_t *trace, const port_model_t *port) {
+    static replay_result_t result;
+    char name[64];
+    char what[128];
+    uint32_t total_latency = 0;
+    uint32_t max_latency = 0;
+    uint32_t duty_ppm;
+    uint32_t current_ua;
+    int i;
+
+    snprintf(name, sizeof(name), "%s, %s", trace->name, port->name);
+    replay_trace(trace, port, &result);
+
+    for (i = 0; i < trace->num_events; ++i) {
+        const trace_event_t *event = &trace->events[i];
+        int scans = 0;
+        int t;
+
+        if (event->type != TRACE_EXPECT_IDLE) {
+            continue;
+        }
+        for (t = event->time_us / 1000; t < event->end_ms; ++t) {
+            scans += result.scanned_at[t];
+        }
+        snprintf(what, sizeof(what), "%lu-%d ms: %d scans while idle",
+                 (unsigned long)(event->time_us / 1000), event->end_ms, scans);
+        check(scans == 0, name, what);
+    }
+
+    for (i = 0; i < result.num_idle_presses; ++i) {
+        total_latency += result.wake_latency_us[i];
+        if (result.wake_latency_us[i] > max_latency) {
+            max_latency = result.wake_latency_us[i];
+        }
+    }
+
+    check(result.missed_presses == 0, name, "a press wasn't registered by its first scan");
+    check(g_scan_stats.wakeups == trace->wakeups, name,
+          "the wakeup count doesn't match the trace");
+    check(g_scan_stats.false_wakeups == trace->false_wakeups, name,
+          "the false wakeup count doesn't match the trace");
+    check(
+        g_scan_stats.wakeups == result.num_idle_presses + trace->false_wakeups,
+        name, "a press made while idle didn't wake the scanner"
+    );
+    if (port->wake_on_irq) {
+        check(max_latency == 0, name, "the column interrupt didn't wake the loop");
+    } else {
+        check(max_latency < TICK_US, name, "a press waited more than a tick");
+    }
+
+    duty_ppm = (uint64_t)result.busy_us * 1000000 / (trace->length_ms * 1000UL);
+    current_ua = port->sleep_ua +
+        (uint64_t)(port->active_ua - port->sleep_ua) * duty_ppm / 1000000;
+
+    printf("%-20s %4u scans, %4u idle checks, %2u wakeups (%u false)\n",
+           name, g_scan_stats.scans, g_scan_stats.idle_checks,
+           g_scan_stats.wakeups, g_scan_stats.false_wakeups);
+    printf("%-20s wake to first scan: avg %4u us, max %4u us\n", "",
+           result.num_idle_presses ? total_latency / result.num_idle_presses : 0,
+           max_latency);
+    printf("%-20s scan duty cycle %.2f%%, average current %u uA\n", "",
+           duty_ppm / 10000.0, current_ua);
+}
+
+int main(void) {
+    int i, j;
+
+    for (i = 0; i < ARRAY_LEN(s_traces); ++i) {
+        for (j = 0; j < ARRAY_LEN(s_ports); ++j) {
+            check_trace(&s_traces[i], &s_ports[j]);
+        }
+    }
+
+    if (s_failures) {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
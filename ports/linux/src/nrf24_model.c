@@ -0,0 +1,756 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file nrf24_model.c
+///
+/// Software nRF24L01+, see `nrf24_model.h`.
+
+#include "nrf24_model.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "core/nrf24.h"
+
+#define FIFO_DEPTH 3
+#define MAX_WIDTH 32
+#define NUM_REGISTERS 0x20
+
+/// Time for the PLL to settle before the radio sends or receives (Tstby2a)
+#define SETTLE_US 130
+/// Preamble and packet control field of an Enhanced ShockBurst frame
+#define FRAME_OVERHEAD_BITS (8 + 9)
+#define PID_MASK 0x03
+#define PLOS_CNT_MAX 0x0f
+
+typedef struct model_payload_t {
+    uint8_t pipe_num; // pipe of a received payload, or of an ACK payload
+    uint8_t no_ack;
+    uint8_t width;
+    uint64_t ready_us; // a received payload shows up in the RX FIFO at this time
+    uint8_t data[MAX_WIDTH];
+} model_payload_t;
+
+typedef struct model_fifo_t {
+    model_payload_t entries[FIFO_DEPTH];
+    uint8_t count;
+} model_fifo_t;
+
+// A frame on the air. It is written to the socket when it starts, and
+// `end_us` is the time the other radio has received all of it.
+typedef struct air_frame_t {
+    uint64_t end_us;
+    uint8_t is_ack;
+    uint8_t channel;
+    uint8_t data_rate;
+    uint8_t addr_width;
+    uint8_t addr[NRF_ADDR_LEN];
+    uint8_t pid;
+    uint8_t no_ack;
+    uint8_t width;
+    uint8_t data[MAX_WIDTH];
+} air_frame_t;
+
+// Last packet received on a pipe, used to drop retransmitted packets
+typedef struct pipe_state_t {
+    bool has_last;
+    uint8_t last_pid;
+    uint8_t last_width;
+    uint8_t last_data[MAX_WIDTH];
+    bool ack_payload_sent;
+} pipe_state_t;
+
+enum {
+    TX_IDLE,
+    TX_WAIT_ACK,
+};
+
+static int s_air_fd = -1;
+static nrf24_model_config_t s_config;
+static unsigned int s_rand_state;
+static nrf24_model_stats_t s_stats;
+static uint64_t s_now_us;
+
+static uint8_t s_regs[NUM_REGISTERS];
+static uint8_t s_rx_addr_p0[NRF_ADDR_LEN];
+static uint8_t s_rx_addr_p1[NRF_ADDR_LEN];
+static uint8_t s_tx_addr[NRF_ADDR_LEN];
+static uint8_t s_ce;
+
+static model_fifo_t s_tx_fifo;
+static model_fifo_t s_rx_fifo;
+// received payloads that have shown up in the RX FIFO
+static uint8_t s_rx_visible;
+
+// SPI transaction
+static bool s_spi_active;
+static uint8_t s_spi_cmd;
+static uint8_t s_spi_index;
+static model_payload_t s_spi_payload;
+
+// transmitter
+static uint8_t s_tx_state;
+static uint8_t s_tx_pid;
+static uint8_t s_arc_cnt;
+static uint8_t s_plos_cnt;
+static uint64_t s_tx_end_us;
+static uint64_t s_tx_deadline_us;
+static bool s_ack_received;
+static uint64_t s_ack_end_us;
+static model_payload_t s_ack_payload;
+
+// receiver
+static pipe_state_t s_pipes[NRF24_NUMBER_PIPES];
+
+uint64_t nrf24_model_time_us(void) {
+    struct timespec tp;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &tp) < 0) {
+        perror("clock_gettime() failed");
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)tp.tv_sec*1000000 + tp.tv_nsec/1000;
+}
+
+const nrf24_model_stats_t *nrf24_model_stats(void) {
+    return &s_stats;
+}
+
+/*********************************************************************
+ *                               FIFOs                               *
+ *********************************************************************/
+
+static bool fifo_push(model_fifo_t *fifo, const model_payload_t *payload) {
+    if (fifo->count == FIFO_DEPTH) {
+        return false;
+    }
+    fifo->entries[fifo->count++] = *payload;
+    return true;
+}
+
+static void fifo_remove(model_fifo_t *fifo, uint8_t pos) {
+    if (pos >= fifo->count) {
+        return;
+    }
+    fifo->count--;
+    memmove(
+        &fifo->entries[pos],
+        &fifo->entries[pos+1],
+        (fifo->count - pos) * sizeof(model_payload_t)
+    );
+}
+
+// The first ACK payload in the TX FIFO for a pipe
+static int find_ack_payload(uint8_t pipe_num) {
+    uint8_t i;
+    for (i = 0; i < s_tx_fifo.count; ++i) {
+        if (s_tx_fifo.entries[i].pipe_num == pipe_num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*********************************************************************
+ *                            radio state                            *
+ *********************************************************************/
+
+static bool is_powered_up(void) {
+    return s_regs[CONFIG] & PWR_UP_bm;
+}
+
+static bool is_receiver(void) {
+    return s_regs[CONFIG] & PRIM_RX_bm;
+}
+
+static uint8_t addr_width(void) {
+    const uint8_t aw = s_regs[SETUP_AW] & 0x03;
+    return aw ? aw + 2 : NRF_ADDR_LEN;
+}
+
+static uint32_t data_rate_bps(uint8_t rf_setup) {
+    if (rf_setup & RF_DR_LOW_bm) {
+        return 250000;
+    } else if (rf_setup & RF_DR_HIGH_bm) {
+        return 2000000;
+    }
+    return 1000000;
+}
+
+static uint32_t air_time_us(uint8_t width) {
+    uint8_t crc_bytes = 0;
+    uint32_t bits;
+
+    if (s_regs[CONFIG] & EN_CRC_bm) {
+        crc_bytes = (s_regs[CONFIG] & CRCO_bm) ? 2 : 1;
+    }
+    bits = FRAME_OVERHEAD_BITS + 8 * (addr_width() + width + crc_bytes);
+    return (bits * 1000000 + data_rate_bps(s_regs[RF_SETUP]) - 1) /
+        data_rate_bps(s_regs[RF_SETUP]);
+}
+
+static uint32_t retransmit_delay_us(void) {
+    return ((s_regs[SETUP_RETR] >> ARD) + 1) * 250;
+}
+
+static uint8_t retransmit_count(void) {
+    return (s_regs[SETUP_RETR] >> ARC) & 0x0f;
+}
+
+static void update_rx_fifo(void) {
+    uint8_t visible = 0;
+    while (visible < s_rx_fifo.count && s_rx_fifo.entries[visible].ready_us <= s_now_us) {
+        visible++;
+    }
+    if (visible > s_rx_visible) {
+        s_regs[NRF_STATUS] |= STATUS_RX_DR_bm;
+    }
+    s_rx_visible = visible;
+}
+
+static uint8_t rx_pipe_num(void) {
+    return s_rx_visible ? s_rx_fifo.entries[0].pipe_num : STATUS_RX_FIFO_EMPTY;
+}
+
+static uint8_t read_status(void) {
+    uint8_t status = s_regs[NRF_STATUS] & STATUS_ALL_IRQ_FLAGS_bm;
+    status |= rx_pipe_num() << STATUS_RX_P_NO;
+    if (s_tx_fifo.count == FIFO_DEPTH) {
+        status |= STATUS_TX_FULL_bm;
+    }
+    return status;
+}
+
+static uint8_t read_fifo_status(void) {
+    uint8_t fifo_status = 0;
+    if (s_tx_fifo.count == FIFO_DEPTH) {
+        fifo_status |= FIFO_TX_FULL_bm;
+    }
+    if (s_tx_fifo.count == 0) {
+        fifo_status |= FIFO_TX_EMPTY_bm;
+    }
+    if (s_rx_fifo.count == FIFO_DEPTH) {
+        fifo_status |= FIFO_RX_FULL_bm;
+    }
+    if (s_rx_visible == 0) {
+        fifo_status |= FIFO_RX_EMPTY_bm;
+    }
+    return fifo_status;
+}
+
+/*********************************************************************
+ *                                air                                *
+ *********************************************************************/
+
+static void air_send(air_frame_t *frame) {
+    frame->end_us += s_config.latency_us;
+
+    if (s_config.loss_percent > 0 &&
+        rand_r(&s_rand_state) < s_config.loss_percent / 100.0 * ((double)RAND_MAX + 1)
+    ) {
+        s_stats.frames_lost++;
+        return;
+    }
+
+    // The frame is lost when the other radio isn't reading the air
+    send(s_air_fd, frame, sizeof(air_frame_t), MSG_DONTWAIT);
+}
+
+static void init_frame(air_frame_t *frame, uint64_t end_us) {
+    memset(frame, 0, sizeof(air_frame_t));
+    frame->end_us = end_us;
+    frame->channel = s_regs[RF_CH];
+    frame->data_rate = s_regs[RF_SETUP] & (RF_DR_LOW_bm | RF_DR_HIGH_bm);
+    frame->addr_width = addr_width();
+}
+
+static bool frame_is_heard(const air_frame_t *frame) {
+    return is_powered_up() &&
+        frame->channel == s_regs[RF_CH] &&
+        frame->data_rate == (s_regs[RF_SETUP] & (RF_DR_LOW_bm | RF_DR_HIGH_bm)) &&
+        frame->addr_width == addr_width();
+}
+
+/*********************************************************************
+ *                            transmitter                            *
+ *********************************************************************/
+
+static bool expects_ack(const model_payload_t *payload) {
+    return !payload->no_ack && (s_regs[EN_AA] & 0x01);
+}
+
+static void tx_start(uint64_t start_us) {
+    const model_payload_t *payload = &s_tx_fifo.entries[0];
+    air_frame_t frame;
+
+    s_tx_end_us = start_us + SETTLE_US + air_time_us(payload->width);
+
+    init_frame(&frame, s_tx_end_us);
+    memcpy(frame.addr, s_tx_addr, NRF_ADDR_LEN);
+    frame.pid = s_tx_pid;
+    frame.no_ack = payload->no_ack;
+    frame.width = payload->width;
+    memcpy(frame.data, payload->data, payload->width);
+    air_send(&frame);
+
+    s_tx_state = TX_WAIT_ACK;
+    s_tx_deadline_us = s_tx_end_us + retransmit_delay_us();
+    s_ack_received = !expects_ack(payload);
+    s_ack_end_us = s_tx_end_us;
+    s_ack_payload.width = 0;
+}
+
+// Start sending the packet at the head of the TX FIFO
+static void tx_start_packet(uint64_t start_us) {
+    s_tx_pid = (s_tx_pid + 1) & PID_MASK;
+    s_arc_cnt = 0;
+    s_stats.packets_sent++;
+    tx_start(start_us);
+}
+
+static bool can_start_tx(void) {
+    return s_tx_state == TX_IDLE &&
+        is_powered_up() &&
+        !is_receiver() &&
+        s_tx_fifo.count != 0 &&
+        !(s_regs[NRF_STATUS] & STATUS_MAX_RT_bm);
+}
+
+static void tx_complete(void) {
+    fifo_remove(&s_tx_fifo, 0);
+    s_regs[NRF_STATUS] |= STATUS_TX_DS_bm;
+    s_tx_state = TX_IDLE;
+
+    if (s_ack_payload.width) {
+        s_ack_payload.pipe_num = 0;
+        s_ack_payload.ready_us = s_ack_end_us;
+        fifo_push(&s_rx_fifo, &s_ack_payload);
+    }
+}
+
+static void tx_update(void) {
+    if (s_tx_state != TX_WAIT_ACK) {
+        return;
+    }
+
+    if (s_ack_received && s_now_us >= s_ack_end_us) {
+        tx_complete();
+
+        // With CE held high, the next packet is sent right away
+        if (s_ce && can_start_tx()) {
+            tx_start_packet(s_now_us);
+        }
+    } else if (!s_ack_received && s_now_us >= s_tx_deadline_us) {
+        if (s_arc_cnt < retransmit_count()) {
+            s_arc_cnt++;
+            s_stats.retransmits++;
+            tx_start(s_tx_deadline_us);
+        } else {
+            s_regs[NRF_STATUS] |= STATUS_MAX_RT_bm;
+            if (s_plos_cnt < PLOS_CNT_MAX) {
+                s_plos_cnt++;
+            }
+            s_stats.max_rt++;
+            s_tx_state = TX_IDLE;
+        }
+    }
+}
+
+static void tx_handle_ack(const air_frame_t *frame) {
+    if (s_tx_state != TX_WAIT_ACK ||
+        s_ack_received ||
+        frame->pid != s_tx_pid ||
+        frame->end_us > s_tx_deadline_us ||
+        memcmp(frame->addr, s_rx_addr_p0, frame->addr_width) != 0
+    ) {
+        return;
+    }
+
+    s_ack_received = true;
+    s_ack_end_us = frame->end_us;
+    s_ack_payload.width = frame->width;
+    memcpy(s_ack_payload.data, frame->data, frame->width);
+}
+
+/*********************************************************************
+ *                             receiver                              *
+ *********************************************************************/
+
+static bool pipe_addr_matches(uint8_t pipe_num, const air_frame_t *frame) {
+    const uint8_t width = frame->addr_width;
+
+    switch (pipe_num) {
+        case 0: return memcmp(frame->addr, s_rx_addr_p0, width) == 0;
+        case 1: return memcmp(frame->addr, s_rx_addr_p1, width) == 0;
+        default: {
+            // P2-P5 only have their least significant byte, the rest is P1
+            return frame->addr[0] == s_regs[RX_ADDR_P0 + pipe_num] &&
+                memcmp(frame->addr+1, s_rx_addr_p1+1, width-1) == 0;
+        }
+    }
+}
+
+static int find_rx_pipe(const air_frame_t *frame) {
+    uint8_t pipe_num;
+    for (pipe_num = 0; pipe_num < NRF24_NUMBER_PIPES; ++pipe_num) {
+        if ((s_regs[EN_RXADDR] & (1 << pipe_num)) && pipe_addr_matches(pipe_num, frame)) {
+            return pipe_num;
+        }
+    }
+    return -1;
+}
+
+static bool has_dynamic_payload(uint8_t pipe_num) {
+    return (s_regs[FEATURE] & EN_DPL_bm) && (s_regs[DYNPD] & (1 << pipe_num));
+}
+
+static void rx_send_ack(uint8_t pipe_num, const air_frame_t *frame) {
+    pipe_state_t *pipe = &s_pipes[pipe_num];
+    const int ack_pos = (s_regs[FEATURE] & EN_ACK_PAY_bm) ? find_ack_payload(pipe_num) : -1;
+    uint8_t width = 0;
+    air_frame_t ack;
+
+    if (ack_pos >= 0) {
+        width = s_tx_fifo.entries[ack_pos].width;
+    }
+
+    init_frame(&ack, frame->end_us + SETTLE_US + air_time_us(width));
+    ack.is_ack = true;
+    memcpy(ack.addr, frame->addr, NRF_ADDR_LEN);
+    ack.pid = frame->pid;
+    ack.width = width;
+    if (ack_pos >= 0) {
+        memcpy(ack.data, s_tx_fifo.entries[ack_pos].data, width);
+        s_stats.ack_payloads_sent++;
+    }
+    pipe->ack_payload_sent = (ack_pos >= 0);
+    s_stats.acks_sent++;
+    air_send(&ack);
+}
+
+static void rx_handle_frame(const air_frame_t *frame) {
+    model_payload_t payload;
+    pipe_state_t *pipe;
+    int pipe_num;
+    bool is_duplicate;
+
+    if (!is_receiver() || !s_ce) {
+        return;
+    }
+
+    pipe_num = find_rx_pipe(frame);
+    if (pipe_num < 0) {
+        return;
+    }
+    pipe = &s_pipes[pipe_num];
+
+    // a static payload width that doesn't match fails the CRC check
+    if (!has_dynamic_payload(pipe_num) && frame->width != s_regs[RX_PW_P0 + pipe_num]) {
+        return;
+    }
+
+    // A packet with the same id and CRC as the last one is a retransmit whose
+    // ACK was lost, it is acked again but not received again.
+    is_duplicate = pipe->has_last &&
+        frame->pid == pipe->last_pid &&
+        frame->width == pipe->last_width &&
+        memcmp(frame->data, pipe->last_data, frame->width) == 0;
+
+    if (is_duplicate) {
+        s_stats.duplicates++;
+    } else {
+        if (s_rx_fifo.count == FIFO_DEPTH) {
+            s_stats.rx_fifo_full++;
+            return;
+        }
+
+        payload.pipe_num = pipe_num;
+        payload.no_ack = frame->no_ack;
+        payload.width = frame->width;
+        payload.ready_us = frame->end_us;
+        memcpy(payload.data, frame->data, frame->width);
+        fifo_push(&s_rx_fifo, &payload);
+
+        // A new packet means the transmitter got the last ACK, so the ACK
+        // payload it held is done
+        if (pipe->ack_payload_sent) {
+            fifo_remove(&s_tx_fifo, find_ack_payload(pipe_num));
+            s_regs[NRF_STATUS] |= STATUS_TX_DS_bm;
+            pipe->ack_payload_sent = false;
+        }
+
+        pipe->has_last = true;
+        pipe->last_pid = frame->pid;
+        pipe->last_width = frame->width;
+        memcpy(pipe->last_data, frame->data, frame->width);
+    }
+
+    if ((s_regs[EN_AA] & (1 << pipe_num)) && !frame->no_ack) {
+        rx_send_ack(pipe_num, frame);
+    }
+}
+
+/*********************************************************************
+ *                             registers                             *
+ *********************************************************************/
+
+static uint8_t *addr_register(uint8_t reg) {
+    switch (reg) {
+        case RX_ADDR_P0: return s_rx_addr_p0;
+        case RX_ADDR_P1: return s_rx_addr_p1;
+        case TX_ADDR: return s_tx_addr;
+        default: return NULL;
+    }
+}
+
+static uint8_t read_register(uint8_t reg, uint8_t index) {
+    uint8_t *addr = addr_register(reg);
+
+    if (addr) {
+        return (index < NRF_ADDR_LEN) ? addr[index] : 0;
+    } else if (index != 0) {
+        return 0;
+    }
+
+    switch (reg) {
+        case NRF_STATUS: return read_status();
+        case OBSERVE_TX: return (s_plos_cnt << PLOS_CNT) | (s_arc_cnt << ARC_CNT);
+        case FIFO_STATUS: return read_fifo_status();
+        default: return s_regs[reg];
+    }
+}
+
+static void write_register(uint8_t reg, uint8_t index, uint8_t val) {
+    uint8_t *addr = addr_register(reg);
+
+    if (addr) {
+        if (index < NRF_ADDR_LEN) {
+            addr[index] = val;
+        }
+        return;
+    } else if (index != 0) {
+        return;
+    }
+
+    switch (reg) {
+        case NRF_STATUS: {
+            // the interrupt flags are cleared by writing 1 to them
+            s_regs[NRF_STATUS] &= ~(val & STATUS_ALL_IRQ_FLAGS_bm);
+        } break;
+
+        case RF_CH: {
+            s_regs[RF_CH] = val;
+            s_plos_cnt = 0;
+        } break;
+
+        case CONFIG: {
+            s_regs[CONFIG] = val;
+            if (!is_powered_up()) {
+                s_tx_state = TX_IDLE;
+            }
+        } break;
+
+        case OBSERVE_TX:
+        case RPD:
+        case FIFO_STATUS: {
+            // read only
+        } break;
+
+        default: {
+            s_regs[reg] = val;
+        } break;
+    }
+}
+
+/*********************************************************************
+ *                                SPI                                *
+ *********************************************************************/
+
+static void spi_command(uint8_t cmd) {
+    switch (cmd) {
+        case FLUSH_TX: {
+            s_tx_fifo.count = 0;
+            s_tx_state = TX_IDLE;
+        } break;
+
+        case FLUSH_RX: {
+            s_rx_fifo.count = 0;
+            s_rx_visible = 0;
+        } break;
+
+        default: {
+            memset(&s_spi_payload, 0, sizeof(s_spi_payload));
+        } break;
+    }
+}
+
+static uint8_t spi_data(uint8_t index, uint8_t byte) {
+    const uint8_t cmd = s_spi_cmd;
+
+    if (cmd < W_REGISTER) {
+        return read_register(cmd & REGISTER_MASK, index);
+    } else if (cmd < W_REGISTER + NUM_REGISTERS) {
+        write_register(cmd & REGISTER_MASK, index, byte);
+    } else if (cmd == R_RX_PAYLOAD) {
+        if (s_rx_visible && index < MAX_WIDTH) {
+            return s_rx_fifo.entries[0].data[index];
+        }
+    } else if (cmd == R_RX_PL_WID) {
+        return s_rx_visible ? s_rx_fifo.entries[0].width : 0;
+    } else if (
+        cmd == W_TX_PAYLOAD ||
+        cmd == W_TX_PAYLOAD_NO_ACK ||
+        (cmd & ~0x07) == W_ACK_PAYLOAD
+    ) {
+        if (index < MAX_WIDTH) {
+            s_spi_payload.data[index] = byte;
+            s_spi_payload.width = index + 1;
+        }
+    }
+    return 0;
+}
+
+static void spi_end(void) {
+    const uint8_t cmd = s_spi_cmd;
+
+    if (s_spi_index == 0) {
+        return;
+    }
+
+    if (cmd == R_RX_PAYLOAD) {
+        if (s_rx_visible) {
+            fifo_remove(&s_rx_fifo, 0);
+            s_rx_visible--;
+        }
+    } else if (cmd == W_TX_PAYLOAD || cmd == W_TX_PAYLOAD_NO_ACK) {
+        s_spi_payload.no_ack = (cmd == W_TX_PAYLOAD_NO_ACK) &&
+            (s_regs[FEATURE] & EN_DYN_ACK_bm);
+        fifo_push(&s_tx_fifo, &s_spi_payload);
+        if (s_ce && can_start_tx()) {
+            tx_start_packet(s_now_us);
+        }
+    } else if ((cmd & ~0x07) == W_ACK_PAYLOAD) {
+        s_spi_payload.pipe_num = cmd & 0x07;
+        fifo_push(&s_tx_fifo, &s_spi_payload);
+    }
+}
+
+/*********************************************************************
+ *                     `core/nrf24.h` port layer                     *
+ *********************************************************************/
+
+void nrf24_model_run(void) {
+    air_frame_t frame;
+
+    s_now_us = nrf24_model_time_us();
+
+    while (recv(s_air_fd, &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame)) {
+        if (!frame_is_heard(&frame)) {
+            continue;
+        }
+        if (frame.is_ack) {
+            tx_handle_ack(&frame);
+        } else {
+            rx_handle_frame(&frame);
+        }
+    }
+
+    tx_update();
+    update_rx_fifo();
+}
+
+void nrf24_model_init(int air_fd, const nrf24_model_config_t *config) {
+    static const uint8_t reset_values[NUM_REGISTERS] = {
+        [CONFIG] = EN_CRC_bm,
+        [EN_AA] = 0x3f,
+        [EN_RXADDR] = 0x03,
+        [SETUP_AW] = 0x03,
+        [SETUP_RETR] = 0x03,
+        [RF_CH] = 0x02,
+        [RF_SETUP] = RF_DR_2MBPS | (PWR_0DB << RF_PWR_LOW),
+        [RX_ADDR_P2] = 0xc3,
+        [RX_ADDR_P3] = 0xc4,
+        [RX_ADDR_P4] = 0xc5,
+        [RX_ADDR_P5] = 0xc6,
+    };
+
+    s_air_fd = air_fd;
+    s_config = *config;
+    s_rand_state = config->seed;
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    memcpy(s_regs, reset_values, NUM_REGISTERS);
+    memset(s_rx_addr_p0, 0xe7, NRF_ADDR_LEN);
+    memset(s_rx_addr_p1, 0xc2, NRF_ADDR_LEN);
+    memset(s_tx_addr, 0xe7, NRF_ADDR_LEN);
+    s_ce = 0;
+
+    s_tx_fifo.count = 0;
+    s_rx_fifo.count = 0;
+    s_rx_visible = 0;
+    s_spi_active = false;
+
+    s_tx_state = TX_IDLE;
+    s_tx_pid = 0;
+    s_arc_cnt = 0;
+    s_plos_cnt = 0;
+    memset(s_pipes, 0, sizeof(s_pipes));
+
+    s_now_us = nrf24_model_time_us();
+}
+
+// The model is set up by `nrf24_model_init()`, like a radio that is already
+// powered when the firmware starts
+void nrf24_init(void) {
+}
+
+void nrf24_disable(void) {
+    s_regs[CONFIG] &= ~PWR_UP_bm;
+    s_tx_state = TX_IDLE;
+}
+
+void nrf24_csn(uint8_t val) {
+    if (!val) {
+        nrf24_model_run();
+        s_spi_active = true;
+        s_spi_index = 0;
+    } else if (s_spi_active) {
+        spi_end();
+        s_spi_active = false;
+    }
+}
+
+void nrf24_ce(uint8_t val) {
+    nrf24_model_run();
+
+    // a rising edge sends the next packet, holding CE high sends them all
+    if (val && !s_ce && can_start_tx()) {
+        tx_start_packet(s_now_us);
+    }
+    s_ce = val;
+}
+
+uint8_t nrf24_spi_send_byte(uint8_t byte) {
+    uint8_t result;
+
+    if (!s_spi_active) {
+        return 0;
+    }
+
+    if (s_spi_index == 0) {
+        // the status register is shifted out while the command is shifted in
+        s_spi_cmd = byte;
+        result = read_status();
+        spi_command(byte);
+    } else {
+        result = spi_data(s_spi_index - 1, byte);
+    }
+
+    if (s_spi_index != 0xff) {
+        s_spi_index++;
+    }
+    return result;
+}
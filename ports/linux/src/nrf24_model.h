@@ -0,0 +1,73 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file nrf24_model.h
+///
+/// Software model of an nRF24L01+ for running `core/nrf24.c` and `core/rf.c`
+/// on Linux without radios.
+///
+/// The model implements the SPI functions that a port provides when it is
+/// built with `NRF24_INBUILT_SPI_HANDLING`: `nrf24_spi_send_byte()`,
+/// `nrf24_csn()` and `nrf24_ce()`. Behind them it has:
+///
+/// * the register file, including the 5 byte address registers
+/// * the 3 level TX and RX FIFOs, with ACK payloads in the TX FIFO of a
+///   receiver
+/// * Enhanced ShockBurst: auto ack, ACK payloads, packet ids to drop
+///   retransmitted packets, auto retransmit after `ARD` up to `ARC` times,
+///   then `MAX_RT`
+/// * the timing of the radio: PLL settling, air time from the data rate and
+///   frame size, and the retransmit delay
+///
+/// Each process has one radio. Two radios share the air through a socket
+/// that the caller creates, e.g. with `socketpair()` before a `fork()`. A
+/// frame is written to the socket when its transmission starts and holds
+/// the time that it ends, read from the monotonic clock that the processes
+/// share. The other radio handles the frame when it reads it, but the
+/// payload only shows up in its RX FIFO, and an ACK only counts, once that
+/// time has passed. Frames can be lost and delayed, see
+/// `nrf24_model_config_t`. Collisions and frames from more than two radios
+/// aren't modeled.
+///
+/// The radio only advances when the firmware talks to it, or when
+/// `nrf24_model_run()` is called, so the main loops of both processes need
+/// to poll it often.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct nrf24_model_config_t {
+    /// Chance that a frame sent by this radio is lost, in percent. Applies
+    /// to packets and ACKs alike.
+    double loss_percent;
+    /// Extra time in µs before a frame sent by this radio is received
+    uint32_t latency_us;
+    /// Seed for the frame loss
+    uint32_t seed;
+} nrf24_model_config_t;
+
+typedef struct nrf24_model_stats_t {
+    uint32_t packets_sent; ///< packets sent, without retransmits
+    uint32_t retransmits; ///< packets sent again after no ACK came
+    uint32_t max_rt; ///< times `STATUS_MAX_RT` was raised
+    uint32_t acks_sent; ///< ACKs sent by the receiver
+    uint32_t ack_payloads_sent; ///< ACKs that held an ACK payload
+    uint32_t frames_lost; ///< packets and ACKs lost on the way out
+    uint32_t duplicates; ///< retransmitted packets acked but not received again
+    uint32_t rx_fifo_full; ///< packets dropped without ACK, RX FIFO full
+} nrf24_model_stats_t;
+
+/// Reset the radio to its power on state and connect it to the air
+///
+/// @param air_fd a `SOCK_SEQPACKET` or `SOCK_DGRAM` socket connected to the
+///     other radio
+void nrf24_model_init(int air_fd, const nrf24_model_config_t *config);
+
+/// Handle the frames received from the air, and advance the radio to the
+/// current time
+void nrf24_model_run(void);
+
+/// The time used by the radio, in µs from the monotonic clock
+uint64_t nrf24_model_time_us(void);
+
+const nrf24_model_stats_t *nrf24_model_stats(void);
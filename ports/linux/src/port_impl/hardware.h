@@ -1,15 +1,25 @@
 #pragma once
 
 #include <stddef.h>
+#include <time.h>
 
 #define F_CPU 0
 
+// Only used by `core/nrf24.c` in the benchmarks that run on the radio model
+#define static_delay_us(t) \
+    nanosleep(&(struct timespec){ .tv_nsec = (long)(t) * 1000 }, NULL)
+#define static_delay_ms(t) \
+    nanosleep(&(struct timespec){ .tv_sec = (t) / 1000, .tv_nsec = ((long)(t) % 1000) * 1000000 }, NULL)
+
 #define enable_interrupts()
 #define disable_interrupts()
 
 #define MCU_BITNESS 8
+// `make matrix-scan-test` builds the scanner with a matrix of its own
+#ifndef IO_PORT_COUNT
 #define IO_PORT_MAX_PIN_NUM 0
 #define IO_PORT_COUNT 0
+#endif
 #define IO_MAP_GPIO_COUNT 0
 #define IO_USABLE_PINS {}
 
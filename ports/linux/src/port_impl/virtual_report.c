@@ -10,6 +10,7 @@
 #include "virtual_input.h"
 #include "event_codes.h"
 #include "core/keycode.h"
+#include "core/util.h"
 
 static hid_report_boot_keyboard_t s_last_boot_report;
 static hid_report_nkro_keyboard_t s_last_nkro_report;
@@ -109,24 +110,21 @@ void kp_virtual_hid_nkro_keyboard_report_send(void) {
 
     updated |= handle_mods(s_last_nkro_report.modifiers, g_nkro_keyboard_report.modifiers);
 
-    for (int i = 0; i < NKRO_REPORT_BYTES; ++i) {
-        int old_bits = s_last_nkro_report.bitmask[i];
-        int new_bits = g_nkro_keyboard_report.bitmask[i];
-        int changed = old_bits ^ new_bits;
-
-        if (!changed) {
-            continue;
-        }
-
-        for (int bit = 0; bit < 8; ++bit) {
-            int hid;
-            int value;
-            if (!(changed & (1<<bit))) {
-                continue;
-            }
-
-            hid = i * 8 + bit;
-            value = !!(new_bits & (1<<bit));
+    for (int i = 0; i < NKRO_REPORT_BYTES; i += BITSET_WORD_SIZE) {
+        const bitset_word_t old_bits = bitset_read_word(
+            &s_last_nkro_report.bitmask[i], NKRO_REPORT_BYTES - i
+        );
+        const bitset_word_t new_bits = bitset_read_word(
+            &g_nkro_keyboard_report.bitmask[i], NKRO_REPORT_BYTES - i
+        );
+        bitset_word_t changed = old_bits ^ new_bits;
+
+        while (changed) {
+            const int bit = bitset_ctz(changed);
+            const int hid = i * 8 + bit;
+            const int value = (new_bits >> bit) & 1;
+
+            changed = bitset_clear_lowest(changed);
             kp_virtual_keyboard_send(EV_KEY, HID_KB_TO_EV[hid], value);
             updated = 1;
         }
@@ -0,0 +1,408 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file rf_link_bench.c
+///
+/// Latency and throughput of the RF link when frames are lost. Run it with
+/// `make rf-link-bench`, or `./build/rf_link_bench <loss %> <latency µs>` to
+/// measure one link.
+///
+/// A keyboard and a receiver run the unmodified `core/rf.c` and
+/// `core/nrf24.c` in two processes, each on the software nRF24L01+ of
+/// `nrf24_model.h`. The keyboard's main loop is the one of the xmega port.
+/// Each matrix state holds a sequence number in its key bits, so the
+/// receiver can tell the states apart and look up when they were queued.
+///
+/// * paced: a new matrix state every `PACED_INTERVAL_US`, like fast typing.
+///   Reports the time from `rf_send_matrix_packet()` queueing a state to
+///   the receiver handling it. States merged in the TX queue are not
+///   handled on their own, so they aren't counted.
+/// * flood: a new matrix state whenever the TX queue has room. Reports the
+///   number of states the receiver handles per second.
+///
+/// The radios run in real time, so the results vary a little between runs
+/// and get worse on a busy machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/aes.h"
+#include "core/matrix_packet.h"
+#include "core/nrf24.h"
+#include "core/rf.h"
+#include "core/settings.h"
+
+#include "nrf24_model.h"
+
+#define TEST_DEVICE_ID 0
+#define TEST_MATRIX_SIZE 2
+#define TEST_CHANNEL 76
+#define TEST_ARC 15
+
+#define RUN_TIME_US 500000
+#define CONNECT_TIMEOUT_US 1000000
+#define DRAIN_TIME_US 100000
+#define PACED_INTERVAL_US 2000
+
+#define SEQ_COUNT 0x10000
+#define HIST_BUCKET_US 100
+#define HIST_BUCKETS 1000
+
+typedef enum {
+    MODE_PACED,
+    MODE_FLOOD,
+} link_mode_t;
+
+// Shared by the two processes
+typedef struct link_shared_t {
+    volatile bool receiver_ready;
+    volatile bool stop;
+    // the first sequence number that is measured, 0 until the link is up
+    volatile uint32_t measure_from;
+    volatile uint32_t handled_any;
+
+    // written by the keyboard
+    uint64_t queued_us[SEQ_COUNT];
+
+    // written by the receiver
+    uint32_t handled;
+    uint64_t latency_sum_us;
+    uint32_t latency_max_us;
+    uint32_t latency_hist[HIST_BUCKETS];
+    nrf24_model_stats_t receiver_model;
+} link_shared_t;
+
+static link_shared_t *s_shared;
+static uint16_t s_last_seq;
+
+XRAM rf_settings_t g_rf_settings;
+XRAM runtime_settings_t g_runtime_settings;
+XRAM uint8_t g_key_num_bitmap[KEY_NUMBER_BITMAP_SIZE];
+bit_t g_slow_clock_mode;
+
+/*********************************************************************
+ *                 stubs for the rest of the firmware                *
+ *********************************************************************/
+
+bool has_critical_error(void) {
+    return false;
+}
+
+uint8_t get_matrix_compressed_size(void) {
+    return TEST_MATRIX_SIZE;
+}
+
+uint16_t increment_session_id(void) {
+    static uint16_t s_session_id = 0x100;
+    return s_session_id++;
+}
+
+void rf_init_receive_irq(void) {}
+void rf_enable_receive_irq(void) {}
+void rf_disable_receive_irq(void) {}
+
+void keyboard_update_device_matrix(uint8_t device_id, const XRAM uint8_t *matrix_packet) REENT {
+    uint8_t matrix[TEST_MATRIX_SIZE];
+    uint16_t seq;
+    uint32_t latency_us;
+
+    matrix_packet_decode(matrix, TEST_MATRIX_SIZE, matrix_packet);
+    seq = matrix[0] | (matrix[1] << 8);
+
+    if (seq == s_last_seq) {
+        return;
+    }
+    s_last_seq = seq;
+    s_shared->handled_any = true;
+
+    if (s_shared->measure_from == 0 || seq < s_shared->measure_from) {
+        return;
+    }
+
+    latency_us = nrf24_model_time_us() - s_shared->queued_us[seq];
+    s_shared->handled++;
+    s_shared->latency_sum_us += latency_us;
+    if (latency_us > s_shared->latency_max_us) {
+        s_shared->latency_max_us = latency_us;
+    }
+    s_shared->latency_hist[
+        (latency_us / HIST_BUCKET_US < HIST_BUCKETS) ?
+        latency_us / HIST_BUCKET_US : HIST_BUCKETS - 1
+    ]++;
+}
+
+/*********************************************************************
+ *                             processes                             *
+ *********************************************************************/
+
+static void setup_device(int air_fd, const nrf24_model_config_t *config) {
+    static const uint8_t key[AES_KEY_SIZE] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+        0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+    };
+    static const uint8_t pipe_addr_0[NRF_ADDR_LEN] = {0x10, 0x22, 0x33, 0x44, 0x55};
+    static const uint8_t pipe_addr_1[NRF_ADDR_LEN] = {0x11, 0x66, 0x77, 0x88, 0x99};
+    settings_t *settings = (settings_t*)g_virtual_storage;
+
+    memset(settings, 0, sizeof(settings_t));
+    settings->device_id = TEST_DEVICE_ID;
+    settings->layout.number_devices = 1;
+
+    memcpy(g_rf_settings.pipe_addr_0, pipe_addr_0, NRF_ADDR_LEN);
+    memcpy(g_rf_settings.pipe_addr_1, pipe_addr_1, NRF_ADDR_LEN);
+    g_rf_settings.pipe_addr_2 = 0x12;
+    g_rf_settings.pipe_addr_3 = 0x13;
+    g_rf_settings.pipe_addr_4 = 0x14;
+    g_rf_settings.pipe_addr_5 = 0x15;
+    g_rf_settings.channel = TEST_CHANNEL;
+    g_rf_settings.arc = TEST_ARC;
+
+    // The T-table backend doesn't use the decryption key
+    aes_key_init(key, key);
+
+    nrf24_model_init(air_fd, config);
+}
+
+static void receiver_main(int air_fd, const nrf24_model_config_t *config) {
+    setup_device(air_fd, config);
+    rf_init_receive();
+    s_shared->receiver_ready = true;
+
+    while (!s_shared->stop) {
+        rf_task();
+    }
+
+    s_shared->receiver_model = *nrf24_model_stats();
+}
+
+// Same order as `battery_mode_main_loop()` in the xmega port
+static void keyboard_tick(bool scan_changed) {
+    const uint8_t status = nrf24_read_status();
+
+    if (status & STATUS_MAX_RT_bm) {
+        rf_tx_handle_max_rt();
+    }
+
+    if (scan_changed) {
+        rf_send_matrix_packet();
+    }
+
+    if (NRF24_STATUS_RX_PIPE(status) != STATUS_RX_FIFO_EMPTY) {
+        rf_handle_ack_payloads();
+    }
+
+    rf_tx_task();
+
+    if (!(nrf24_read_reg(FIFO_STATUS) & FIFO_TX_EMPTY_bm)) {
+        nrf24_send_one();
+    }
+}
+
+static void queue_state(uint16_t seq) {
+    s_shared->queued_us[seq] = nrf24_model_time_us();
+    g_key_num_bitmap[0] = seq & 0xff;
+    g_key_num_bitmap[1] = seq >> 8;
+}
+
+// @return the number of states queued while measuring
+static uint32_t keyboard_main(int air_fd, const nrf24_model_config_t *config, link_mode_t mode) {
+    uint16_t seq = 0;
+    uint64_t start_us;
+    uint64_t next_us;
+    uint64_t now_us;
+
+    setup_device(air_fd, config);
+    rf_init_send();
+
+    while (!s_shared->receiver_ready) {
+        nrf24_model_run();
+    }
+
+    // The first state starts the session challenge, keep sending until the
+    // receiver handles one
+    start_us = nrf24_model_time_us();
+    next_us = start_us;
+    while (!s_shared->handled_any) {
+        now_us = nrf24_model_time_us();
+        if (now_us - start_us > CONNECT_TIMEOUT_US) {
+            return 0;
+        }
+        if (now_us >= next_us) {
+            queue_state(++seq);
+            next_us += PACED_INTERVAL_US;
+            keyboard_tick(true);
+        } else {
+            keyboard_tick(false);
+        }
+    }
+
+    s_shared->measure_from = seq + 1;
+    start_us = nrf24_model_time_us();
+    next_us = start_us;
+    while ((now_us = nrf24_model_time_us()) - start_us < RUN_TIME_US) {
+        bool new_state = false;
+
+        if (mode == MODE_PACED) {
+            new_state = (now_us >= next_us);
+            if (new_state) {
+                next_us += PACED_INTERVAL_US;
+            }
+        } else {
+            new_state = (rf_tx_queue_depth() < RF_TX_QUEUE_SIZE);
+        }
+
+        if (new_state && seq + 1 < SEQ_COUNT) {
+            queue_state(++seq);
+        } else {
+            new_state = false;
+        }
+        keyboard_tick(new_state);
+    }
+
+    // let the queued states through
+    start_us = nrf24_model_time_us();
+    while (nrf24_model_time_us() - start_us < DRAIN_TIME_US) {
+        keyboard_tick(false);
+    }
+
+    return seq - s_shared->measure_from + 1;
+}
+
+/*********************************************************************
+ *                              results                              *
+ *********************************************************************/
+
+static double hist_percentile_ms(double percentile) {
+    const uint32_t target = s_shared->handled * percentile;
+    uint32_t count = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        count += s_shared->latency_hist[i];
+        if (count > target) {
+            break;
+        }
+    }
+
+    // the end of the bucket, but never more than the largest latency
+    if ((i + 1) * HIST_BUCKET_US > s_shared->latency_max_us) {
+        return s_shared->latency_max_us / 1000.0;
+    }
+    return (i + 1) * HIST_BUCKET_US / 1000.0;
+}
+
+static void print_header(link_mode_t mode) {
+    if (mode == MODE_PACED) {
+        printf("\npaced, a new matrix state every %d ms:\n", PACED_INTERVAL_US / 1000);
+        printf("  loss  latency  queued  handled  avg ms  p99 ms  max ms  resends  max_rt\n");
+    } else {
+        printf("\nflood, a new matrix state whenever the TX queue has room:\n");
+        printf("  loss  latency  queued  handled  states/s  lost frames  resends  max_rt\n");
+    }
+}
+
+static bool run_link(double loss_percent, uint32_t latency_us, link_mode_t mode) {
+    const nrf24_model_config_t keyboard_config = {loss_percent, latency_us, 1};
+    const nrf24_model_config_t receiver_config = {loss_percent, latency_us, 2};
+    const nrf24_model_stats_t *keyboard_model;
+    int air[2];
+    uint32_t queued;
+    pid_t pid;
+
+    memset(s_shared, 0, sizeof(link_shared_t));
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, air) < 0) {
+        perror("socketpair() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork() failed");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        close(air[0]);
+        receiver_main(air[1], &receiver_config);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(air[1]);
+    queued = keyboard_main(air[0], &keyboard_config, mode);
+    s_shared->stop = true;
+    waitpid(pid, NULL, 0);
+    close(air[0]);
+
+    keyboard_model = nrf24_model_stats();
+
+    printf("  %3.0f%%  %4d us  %6d  %7d", loss_percent, latency_us, queued, s_shared->handled);
+
+    if (queued == 0) {
+        printf("  no connection\n");
+        return false;
+    }
+
+    if (mode == MODE_PACED) {
+        printf("  %6.2f  %6.1f  %6.1f",
+            s_shared->handled ?
+                (double)s_shared->latency_sum_us / s_shared->handled / 1000.0 : 0,
+            hist_percentile_ms(0.99),
+            s_shared->latency_max_us / 1000.0
+        );
+    } else {
+        printf("  %8.0f  %11d",
+            s_shared->handled * 1000000.0 / RUN_TIME_US,
+            keyboard_model->frames_lost + s_shared->receiver_model.frames_lost
+        );
+    }
+    printf("  %7d  %6d\n", keyboard_model->retransmits, keyboard_model->max_rt);
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        double loss_percent;
+        uint32_t latency_us;
+    } links[] = {
+        {0, 0},
+        {1, 0},
+        {5, 0},
+        {10, 0},
+        {20, 0},
+        {30, 0},
+        {10, 100},
+    };
+    bool ok = true;
+    link_mode_t mode;
+    size_t i;
+
+    s_shared = mmap(
+        NULL, sizeof(link_shared_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+        -1, 0
+    );
+    if (s_shared == MAP_FAILED) {
+        perror("mmap() failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("RF link on the nRF24L01+ model: 2Mbps, ARC %d, %d byte matrix\n",
+        TEST_ARC, TEST_MATRIX_SIZE);
+
+    for (mode = MODE_PACED; mode <= MODE_FLOOD; ++mode) {
+        print_header(mode);
+        if (argc == 3) {
+            ok &= run_link(atof(argv[1]), atoi(argv[2]), mode);
+            continue;
+        }
+        for (i = 0; i < sizeof(links) / sizeof(links[0]); ++i) {
+            ok &= run_link(links[i].loss_percent, links[i].latency_us, mode);
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,433 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file rf_resume_bench.c
+///
+/// Measures the time from a wireless keyboard waking up to the receiver
+/// handling its first key press, and checks when the receiver's session
+/// tickets let the keyboard skip the challenge. Run it with
+/// `make rf-resume-bench`.
+///
+/// A keyboard and a receiver run the unmodified `core/rf.c` and
+/// `core/nrf24.c` in two processes, each on the software nRF24L01+ of
+/// `nrf24_model.h`, like `rf_link_bench.c`. The receivers are forked from a
+/// launcher process that is started before any firmware code runs, so each
+/// receiver starts with the RAM of a freshly loaded image:
+///
+/// * MCU reset: the new receiver gets the `ATTR_NO_INIT` RAM of the one
+///   before it, the rest of its RAM is cleared.
+/// * power cycle: the `ATTR_NO_INIT` RAM holds random bytes.
+///
+/// The keyboard sleeps for minutes without sending, which the bench fakes by
+/// moving the firmware clock ahead in steps while the receiver keeps running.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/aes.h"
+#include "core/matrix_packet.h"
+#include "core/nrf24.h"
+#include "core/rf.h"
+#include "core/settings.h"
+#include "core/timer.h"
+
+#include "nrf24_model.h"
+
+#define TEST_DEVICE_ID 0
+#define TEST_MATRIX_SIZE 2
+#define TEST_KEY_NUM 5
+#define TEST_CHANNEL 76
+#define TEST_ARC 15
+
+#define CONNECT_TIMEOUT_US 1000000
+#define SETTLE_TIME_US 20000
+#define RETRY_INTERVAL_US 2000
+
+// Must stay below the 16 bit ms timer wrapping
+#define SLEEP_STEP_MS 10000
+
+#define NO_INIT_MAX_SIZE 1024
+
+typedef enum {
+    RECEIVER_POWER_ON,
+    RECEIVER_RESET,
+} receiver_start_t;
+
+typedef enum {
+    RESULT_IN_SESSION,
+    RESULT_RESUMED,
+    RESULT_CHALLENGE,
+    RESULT_NO_REPORT,
+} wake_result_t;
+
+// Shared by the processes
+typedef struct resume_shared_t {
+    // set by a receiver once it is running, cleared when it has stopped
+    volatile bool receiver_ready;
+    volatile bool stop;
+
+    // time that the keyboard slept, added to the firmware clock
+    volatile uint32_t sleep_ms;
+    // the last `sleep_ms` seen by a pass of the receiver's main loop
+    volatile uint32_t receiver_sleep_ms;
+
+    // written by the receiver
+    volatile bool key_down;
+    volatile uint16_t resumes;
+
+    // `ATTR_NO_INIT` RAM of the last receiver, kept over a reset
+    uint8_t no_init_ram[NO_INIT_MAX_SIZE];
+} resume_shared_t;
+
+extern uint8_t __start_kp_noinit[];
+extern uint8_t __stop_kp_noinit[];
+
+static resume_shared_t *s_shared;
+static int s_launch_fd;
+
+XRAM rf_settings_t g_rf_settings;
+XRAM runtime_settings_t g_runtime_settings;
+XRAM uint8_t g_key_num_bitmap[KEY_NUMBER_BITMAP_SIZE];
+bit_t g_slow_clock_mode;
+
+/*********************************************************************
+ *                 stubs for the rest of the firmware                *
+ *********************************************************************/
+
+uint16_t timer_read16_ms(void) {
+    return nrf24_model_time_us() / 1000 + s_shared->sleep_ms;
+}
+
+uint32_t timer_read_ms(void) {
+    return nrf24_model_time_us() / 1000 + s_shared->sleep_ms;
+}
+
+bool has_critical_error(void) {
+    return false;
+}
+
+uint8_t get_matrix_compressed_size(void) {
+    return TEST_MATRIX_SIZE;
+}
+
+uint16_t increment_session_id(void) {
+    static uint16_t s_session_id = 0x100;
+    return s_session_id++;
+}
+
+void rf_init_receive_irq(void) {}
+void rf_enable_receive_irq(void) {}
+void rf_disable_receive_irq(void) {}
+
+void keyboard_update_device_matrix(uint8_t device_id, const XRAM uint8_t *matrix_packet) REENT {
+    uint8_t matrix[TEST_MATRIX_SIZE];
+
+    matrix_packet_decode(matrix, TEST_MATRIX_SIZE, matrix_packet);
+    s_shared->key_down = (matrix[TEST_KEY_NUM / 8] >> (TEST_KEY_NUM % 8)) & 1;
+}
+
+/*********************************************************************
+ *                             processes                             *
+ *********************************************************************/
+
+static size_t no_init_size(void) {
+    return __stop_kp_noinit - __start_kp_noinit;
+}
+
+static void setup_device(int air_fd, uint32_t seed) {
+    static const uint8_t key[AES_KEY_SIZE] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+        0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+    };
+    static const uint8_t pipe_addr_0[NRF_ADDR_LEN] = {0x10, 0x22, 0x33, 0x44, 0x55};
+    static const uint8_t pipe_addr_1[NRF_ADDR_LEN] = {0x11, 0x66, 0x77, 0x88, 0x99};
+    const nrf24_model_config_t config = {0, 0, seed};
+    settings_t *settings = (settings_t*)g_virtual_storage;
+
+    memset(settings, 0, sizeof(settings_t));
+    settings->device_id = TEST_DEVICE_ID;
+    settings->layout.number_devices = 1;
+
+    memcpy(g_rf_settings.pipe_addr_0, pipe_addr_0, NRF_ADDR_LEN);
+    memcpy(g_rf_settings.pipe_addr_1, pipe_addr_1, NRF_ADDR_LEN);
+    g_rf_settings.pipe_addr_2 = 0x12;
+    g_rf_settings.pipe_addr_3 = 0x13;
+    g_rf_settings.pipe_addr_4 = 0x14;
+    g_rf_settings.pipe_addr_5 = 0x15;
+    g_rf_settings.channel = TEST_CHANNEL;
+    g_rf_settings.arc = TEST_ARC;
+
+    // The T-table backend doesn't use the decryption key
+    aes_key_init(key, key);
+
+    nrf24_model_init(air_fd, &config);
+}
+
+static void receiver_main(int air_fd, receiver_start_t start, uint32_t seed) {
+    size_t i;
+
+    if (start == RECEIVER_RESET) {
+        memcpy(__start_kp_noinit, s_shared->no_init_ram, no_init_size());
+    } else {
+        srand(seed);
+        for (i = 0; i < no_init_size(); ++i) {
+            __start_kp_noinit[i] = rand();
+        }
+    }
+
+    setup_device(air_fd, 2);
+    rf_init_receive();
+    s_shared->receiver_ready = true;
+
+    while (!s_shared->stop) {
+        const uint32_t sleep_ms = s_shared->sleep_ms;
+        rf_task();
+        s_shared->resumes = g_rf_rx_stats.resumes;
+        s_shared->receiver_sleep_ms = sleep_ms;
+    }
+
+    memcpy(s_shared->no_init_ram, __start_kp_noinit, no_init_size());
+    s_shared->receiver_ready = false;
+}
+
+// Runs before any firmware code, so every receiver it forks starts with the
+// RAM of a freshly loaded image
+static void launcher_main(int command_fd, int air_fd) {
+    uint32_t receiver_count = 0;
+    uint8_t start;
+    pid_t pid;
+
+    while (read(command_fd, &start, 1) == 1) {
+        pid = fork();
+        if (pid < 0) {
+            perror("fork() failed");
+            exit(EXIT_FAILURE);
+        } else if (pid == 0) {
+            receiver_main(air_fd, start, receiver_count);
+            _exit(EXIT_SUCCESS);
+        }
+        receiver_count++;
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static void start_receiver(receiver_start_t start) {
+    const uint8_t command = start;
+
+    s_shared->stop = false;
+    s_shared->resumes = 0;
+    if (write(s_launch_fd, &command, 1) != 1) {
+        perror("write() failed");
+        exit(EXIT_FAILURE);
+    }
+    while (!s_shared->receiver_ready) {
+        nrf24_model_run();
+    }
+}
+
+static void stop_receiver(void) {
+    s_shared->stop = true;
+    while (s_shared->receiver_ready) {
+    }
+}
+
+// Same order as `battery_mode_main_loop()` in the xmega port
+static void keyboard_tick(bool scan_changed) {
+    const uint8_t status = nrf24_read_status();
+
+    if (status & STATUS_MAX_RT_bm) {
+        rf_tx_handle_max_rt();
+    }
+
+    if (scan_changed) {
+        rf_send_matrix_packet();
+    }
+
+    if (NRF24_STATUS_RX_PIPE(status) != STATUS_RX_FIFO_EMPTY) {
+        rf_handle_ack_payloads();
+    }
+
+    rf_tx_task();
+
+    if (!(nrf24_read_reg(FIFO_STATUS) & FIFO_TX_EMPTY_bm)) {
+        nrf24_send_one();
+    }
+}
+
+static void set_key(bool down) {
+    if (down) {
+        g_key_num_bitmap[TEST_KEY_NUM / 8] |= (1 << (TEST_KEY_NUM % 8));
+    } else {
+        g_key_num_bitmap[TEST_KEY_NUM / 8] &= ~(1 << (TEST_KEY_NUM % 8));
+    }
+}
+
+// Change the key and send the matrix until the receiver has handled it.
+// The matrix is sent again every `RETRY_INTERVAL_US`, since the first
+// packets of a session are used by the challenge.
+//
+// @return the time it took in µs, or 0 on a timeout
+static uint64_t send_key(bool down) {
+    const uint64_t start_us = nrf24_model_time_us();
+    uint64_t next_us = start_us;
+    uint64_t now_us;
+
+    set_key(down);
+    while (s_shared->key_down != down) {
+        now_us = nrf24_model_time_us();
+        if (now_us - start_us > CONNECT_TIMEOUT_US) {
+            return 0;
+        }
+        keyboard_tick(now_us >= next_us);
+        if (now_us >= next_us) {
+            next_us += RETRY_INTERVAL_US;
+        }
+    }
+    return nrf24_model_time_us() - start_us;
+}
+
+static void settle(void) {
+    const uint64_t start_us = nrf24_model_time_us();
+    while (nrf24_model_time_us() - start_us < SETTLE_TIME_US) {
+        keyboard_tick(false);
+    }
+}
+
+// The keyboard sends nothing while the receiver's clock moves ahead
+static void sleep_minutes(uint16_t minutes) {
+    const uint32_t end_ms = s_shared->sleep_ms + (uint32_t)minutes * 60000;
+
+    while (s_shared->sleep_ms < end_ms) {
+        s_shared->sleep_ms += SLEEP_STEP_MS;
+        while (s_shared->receiver_sleep_ms != s_shared->sleep_ms) {
+        }
+    }
+}
+
+static const char *result_name(wake_result_t result) {
+    switch (result) {
+        case RESULT_IN_SESSION: return "in session";
+        case RESULT_RESUMED: return "resumed";
+        case RESULT_CHALLENGE: return "challenge";
+        default: return "no report";
+    }
+}
+
+static bool run_scenario(
+    const char *name,
+    uint16_t sleep_time,
+    bool restart,
+    receiver_start_t start,
+    wake_result_t expected
+) {
+    const nrf24_model_stats_t *model = nrf24_model_stats();
+    wake_result_t result;
+    uint32_t packets_start;
+    uint16_t resumes_start;
+    uint16_t resyncs_start;
+    uint64_t wake_us;
+
+    // Tap a key so the keyboard is in session
+    if (!send_key(true) || !send_key(false)) {
+        printf("  %-34s no connection\n", name);
+        return false;
+    }
+    settle();
+
+    sleep_minutes(sleep_time);
+    if (restart) {
+        stop_receiver();
+        start_receiver(start);
+    }
+
+    packets_start = model->packets_sent;
+    resumes_start = s_shared->resumes;
+    resyncs_start = g_rf_tx_stats.resyncs;
+
+    // the key press that woke the keyboard
+    wake_us = send_key(true);
+
+    if (!wake_us) {
+        result = RESULT_NO_REPORT;
+    } else if (s_shared->resumes != resumes_start) {
+        result = RESULT_RESUMED;
+    } else if (g_rf_tx_stats.resyncs != resyncs_start) {
+        result = RESULT_CHALLENGE;
+    } else {
+        result = RESULT_IN_SESSION;
+    }
+
+    printf("  %-34s %6.2f ms %4d packets  %-10s %s\n",
+        name,
+        wake_us / 1000.0,
+        model->packets_sent - packets_start,
+        result_name(result),
+        (result == expected) ? "ok" : "FAIL"
+    );
+
+    send_key(false);
+    settle();
+
+    return result == expected;
+}
+
+int main(void) {
+    int air[2];
+    int launch[2];
+    bool ok = true;
+    pid_t launcher;
+
+    s_shared = mmap(
+        NULL, sizeof(resume_shared_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+        -1, 0
+    );
+    if (s_shared == MAP_FAILED) {
+        perror("mmap() failed");
+        return EXIT_FAILURE;
+    }
+    if (no_init_size() > NO_INIT_MAX_SIZE) {
+        fprintf(stderr, "NO_INIT_MAX_SIZE is too small\n");
+        return EXIT_FAILURE;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, air) < 0 || pipe(launch) < 0) {
+        perror("socketpair() failed");
+        return EXIT_FAILURE;
+    }
+
+    launcher = fork();
+    if (launcher < 0) {
+        perror("fork() failed");
+        return EXIT_FAILURE;
+    } else if (launcher == 0) {
+        close(air[0]);
+        close(launch[1]);
+        launcher_main(launch[0], air[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    close(air[1]);
+    close(launch[0]);
+    s_launch_fd = launch[1];
+
+    setup_device(air[0], 1);
+    rf_init_send();
+    start_receiver(RECEIVER_POWER_ON);
+
+    printf("wake to first report, %d minute session tickets:\n", RF_SESSION_TICKET_MINUTES);
+    ok &= run_scenario("session kept", 5, false, RECEIVER_RESET, RESULT_IN_SESSION);
+    ok &= run_scenario("receiver reset, valid ticket", 5, true, RECEIVER_RESET, RESULT_RESUMED);
+    ok &= run_scenario("receiver reset, expired ticket",
+        RF_SESSION_TICKET_MINUTES + 5, true, RECEIVER_RESET, RESULT_CHALLENGE);
+    ok &= run_scenario("receiver power cycle", 5, true, RECEIVER_POWER_ON, RESULT_CHALLENGE);
+
+    stop_receiver();
+    close(s_launch_fd);
+    waitpid(launcher, NULL, 0);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
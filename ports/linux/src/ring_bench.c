@@ -0,0 +1,228 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file ring_bench.c
+///
+/// Compares the spsc ring buffers from `core/ring_buf.h` with the older
+/// `ring_buf128`, then stress tests the spsc ring with a producer thread
+/// standing in for an ISR. Run it with `make ring-bench`.
+///
+/// The spsc ring is safe without masking interrupts, not faster: one element
+/// at a time it is slower than `ring_buf128`, since every put and get stores
+/// the index behind a compiler barrier.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "core/ring_buf.h"
+
+#include "bench_util.h"
+
+#define BENCH_BYTES (16UL * 1024 * 1024)
+#define BENCH_CHUNK 24
+#define STRESS_RECORDS 2000000UL
+#define STRESS_MAX_RECORD_LEN 24
+
+DEFINE_INLINE_SPSC_RING_VARIANT(128, uint8_t, uint8_t, bench_ring);
+
+static ring_buf128_type s_old_ring;
+static bench_ring_type s_new_ring;
+static bench_ring_type s_stress_ring;
+
+typedef struct ring_bench_t {
+    uint32_t (*func)(void);
+    uint32_t check;
+} ring_bench_t;
+
+static void run_ring_bench(void *ctx) {
+    ring_bench_t *bench = ctx;
+    bench->check = bench->func();
+}
+
+/// Print the throughput of the fastest of `BENCH_RUNS` calls of `func`
+static void run_bench(const char *name, uint32_t (*func)(void)) {
+    ring_bench_t bench = { func, 0 };
+    const bench_time_t best = bench_best_of(run_ring_bench, &bench);
+
+    printf("%-26s %8.1f MB/s (check %08x)\n", name,
+           (double)BENCH_BYTES * 1000.0 / best.ns, bench.check);
+}
+
+static uint32_t bench_old_single(void) {
+    uint32_t check = 0;
+    unsigned long i;
+    uint8_t j;
+
+    ring_buf128_clear(&s_old_ring);
+    for (i = 0; i < BENCH_BYTES; i += BENCH_CHUNK) {
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            ring_buf128_put(&s_old_ring, (uint8_t)(i + j));
+        }
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            check += ring_buf128_get(&s_old_ring);
+        }
+    }
+    return check;
+}
+
+static uint32_t bench_old_bulk(void) {
+    uint8_t chunk[BENCH_CHUNK];
+    uint32_t check = 0;
+    unsigned long i;
+    uint8_t j;
+
+    ring_buf128_clear(&s_old_ring);
+    for (i = 0; i < BENCH_BYTES; i += BENCH_CHUNK) {
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            chunk[j] = (uint8_t)(i + j);
+        }
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            ring_buf128_put(&s_old_ring, chunk[j]);
+        }
+        ring_buf128_take(&s_old_ring, chunk, BENCH_CHUNK);
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            check += chunk[j];
+        }
+    }
+    return check;
+}
+
+static uint32_t bench_new_single(void) {
+    uint32_t check = 0;
+    unsigned long i;
+    uint8_t j;
+
+    bench_ring_init(&s_new_ring);
+    for (i = 0; i < BENCH_BYTES; i += BENCH_CHUNK) {
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            bench_ring_put(&s_new_ring, (uint8_t)(i + j));
+        }
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            check += bench_ring_get(&s_new_ring);
+        }
+    }
+    return check;
+}
+
+/// Like an ISR producer and a main loop consumer, check for room and for
+/// data before each element
+static uint32_t bench_new_checked(void) {
+    uint32_t check = 0;
+    unsigned long i;
+    uint8_t j;
+
+    bench_ring_init(&s_new_ring);
+    for (i = 0; i < BENCH_BYTES; i += BENCH_CHUNK) {
+        for (j = 0; j < BENCH_CHUNK && bench_ring_free_space(&s_new_ring) != 0; ++j) {
+            bench_ring_put(&s_new_ring, (uint8_t)(i + j));
+        }
+        while (bench_ring_has_data(&s_new_ring)) {
+            check += bench_ring_get(&s_new_ring);
+        }
+    }
+    return check;
+}
+
+static uint32_t bench_new_bulk(void) {
+    uint8_t chunk[BENCH_CHUNK];
+    uint32_t check = 0;
+    unsigned long i;
+    uint8_t j;
+
+    bench_ring_init(&s_new_ring);
+    for (i = 0; i < BENCH_BYTES; i += BENCH_CHUNK) {
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            chunk[j] = (uint8_t)(i + j);
+        }
+        bench_ring_put_n(&s_new_ring, chunk, BENCH_CHUNK);
+        bench_ring_get_n(&s_new_ring, chunk, BENCH_CHUNK);
+        for (j = 0; j < BENCH_CHUNK; ++j) {
+            check += chunk[j];
+        }
+    }
+    return check;
+}
+
+/// Writes records of `len, seq, seq+1, ...` like the RF receive buffer, each
+/// published with a single commit.
+static void *stress_producer(void *arg) {
+    uint8_t record[STRESS_MAX_RECORD_LEN];
+    uint8_t seq = 0;
+    unsigned long n;
+    (void)arg;
+
+    for (n = 0; n < STRESS_RECORDS; ++n) {
+        const uint8_t len = 1 + n % (STRESS_MAX_RECORD_LEN-1);
+        uint8_t i;
+
+        record[0] = len;
+        for (i = 1; i < len; ++i) {
+            record[i] = seq++;
+        }
+
+        while (bench_ring_free_space(&s_stress_ring) < len) {
+            sched_yield();
+        }
+
+        bench_ring_write_n(&s_stress_ring, 0, record, 1);
+        bench_ring_write_n(&s_stress_ring, 1, record+1, len-1);
+        bench_ring_commit(&s_stress_ring, len);
+    }
+
+    return NULL;
+}
+
+static unsigned long stress_test(void) {
+    pthread_t producer;
+    uint8_t record[STRESS_MAX_RECORD_LEN];
+    uint8_t seq = 0;
+    unsigned long errors = 0;
+    unsigned long n;
+
+    bench_ring_init(&s_stress_ring);
+    pthread_create(&producer, NULL, stress_producer, NULL);
+
+    for (n = 0; n < STRESS_RECORDS; ++n) {
+        uint8_t len;
+        uint8_t i;
+
+        while (!bench_ring_has_data(&s_stress_ring)) {
+            sched_yield();
+        }
+
+        // The whole record must be visible once its first byte is
+        len = bench_ring_get(&s_stress_ring);
+        if (len == 0 || len > STRESS_MAX_RECORD_LEN ||
+            (uint8_t)(len-1) > bench_ring_len(&s_stress_ring)) {
+            errors++;
+            break;
+        }
+
+        bench_ring_get_n(&s_stress_ring, record, len-1);
+        for (i = 0; i < len-1; ++i) {
+            if (record[i] != seq++) {
+                errors++;
+            }
+        }
+    }
+
+    pthread_join(producer, NULL);
+    return errors;
+}
+
+int main(void) {
+    unsigned long errors;
+
+    printf("%lu bytes in chunks of %d, best of %d runs\n",
+           BENCH_BYTES, BENCH_CHUNK, BENCH_RUNS);
+    run_bench("ring_buf128 put/get", bench_old_single);
+    run_bench("ring_buf128 take", bench_old_bulk);
+    run_bench("spsc ring put/get", bench_new_single);
+    run_bench("spsc ring checked put/get", bench_new_checked);
+    run_bench("spsc ring put_n/get_n", bench_new_bulk);
+
+    errors = stress_test();
+    printf("stress test: %lu records, %lu errors\n", STRESS_RECORDS, errors);
+
+    return errors != 0;
+}
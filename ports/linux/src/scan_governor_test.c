@@ -0,0 +1,338 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file scan_governor_test.c
+///
+/// Replays traces of key presses through `core/scan_governor.c`, and checks
+/// the scan tier it picks and how often it scans the matrix. Run it with
+/// `make scan-governor-test`.
+///
+/// The matrix scanner is replaced by a model of `core/matrix_scanner.c`: a
+/// scan reads the keys held down in the trace, a change debounces for
+/// `MODEL_DEBOUNCE_MS`, and once no keys are down or debouncing the model
+/// goes idle until a key is pressed. The clock advances 1 ms per call to
+/// `scan_governor_task()`, like the xmega battery mode loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/flash.h"
+#include "core/matrix_scanner.h"
+#include "core/scan_governor.h"
+#include "core/settings.h"
+
+#define MODEL_DEBOUNCE_MS 5
+#define MAX_TRACE_TIME 2500
+
+/*********************************************************************
+ *                 model of the matrix scanner and timer             *
+ *********************************************************************/
+
+static uint16_t s_now;
+/// Keys held down in the trace
+static uint8_t s_keys_down;
+/// Keys down at the last scan
+static uint8_t s_matrix_keys;
+static uint16_t s_debounce_end;
+static bool s_is_idle;
+static int s_scans;
+
+uint16_t timer_read16_ms(void) {
+    return s_now;
+}
+
+static bool model_is_debouncing(void) {
+    return (int16_t)(s_now - s_debounce_end) < 0;
+}
+
+bool matrix_scan_task(void) {
+    bool changed = false;
+
+    if (s_is_idle) {
+        // Only a key press raises the column interrupt
+        if (s_keys_down == 0) {
+            return false;
+        }
+        s_is_idle = false;
+    }
+
+    s_scans++;
+    if (s_keys_down != s_matrix_keys && !model_is_debouncing()) {
+        s_matrix_keys = s_keys_down;
+        s_debounce_end = s_now + MODEL_DEBOUNCE_MS;
+        changed = true;
+    }
+
+    if (s_matrix_keys == 0 && !model_is_debouncing()) {
+        s_is_idle = true;
+    }
+
+    return changed;
+}
+
+bit_t matrix_scan_is_idle(void) {
+    return s_is_idle;
+}
+
+uint8_t get_matrix_num_keys_debouncing(void) {
+    return model_is_debouncing() ? s_matrix_keys + 1 : 0;
+}
+
+/*********************************************************************
+ *                               traces                              *
+ *********************************************************************/
+
+typedef enum trace_event_type_t {
+    /// `value` is the number of keys held down from `time` on
+    TRACE_KEYS,
+    /// `value` is the battery level passed to the governor at `time`
+    TRACE_BATTERY,
+    /// The governor must be in tier `value` from `time` until `end`
+    TRACE_EXPECT_TIER,
+    /// The matrix must be scanned `value` times from `time` until `end`
+    TRACE_EXPECT_SCANS,
+} trace_event_type_t;
+
+typedef struct trace_event_t {
+    uint8_t type;
+    uint16_t time;
+    uint16_t end;
+    uint16_t value;
+} trace_event_t;
+
+typedef struct trace_t {
+    const char *name;
+    /// Governor settings written to flash, or NULL for the defaults
+    const scan_governor_settings_t *settings;
+    uint16_t length;
+    const trace_event_t *events;
+    int num_events;
+} trace_t;
+
+#define KEYS(t, n) { TRACE_KEYS, (t), 0, (n) }
+#define BATTERY(t, level) { TRACE_BATTERY, (t), 0, (level) }
+#define TIER(t, end, tier) { TRACE_EXPECT_TIER, (t), (end), (tier) }
+#define SCANS(t, end, n) { TRACE_EXPECT_SCANS, (t), (end), (n) }
+
+/// Hold a key, release it, then do the same on a low battery, and type on
+/// top of a held key. Uses the default settings: 1 ms fast interval, 10 ms
+/// slow interval and 250 ms fast timeout, shortened to 62 ms and a 2 ms
+/// interval below 20% battery.
+static const trace_event_t s_default_events[] = {
+    // goes idle right away with nothing pressed
+    TIER(5, 100, SCAN_TIER_IDLE),
+    SCANS(10, 100, 0),
+
+    // the press is scanned as soon as it happens, then the held key drops
+    // to the slow tier 250 ms after it has debounced
+    KEYS(100, 1),
+    TIER(100, 350, SCAN_TIER_FAST),
+    SCANS(200, 300, 100),
+    TIER(360, 600, SCAN_TIER_SLOW),
+    SCANS(400, 500, 10),
+
+    // the release is seen within one slow interval
+    KEYS(600, 0),
+    TIER(610, 1000, SCAN_TIER_IDLE),
+    SCANS(700, 800, 0),
+
+    // low battery: half the scan rate and a quarter of the fast timeout
+    BATTERY(900, 10),
+    KEYS(1000, 1),
+    TIER(1000, 1060, SCAN_TIER_FAST),
+    SCANS(1010, 1050, 20),
+    TIER(1070, 1200, SCAN_TIER_SLOW),
+    KEYS(1200, 0),
+    TIER(1220, 1400, SCAN_TIER_IDLE),
+    BATTERY(1300, 100),
+
+    // typing over a held modifier keeps the fast tier until the last tap
+    KEYS(1400, 1),
+    KEYS(1500, 2),
+    KEYS(1550, 1),
+    KEYS(1650, 2),
+    KEYS(1700, 1),
+    KEYS(1800, 2),
+    KEYS(1850, 1),
+    TIER(1400, 2100, SCAN_TIER_FAST),
+    TIER(2110, 2300, SCAN_TIER_SLOW),
+    KEYS(2300, 0),
+    TIER(2320, 2400, SCAN_TIER_IDLE),
+};
+
+static const scan_governor_settings_t s_custom_settings = {
+    .fast_interval = 2,
+    .slow_interval = 20,
+    .fast_timeout = 100,
+    .low_battery_level = 50,
+};
+
+/// The thresholds stored in the settings are used in place of the defaults
+static const trace_event_t s_custom_events[] = {
+    KEYS(100, 1),
+    TIER(100, 200, SCAN_TIER_FAST),
+    SCANS(120, 180, 30),
+    TIER(210, 400, SCAN_TIER_SLOW),
+    SCANS(300, 400, 5),
+    KEYS(400, 0),
+    TIER(430, 500, SCAN_TIER_IDLE),
+
+    // 40% is a low battery with these settings
+    BATTERY(500, 40),
+    KEYS(600, 1),
+    TIER(600, 625, SCAN_TIER_FAST),
+    SCANS(610, 630, 5),
+    TIER(640, 700, SCAN_TIER_SLOW),
+};
+
+#define ARRAY_LEN(x) ((int)(sizeof(x)/sizeof((x)[0])))
+
+static const trace_t s_traces[] = {
+    {
+        "default settings", NULL, 2400,
+        s_default_events, ARRAY_LEN(s_default_events)
+    },
+    {
+        "custom settings", &s_custom_settings, 700,
+        s_custom_events, ARRAY_LEN(s_custom_events)
+    },
+};
+
+/*********************************************************************
+ *                                test                               *
+ *********************************************************************/
+
+static const char *s_tier_names[SCAN_TIER_COUNT] = { "fast", "slow", "idle" };
+
+static uint8_t s_tier_at[MAX_TRACE_TIME];
+static uint8_t s_scanned_at[MAX_TRACE_TIME];
+static int s_failures;
+
+static void check(bool ok, const char *test_name, const char *what) {
+    if (!ok) {
+        printf("FAIL %s: %s\n", test_name, what);
+        s_failures++;
+    }
+}
+
+static void load_settings(const scan_governor_settings_t *settings) {
+    uint8_t *dest = &g_virtual_storage[GET_SETTING_ADDR(scan_governor)];
+
+    if (settings) {
+        memcpy(dest, settings, sizeof(scan_governor_settings_t));
+    } else {
+        memset(dest, 0xff, sizeof(scan_governor_settings_t));
+    }
+}
+
+/// Step the clock through the trace 1 ms at a time, and record the tier and
+/// whether the matrix was scanned after each call of the governor
+static void replay_trace(const trace_t *trace) {
+    uint16_t tier_changes = 0;
+    uint8_t last_tier = SCAN_TIER_FAST;
+    int i;
+
+    s_now = 0;
+    s_keys_down = 0;
+    s_matrix_keys = 0;
+    s_debounce_end = 0;
+    s_is_idle = false;
+
+    load_settings(trace->settings);
+    scan_governor_init();
+
+    for (s_now = 0; s_now < trace->length; ++s_now) {
+        const int scans = s_scans;
+
+        for (i = 0; i < trace->num_events; ++i) {
+            const trace_event_t *event = &trace->events[i];
+            if (event->time != s_now) {
+                continue;
+            }
+            if (event->type == TRACE_KEYS) {
+                s_keys_down = event->value;
+            } else if (event->type == TRACE_BATTERY) {
+                scan_governor_set_battery_level(event->value);
+            }
+        }
+
+        scan_governor_task();
+
+        s_tier_at[s_now] = scan_governor_get_tier();
+        s_scanned_at[s_now] = s_scans != scans;
+        if (s_tier_at[s_now] != last_tier) {
+            last_tier = s_tier_at[s_now];
+            tier_changes++;
+        }
+    }
+
+    check(
+        g_scan_governor_stats.tier_changes == tier_changes,
+        trace->name, "the tier change count doesn't match the trace"
+    );
+}
+
+static void check_trace(const trace_t *trace) {
+    uint32_t total_time = 0;
+    char what[128];
+    int i;
+
+    replay_trace(trace);
+
+    for (i = 0; i < trace->num_events; ++i) {
+        const trace_event_t *event = &trace->events[i];
+        int scans = 0;
+        int t;
+
+        if (event->type == TRACE_EXPECT_TIER) {
+            for (t = event->time; t < event->end; ++t) {
+                if (s_tier_at[t] != event->value) {
+                    snprintf(what, sizeof(what),
+                             "at %d ms: tier is %s, expected %s",
+                             t, s_tier_names[s_tier_at[t]],
+                             s_tier_names[event->value]);
+                    check(false, trace->name, what);
+                    break;
+                }
+            }
+        } else if (event->type == TRACE_EXPECT_SCANS) {
+            for (t = event->time; t < event->end; ++t) {
+                scans += s_scanned_at[t];
+            }
+            snprintf(what, sizeof(what),
+                     "%d-%d ms: %d scans, expected %d",
+                     event->time, event->end, scans, event->value);
+            check(scans == event->value, trace->name, what);
+        }
+    }
+
+    for (i = 0; i < SCAN_TIER_COUNT; ++i) {
+        total_time += g_scan_governor_stats.tier_time[i];
+    }
+    check(
+        total_time == (uint32_t)(trace->length - 1),
+        trace->name, "the tier times don't add up to the trace length"
+    );
+
+    printf("%-16s %4u ms fast, %4u ms slow, %4u ms idle, %u tier changes\n",
+           trace->name,
+           g_scan_governor_stats.tier_time[SCAN_TIER_FAST],
+           g_scan_governor_stats.tier_time[SCAN_TIER_SLOW],
+           g_scan_governor_stats.tier_time[SCAN_TIER_IDLE],
+           g_scan_governor_stats.tier_changes);
+}
+
+int main(void) {
+    int i;
+
+    for (i = 0; i < ARRAY_LEN(s_traces); ++i) {
+        check_trace(&s_traces[i]);
+    }
+
+    if (s_failures) {
+        printf("%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
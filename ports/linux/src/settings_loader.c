@@ -8,20 +8,26 @@
 
 #include "debug.h"
 
+#include "core/layout.h"
+
 void load_virtual_device_settings(void) {
     flash_addr_t pos;
-    uint32_t size;
+    flash_addr_t end;
 
     mapper_reset();
     device_manager_targets_reset();
 
-    pos = LAYOUT_ADDR;
-    flash_read((uint8_t*)&size, pos, sizeof(uint32_t));
-    pos += sizeof(uint32_t);
+    if (!layout_has_valid_index()) {
+        KP_LOG_ERROR("configuration file has an invalid layout index");
+        return;
+    }
+
+    pos = layout_get_section_addr(LAYOUT_SECTION_PIN_MAP);
+    end = pos + layout_get_section_size(LAYOUT_SECTION_PIN_MAP);
 
-    KP_ASSERT(is_valid_storage_pos(pos + size));
+    KP_ASSERT(is_valid_storage_pos(end - 1));
 
-    while (pos < size) {
+    while (pos + sizeof(virtual_device_header_t) + KEY_MAP_SIZE <= end) {
         struct virtual_device_header_t dev;
         flash_read((uint8_t*)&dev, pos, sizeof(dev));
         device_manager_targets_add(&dev);
@@ -31,4 +37,3 @@ void load_virtual_device_settings(void) {
         pos += KEY_MAP_SIZE;
     }
 }
-
@@ -14,6 +14,7 @@
 #include "core/unifying.h"
 
 #include "core/aes.h"
+#include "core/combo.h"
 #include "core/error.h"
 #include "core/hardware.h"
 #include "core/led.h"
@@ -124,6 +125,7 @@ void main(void) {
 
                 // handle special key tasks
                 sticky_key_task();
+                combo_task();
                 hold_key_task(false);
             }
             irq_on();
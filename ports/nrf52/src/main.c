@@ -10,12 +10,14 @@
 #include "nrf_log_default_backends.h"
 
 #include "core/aes.h"
+#include "core/combo.h"
 #include "core/error.h"
 #include "core/flash.h"
 #include "core/led.h"
 #include "core/macro.h"
 #include "core/nonce.h"
 #include "core/rf.h"
+#include "core/scheduler.h"
 #include "core/settings.h"
 #include "core/timer.h"
 #include "core/nrf52_esb.h"
@@ -113,6 +115,51 @@ NO_RETURN_ATTR void recovery_mode_main_loop(void) {
     }
 }
 
+bit_t scheduler_port_task(void) {
+    static uint32_t last_time = 0;
+    bit_t has_data = false;
+
+    // Log current time (for debugging)
+    {
+        uint32_t new_time = timer_read_ms();
+        if ((uint32_t)(new_time - last_time) >= 1000) {
+            NRF_LOG_INFO("time: %d", timer_read_ms());
+            last_time = new_time;
+        }
+    }
+
+#if USE_NRF24
+    if (g_rf_enabled) {
+        #if USE_UNIFYING
+            if (unifying_is_pairing_active()) {
+                unifying_pairing_poll();
+            } else {
+                has_data = rf_task();
+            }
+            handle_mouse_events();
+        #else
+            has_data = rf_task();
+        #endif
+    }
+#endif
+
+    UNUSED_RETURN_VALUE(NRF_LOG_PROCESS());
+
+    return has_data;
+}
+
+void wait_for_event(uint16_t deadline, bit_t has_deadline) {
+    // The RTC ticks every 1ms, which is soon enough for any deadline.
+    UNREFERENCED_ARGUMENT(deadline);
+    UNREFERENCED_ARGUMENT(has_deadline);
+
+    // Even if we miss an event enabling USB, USB event would wake us up.
+    __WFE();
+    // Clear SEV flag if CPU was woken up by event
+    __SEV();
+    __WFE();
+}
+
 int ble_test_main(uint8_t x);
 
 int main(void) {
@@ -167,76 +214,13 @@ int main(void) {
 
     NRF_LOG_INFO("Starting main() loop");
 
-    uint32_t last_time = 0;
+    scheduler_init();
 
     while (true) {
         if (has_critical_error()) {
             recovery_mode_main_loop();
         }
 
-        // Log current time (for debugging)
-        {
-            uint32_t new_time = timer_read_ms();
-            if ((uint32_t)(new_time - last_time) >= 1000) {
-                NRF_LOG_INFO("time: %d", timer_read_ms());
-                last_time = new_time;
-            }
-        }
-
-        // Matrix scanning
-        {
-            bool scan_changed = false;
-
-            scan_changed |= matrix_scan();
-            if (scan_changed) {
-                uint8_t matrix_data[32];
-                const uint8_t use_deltas = true;
-                const uint8_t data_size = get_matrix_data(matrix_data, use_deltas);
-
-                keyboard_update_device_matrix(GET_SETTING(device_id), matrix_data);
-            }
-
-            interpret_all_keyboard_matrices();
-
-        }
-
-#if USE_NRF24
-        if (g_rf_enabled) {
-            #if USE_UNIFYING
-                if (unifying_is_pairing_active()) {
-                    unifying_pairing_poll();
-                } else {
-                    rf_task();
-                }
-                handle_mouse_events();
-            #else
-                rf_task();
-            #endif
-        }
-#endif
-
-        macro_task();
-        mouse_key_task();
-
-        if (is_usb_configured()) {
-            send_keyboard_report();
-            send_media_report();
-            send_mouse_report();
-            send_vendor_report();
-        }
-
-        // TODO: testing needed
-        handle_vendor_out_reports();
-
-        sticky_key_task();
-        hold_key_task(false);
-
-        UNUSED_RETURN_VALUE(NRF_LOG_PROCESS());
-
-        // Even if we miss an event enabling USB, USB event would wake us up.
-        __WFE();
-        // Clear SEV flag if CPU was woken up by event
-        __SEV();
-        __WFE();
+        scheduler_run();
     }
 }
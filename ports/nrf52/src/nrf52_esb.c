@@ -59,6 +59,7 @@
 
 #include "core/rf.h"
 #include "core/led.h"
+#include "core/timer.h"
 
 #include "esb_timeslot.h"
 
@@ -83,41 +84,36 @@ static bool esb_data_flag;
     #include "core/packet.h"
     #include "core/settings.h"
     #include "core/aes.h"
-    #define PACKET_BUFFER_MAX_LEN 22
     #define MAX_ESB_PIPE 5
-
-    typedef struct packet_id_t {
-        uint8_t sync_state;
-        uint32_t check_id;
-    } packet_id_t;
-
-    extern XRAM packet_id_t device_uid_list[MAX_NUM_DEVICES];
 #endif
 
 void nrf52_esb_packet_buffer_add(nrf_esb_payload_t *packet) {
+    rf_rx_packet_t *slot;
+
     if (packet->pipe > MAX_ESB_PIPE) {
         // no data in rx fifo
         return;
     }
 
-    if (packet_buffer_free_space() < packet->length+2) {
-        // no space left in buffer
-        // nrf_esb_flush_rx();
-        // drop packet
+    if (packet->length > RF_RX_PAYLOAD_MAX_LEN) {
+        // drop packets that are too large
+        g_rf_rx_stats.dropped++;
         return;
     }
 
-    if (packet->length > PACKET_BUFFER_MAX_LEN) {
-        // drop packets that are too large
+    slot = rf_rx_queue_reserve();
+    if (slot == NULL) {
+        // no free slot left
+        // nrf_esb_flush_rx();
+        // drop packet
         return;
     }
 
-    packet_buffer_add_byte(packet->pipe);
-    packet_buffer_add_byte(packet->length);
-
-    for (int i = 0; i < packet->length; ++i) {
-        packet_buffer_add_byte(packet->data[i]);
-    }
+    slot->pipe_num = packet->pipe;
+    slot->width = packet->length;
+    slot->timestamp = timer_read16_ms();
+    memcpy(slot->payload, packet->data, packet->length);
+    rf_rx_queue_commit();
 }
 
 void rf_esb_write_ack_payload(nrf_esb_payload_t *tx_payload) {
@@ -142,18 +138,11 @@ void rf_esb_write_ack_payload(nrf_esb_payload_t *tx_payload) {
 }
 
 void rf_nrf52_load_sync_ack_payload(uint8_t device_id) {
-    packet_t *packet = (packet_t*)tx_payload.data;
-
-    // construct the packet
-    set_packet_type(packet, PACKET_TYPE_SESSION_UPDATE);
-    packet->sync.nonce = device_uid_list[device_id].check_id;
-    memset(packet->sync.salt, 0, PACKET_SYNC_SALT_LENGTH);
-    // encrypt and load into ack payload fifo
+    // construct the encrypted packet and load into ack payload fifo
+    rf_make_sync_ack_payload(tx_payload.data, device_id);
 
     tx_payload.pipe = device_id_to_pipe_num(device_id);
-    tx_payload.length = 16;
-
-    aes_encrypt(tx_payload.data); // PACKET_SIZE is one block
+    tx_payload.length = PACKET_SIZE;
 
     rf_esb_write_ack_payload(&tx_payload);
 }
@@ -8,8 +8,7 @@
 
 // NOTE: only nRF52840 has arm cryptocell 310 hardware. However, other devices
 // in the nRF52 family have AES encryption peripheral but offers no decryption.
-// It might be better to switch to using that peripheral and provide a software
-// implementation of AES decryption.
+// Those devices can build with `AES_BACKEND = ttable` instead of this file.
 
 static uint8_t s_ekey_ptr[AES_KEY_SIZE];
 
@@ -24,6 +24,7 @@ static io_port_t *s_row_ports[MAX_NUM_ROWS];
 
 static bool s_col_read_invert;
 static bool s_row_drive;
+static volatile bool s_has_scan_irq_triggered;
 
 static inline void unselect_all_rows(void);
 static inline void select_all_rows(void);
@@ -346,11 +347,13 @@ void GPIOTE_IRQHandler(void) {
     if(nrf_gpiote_event_is_set(NRF_GPIOTE_EVENTS_PORT)){
         nrf_gpiote_event_clear(NRF_GPIOTE_EVENTS_PORT);
         NRF_LOG_INFO("PORT IRQ CALLED");
+        s_has_scan_irq_triggered = true;
     }
 }
 
 void matrix_scan_irq_enable(void) {
     nrf_gpiote_int_disable(NRF_GPIOTE_INT_PORT_MASK);
+    matrix_scan_irq_clear();
     {
         NVIC_ClearPendingIRQ(GPIOTE_IRQn);
         NVIC_SetPriority(GPIOTE_IRQn, GPIOTE_IRQPriority);
@@ -369,9 +372,9 @@ void matrix_scan_irq_disable(void) {
 }
 
 bool matrix_scan_irq_has_triggered(void) {
-    return false;
+    return s_has_scan_irq_triggered || matrix_has_active_row();
 }
 
 void matrix_scan_irq_clear(void) {
-
+    s_has_scan_irq_triggered = false;
 }
@@ -7,10 +7,13 @@
 
 #include "nrf_drv_usbd.h"
 
+#include "nrf52_usb.h"
 
-/// Checks if a USB IN endpoint is ready to take more data
+
+/// Checks if a USB IN endpoint is ready to take more data. Reports stay
+/// queued until the host has configured the device.
 bit_t is_in_endpoint_ready(uint8_t endpoint_num) {
-    return !nrf_drv_usbd_ep_is_busy(USB_DIR_IN | endpoint_num);
+    return is_usb_configured() && !nrf_drv_usbd_ep_is_busy(USB_DIR_IN | endpoint_num);
 }
 
 /// Checks if a USB OUT endpoint has data
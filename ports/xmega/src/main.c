@@ -14,12 +14,13 @@
 #include "core/io_map.h"
 #include "core/layout.h"
 #include "core/led.h"
-#include "core/macro.h"
 #include "core/matrix_interpret.h"
 #include "core/matrix_scanner.h"
 #include "core/nrf24.h"
 #include "core/packet.h"
 #include "core/rf.h"
+#include "core/scan_governor.h"
+#include "core/scheduler.h"
 #include "core/settings.h"
 #include "core/timer.h"
 #include "core/usb_commands.h"
@@ -30,9 +31,6 @@
 #include "hid_reports/mouse_report.h"
 #include "hid_reports/vendor_report.h"
 
-#include "key_handlers/key_hold.h"
-#include "key_handlers/key_mouse.h"
-
 #include "xmega/usb_xmega.h"
 
 #include "power.h"
@@ -84,6 +82,7 @@ void battery_mode_setup(void) {
 
     battery_mode_clock_init();
     xmega_common_init();
+    scan_governor_init();
     rf_init_send();
 
     // enable interrupt levels
@@ -91,14 +90,9 @@ void battery_mode_setup(void) {
     sei();
 }
 
-#define MAX_RETRY_COUNT 10
-#define ADAPTIVE_SCAN 1
-
 void battery_mode_main_loop(void) {
     uint16_t idle_time_start = 0;
-    uint8_t err_count = 0;
 
-    bool matrix_needs_scanning = true;
     bool scan_changed = false;
     bool deep_sleep_resync_packet = false;
 
@@ -112,41 +106,14 @@ void battery_mode_main_loop(void) {
     }
 
     while (1) {
-#if ADAPTIVE_SCAN
-        scan_changed = false;
-        if (matrix_needs_scanning) {
-#else
-        {
-#endif
-            // TODO: Add an optimization to skip matrix scanning all together if
-            // no keys are down. If no keys are down or debouncing, then we can set
-            // the matrix in interrupt mode. Then as long as no matrix interrupts
-            // are generated, we don't need to scan th matrix.
-            scan_changed = matrix_scan();
-        }
+        // Scans at a rate picked from the recent key activity, and only
+        // waits for a matrix interrupt when no keys are down.
+        scan_changed = scan_governor_task();
 
         uint8_t nrf_status = nrf24_read_status();
 
-        // TODO: add queue of messages.
-        // try process messages based on order in queue.
-        // drop messages if queued for too long
         if (nrf_status & (STATUS_MAX_RT_bm)) {
-            // TODO: Probably want to do this differently.
-            // Instead, when we write an RF packet, we should check if the TX
-            // buffer is full, then, if it is we should queue the packet for
-            // a time when it is not full.
-            //
-            // Then if we have lots of failed attempts, we should clear
-            // messages from the queue.
-            err_count++;
-
-            if (err_count > MAX_RETRY_COUNT) {
-                nrf24_flush_tx();
-                err_count = 0;
-            } else {
-                nrf24_send_one();
-            }
-            nrf24_write_reg(NRF_STATUS, STATUS_MAX_RT_bm);
+            rf_tx_handle_max_rt();
         }
 
         if (scan_changed) {
@@ -158,15 +125,14 @@ void battery_mode_main_loop(void) {
             rf_handle_ack_payloads();
         }
 
+        // Load the next matrix state once the last packet is done
+        rf_tx_task();
+
         // TODO: We can combine getting the FIFO_STATUS and STATUS register
         // into one SPI transaction.
         uint8_t fifo_status = nrf24_read_reg(FIFO_STATUS);
 
-        if (fifo_status & FIFO_TX_EMPTY_bm) {
-            // empty
-            err_count = 0;
-        } else {
-            // not empty
+        if (!(fifo_status & FIFO_TX_EMPTY_bm)) {
             nrf24_send_one();
         }
 
@@ -174,38 +140,17 @@ void battery_mode_main_loop(void) {
             (uint16_t)(timer_read16_ms() - idle_time_start) > DEEP_SLEEP_TIME &&
             get_matrix_num_keys_debouncing() == 0 &&
             !scan_changed &&
-            (fifo_status & FIFO_TX_EMPTY_bm)
+            (fifo_status & FIFO_TX_EMPTY_bm) &&
+            rf_tx_queue_depth() == 0
             ) {
             deep_sleep();
+            matrix_scan_wakeup();
             idle_time_start = timer_read16_ms();
-            matrix_needs_scanning = true;
             deep_sleep_resync_packet = true;
         } else {
-
-#if ADAPTIVE_SCAN
-            uint8_t num_keys = get_matrix_num_keys_down();
-
-            if (num_keys == 0 && get_matrix_num_keys_debouncing() == 0) {
-                matrix_scan_irq_enable();
-
-                // this wakes up everytime the timer ticks, or when a key is
-                // pressed
-                enter_sleep_mode(SLEEP_MODE_PWR_SAVE);
-
-                if (matrix_has_active_row()) {
-                    matrix_needs_scanning = true;
-                    matrix_scan_irq_disable();
-                } else {
-                    matrix_needs_scanning = false;
-                }
-            } else {
-                // this wakes up everytime the timer ticks
-                enter_sleep_mode(SLEEP_MODE_PWR_SAVE);
-                matrix_needs_scanning = true;
-            }
-#else
-        enter_sleep_mode(SLEEP_MODE_PWR_SAVE);
-#endif
+            // This wakes up everytime the timer ticks, or when a key is
+            // pressed while the scanner is idle.
+            enter_sleep_mode(SLEEP_MODE_PWR_SAVE);
 
             // NOTE: This sends an additional packet after wakeup from deep
             // sleep. This is done because in the nRF ESB protocl we can only
@@ -297,104 +242,51 @@ void usb_mode_setup(void) {
 NO_RETURN_ATTR void recovery_mode_main_loop(void);
 extern port_mask_t s_available_pins[IO_PORT_COUNT];
 
-void usb_mode_main_loop(void) {
-    if (has_critical_error()) {
-        recovery_mode_main_loop();
-    }
-
-    while (1) {
-        bool scan_changed = false;
+bit_t scheduler_port_task(void) {
+    bit_t has_data = false;
 
-        scan_changed |= matrix_scan();
+    passthrough_keycodes_task();
 
-        // TODO: need to clean this up
-        if (scan_changed) {
-            uint8_t i2c_packet[32];
-            uint8_t *matrix_data = i2c_packet+1;
-            const uint8_t use_deltas = true;
-
-#if USE_I2C
-            i2c_packet[0] = (i2c_get_active_address() << 1) | 0x01;
+#if USE_NRF24
+    if (g_rf_enabled) {
+        if (unifying_is_pairing_active()) {
+            unifying_pairing_poll();
+        } else {
+            has_data = rf_task();
+        }
+        handle_mouse_events();
+    }
 #endif
 
-            const uint8_t data_size = get_matrix_data(matrix_data, use_deltas);
-
-#if USE_I2C
-            if (!g_runtime_settings.feature.ctrl.wired_disabled) {
-                i2c_packet[data_size+1] = i2c_calculate_checksum(i2c_packet, data_size+1);
-
-
-                // TODO: IMPORTANT! really need to fix this
-                // TODO: don't block here, add buffer for queued messages
-                // while (!i2c_broadcast(i2c_packet, data_size+2));
+    return has_data;
+}
 
-                // TODO: I2C is broken
-                // i2c_broadcast(i2c_packet, data_size+2);
-            }
+void wait_for_event(uint16_t deadline, bit_t has_deadline) {
+    UNREFERENCED_ARGUMENT(deadline);
+    UNREFERENCED_ARGUMENT(has_deadline);
+#if USE_NRF24 && RF_POLLING
+    // Don't have RF IRQ, so don't sleep to reduce chance that packets are
+    // dropped
+#else
+    // okay to sleep if we have RF IRQ. The USB start of frame interrupt wakes
+    // us every 1ms, which is soon enough for any deadline.
+    enter_sleep_mode(SLEEP_MODE_IDLE);
 #endif
+}
 
-            keyboard_update_device_matrix(GET_SETTING(device_id), matrix_data);
-
-        }
-
-        passthrough_keycodes_task();
-
-        //
-
-// #if USE_I2C
-        // // check for i2c data
-        // {
-        //     uint8_t *i2c_packet = i2c_get_buffer();
-        //     while (i2c_packet) {
-        //         const uint8_t sender_i2c_address = i2c_packet[0] >> 1;
-        //         const uint8_t sender_device_id = i2c_address_to_device_id(sender_i2c_address);
-        //         keyboard_update_device_matrix(sender_device_id, i2c_packet+1);
+void usb_mode_main_loop(void) {
+    if (has_critical_error()) {
+        recovery_mode_main_loop();
+    }
 
-        //         i2c_buffer_advance();
-        //         i2c_packet = i2c_get_buffer();
-        //     }
-        // }
-// #endif
+    scheduler_init();
 
-        interpret_all_keyboard_matrices();
+    while (1) {
+        scheduler_run();
 
-#if USE_NRF24
-        if (g_rf_enabled) {
-            // TODO: might want to implement a scheduling system for tasks
-            if (unifying_is_pairing_active()) {
-                unifying_pairing_poll();
-            } else {
-                rf_task();
-            }
-            handle_mouse_events();
+        if (has_critical_error()) {
+            recovery_mode_main_loop();
         }
-#endif
-        macro_task();
-        mouse_key_task();
-
-        send_keyboard_report();
-        send_media_report();
-        send_mouse_report();
-        send_vendor_report();
-
-        // usb out reports
-        handle_vendor_out_reports();
-
-        sticky_key_task();
-        hold_key_task(false);
-
-        // led_task();
-
-#if USE_NRF24 && RF_POLLING
-        // Don't have RF IRQ, so don't sleep to reduce chance that packets are
-        // dropped
-        // debug_toggle(0);
-#else
-        // okay to sleep if we have RF IRQ
-        // debug_set(0, 1);
-        enter_sleep_mode(SLEEP_MODE_IDLE);
-        // debug_set(0, 0);
-#endif
 
         wdt_kick();
     }
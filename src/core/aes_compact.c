@@ -0,0 +1,205 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/aes_compact.c
+///
+/// Byte oriented AES-128 backend for 8-bit targets without an AES engine,
+/// used with `AES_BACKEND = compact`.
+///
+/// Only the two S-boxes (512 bytes) are stored in flash. The round keys are
+/// computed on the fly: forwards from `ekey` when encrypting, and backwards
+/// from the final round key `dkey` when decrypting, so the expanded key
+/// schedule never needs to be held in RAM.
+
+#include "core/aes.h"
+
+#include "core/aes_tables.h"
+
+#define AES_BYTE_ENTRY(s) (s),
+
+/// Round constant of the final round, used to step the key schedule back
+#define AES_LAST_RCON 0x36
+
+static const ROM uint8_t s_sbox[256] = { AES_SBOX_LIST(AES_BYTE_ENTRY) };
+static const ROM uint8_t s_inv_sbox[256] = { AES_INV_SBOX_LIST(AES_BYTE_ENTRY) };
+
+static XRAM uint8_t s_ekey[AES_KEY_SIZE];
+static XRAM uint8_t s_dkey[AES_KEY_SIZE];
+static XRAM uint8_t s_round_key[AES_KEY_SIZE];
+
+static uint8_t xtime(uint8_t x) {
+    return AES_MUL2(x);
+}
+
+/// Inverse of `xtime()`, used to step the round constant back
+static uint8_t inv_xtime(uint8_t x) {
+    return (x & 0x01) ? ((x >> 1) ^ 0x8d) : (x >> 1);
+}
+
+static void add_round_key(uint8_t *block) {
+    uint8_t i;
+    for (i = 0; i < AES_BLOCK_SIZE; ++i) {
+        block[i] ^= s_round_key[i];
+    }
+}
+
+static void next_round_key(uint8_t rcon) {
+    uint8_t i;
+    s_round_key[0] ^= s_sbox[s_round_key[13]] ^ rcon;
+    s_round_key[1] ^= s_sbox[s_round_key[14]];
+    s_round_key[2] ^= s_sbox[s_round_key[15]];
+    s_round_key[3] ^= s_sbox[s_round_key[12]];
+    for (i = 4; i < AES_KEY_SIZE; ++i) {
+        s_round_key[i] ^= s_round_key[i-4];
+    }
+}
+
+static void prev_round_key(uint8_t rcon) {
+    uint8_t i;
+    for (i = AES_KEY_SIZE-1; i >= 4; --i) {
+        s_round_key[i] ^= s_round_key[i-4];
+    }
+    s_round_key[0] ^= s_sbox[s_round_key[13]] ^ rcon;
+    s_round_key[1] ^= s_sbox[s_round_key[14]];
+    s_round_key[2] ^= s_sbox[s_round_key[15]];
+    s_round_key[3] ^= s_sbox[s_round_key[12]];
+}
+
+/// SubBytes and ShiftRows, the block is stored column by column
+static void sub_bytes_shift_rows(uint8_t *block) {
+    uint8_t temp;
+    uint8_t i;
+
+    for (i = 0; i < AES_BLOCK_SIZE; i += 4) {
+        block[i] = s_sbox[block[i]];
+    }
+
+    // row 1: rotate left by 1
+    temp = block[1];
+    block[1] = s_sbox[block[5]];
+    block[5] = s_sbox[block[9]];
+    block[9] = s_sbox[block[13]];
+    block[13] = s_sbox[temp];
+
+    // row 2: rotate left by 2
+    temp = block[2];
+    block[2] = s_sbox[block[10]];
+    block[10] = s_sbox[temp];
+    temp = block[6];
+    block[6] = s_sbox[block[14]];
+    block[14] = s_sbox[temp];
+
+    // row 3: rotate left by 3
+    temp = block[15];
+    block[15] = s_sbox[block[11]];
+    block[11] = s_sbox[block[7]];
+    block[7] = s_sbox[block[3]];
+    block[3] = s_sbox[temp];
+}
+
+static void inv_sub_bytes_shift_rows(uint8_t *block) {
+    uint8_t temp;
+    uint8_t i;
+
+    for (i = 0; i < AES_BLOCK_SIZE; i += 4) {
+        block[i] = s_inv_sbox[block[i]];
+    }
+
+    // row 1: rotate right by 1
+    temp = block[13];
+    block[13] = s_inv_sbox[block[9]];
+    block[9] = s_inv_sbox[block[5]];
+    block[5] = s_inv_sbox[block[1]];
+    block[1] = s_inv_sbox[temp];
+
+    // row 2: rotate right by 2
+    temp = block[2];
+    block[2] = s_inv_sbox[block[10]];
+    block[10] = s_inv_sbox[temp];
+    temp = block[6];
+    block[6] = s_inv_sbox[block[14]];
+    block[14] = s_inv_sbox[temp];
+
+    // row 3: rotate right by 3
+    temp = block[3];
+    block[3] = s_inv_sbox[block[7]];
+    block[7] = s_inv_sbox[block[11]];
+    block[11] = s_inv_sbox[block[15]];
+    block[15] = s_inv_sbox[temp];
+}
+
+static void mix_columns(uint8_t *block) {
+    uint8_t i;
+    for (i = 0; i < AES_BLOCK_SIZE; i += 4) {
+        const uint8_t a0 = block[i+0];
+        const uint8_t all = a0 ^ block[i+1] ^ block[i+2] ^ block[i+3];
+        block[i+0] ^= all ^ xtime(block[i+0] ^ block[i+1]);
+        block[i+1] ^= all ^ xtime(block[i+1] ^ block[i+2]);
+        block[i+2] ^= all ^ xtime(block[i+2] ^ block[i+3]);
+        block[i+3] ^= all ^ xtime(block[i+3] ^ a0);
+    }
+}
+
+/// InvMixColumns is MixColumns after multiplying each column by
+/// `{04}x^2 + {05}`, which is cheaper than multiplying by `{0b,0d,09,0e}`.
+static void inv_mix_columns(uint8_t *block) {
+    uint8_t i;
+    for (i = 0; i < AES_BLOCK_SIZE; i += 4) {
+        const uint8_t u = xtime(xtime(block[i+0] ^ block[i+2]));
+        const uint8_t v = xtime(xtime(block[i+1] ^ block[i+3]));
+        block[i+0] ^= u;
+        block[i+1] ^= v;
+        block[i+2] ^= u;
+        block[i+3] ^= v;
+    }
+    mix_columns(block);
+}
+
+void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
+    uint8_t i;
+    for (i = 0; i < AES_KEY_SIZE; ++i) {
+        s_ekey[i] = ekey[i];
+        s_dkey[i] = dkey[i];
+    }
+}
+
+void aes_encrypt(uint8_t *block) {
+    uint8_t rcon = 0x01;
+    uint8_t round;
+    uint8_t i;
+
+    for (i = 0; i < AES_KEY_SIZE; ++i) {
+        s_round_key[i] = s_ekey[i];
+    }
+    add_round_key(block);
+
+    for (round = 1; round <= AES_NUM_ROUNDS; ++round) {
+        sub_bytes_shift_rows(block);
+        if (round != AES_NUM_ROUNDS) {
+            mix_columns(block);
+        }
+        next_round_key(rcon);
+        rcon = xtime(rcon);
+        add_round_key(block);
+    }
+}
+
+void aes_decrypt(uint8_t *block) {
+    uint8_t rcon = AES_LAST_RCON;
+    uint8_t round;
+    uint8_t i;
+
+    for (i = 0; i < AES_KEY_SIZE; ++i) {
+        s_round_key[i] = s_dkey[i];
+    }
+    add_round_key(block);
+
+    for (round = AES_NUM_ROUNDS; round >= 1; --round) {
+        inv_sub_bytes_shift_rows(block);
+        prev_round_key(rcon);
+        rcon = inv_xtime(rcon);
+        add_round_key(block);
+        if (round != 1) {
+            inv_mix_columns(block);
+        }
+    }
+}
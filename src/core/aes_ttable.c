@@ -0,0 +1,193 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/aes_ttable.c
+///
+/// T-table AES-128 backend for 32-bit targets, used with
+/// `AES_BACKEND = ttable`.
+///
+/// Each round is 16 lookups into four 1KB tables that combine SubBytes,
+/// ShiftRows and MixColumns, so a block costs ~160 table loads instead of
+/// the byte operations of the compact backend. The tables (8.5KB) are
+/// const and stay in flash, the expanded keys use 352 bytes of RAM.
+///
+/// The key schedule is expanded from `ekey` in `aes_key_init()`, so the
+/// final round key `dkey` isn't needed by this backend.
+
+#include "core/aes.h"
+
+#include "core/aes_tables.h"
+
+#define AES_NUM_ROUND_KEY_WORDS (4 * (AES_NUM_ROUNDS + 1))
+
+/// Pack bytes into a column word, the first byte is the most significant
+#define AES_WORD(b0, b1, b2, b3) ( \
+    ((uint32_t)(b0) << 24) | \
+    ((uint32_t)(b1) << 16) | \
+    ((uint32_t)(b2) << 8) | \
+    ((uint32_t)(b3)) \
+)
+
+#define AES_BYTE_ENTRY(s) (s),
+
+#define AES_TE0_ENTRY(s) AES_WORD(AES_MUL2(s), (s), (s), AES_MUL3(s)),
+#define AES_TE1_ENTRY(s) AES_WORD(AES_MUL3(s), AES_MUL2(s), (s), (s)),
+#define AES_TE2_ENTRY(s) AES_WORD((s), AES_MUL3(s), AES_MUL2(s), (s)),
+#define AES_TE3_ENTRY(s) AES_WORD((s), (s), AES_MUL3(s), AES_MUL2(s)),
+
+#define AES_TD0_ENTRY(s) AES_WORD(AES_MUL14(s), AES_MUL9(s), AES_MUL13(s), AES_MUL11(s)),
+#define AES_TD1_ENTRY(s) AES_WORD(AES_MUL11(s), AES_MUL14(s), AES_MUL9(s), AES_MUL13(s)),
+#define AES_TD2_ENTRY(s) AES_WORD(AES_MUL13(s), AES_MUL11(s), AES_MUL14(s), AES_MUL9(s)),
+#define AES_TD3_ENTRY(s) AES_WORD(AES_MUL9(s), AES_MUL13(s), AES_MUL11(s), AES_MUL14(s)),
+
+static const ROM uint8_t s_sbox[256] = { AES_SBOX_LIST(AES_BYTE_ENTRY) };
+static const ROM uint8_t s_inv_sbox[256] = { AES_INV_SBOX_LIST(AES_BYTE_ENTRY) };
+
+static const ROM uint32_t s_te0[256] = { AES_SBOX_LIST(AES_TE0_ENTRY) };
+static const ROM uint32_t s_te1[256] = { AES_SBOX_LIST(AES_TE1_ENTRY) };
+static const ROM uint32_t s_te2[256] = { AES_SBOX_LIST(AES_TE2_ENTRY) };
+static const ROM uint32_t s_te3[256] = { AES_SBOX_LIST(AES_TE3_ENTRY) };
+
+static const ROM uint32_t s_td0[256] = { AES_INV_SBOX_LIST(AES_TD0_ENTRY) };
+static const ROM uint32_t s_td1[256] = { AES_INV_SBOX_LIST(AES_TD1_ENTRY) };
+static const ROM uint32_t s_td2[256] = { AES_INV_SBOX_LIST(AES_TD2_ENTRY) };
+static const ROM uint32_t s_td3[256] = { AES_INV_SBOX_LIST(AES_TD3_ENTRY) };
+
+static XRAM uint32_t s_enc_keys[AES_NUM_ROUND_KEY_WORDS];
+/// Round keys for the equivalent inverse cipher, in the order they are used
+static XRAM uint32_t s_dec_keys[AES_NUM_ROUND_KEY_WORDS];
+
+#define B0(w) ((uint8_t)((w) >> 24))
+#define B1(w) ((uint8_t)((w) >> 16))
+#define B2(w) ((uint8_t)((w) >> 8))
+#define B3(w) ((uint8_t)(w))
+
+static uint32_t load_word(const uint8_t *buf) {
+    return AES_WORD(buf[0], buf[1], buf[2], buf[3]);
+}
+
+static void store_word(uint8_t *buf, uint32_t word) {
+    buf[0] = B0(word);
+    buf[1] = B1(word);
+    buf[2] = B2(word);
+    buf[3] = B3(word);
+}
+
+static uint32_t sub_word(uint32_t w) {
+    return AES_WORD(s_sbox[B0(w)], s_sbox[B1(w)], s_sbox[B2(w)], s_sbox[B3(w)]);
+}
+
+/// The Td tables apply InvMixColumns after InvSubBytes, so looking up the
+/// S-box of each byte first leaves only InvMixColumns.
+static uint32_t inv_mix_column(uint32_t w) {
+    return s_td0[s_sbox[B0(w)]] ^ s_td1[s_sbox[B1(w)]] ^
+        s_td2[s_sbox[B2(w)]] ^ s_td3[s_sbox[B3(w)]];
+}
+
+void aes_key_init(const uint8_t *ekey, const uint8_t *dkey) {
+    uint8_t rcon = 0x01;
+    uint8_t i;
+    uint8_t round;
+
+    (void)dkey;
+
+    for (i = 0; i < 4; ++i) {
+        s_enc_keys[i] = load_word(ekey + 4*i);
+    }
+
+    for (i = 4; i < AES_NUM_ROUND_KEY_WORDS; ++i) {
+        uint32_t temp = s_enc_keys[i-1];
+        if ((i % 4) == 0) {
+            temp = sub_word((temp << 8) | (temp >> 24)) ^ ((uint32_t)rcon << 24);
+            rcon = AES_MUL2(rcon);
+        }
+        s_enc_keys[i] = s_enc_keys[i-4] ^ temp;
+    }
+
+    for (round = 0; round <= AES_NUM_ROUNDS; ++round) {
+        for (i = 0; i < 4; ++i) {
+            uint32_t key = s_enc_keys[4*(AES_NUM_ROUNDS - round) + i];
+            if (round != 0 && round != AES_NUM_ROUNDS) {
+                key = inv_mix_column(key);
+            }
+            s_dec_keys[4*round + i] = key;
+        }
+    }
+}
+
+void aes_encrypt(uint8_t *block) {
+    const XRAM uint32_t *rk = s_enc_keys;
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+    uint8_t round;
+
+    s0 = load_word(block + 0) ^ rk[0];
+    s1 = load_word(block + 4) ^ rk[1];
+    s2 = load_word(block + 8) ^ rk[2];
+    s3 = load_word(block + 12) ^ rk[3];
+
+    for (round = 1; round < AES_NUM_ROUNDS; ++round) {
+        rk += 4;
+        t0 = s_te0[B0(s0)] ^ s_te1[B1(s1)] ^ s_te2[B2(s2)] ^ s_te3[B3(s3)] ^ rk[0];
+        t1 = s_te0[B0(s1)] ^ s_te1[B1(s2)] ^ s_te2[B2(s3)] ^ s_te3[B3(s0)] ^ rk[1];
+        t2 = s_te0[B0(s2)] ^ s_te1[B1(s3)] ^ s_te2[B2(s0)] ^ s_te3[B3(s1)] ^ rk[2];
+        t3 = s_te0[B0(s3)] ^ s_te1[B1(s0)] ^ s_te2[B2(s1)] ^ s_te3[B3(s2)] ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // the final round has no MixColumns
+    rk += 4;
+    store_word(block + 0, AES_WORD(
+        s_sbox[B0(s0)], s_sbox[B1(s1)], s_sbox[B2(s2)], s_sbox[B3(s3)]
+    ) ^ rk[0]);
+    store_word(block + 4, AES_WORD(
+        s_sbox[B0(s1)], s_sbox[B1(s2)], s_sbox[B2(s3)], s_sbox[B3(s0)]
+    ) ^ rk[1]);
+    store_word(block + 8, AES_WORD(
+        s_sbox[B0(s2)], s_sbox[B1(s3)], s_sbox[B2(s0)], s_sbox[B3(s1)]
+    ) ^ rk[2]);
+    store_word(block + 12, AES_WORD(
+        s_sbox[B0(s3)], s_sbox[B1(s0)], s_sbox[B2(s1)], s_sbox[B3(s2)]
+    ) ^ rk[3]);
+}
+
+void aes_decrypt(uint8_t *block) {
+    const XRAM uint32_t *rk = s_dec_keys;
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+    uint8_t round;
+
+    s0 = load_word(block + 0) ^ rk[0];
+    s1 = load_word(block + 4) ^ rk[1];
+    s2 = load_word(block + 8) ^ rk[2];
+    s3 = load_word(block + 12) ^ rk[3];
+
+    for (round = 1; round < AES_NUM_ROUNDS; ++round) {
+        rk += 4;
+        t0 = s_td0[B0(s0)] ^ s_td1[B1(s3)] ^ s_td2[B2(s2)] ^ s_td3[B3(s1)] ^ rk[0];
+        t1 = s_td0[B0(s1)] ^ s_td1[B1(s0)] ^ s_td2[B2(s3)] ^ s_td3[B3(s2)] ^ rk[1];
+        t2 = s_td0[B0(s2)] ^ s_td1[B1(s1)] ^ s_td2[B2(s0)] ^ s_td3[B3(s3)] ^ rk[2];
+        t3 = s_td0[B0(s3)] ^ s_td1[B1(s2)] ^ s_td2[B2(s1)] ^ s_td3[B3(s0)] ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // the final round has no InvMixColumns
+    rk += 4;
+    store_word(block + 0, AES_WORD(
+        s_inv_sbox[B0(s0)], s_inv_sbox[B1(s3)], s_inv_sbox[B2(s2)], s_inv_sbox[B3(s1)]
+    ) ^ rk[0]);
+    store_word(block + 4, AES_WORD(
+        s_inv_sbox[B0(s1)], s_inv_sbox[B1(s0)], s_inv_sbox[B2(s3)], s_inv_sbox[B3(s2)]
+    ) ^ rk[1]);
+    store_word(block + 8, AES_WORD(
+        s_inv_sbox[B0(s2)], s_inv_sbox[B1(s1)], s_inv_sbox[B2(s0)], s_inv_sbox[B3(s3)]
+    ) ^ rk[2]);
+    store_word(block + 12, AES_WORD(
+        s_inv_sbox[B0(s3)], s_inv_sbox[B1(s2)], s_inv_sbox[B2(s1)], s_inv_sbox[B3(s0)]
+    ) ^ rk[3]);
+}
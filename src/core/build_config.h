@@ -0,0 +1,27 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/build_config.h
+///
+/// RAM table sizes generated from the layout file for builds with
+/// `USE_GENERATED_CONFIG=1`.
+///
+/// `keyplus-cli program --config-header` writes `generated_config.h` with the
+/// limits that the layout actually needs (number of layouts, layers, keys,
+/// hold keys and combos). Each value is guarded with `#ifndef`, so values given on the
+/// command line (e.g. `KEYBOARD_SLOTS=N`) take priority, and any limit that
+/// isn't generated keeps the worst case default of the header that uses it.
+///
+/// The header starts with a report of the bytes of RAM that each of these
+/// tables uses for the layout, and the bytes saved over the defaults. With
+/// `RAM_BUDGET=N`, the build fails if the sized tables need more than N bytes,
+/// see `core/ram_budget.c`.
+///
+/// The firmware still checks the settings and layout against these limits at
+/// start up, so a layout that needs more than the firmware was built for
+/// raises an error instead of writing past the end of a table.
+
+#pragma once
+
+#if USE_GENERATED_CONFIG
+    #include "generated_config.h"
+#endif
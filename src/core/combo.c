@@ -0,0 +1,328 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/combo.c
+///
+/// Combo engine for the matrix interpreter.
+///
+/// When the combo table is loaded, an index is built that maps each key number
+/// to a bit mask of the combos that the key is part of. Keys that aren't part
+/// of any combo have an empty mask and are passed straight through to the
+/// interpreter, so they don't get any extra latency.
+///
+/// When a key that is part of a combo is pressed, it is held back with
+/// `keyboard_buffer_key()` and the set of candidate combos is set to its
+/// mask. Each following key press ANDs its mask with the candidate set. When a candidate has had all of its keys
+/// pressed and no larger candidate is left, the combo keycode is pressed.
+/// If the candidate set becomes empty, a buffered key is released or the
+/// combo term expires, the buffered keys are replayed as normal key presses.
+
+#include "core/combo.h"
+
+#include <string.h>
+
+#include "core/error.h"
+#include "core/matrix_interpret.h"
+#include "core/scheduler.h"
+#include "core/settings.h"
+#include "core/timer.h"
+
+#define COMBO_NONE 0xff
+
+KP_STATIC_ASSERT(
+    COMBO_MAX_KEYS <= MAX_NUM_BUFFERED_KEYS,
+    "The key buffer must fit all the keys of a combo"
+);
+
+#if (defined(__SDCC_mcs51) || defined(AVR)) && MAX_NUM_COMBOS > 8
+/// `bitset_ctz()` only takes a byte on 8 bit cores
+static uint8_t combo_ctz(combo_mask_t mask) {
+    uint8_t offset = 0;
+    while (!(uint8_t)mask) {
+        mask >>= 8;
+        offset += 8;
+    }
+    return offset + bitset_ctz((uint8_t)mask);
+}
+#else
+#define combo_ctz(mask) bitset_ctz(mask)
+#endif
+
+/// Combo table loaded from the layout
+static XRAM combo_entry_t s_combos[MAX_NUM_COMBOS];
+static XRAM uint8_t s_combo_size[MAX_NUM_COMBOS];
+static XRAM uint8_t s_num_combos;
+
+/// Maps key number -> mask of combos that the key is part of
+static XRAM combo_mask_t s_combo_key_index[COMBO_MAX_KEY_NUM];
+
+/// State for a combo whose keys are still being pressed, the keys themselves
+/// are in `g_buffered_keys`
+static XRAM combo_mask_t s_candidates;
+static XRAM uint16_t s_pending_deadline;
+
+/// State for a combo that has been pressed, and whose keys are still down
+static XRAM uint8_t s_active_combo;
+static XRAM uint8_t s_active_kb_id;
+static XRAM uint8_t s_active_keys_down;
+static XRAM uint8_t s_active_pressed;
+
+void combo_init(void) {
+    const uint16_t table_offset = GET_SETTING(layout.combo_table_offset);
+    uint8_t num_combos = GET_SETTING(layout.combo_count);
+    uint8_t i;
+
+    memset(s_combo_key_index, 0, sizeof(s_combo_key_index));
+    s_num_combos = 0;
+    keyboard_drop_buffered_keys(BUFFERED_KEYS_COMBO);
+    s_active_combo = COMBO_NONE;
+
+    if (num_combos > MAX_NUM_COMBOS) {
+        register_error(ERROR_COMBO_TABLE_TOO_LARGE);
+        num_combos = MAX_NUM_COMBOS;
+    }
+
+    for (i = 0; i < num_combos; ++i) {
+        combo_entry_t XRAM* combo = &s_combos[s_num_combos];
+        uint8_t size = 0;
+        uint8_t j;
+
+        if (get_ekc_data(
+            (uint8_t*)combo,
+            table_offset + i*sizeof(combo_entry_t),
+            sizeof(combo_entry_t)
+        )) {
+            break;
+        }
+
+        // check all the keys can be indexed before adding the combo
+        for (j = 0; j < COMBO_MAX_KEYS; ++j) {
+            const uint8_t key_num = combo->keys[j];
+            if (key_num == COMBO_KEY_NONE) {
+                continue;
+            } else if (key_num >= COMBO_MAX_KEY_NUM) {
+                size = 0;
+                break;
+            }
+            size++;
+        }
+
+        // a combo needs at least two keys
+        if (size < 2) {
+            continue;
+        }
+
+        for (j = 0; j < COMBO_MAX_KEYS; ++j) {
+            const uint8_t key_num = combo->keys[j];
+            if (key_num != COMBO_KEY_NONE) {
+                s_combo_key_index[key_num] |= ((combo_mask_t)1 << s_num_combos);
+            }
+        }
+
+        if (combo->term == 0) {
+            combo->term = COMBO_DEFAULT_TERM;
+        }
+
+        s_combo_size[s_num_combos] = size;
+        s_num_combos++;
+    }
+}
+
+/// Check if a combo on `kb_id` is waiting for more keys
+static bit_t is_combo_pending(uint8_t kb_id) {
+    return g_buffered_keys.owner == BUFFERED_KEYS_COMBO && g_buffered_keys.kb_id == kb_id;
+}
+
+/// Returns a bit mask of the key positions in `combo_id` that match `key_num`
+static uint8_t get_combo_key_bit(uint8_t combo_id, uint8_t key_num) {
+    uint8_t j;
+    for (j = 0; j < COMBO_MAX_KEYS; ++j) {
+        if (s_combos[combo_id].keys[j] == key_num) {
+            return bitn_mask(j);
+        }
+    }
+    return 0;
+}
+
+/// Press the keycode of a combo whose keys are all in the buffer.
+static void combo_fire(uint8_t combo_id) REENT {
+    uint8_t i;
+
+    s_active_combo = combo_id;
+    s_active_kb_id = g_buffered_keys.kb_id;
+    s_active_keys_down = 0;
+    s_active_pressed = true;
+    for (i = 0; i < g_buffered_keys.len; ++i) {
+        s_active_keys_down |= get_combo_key_bit(combo_id, g_buffered_keys.keys[i]);
+    }
+
+    keyboard_drop_buffered_keys(BUFFERED_KEYS_COMBO);
+
+    keyboard_trigger_event(s_combos[combo_id].keycode, EVENT_PRESSED);
+}
+
+/// Returns the candidates that have had all of their keys pressed
+static combo_mask_t get_complete_candidates(void) {
+    combo_mask_t complete = 0;
+    combo_mask_t candidates = s_candidates;
+
+    // Every buffered key is part of every candidate, so a candidate is
+    // complete when its size matches the number of buffered keys.
+    while (candidates) {
+        const uint8_t combo_id = combo_ctz(candidates);
+        candidates = bitset_clear_lowest(candidates);
+        if (s_combo_size[combo_id] == g_buffered_keys.len) {
+            complete |= ((combo_mask_t)1 << combo_id);
+        }
+    }
+
+    return complete;
+}
+
+/// The combo can't grow any more, so either press a completed combo or
+/// replay the buffered keys.
+static void combo_resolve(void) REENT {
+    const combo_mask_t complete = get_complete_candidates();
+    if (complete) {
+        combo_fire(combo_ctz(complete));
+    } else {
+        keyboard_replay_buffered_keys(BUFFERED_KEYS_COMBO);
+    }
+}
+
+bit_t combo_key_pressed(uint8_t kb_id, uint8_t key_num) REENT {
+    combo_mask_t combos;
+
+    if (key_num >= COMBO_MAX_KEY_NUM) {
+        combos = 0;
+    } else {
+        combos = s_combo_key_index[key_num];
+    }
+
+    if (g_buffered_keys.owner != BUFFERED_KEYS_COMBO) {
+        uint8_t term = 0xff;
+
+        // Only one combo is tracked at a time. Keys that aren't part of any
+        // combo are not delayed at all.
+        if (!combos || s_active_combo != COMBO_NONE) {
+            return false;
+        }
+
+        // only keep combos for this keyboard
+        {
+            combo_mask_t check = combos;
+            while (check) {
+                const uint8_t combo_id = combo_ctz(check);
+                check = bitset_clear_lowest(check);
+                if (s_combos[combo_id].layout_id != kb_id) {
+                    combos &= ~((combo_mask_t)1 << combo_id);
+                } else {
+                    term = KP_MIN(term, s_combos[combo_id].term);
+                }
+            }
+        }
+
+        // the buffer is in use while a permissive hold key is undecided
+        if (!combos || !keyboard_buffer_key(BUFFERED_KEYS_COMBO, kb_id, key_num)) {
+            return false;
+        }
+
+        s_candidates = combos;
+        s_pending_deadline = timer_read16_ms() + term;
+        return true;
+    }
+
+    if (g_buffered_keys.kb_id != kb_id) {
+        // combos from other keyboards don't affect this one
+        return false;
+    }
+
+    combos &= s_candidates;
+    if (!combos) {
+        // This key can't be part of any of the candidates, so the combo is
+        // finished. The key itself is handled normally after the buffered
+        // keys.
+        combo_resolve();
+        return false;
+    }
+
+    // Each buffered key is a different key of every candidate, so there is
+    // always room for one more
+    s_candidates = combos;
+    keyboard_buffer_key(BUFFERED_KEYS_COMBO, kb_id, key_num);
+
+    {
+        const combo_mask_t complete = get_complete_candidates();
+        // If the only candidates left are complete, no more keys can be added
+        // so don't need to wait for the term to expire.
+        if (complete && complete == s_candidates) {
+            combo_fire(combo_ctz(complete));
+        }
+    }
+
+    return true;
+}
+
+bit_t combo_key_released(uint8_t kb_id, uint8_t key_num) REENT {
+    if (keyboard_is_key_buffered(BUFFERED_KEYS_COMBO, kb_id, key_num)) {
+        // A buffered key was released before the combo finished.
+        combo_resolve();
+    }
+
+    if (s_active_combo != COMBO_NONE && s_active_kb_id == kb_id) {
+        const uint8_t key_bit = get_combo_key_bit(s_active_combo, key_num);
+
+        if (key_bit & s_active_keys_down) {
+            s_active_keys_down &= ~key_bit;
+
+            // the combo keycode is released when any of its keys is released
+            if (s_active_pressed) {
+                s_active_pressed = false;
+                keyboard_trigger_event(s_combos[s_active_combo].keycode, EVENT_RELEASED);
+            }
+
+            if (s_active_keys_down == 0) {
+                s_active_combo = COMBO_NONE;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void combo_check_timeout(uint8_t kb_id) REENT {
+    if (!is_combo_pending(kb_id)) {
+        return;
+    }
+
+    if (has_passed_time16(timer_read16_ms(), s_pending_deadline)) {
+        combo_resolve();
+    }
+}
+
+void combo_cancel_keyboard(uint8_t kb_id) REENT {
+    if (is_combo_pending(kb_id)) {
+        keyboard_drop_buffered_keys(BUFFERED_KEYS_COMBO);
+    }
+
+    if (s_active_combo != COMBO_NONE && s_active_kb_id == kb_id) {
+        if (s_active_pressed) {
+            keyboard_trigger_event(s_combos[s_active_combo].keycode, EVENT_RELEASED);
+        }
+        s_active_combo = COMBO_NONE;
+    }
+}
+
+bool combo_task(void) {
+    if (g_buffered_keys.owner != BUFFERED_KEYS_COMBO) {
+        return false;
+    }
+
+    if (has_passed_time16(timer_read16_ms(), s_pending_deadline)) {
+        keyboard_request_update(g_buffered_keys.kb_id);
+    } else {
+        scheduler_wake_at(s_pending_deadline + 1);
+    }
+
+    return true;
+}
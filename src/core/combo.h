@@ -0,0 +1,104 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/combo.h
+///
+/// Key combos (chords): pressing several keys at the same time generates a
+/// different keycode.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/build_config.h"
+#include "core/keycode.h"
+#include "core/util.h"
+
+/// Maximum number of keys in a single combo
+#define COMBO_MAX_KEYS 4
+
+/// Value used for unused entries in `combo_entry_t.keys`
+#define COMBO_KEY_NONE 0xff
+
+/// Term used for combos that don't give one (ms)
+#define COMBO_DEFAULT_TERM 50
+
+/// Maximum number of combos that are loaded from the combo table. The
+/// generated config header sets it to the number of combos in the layout.
+#ifndef MAX_NUM_COMBOS
+    #define MAX_NUM_COMBOS 8
+#endif
+
+/// Key numbers at or above this value can't be used in combos. The per key
+/// combo index uses `sizeof(combo_mask_t)` bytes for each key number.
+#ifndef COMBO_MAX_KEY_NUM
+    #define COMBO_MAX_KEY_NUM 128
+#endif
+
+#if MAX_NUM_COMBOS <= 8
+    typedef uint8_t combo_mask_t;
+#elif MAX_NUM_COMBOS <= 16
+    typedef uint16_t combo_mask_t;
+#elif MAX_NUM_COMBOS <= 32
+    typedef uint32_t combo_mask_t;
+#else
+    #error "MAX_NUM_COMBOS can be at most 32"
+#endif
+
+/// An entry in the combo table.
+///
+/// The combo table is stored in the extended keycode data section, at the
+/// offset given by `layout_settings_t.combo_table_offset`.
+typedef struct combo_entry_t {
+    /// The layout (keyboard) that this combo is used on
+    uint8_t layout_id;
+    /// All the keys must be pressed within this many ms of the first key.
+    /// If 0 then `COMBO_DEFAULT_TERM` is used.
+    uint8_t term;
+    /// Key numbers of the keys in the combo, unused keys are `COMBO_KEY_NONE`
+    uint8_t keys[COMBO_MAX_KEYS];
+    /// The keycode generated by the combo
+    keycode_t keycode;
+} ATTR_PACKED combo_entry_t;
+
+#if SUPPORT_COMBO
+
+/// Load the combo table from the layout and build the per key combo index.
+///
+/// Must be called after `keyboard_layouts_init()`.
+void combo_init(void);
+
+/// Called by the matrix interpreter when a key is pressed.
+///
+/// @return true if the key was buffered as part of a possible combo, in which
+/// case the interpreter should not generate a press event for it.
+bit_t combo_key_pressed(uint8_t kb_id, uint8_t key_num) REENT;
+
+/// Called by the matrix interpreter when a key is released.
+///
+/// @return true if the release was consumed by a combo, in which case the
+/// interpreter should not generate a release event for it.
+bit_t combo_key_released(uint8_t kb_id, uint8_t key_num) REENT;
+
+/// Resolve a pending combo if its term has expired. Called by the matrix
+/// interpreter before it processes the keyboard.
+void combo_check_timeout(uint8_t kb_id) REENT;
+
+/// Drop any combo state for a keyboard that is being unloaded, releasing the
+/// combo keycode if it is held.
+void combo_cancel_keyboard(uint8_t kb_id) REENT;
+
+/// Wakes the matrix interpreter when a pending combo's term expires.
+///
+/// @return true if a combo is pending
+bool combo_task(void);
+
+#else
+
+#define combo_init()
+#define combo_key_pressed(kb_id, key_num) (false)
+#define combo_key_released(kb_id, key_num) (false)
+#define combo_check_timeout(kb_id)
+#define combo_cancel_keyboard(kb_id)
+#define combo_task() (false)
+
+#endif
@@ -60,6 +60,7 @@ ID                ?= 0
 MAX_NUM_ROWS      ?= 18
 
 SUPPORT_MACRO     ?= 1
+SUPPORT_COMBO     ?= 1
 USE_MOUSE_GESTURE ?= 1
 
 CDEFS += -DDEVICE_ID=$(ID)
@@ -75,6 +76,7 @@ C_SRC += \
 	$(CORE_PATH)/flash.c \
 	$(CORE_PATH)/hardware.c \
 	$(CORE_PATH)/layout.c \
+	$(CORE_PATH)/matrix_packet.c \
 	$(CORE_PATH)/packet.c \
 	$(CORE_PATH)/ring_buf.c \
 	$(CORE_PATH)/settings.c \
@@ -108,11 +110,45 @@ ifeq ($(USE_SCANNER), 0)
 else
     C_SRC += \
         $(CORE_PATH)/io_map.c \
-        $(CORE_PATH)/matrix_scanner.c
+        $(CORE_PATH)/matrix_scanner.c \
+        $(CORE_PATH)/scan_governor.c
     CDEFS += -DUSE_SCANNER=1
     CDEFS += -DMAX_NUM_ROWS=$(MAX_NUM_ROWS)
 endif
 
+# Static layout, defaults to 0. When enabled, the keymaps of `LAYOUT_FILE`
+# are compiled into the firmware from a C file generated by keyplus-cli.
+ifeq ($(USE_STATIC_LAYOUT), 1)
+    STATIC_LAYOUT_C ?= $(BUILD_TARGET_DIR)/static_layout.c
+    C_SRC += $(STATIC_LAYOUT_C)
+    CDEFS += -DUSE_STATIC_LAYOUT=1
+else
+    CDEFS += -DUSE_STATIC_LAYOUT=0
+endif
+
+# Generated config, defaults to 0. When enabled, keyplus-cli writes a header
+# with the RAM table sizes that `LAYOUT_FILE` needs, see `core/build_config.h`.
+ifeq ($(USE_GENERATED_CONFIG), 1)
+    GENERATED_CONFIG_H = $(BUILD_TARGET_DIR)/generated_config.h
+    INC_PATHS += -I$(BUILD_TARGET_DIR)
+    CDEFS += -DUSE_GENERATED_CONFIG=1
+else
+    CDEFS += -DUSE_GENERATED_CONFIG=0
+endif
+
+# Fail the build if the RAM tables sized from the layout need more than
+# RAM_BUDGET bytes, see `core/ram_budget.c`.
+ifdef RAM_BUDGET
+    CDEFS += -DRAM_BUDGET=$(RAM_BUDGET)
+    C_SRC += $(CORE_PATH)/ram_budget.c
+endif
+
+# CRC lookup table, defaults to a nibble table on 8-bit parts and a byte table
+# on the others, see `core/crc.h`.
+ifdef CRC16_BYTE_TABLE
+    CDEFS += -DCRC16_BYTE_TABLE=$(CRC16_BYTE_TABLE)
+endif
+
 # Hardware specific scan, defaults to 0
 ifeq ($(USE_HARDWARE_SPECIFIC_SCAN), 1)
     CDEFS += -DUSE_HARDWARE_SPECIFIC_SCAN=1
@@ -143,15 +179,69 @@ ifeq ($(USE_HID), 1)
     ifeq ($(SUPPORT_MACRO), 1)
         CDEFS += -DSUPPORT_MACRO=1
         C_SRC += $(CORE_PATH)/macro.c
+
+        # Number of macros that can run at once, and the number of decoded
+        # macro instructions kept in RAM.
+        ifdef MACRO_INSTANCES
+            CDEFS += -DMAX_NUM_MACRO_INSTANCES=$(MACRO_INSTANCES)
+        endif
+
+        ifdef MACRO_CACHE_SIZE
+            CDEFS += -DMACRO_CACHE_SIZE=$(MACRO_CACHE_SIZE)
+        endif
     else
         CDEFS += -DSUPPORT_MACRO=0
     endif
 
+    ifeq ($(SUPPORT_COMBO), 1)
+        CDEFS += -DSUPPORT_COMBO=1
+        C_SRC += $(CORE_PATH)/combo.c
+    else
+        CDEFS += -DSUPPORT_COMBO=0
+    endif
+
     C_SRC += \
         $(CORE_PATH)/mods.c \
         $(CORE_PATH)/matrix_interpret.c \
         $(CORE_PATH)/keycode.c \
     #
+
+    # Main loop scheduler, defaults to 0. Ports that run their main loop with
+    # `scheduler_run()` turn it on, and provide `wait_for_event()` and
+    # `scheduler_port_task()`. See `core/scheduler.h`.
+    ifeq ($(USE_SCHEDULER), 1)
+        C_SRC += $(CORE_PATH)/scheduler.c
+        CDEFS += -DUSE_SCHEDULER=1
+    else
+        CDEFS += -DUSE_SCHEDULER=0
+    endif
+
+    # Measure the cost of each main loop task, the port needs to provide
+    # `scheduler_read_cycles()` when this is enabled.
+    ifeq ($(SCHEDULER_PROFILE), 1)
+        CDEFS += -DSCHEDULER_PROFILE=1
+    endif
+
+    # Background check of the settings and layout CRCs, run by the scheduler.
+    # Defaults to USE_SCHEDULER. See `core/flash_verify.h`.
+    USE_FLASH_VERIFY ?= $(USE_SCHEDULER)
+    ifneq ($(USE_FLASH_VERIFY), 1)
+        CDEFS += -DUSE_FLASH_VERIFY=0
+    else
+        C_SRC += $(CORE_PATH)/flash_verify.c
+        CDEFS += -DUSE_FLASH_VERIFY=1
+
+        # Bytes checked per idle pass, defaults to PAGE_SIZE
+        ifdef FLASH_VERIFY_CHUNK_SIZE
+            CDEFS += -DFLASH_VERIFY_CHUNK_SIZE=$(FLASH_VERIFY_CHUNK_SIZE)
+        endif
+    endif
+
+    # Number of keyboards the matrix interpreter can track at once, each slot
+    # costs sizeof(keyboard_t) bytes of RAM. Defaults to 4 when not given.
+    ifdef KEYBOARD_SLOTS
+        CDEFS += -DMAX_NUM_KEYBOARD_SLOTS=$(KEYBOARD_SLOTS)
+    endif
 endif
 
 # NRF24 module, defaults to 0
@@ -164,6 +254,14 @@ ifeq ($(USE_NRF24), 1)
     CDEFS += -DUSE_NRF24=1
     CDEFS += -DNONCE_ADDR=$(NONCE_ADDR)
 
+    # Number of device ids a receiver keeps session state and link counters
+    # for, each costs about 16 bytes of RAM. Defaults to MAX_NUM_DEVICES (64)
+    # when not given. KEYBOARD_SLOTS sets the number of keyboards handled at
+    # once.
+    ifdef RF_DEVICES
+        CDEFS += -DRF_MAX_NUM_DEVICES=$(RF_DEVICES)
+    endif
+
     ifeq ($(USE_UNIFYING), 0)
         CDEFS += -DUSE_UNIFYING=0
     else
@@ -185,6 +283,20 @@ else
     CDEFS += -DUSE_NRF52_ESB=0
 endif
 
+# AES backend that implements `core/aes.h` for RF packet encryption. Run
+# `make aes-bench` in `ports/linux` to compare the software backends.
+#   port: the port provides its own implementation (AES engine or library)
+#   ttable: T-table implementation for 32-bit targets, 8.5KB of tables
+#   compact: byte oriented implementation for 8-bit targets, 512B of tables
+AES_BACKEND ?= port
+ifeq ($(AES_BACKEND), ttable)
+    C_SRC += $(CORE_PATH)/aes_ttable.c
+else ifeq ($(AES_BACKEND), compact)
+    C_SRC += $(CORE_PATH)/aes_compact.c
+else ifneq ($(AES_BACKEND), port)
+    $(error "Unknown AES_BACKEND: $(AES_BACKEND)")
+endif
+
 ifeq ($(USE_MOUSE), 1)
     CDEFS += -DUSE_MOUSE=1
     C_SRC += $(CORE_PATH)/mouse.c
@@ -3,12 +3,49 @@
 /// @file core/crc.h
 ///
 /// CRC functions used for RF packets and verifying the settings section.
+///
+/// The CRC is CRC-16/CCITT-FALSE (poly 0x1021, initial value 0xffff, no bit
+/// reflection), the same as `keyplus/utility/crc16.py` in the host software.
+///
+/// `crc16_update()` uses a lookup table. With `CRC16_BYTE_TABLE=1` the table
+/// has 256 entries (512 bytes) and handles a byte per lookup, otherwise it has
+/// 16 entries (32 bytes) and handles a nibble per lookup. The byte table is
+/// the default where code space is less constrained.
 
 #pragma once
 
+#include "core/hardware.h"
 #include "core/util.h"
 
+#define CRC16_INIT 0xffff
+
+#ifndef CRC16_BYTE_TABLE
+    #if defined(__SDCC_mcs51) || defined(AVR)
+        #define CRC16_BYTE_TABLE 0
+    #else
+        #define CRC16_BYTE_TABLE 1
+    #endif
+#endif
+
+/// Bitwise CRC update of the `num_bits` most significant bits of `data`.
+/// Only needed for inputs that aren't a whole number of bytes.
 uint16_t crc16_step(uint16_t crc, uint8_t data, uint8_t num_bits);
+
+/// Add a byte to the CRC. Start from `CRC16_INIT`.
+uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+/// Add `length` bytes from RAM to the CRC. The CRC of data split over
+/// several buffers can be computed by passing the result of each call to the
+/// next one.
+uint16_t crc16_update_buffer(uint16_t crc, const uint8_t *buf_ptr, uint16_t length);
+
+/// Same as `crc16_update_buffer()` for bytes stored in flash.
+uint16_t crc16_flash_update(uint16_t crc, flash_addr_t flash_ptr, flash_size_t length);
+
+/// @return the CRC of `length` bytes in RAM
+uint16_t crc16_buffer(const uint8_t *buf_ptr, uint16_t length);
+
+/// @return the CRC of `length` bytes in flash
+uint16_t crc16_flash_buffer(flash_addr_t flash_ptr, flash_size_t length);
+
 bit_t crc_check_nrf24_raw_packet(XRAM const uint8_t *addr, XRAM uint8_t *raw_packet, uint8_t payload_len);
-uint16_t crc16_buffer(const uint8_t *buf_ptr, uint8_t length);
-uint16_t crc16_flash_buffer(flash_addr_t flash_ptr, uint8_t length);
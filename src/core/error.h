@@ -33,6 +33,7 @@ typedef enum error_code_type {
     ERROR_VENDOR_IN_REPORT_CANT_KEEP_UP = 6,
     ERROR_INVALID_KB_ID_USED = 7,
     ERROR_MACRO_CMD_ERROR = 8,
+    ERROR_COMBO_TABLE_TOO_LARGE = 9,
 
     // critical errors
     CRITICAL_ERROR_START = 64,
@@ -46,6 +47,11 @@ typedef enum error_code_type {
     ERROR_UNSUPPORTED_SCAN_MODE = 71,
     ERROR_MAXIMUM_KEY_NUMBER_EXCEEDED = 72,
     ERROR_SETTINGS_INVALID_VALUE = 73,
+    ERROR_STATIC_LAYOUT_MISMATCH = 74,
+    ERROR_LAYOUT_FORMAT_INVALID = 75,
+    ERROR_LAYOUT_SECTION_CRC_MISMATCH = 76,
+    ERROR_NUM_LAYERS_TOO_LARGE = 77,
+    ERROR_FLASH_VERIFY_FAILED = 78,
 } error_code_type;
 
 /// Bitmap that holds the list of errors that have been triggered.
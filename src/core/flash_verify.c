@@ -0,0 +1,125 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/flash_verify.c
+///
+/// Background check of the settings and layout storage, see
+/// `core/flash_verify.h`.
+
+#include "core/flash_verify.h"
+
+#include <stddef.h>
+
+#include "core/crc.h"
+#include "core/error.h"
+#include "core/flash.h"
+#include "core/layout.h"
+#include "core/matrix_interpret.h"
+#include "core/settings.h"
+
+/// The main settings block and the layout index come before the sections
+#define FLASH_VERIFY_REGION_SETTINGS 0
+#define FLASH_VERIFY_REGION_LAYOUT_INDEX 1
+#define FLASH_VERIFY_REGION_FIRST_SECTION 2
+#define FLASH_VERIFY_REGION_COUNT (FLASH_VERIFY_REGION_FIRST_SECTION + LAYOUT_SECTION_COUNT)
+
+typedef struct flash_verify_region_t {
+    flash_addr_t addr;
+    flash_size_t size;
+    uint16_t crc; ///< The CRC stored by the host software
+} flash_verify_region_t;
+
+static XRAM uint8_t s_region;
+static XRAM flash_size_t s_offset;
+static XRAM uint16_t s_crc;
+static XRAM uint16_t s_pass_count;
+
+void flash_verify_init(void) {
+    s_region = FLASH_VERIFY_REGION_SETTINGS;
+    s_offset = 0;
+    s_crc = CRC16_INIT;
+    s_pass_count = 0;
+}
+
+uint16_t flash_verify_get_pass_count(void) {
+    return s_pass_count;
+}
+
+/// The region bounds are read from flash each time, so a layout written by
+/// the host is checked against its new index.
+///
+/// @return false if the region doesn't lie inside the layout storage
+static bit_t flash_verify_get_region(uint8_t region_id, flash_verify_region_t *region) {
+    if (region_id == FLASH_VERIFY_REGION_SETTINGS) {
+        region->addr = GET_SETTING_ADDR(device_id); // NOTE: first setting in table
+        region->size = SETTINGS_MAIN_INFO_SIZE-2;
+        region->crc = flash_read_word(GET_SETTING_ADDR(crc));
+    } else if (region_id == FLASH_VERIFY_REGION_LAYOUT_INDEX) {
+        region->addr = LAYOUT_INDEX_ADDR;
+        region->size = offsetof(layout_index_t, crc);
+        region->crc = flash_read_word(LAYOUT_INDEX_ADDR + offsetof(layout_index_t, crc));
+    } else {
+        const uint8_t section_id = region_id - FLASH_VERIFY_REGION_FIRST_SECTION;
+        region->addr = layout_get_section_addr(section_id);
+        region->size = layout_get_section_size(section_id);
+        region->crc = layout_get_section_crc(section_id);
+
+        // The sections were checked at start up, but the index could have
+        // gone bad since the last time it was verified.
+        if (
+            region->addr < LAYOUT_ADDR ||
+            region->addr > LAYOUT_ADDR + LAYOUT_SIZE ||
+            region->size > LAYOUT_ADDR + LAYOUT_SIZE - region->addr
+        ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void flash_verify_task(void) {
+    flash_verify_region_t region;
+    flash_size_t chunk_size;
+
+    if (has_critical_error()) {
+        return;
+    }
+
+    // The host is writing to flash, so the CRCs won't match until it is done
+    if (g_input_disabled) {
+        s_region = FLASH_VERIFY_REGION_SETTINGS;
+        s_offset = 0;
+        s_crc = CRC16_INIT;
+        return;
+    }
+
+    if (!flash_verify_get_region(s_region, &region)) {
+        register_error(ERROR_FLASH_VERIFY_FAILED);
+        return;
+    }
+
+    chunk_size = region.size - s_offset;
+    if (chunk_size > FLASH_VERIFY_CHUNK_SIZE) {
+        chunk_size = FLASH_VERIFY_CHUNK_SIZE;
+    }
+
+    s_crc = crc16_flash_update(s_crc, region.addr + s_offset, chunk_size);
+    s_offset += chunk_size;
+
+    if (s_offset < region.size) {
+        return;
+    }
+
+    if (s_crc != region.crc) {
+        register_error(ERROR_FLASH_VERIFY_FAILED);
+        return;
+    }
+
+    s_offset = 0;
+    s_crc = CRC16_INIT;
+    s_region++;
+    if (s_region == FLASH_VERIFY_REGION_COUNT) {
+        s_region = FLASH_VERIFY_REGION_SETTINGS;
+        s_pass_count++;
+    }
+}
@@ -0,0 +1,49 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/flash_verify.h
+///
+/// Background check of the settings and layout storage in flash.
+///
+/// The CRCs written by the host software are checked once at start up by
+/// `settings_load_from_flash()` and `keyboard_layouts_init()`. To also catch
+/// flash that goes bad while the device is running, `flash_verify_task()`
+/// walks the same regions again, `FLASH_VERIFY_CHUNK_SIZE` bytes per call:
+///
+/// 1. the main settings block
+/// 2. the layout index
+/// 3. each section listed in the layout index
+///
+/// When a region doesn't match its stored CRC, `ERROR_FLASH_VERIFY_FAILED` is
+/// raised. It is a critical error, so the port stops using the layouts and
+/// falls back to `recovery_mode_main_loop()` where the device can be
+/// reprogrammed.
+///
+/// The scheduler calls `flash_verify_task()` once in each pass that ends with
+/// no task ready or pending, just before it waits for the next event.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/util.h"
+
+#ifndef USE_FLASH_VERIFY
+    #define USE_FLASH_VERIFY 0
+#endif
+
+#ifndef FLASH_VERIFY_CHUNK_SIZE
+    #define FLASH_VERIFY_CHUNK_SIZE PAGE_SIZE
+#endif
+
+/// Restart the check from the first region.
+void flash_verify_init(void);
+
+/// Add the next chunk of the current region to its CRC, and compare the CRC
+/// once the end of the region is reached. Does nothing after a critical error
+/// has been raised, and restarts from the first region while the host is
+/// writing to flash.
+void flash_verify_task(void);
+
+/// @return the number of times every region has been checked since
+/// `flash_verify_init()`
+uint16_t flash_verify_get_pass_count(void);
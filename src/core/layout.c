@@ -5,36 +5,37 @@
 
 #include "config.h"
 
+#include <stddef.h>
+
+#include "core/crc.h"
 #include "core/error.h"
 #include "core/keycode.h"
 #include "core/macro.h"
 #include "core/settings.h"
+#include "core/static_layout.h"
 #include "core/flash.h"
 
-// layout storage structure is like this:
-//
-// The first section is for storing the (row, col) -> (key number map). It's
-// size is `g_settings.row_count * g_settings.col_count`.
-//  `flash_addr_t storage_pos = (g_settings.row_count * g_settings.col_count + 1) / 2;`
-//
-// The second section is for the extended keycode data. It's size is given in the
-// first 2 bytes of the section.
+// The layout storage is split into sections. A fixed size index at the start
+// gives the offset, size and CRC of each section, and the layout table gives
+// the offset of each layout's keycode array:
 //
-// The third section is for the layout data. The structure of the layout section
-// is determined by the g_settings.layout[].
+// layout_storage: {
+//    layout_index_t index;
 //
+//    // LAYOUT_SECTION_PIN_MAP: row/col pins, and maps (row, column) -> key
+//    // number. Always starts right after the index.
+//    uint8_t pin_map[];
 //
-// layout_storage: {
-//    // maps (row, column) -> key number
-//    uint8_t matrix_to_key_num_map[rows * (col+1)];
+//    // LAYOUT_SECTION_EKC
+//    uint8_t ekc_data[];
 //
-//    uint16_t ekc_data_size;
-//    uint8_t ekc_data[ekc_data_size];
+//    // LAYOUT_SECTION_LAYOUT_TABLE
+//    layout_table_entry_t layout_table[num_layouts];
 //
-//    layout_array[num_layouts] = {
-//        layout_header_t header;
-//        keycode_t keycode_array[8 * matrix_size * layer_count]; // matrix_size = ceil(num_keys/8)
-//    }
+//    // LAYOUT_SECTION_KEYMAPS, for each layout either:
+//    keycode_t keycode_array[8 * matrix_size * layer_count];
+//    // or with LAYOUT_FLAG_SPARSE_LAYERS (see layout_sparse_row_t):
+//    uint32_t layer_offsets[layer_count]; // followed by each layer
 // }
 #if USE_VIRTUAL_MODE
     //
@@ -42,98 +43,288 @@
 AT__LAYOUT_ADDR const uint8_t g_layout_storage[LAYOUT_SIZE] = { 0 };
 #endif
 
-// Lookup table for the address where a layout starts:
-// maps layout id -> start of layout in flash
-XRAM flash_addr_t g_layout_storage_pos[MAX_NUM_KEYBOARDS];
-
-void keyboard_layouts_init(void) {
+#if USE_STATIC_LAYOUT
+/// Check that the keymaps compiled into the firmware match the layout
+/// settings in flash, otherwise the key number maps and keymaps would come
+/// from different layout files.
+static void static_layout_check(void) {
     uint8_t i;
+    const uint8_t num_layouts = GET_SETTING(layout.number_layouts);
 
-    flash_addr_t storage_pos = LAYOUT_PORT_KEY_NUM_MAP_ADDR;
+    if (num_layouts != g_static_layout_count) {
+        register_error(ERROR_STATIC_LAYOUT_MISMATCH);
+        return;
+    }
 
-#if !defined(NO_MATRIX) && !USE_VIRTUAL_MODE
-    // key num map section
-    {
-        // skip the key num map section, since it is in a known location at compile
-        // time.
-        flash_addr_t key_num_map_size = g_scan_plan.rows * (g_scan_plan.max_col_pin_num+1);
-        storage_pos += key_num_map_size;
+    for (i = 0; i < num_layouts; ++i) {
+        if (
+            GET_SETTING(layout.layouts[i].matrix_size) != g_static_layouts[i].matrix_size ||
+            GET_SETTING(layout.layouts[i].layer_count) != g_static_layouts[i].layer_count
+        ) {
+            register_error(ERROR_STATIC_LAYOUT_MISMATCH);
+            return;
+        }
     }
+}
 #endif
 
-#if USE_VIRTUAL_MODE && !defined(NO_MATRIX)
-    #error "should use `NO_MATRIX` with `USE_VIRTUAL_MODE`"
-#endif
+#define LAYOUT_SECTION_ADDR(section_id, field) ( \
+    LAYOUT_INDEX_ADDR + offsetof(layout_index_t, sections) + \
+    (section_id) * sizeof(layout_section_t) + offsetof(layout_section_t, field) \
+)
 
-#if USE_VIRTUAL_MODE
-    // virtual mode includes the key number maps for all devices
-    {
-        // skip the key num map section
-        uint32_t key_num_map_size;
-        flash_read((uint8_t*)&key_num_map_size, storage_pos, sizeof(uint32_t));
-        storage_pos += key_num_map_size + sizeof(uint32_t);
+#define LAYOUT_TABLE_ENTRY_ADDR(table_addr, layout_id, field) ( \
+    (table_addr) + (flash_addr_t)(layout_id) * sizeof(layout_table_entry_t) + \
+    offsetof(layout_table_entry_t, field) \
+)
+
+static uint32_t flash_read_u32(flash_addr_t addr) {
+    uint32_t result;
+    flash_read((uint8_t*)&result, addr, sizeof(uint32_t));
+    return result;
+}
+
+bit_t layout_has_valid_index(void) {
+    return (
+        flash_read_word(LAYOUT_INDEX_ADDR + offsetof(layout_index_t, magic)) == LAYOUT_INDEX_MAGIC &&
+        flash_read_byte(LAYOUT_INDEX_ADDR + offsetof(layout_index_t, version)) == LAYOUT_FORMAT_VERSION &&
+        flash_read_byte(LAYOUT_INDEX_ADDR + offsetof(layout_index_t, section_count)) == LAYOUT_SECTION_COUNT &&
+        crc16_flash_buffer(LAYOUT_INDEX_ADDR, offsetof(layout_index_t, crc)) ==
+            flash_read_word(LAYOUT_INDEX_ADDR + offsetof(layout_index_t, crc))
+    );
+}
+
+flash_addr_t layout_get_section_addr(uint8_t section_id) {
+    return LAYOUT_ADDR + flash_read_u32(LAYOUT_SECTION_ADDR(section_id, offset));
+}
+
+flash_size_t layout_get_section_size(uint8_t section_id) {
+    return flash_read_u32(LAYOUT_SECTION_ADDR(section_id, size));
+}
+
+uint16_t layout_get_section_crc(uint8_t section_id) {
+    return flash_read_word(LAYOUT_SECTION_ADDR(section_id, crc));
+}
+
+flash_addr_t layout_get_keymap_addr(uint8_t layout_id) {
+    const flash_addr_t table_addr = layout_get_section_addr(LAYOUT_SECTION_LAYOUT_TABLE);
+    return LAYOUT_ADDR + flash_read_u32(LAYOUT_TABLE_ENTRY_ADDR(table_addr, layout_id, offset));
+}
+
+bit_t layout_has_sparse_layers(uint8_t layout_id) {
+    const flash_addr_t table_addr = layout_get_section_addr(LAYOUT_SECTION_LAYOUT_TABLE);
+    return (
+        flash_read_byte(LAYOUT_TABLE_ENTRY_ADDR(table_addr, layout_id, flags)) &
+        LAYOUT_FLAG_SPARSE_LAYERS
+    ) != 0;
+}
+
+// The layer offsets of the last sparse keymap read, so a lookup only needs
+// to read the offset of a layer from flash the first time the layer is used.
+// Most lookups come from the same keyboard, so one keymap is cached.
+static XRAM flash_addr_t s_sparse_keymap;
+static XRAM flash_addr_t s_sparse_layer_addr[MAX_NUM_LAYERS];
+/// bit n is set if `s_sparse_layer_addr[n]` is loaded
+static XRAM layer_mask_t s_sparse_layers_cached;
+/// bit n is set if layer n has `LAYOUT_LAYER_SPARSE`
+static XRAM layer_mask_t s_sparse_layers_sparse;
+
+void layout_sparse_cache_clear(void) {
+    s_sparse_layers_cached = 0;
+}
+
+keycode_t layout_read_sparse_keycode(
+    flash_addr_t keymap,
+    uint8_t matrix_size,
+    uint8_t layer,
+    uint8_t row,
+    uint8_t col
+) {
+    const layer_mask_t layer_bit = (layer_mask_t)1 << layer;
+    flash_addr_t layer_addr;
+    layout_sparse_row_t sparse_row;
+
+    if (layer >= MAX_NUM_LAYERS) {
+        return KC_TRNS;
     }
-#endif
 
-    // extended keycode section
-    {
-        flash_read((uint8_t*)&g_ekc_storage_size, storage_pos, sizeof(uint16_t));
-        storage_pos += sizeof(uint16_t);
+    if (keymap != s_sparse_keymap) {
+        s_sparse_keymap = keymap;
+        s_sparse_layers_cached = 0;
+    }
 
-        if (!is_valid_storage_pos(storage_pos + g_ekc_storage_size)) {
-            g_ekc_storage_size = 0;
-            register_error(ERROR_EKC_STORAGE_TOO_LARGE);
-            return;
+    if (!(s_sparse_layers_cached & layer_bit)) {
+        const uint32_t layer_offset = flash_read_u32(keymap + sizeof(uint32_t)*layer);
+        s_sparse_layer_addr[layer] = keymap + (layer_offset & LAYOUT_LAYER_OFFSET_MASK);
+        if (layer_offset & LAYOUT_LAYER_SPARSE) {
+            s_sparse_layers_sparse |= layer_bit;
         } else {
-            g_ekc_storage_ptr = storage_pos;
+            s_sparse_layers_sparse &= ~layer_bit;
         }
+        s_sparse_layers_cached |= layer_bit;
+    }
+
+    layer_addr = s_sparse_layer_addr[layer];
 
-        storage_pos += g_ekc_storage_size;
+    if (!(s_sparse_layers_sparse & layer_bit)) {
+        return flash_read_word(layer_addr + sizeof(keycode_t)*(8*row + col));
     }
 
+    flash_read(
+        (uint8_t*)&sparse_row,
+        layer_addr + sizeof(layout_sparse_row_t)*row,
+        sizeof(layout_sparse_row_t)
+    );
 
-    // layout section
-    {
-       uint8_t num_layouts;
+    if (!is_bitn_set(sparse_row.present, col)) {
+        return KC_TRNS;
+    }
 
-       storage_pos += LAYOUT_HEADER_SIZE;
-#if NO_SPLIT
-        g_layout_storage_pos[0] = storage_pos;
-#else
-        num_layouts = GET_SETTING(layout.number_layouts);
-        g_layout_storage_pos[0] = storage_pos;
+    return flash_read_word(
+        layer_addr +
+        sizeof(layout_sparse_row_t)*matrix_size +
+        sizeof(keycode_t)*(
+            sparse_row.base +
+            bitset_popcount(sparse_row.present & ((1 << col) - 1))
+        )
+    );
+}
+
+/// Check that a section lies inside the layout storage and that its
+/// contents match its CRC.
+static bit_t layout_check_section(uint8_t section_id) {
+    const uint32_t offset = flash_read_u32(LAYOUT_SECTION_ADDR(section_id, offset));
+    const uint32_t size = flash_read_u32(LAYOUT_SECTION_ADDR(section_id, size));
+
+    if (offset < LAYOUT_INDEX_SIZE || offset > LAYOUT_SIZE || size > LAYOUT_SIZE - offset) {
+        register_error(ERROR_LAYOUT_STORAGE_OUT_OF_BOUNDS);
+        return false;
+    }
+
+    if (
+        crc16_flash_buffer(LAYOUT_ADDR + offset, size) !=
+        layout_get_section_crc(section_id)
+    ) {
+        register_error(ERROR_LAYOUT_SECTION_CRC_MISMATCH);
+        return false;
+    }
+
+    return true;
+}
+
+/// Check that the layouts fit in the RAM tables the firmware was built with,
+/// see `core/build_config.h`.
+static bit_t layout_check_limits(void) {
+    const uint8_t num_layouts = GET_SETTING(layout.number_layouts);
+    uint8_t i;
+
+    if (num_layouts > MAX_NUM_LAYOUTS) {
+        register_error(ERROR_NUM_LAYOUTS_TOO_LARGE);
+        return false;
+    }
+
+    for (i = 0; i < num_layouts; ++i) {
+        if (GET_SETTING(layout.layouts[i].layer_count) > MAX_NUM_LAYERS) {
+            register_error(ERROR_NUM_LAYERS_TOO_LARGE);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if !USE_STATIC_LAYOUT
+/// Check that the layout table matches the layout settings, and that the
+/// keycode array of each layout lies inside the keymaps section.
+static void layout_check_table(void) {
+    const flash_addr_t table_addr = layout_get_section_addr(LAYOUT_SECTION_LAYOUT_TABLE);
+    const flash_addr_t keymaps_start = layout_get_section_addr(LAYOUT_SECTION_KEYMAPS);
+    const flash_addr_t keymaps_end = keymaps_start + layout_get_section_size(LAYOUT_SECTION_KEYMAPS);
+    const uint8_t num_layouts = GET_SETTING(layout.number_layouts);
+    uint8_t i;
+
+    if (
+        layout_get_section_size(LAYOUT_SECTION_LAYOUT_TABLE) <
+        (flash_size_t)num_layouts * sizeof(layout_table_entry_t)
+    ) {
+        register_error(ERROR_LAYOUT_STORAGE_OUT_OF_BOUNDS);
+        return;
+    }
+
+    for (i = 0; i < num_layouts; ++i) {
+        const uint8_t matrix_size = flash_read_byte(LAYOUT_TABLE_ENTRY_ADDR(table_addr, i, matrix_size));
+        const uint8_t layer_count = flash_read_byte(LAYOUT_TABLE_ENTRY_ADDR(table_addr, i, layer_count));
+        const flash_addr_t keymap_addr = layout_get_keymap_addr(i);
+        flash_size_t keymap_size = 8*sizeof(keycode_t) * matrix_size * layer_count;
+
+        if (layout_has_sparse_layers(i)) {
+            // Only the layer offset table is checked here, the layers
+            // themselves are covered by the CRC of the keymaps section.
+            keymap_size = sizeof(uint32_t) * layer_count;
+        }
 
-        if (num_layouts > MAX_NUM_KEYBOARDS) {
-            register_error(ERROR_NUM_LAYOUTS_TOO_LARGE);
+        if (
+            matrix_size != GET_SETTING(layout.layouts[i].matrix_size) ||
+            layer_count != GET_SETTING(layout.layouts[i].layer_count) ||
+            keymap_addr < keymaps_start ||
+            keymap_addr > keymaps_end ||
+            keymap_size > keymaps_end - keymap_addr
+        ) {
+            register_error(ERROR_LAYOUT_STORAGE_OUT_OF_BOUNDS);
             return;
-        } else {
-            // calculate the start of the keyload positions and save them for later
-            for (i = 1; i < num_layouts; ++i) {
-                const uint8_t matrix_size = GET_SETTING(layout.layouts[i-1].matrix_size);
-                const uint8_t layer_count = GET_SETTING(layout.layouts[i-1].layer_count);
-                const flash_addr_t this_layout_size = GET_SETTING(layout.layouts[i].matrix_size);
-
-                // skip the layout HEADER
-                storage_pos += LAYOUT_HEADER_SIZE;
-
-                // skip the layout body, pos should now be set to the start
-                // of the next layout
-                storage_pos += 8*sizeof(keycode_t) * matrix_size * layer_count;
-
-                if (is_valid_storage_pos(storage_pos + this_layout_size - 1)) {
-                    g_layout_storage_pos[i] = storage_pos;
-                } else {
-                    register_error(ERROR_LAYOUT_STORAGE_OUT_OF_BOUNDS);
-                    break;
-                }
-            }
         }
+    }
+}
 #endif
+
+void keyboard_layouts_init(void) {
+    uint8_t section_id;
+
+    g_ekc_storage_size = 0;
+    layout_sparse_cache_clear();
+
+    if (!layout_has_valid_index()) {
+        register_error(ERROR_LAYOUT_FORMAT_INVALID);
+        return;
+    }
+
+    // The pin map is read from a fixed address
+    if (
+        layout_get_section_addr(LAYOUT_SECTION_PIN_MAP) !=
+        LAYOUT_INDEX_ADDR + LAYOUT_INDEX_SIZE
+    ) {
+        register_error(ERROR_LAYOUT_FORMAT_INVALID);
+        return;
     }
+
+    for (section_id = 0; section_id < LAYOUT_SECTION_COUNT; ++section_id) {
+        if (!layout_check_section(section_id)) {
+            return;
+        }
+    }
+
+    g_ekc_storage_ptr = layout_get_section_addr(LAYOUT_SECTION_EKC);
+    g_ekc_storage_size = layout_get_section_size(LAYOUT_SECTION_EKC);
+
+    if (!layout_check_limits()) {
+        return;
+    }
+
+#if USE_STATIC_LAYOUT
+    // The keymaps are in `g_static_layouts`, so only check that they match.
+    static_layout_check();
+#else
+    layout_check_table();
+#endif
 }
 
 bool has_mouse_layers(uint8_t layout_id) {
-   return flash_read_byte(
-      g_layout_storage_pos[layout_id] - LAYOUT_HEADER_SIZE + 0
-   );
+#if USE_STATIC_LAYOUT
+    return g_static_layouts[layout_id].has_mouse_layers;
+#else
+    const flash_addr_t table_addr = layout_get_section_addr(LAYOUT_SECTION_LAYOUT_TABLE);
+    return flash_read_byte(
+        LAYOUT_TABLE_ENTRY_ADDR(table_addr, layout_id, flags)
+    ) & LAYOUT_FLAG_HAS_MOUSE_LAYERS;
+#endif
 }
@@ -21,10 +21,15 @@
 #   define __LAYOUT_PADDING_LOC AT(LAYOUT_ADDR + sizeof(layout))
 #endif
 
+/// The layout index is at the start of the layout storage, and the pin map
+/// section always follows it, so the pin map has a fixed address.
+#define LAYOUT_INDEX_ADDR (flash_addr_t)(LAYOUT_ADDR + 0)
+#define LAYOUT_INDEX_SIZE 64
+
 #ifdef NO_MATRIX
-#   define LAYOUT_PORT_KEY_NUM_MAP_ADDR (flash_addr_t)(LAYOUT_ADDR + 0)
+#   define LAYOUT_PORT_KEY_NUM_MAP_ADDR (flash_addr_t)(LAYOUT_INDEX_ADDR + LAYOUT_INDEX_SIZE)
 #else
-#   define LAYOUT_PORT_ROW_PINS_ADDR    (flash_addr_t)(LAYOUT_ADDR + 0)
+#   define LAYOUT_PORT_ROW_PINS_ADDR    (flash_addr_t)(LAYOUT_INDEX_ADDR + LAYOUT_INDEX_SIZE)
 // #define LAYOUT_PORT_COL_MASKS_ADDR   (flash_addr_t)(LAYOUT_PORT_ROW_PINS_ADDR + MAX_NUM_ROWS)
 // #define LAYOUT_PORT_KEY_NUM_MAP_ADDR (flash_addr_t)(LAYOUT_PORT_COL_MASKS_ADDR + IO_PORT_COUNT)
 #   define LAYOUT_PORT_COL_PINS_ADDR    (flash_addr_t)(LAYOUT_PORT_ROW_PINS_ADDR + MAX_NUM_ROWS)
@@ -38,12 +43,87 @@
 #define LAYOUT_MAX_NUMBER_KEYBOARDS 64
 #define LAYOUT_MAX_NUMBER_DEVICES 64
 
-#define LAYOUT_HEADER_SIZE 1
-
-typedef struct layout_header_t {
-    uint8_t has_mouse_layers: 1;
-    uint8_t reserved0: 7;
-} layout_header_t;
+/// "KP" in little endian
+#define LAYOUT_INDEX_MAGIC 0x504b
+#define LAYOUT_FORMAT_VERSION 2
+
+/// The sections of the layout storage, in the order they are stored.
+typedef enum layout_section_id_t {
+    /// Row/column pins and the (row, col) -> key number map. In virtual mode,
+    /// the `virtual_device_header_t` and key number map of each device.
+    LAYOUT_SECTION_PIN_MAP = 0,
+    /// Extended keycode data, see `g_ekc_storage_ptr`
+    LAYOUT_SECTION_EKC = 1,
+    /// A `layout_table_entry_t` for each layout
+    LAYOUT_SECTION_LAYOUT_TABLE = 2,
+    /// The keycode arrays of all the layouts
+    LAYOUT_SECTION_KEYMAPS = 3,
+    LAYOUT_SECTION_COUNT,
+} layout_section_id_t;
+
+typedef struct layout_section_t {
+    uint32_t offset; ///< offset of the section from `LAYOUT_ADDR`
+    uint32_t size; ///< size of the section in bytes
+    uint16_t crc; ///< `crc16_flash_buffer()` of the section
+    uint8_t _reserved[2];
+} ATTR_PACKED layout_section_t;
+
+/// Table of contents at the start of the layout storage. It is written by
+/// the host software, and lets the firmware find every section and layout
+/// with a direct read instead of walking the chain of variable sized records.
+typedef struct layout_index_t {
+    uint16_t magic; ///< `LAYOUT_INDEX_MAGIC`
+    uint8_t version; ///< `LAYOUT_FORMAT_VERSION`
+    uint8_t section_count; ///< `LAYOUT_SECTION_COUNT`
+    layout_section_t sections[LAYOUT_SECTION_COUNT];
+    uint8_t _reserved[10];
+    uint16_t crc; ///< The CRC over the previous 62 bytes
+} ATTR_PACKED layout_index_t;
+
+KP_STATIC_ASSERT(sizeof(layout_index_t)==LAYOUT_INDEX_SIZE, "internal error");
+
+#define LAYOUT_FLAG_HAS_MOUSE_LAYERS 0x01
+/// The layout's keymap starts with a layer offset table, see
+/// `layout_sparse_row_t`.
+#define LAYOUT_FLAG_SPARSE_LAYERS 0x02
+
+/// Entry of the `LAYOUT_SECTION_LAYOUT_TABLE` section
+typedef struct layout_table_entry_t {
+    /// offset of the layout's keymap from `LAYOUT_ADDR`. Without
+    /// `LAYOUT_FLAG_SPARSE_LAYERS`, the keymap is an array of
+    /// `8 * matrix_size * layer_count` keycodes.
+    uint32_t offset;
+    uint8_t matrix_size;
+    uint8_t layer_count;
+    uint8_t flags; ///< `LAYOUT_FLAG_*`
+    uint8_t _reserved;
+} ATTR_PACKED layout_table_entry_t;
+
+/// Set in a layer offset to mark a sparse layer
+#define LAYOUT_LAYER_SPARSE 0x80000000UL
+#define LAYOUT_LAYER_OFFSET_MASK 0x7fffffffUL
+
+/// Row of a sparse layer.
+///
+/// A layout with `LAYOUT_FLAG_SPARSE_LAYERS` starts with
+/// `uint32_t layer_offsets[layer_count]`, the offset of each layer from the
+/// start of the keymap. A layer without `LAYOUT_LAYER_SPARSE` set is stored
+/// as `8 * matrix_size` keycodes like in a dense layout. A sparse layer is
+/// stored as:
+///
+/// ```
+/// layout_sparse_row_t rows[matrix_size];
+/// keycode_t keycodes[]; // only the keys that are not KC_TRNS
+/// ```
+///
+/// The keycode of (row, col) is `keycodes[base + popcount(present & ((1<<col)-1))]`
+/// if bit `col` of `present` is set, and `KC_TRNS` otherwise.
+typedef struct layout_sparse_row_t {
+    /// index in `keycodes` of the first key of the row
+    uint16_t base;
+    /// bit n is set if the key in column n is stored in `keycodes`
+    uint8_t present;
+} ATTR_PACKED layout_sparse_row_t;
 
 enum vdevice_stats_t {
     STATS_ENABLED = 1,
@@ -65,7 +145,47 @@ KP_STATIC_ASSERT(sizeof(virtual_device_header_t)==256, "internal error");
 // #define LAYOUT_PORT_KEY_NUM_MAP_ADDR (LAYOUT_ADDR + 16)
 
 AT__LAYOUT_ADDR extern const uint8_t g_layout_storage[];
-extern XRAM flash_addr_t g_layout_storage_pos[MAX_NUM_KEYBOARDS];
 
+/// Check the layout index and the CRC of each section, then load the
+/// location of the EKC data.
 void keyboard_layouts_init(void);
+
+/// @return true if the layout storage starts with a valid layout index
+bit_t layout_has_valid_index(void);
+
+/// @return the address of the given `layout_section_id_t` in flash
+flash_addr_t layout_get_section_addr(uint8_t section_id);
+
+/// @return the size of the given `layout_section_id_t` in bytes
+flash_size_t layout_get_section_size(uint8_t section_id);
+
+/// @return the CRC of the given `layout_section_id_t` stored in the index
+uint16_t layout_get_section_crc(uint8_t section_id);
+
+/// @return the address of the keymap of a layout in flash
+flash_addr_t layout_get_keymap_addr(uint8_t layout_id);
+
+/// @return true if the layout is stored with `LAYOUT_FLAG_SPARSE_LAYERS`
+bit_t layout_has_sparse_layers(uint8_t layout_id);
+
+/// Read the keycode of the key at (row, col) in a layer of a layout with
+/// `LAYOUT_FLAG_SPARSE_LAYERS`.
+///
+/// The layer offsets of the last keymap read are cached in RAM, see
+/// `layout_sparse_cache_clear()`.
+///
+/// @param keymap the address of the layout's keymap
+keycode_t layout_read_sparse_keycode(
+    flash_addr_t keymap,
+    uint8_t matrix_size,
+    uint8_t layer,
+    uint8_t row,
+    uint8_t col
+);
+
+/// Forget the cached layer offsets of `layout_read_sparse_keycode()`, must
+/// be called when the layout storage changes. Done by
+/// `keyboard_layouts_init()`.
+void layout_sparse_cache_clear(void);
+
 bool has_mouse_layers(uint8_t layout_id);
@@ -9,6 +9,8 @@
 #include "core/hardware.h"
 #include "core/layout.h"
 #include "core/matrix_interpret.h"
+#include "core/mods.h"
+#include "core/scheduler.h"
 #include "core/timer.h"
 
 #include "key_handlers/key_normal.h"
@@ -16,83 +18,359 @@
 #include "hid_reports/keyboard_report.h"
 #include "hid_reports/mouse_report.h"
 
+/// op used for a plain keycode, which is pressed and then released after the
+/// clear rate
+#define MACRO_OP_TAP 0xff
+
+/// Returned by `macro_operand_size()` for unknown commands
+#define MACRO_OPERAND_INVALID 0xff
+
+/// `macro_instance_t.cache_entry` value for macros that run from flash
+#define MACRO_NOT_CACHED 0xff
+
+/// Returned by `macro_cache_fill()` when the program doesn't fit in the free
+/// part of the cache
+#define MACRO_CACHE_NO_ROOM 0xff
+
+#define MACRO_OP(cmd) ((uint8_t)((cmd) & 0xff))
+
+#define DEFAULT_MACRO_RATE 5
+#define DEFAULT_MACRO_CLEAR_RATE 2
+
 /*********************************************************************
- *                        macro repeat stack                         *
+ *                       macro state variables                       *
+ *********************************************************************/
+
+typedef struct macro_instance_t {
+    /// address of the macro program, used to identify the macro
+    uint16_t ekc_addr;
+    /// instruction index if the macro is cached, otherwise its flash address
+    uint16_t pc;
+    /// time the last step ran, the next step is due `rate` ms after it
+    uint32_t step_start;
+    uint16_t rate;
+    uint16_t clear_rate;
+    keycode_t clear_kc;
+    uint8_t kb_id;
+    uint8_t cache_entry;
+    uint8_t is_running;
+    /// set by `MACRO_CMD_SET_BURST`
+    uint8_t is_burst;
+    /// keys and mods pressed by the last burst frame
+    uint8_t burst_len;
+    uint8_t burst_mods;
+    uint8_t burst_keys[MACRO_BURST_MAX_KEYS];
+    // NOTE: repeat stack doesn't use the lowest in this array
+    uint8_t repeat_stack_ptr;
+    uint16_t repeat_stack[MACRO_REPEAT_STACK_SIZE];
+} macro_instance_t;
+
+static XRAM macro_instance_t s_macros[MAX_NUM_MACRO_INSTANCES];
+
+/*********************************************************************
+ *                      macro instruction cache                      *
  *********************************************************************/
-#define REPEAT_STACK_SIZE 8
 
-// NOTE: repeat stack doesn't use the lowest in this array
-static XRAM uint16_t repeat_stack[REPEAT_STACK_SIZE];
-static XRAM uint8_t repeat_stack_ptr;
+static XRAM macro_instr_t s_instr_cache[MACRO_CACHE_SIZE];
+static XRAM macro_cache_entry_t s_cache_entries[MACRO_CACHE_ENTRIES];
+static XRAM uint8_t s_cache_entries_len;
+static XRAM uint8_t s_cache_used;
+
+KP_STATIC_ASSERT(
+    MACRO_CACHE_SIZE < MACRO_CACHE_NO_ROOM,
+    "MACRO_CACHE_SIZE must be less than 255"
+);
+
+/// Returns the number of operand bytes that follow a macro command.
+static uint8_t macro_operand_size(uint8_t op) {
+    switch (op) {
+        case MACRO_OP(MACRO_CMD_PRESS):
+        case MACRO_OP(MACRO_CMD_RELEASE):
+        case MACRO_OP(MACRO_CMD_SET_RATE):
+        case MACRO_OP(MACRO_CMD_SET_CLEAR_RATE):
+        case MACRO_OP(MACRO_CMD_SET_BURST):
+        case MACRO_OP(MACRO_CMD_REPEAT_BLOCK):
+        case MACRO_OP(MACRO_CMD_REPEAT_JMP):
+            return sizeof(uint16_t);
+        case MACRO_OP(MACRO_CMD_MOUSE_MOVE):
+            return sizeof(macro_cmd_mouse_move_t);
+        case MACRO_OP(MACRO_CMD_MOUSE_WHEEL):
+            return sizeof(macro_cmd_mouse_wheel_t);
+        case MACRO_OP(MACRO_CMD_FINISH):
+        case MACRO_OP(MACRO_CMD_CLEAR_KEYBOARD):
+        case MACRO_OP(MACRO_CMD_CLEAR_MOUSE):
+            return 0;
+        default:
+            return MACRO_OPERAND_INVALID;
+    }
+}
+
+/// Check that a decoded instruction is a plain keycode or a known command
+static bit_t macro_is_valid_op(uint8_t op) {
+    return op == MACRO_OP_TAP || macro_operand_size(op) != MACRO_OPERAND_INVALID;
+}
+
+/// Returns the size in bytes of the bytecode for a (valid) decoded instruction
+static uint8_t macro_instr_size(uint8_t op) {
+    if (op == MACRO_OP_TAP) {
+        return sizeof(keycode_t);
+    }
+    return sizeof(keycode_t) + macro_operand_size(op);
+}
+
+/// Decode the instruction at `addr`. The target of a jump is stored as an
+/// absolute address.
+///
+/// For unknown commands only `op` is filled in.
+///
+/// @return the size of the instruction in bytes, or 0 if it couldn't be read
+static uint8_t macro_decode(uint16_t addr, macro_instr_t *instr) REENT {
+    keycode_t keycode;
+    uint8_t size;
 
-static uint8_t macro_stack_push(uint16_t x) {
-    if (repeat_stack_ptr < (REPEAT_STACK_SIZE-1)) {
-        repeat_stack[++repeat_stack_ptr] = x;
+    if (get_ekc_data((uint8_t*)&keycode, addr, sizeof(keycode_t))) {
         return 0;
-    } else {
-        return 1;
     }
+
+    // if (modkey_keycodes.checker(keycode)) {
+    if (keycode < KC_MACRO_CMD_START_ADDR) {
+        instr->op = MACRO_OP_TAP;
+        instr->arg.keycode = keycode;
+        return sizeof(keycode_t);
+    }
+
+    instr->op = MACRO_OP(keycode);
+    size = macro_operand_size(instr->op);
+
+    if (size == MACRO_OPERAND_INVALID) {
+        return sizeof(keycode_t);
+    }
+
+    if (size != 0 &&
+        get_ekc_data((uint8_t*)&instr->arg, addr+sizeof(keycode_t), size)
+    ) {
+        return 0;
+    }
+
+    size += sizeof(keycode_t);
+
+    if (instr->op == MACRO_OP(MACRO_CMD_REPEAT_JMP)) {
+        // jumps are relative to the end of the jump instruction
+        instr->arg.value = addr + size + instr->arg.value;
+    }
+
+    return size;
+}
+
+/// Check if the rest of a macro program, from `addr`, ends within `max_len`
+/// instructions.
+///
+/// @return `MACRO_CACHE_NO_ROOM` if it does, otherwise 0
+static uint8_t macro_cache_program_fits(uint16_t addr, uint8_t max_len) REENT {
+    macro_instr_t instr;
+
+    while (max_len--) {
+        const uint8_t size = macro_decode(addr, &instr);
+        if (size == 0 || !macro_is_valid_op(instr.op)) {
+            return 0;
+        }
+        if (instr.op == MACRO_OP(MACRO_CMD_FINISH)) {
+            return MACRO_CACHE_NO_ROOM;
+        }
+        addr += size;
+    }
+
+    return 0;
 }
 
-static uint16_t macro_stack_peek(void) {
-    return repeat_stack[repeat_stack_ptr];
+/// Try to decode the macro program at `ekc_addr` into the cache starting at
+/// `start`. Jump targets are converted to instruction indices.
+///
+/// @return the number of instructions, `MACRO_CACHE_NO_ROOM` if the program
+///     would fit in an empty cache but not after `start`, or 0 if the
+///     program can't be cached
+static uint8_t macro_cache_fill(uint16_t ekc_addr, uint8_t start) REENT {
+    uint16_t addr = ekc_addr;
+    uint8_t len = 0;
+    uint8_t i;
+
+    while (1) {
+        macro_instr_t XRAM* instr = &s_instr_cache[start + len];
+        uint8_t size;
+
+        if (start + len >= MACRO_CACHE_SIZE) {
+            return (start != 0) ?
+                macro_cache_program_fits(addr, MACRO_CACHE_SIZE - len) :
+                0;
+        }
+
+        size = macro_decode(addr, instr);
+        if (size == 0 || !macro_is_valid_op(instr->op)) {
+            // errors are reported when the macro runs from flash
+            return 0;
+        }
+
+        addr += size;
+        len++;
+
+        if (instr->op == MACRO_OP(MACRO_CMD_FINISH)) {
+            break;
+        }
+    }
+
+    // convert the jump target addresses to instruction indices
+    for (i = 0; i < len; ++i) {
+        macro_instr_t XRAM* jmp = &s_instr_cache[start + i];
+        uint8_t target;
+
+        if (jmp->op != MACRO_OP(MACRO_CMD_REPEAT_JMP)) {
+            continue;
+        }
+
+        addr = ekc_addr;
+        for (target = 0; target < len; ++target) {
+            if (addr == jmp->arg.value) {
+                break;
+            }
+            addr += macro_instr_size(s_instr_cache[start + target].op);
+        }
+
+        if (target == len) {
+            // jump to somewhere outside the program
+            return 0;
+        }
+
+        jmp->arg.value = target;
+    }
+
+    return len;
 }
 
-static uint16_t macro_stack_dec(void) {
-    repeat_stack[repeat_stack_ptr] -= 1;
-    return repeat_stack[repeat_stack_ptr];
+/// Remove all the programs from the instruction cache. This can only be done
+/// when none of the running macros are using it.
+///
+/// @return true if the cache was cleared
+static bit_t macro_cache_clear(void) {
+    uint8_t i;
+
+    for (i = 0; i < MAX_NUM_MACRO_INSTANCES; ++i) {
+        if (s_macros[i].is_running &&
+            s_macros[i].cache_entry != MACRO_NOT_CACHED) {
+            return false;
+        }
+    }
+
+    s_cache_entries_len = 0;
+    s_cache_used = 0;
+    return true;
 }
 
-static void macro_stack_pop(void) {
-    if (repeat_stack_ptr > 0) {
-        repeat_stack_ptr--;
+/// Find the macro program at `ekc_addr` in the instruction cache, decoding it
+/// into the cache if this is the first time it is run.
+///
+/// @return the index of the cache entry, or `MACRO_NOT_CACHED`
+static uint8_t macro_cache_load(uint16_t ekc_addr) REENT {
+    uint8_t i;
+    uint8_t len;
+
+    for (i = 0; i < s_cache_entries_len; ++i) {
+        if (s_cache_entries[i].ekc_addr == ekc_addr) {
+            return i;
+        }
     }
+
+    if (s_cache_entries_len >= MACRO_CACHE_ENTRIES) {
+        // out of entries
+        if (!macro_cache_clear()) {
+            return MACRO_NOT_CACHED;
+        }
+    }
+
+    len = macro_cache_fill(ekc_addr, s_cache_used);
+    if (len == MACRO_CACHE_NO_ROOM) {
+        // out of instruction space, but the program fits in an empty cache
+        if (!macro_cache_clear()) {
+            return MACRO_NOT_CACHED;
+        }
+        len = macro_cache_fill(ekc_addr, 0);
+    }
+    if (len == 0) {
+        return MACRO_NOT_CACHED;
+    }
+
+    s_cache_entries[s_cache_entries_len].ekc_addr = ekc_addr;
+    s_cache_entries[s_cache_entries_len].start = s_cache_used;
+    s_cache_entries[s_cache_entries_len].len = len;
+    s_cache_used += len;
+
+    return s_cache_entries_len++;
 }
 
 /*********************************************************************
- *                       macro state variables                       *
+ *                        macro repeat stack                         *
  *********************************************************************/
 
-static XRAM uint16_t macro_rate;
-static XRAM uint16_t macro_clear_rate;
-static XRAM uint16_t data_offset;
-static XRAM uint8_t is_macro_running;
-static XRAM uint32_t macro_delay_start;
-static XRAM keycode_t macro_clear_kc;
-static XRAM uint8_t macro_kb_id;
+static uint8_t macro_stack_push(macro_instance_t XRAM* macro, uint16_t x) {
+    if (macro->repeat_stack_ptr < (MACRO_REPEAT_STACK_SIZE-1)) {
+        macro->repeat_stack[++macro->repeat_stack_ptr] = x;
+        return 0;
+    } else {
+        return 1;
+    }
+}
 
-/// Run the macro program at the given address
-void call_macro(uint16_t ekc_addr, uint8_t kb_id) {
-    if (!is_macro_running) {
-        is_macro_running = true;
-        data_offset = ekc_addr;
-        macro_rate = 5;
-        macro_clear_rate = 2;
-        repeat_stack_ptr = 0;
-        macro_clear_kc = KC_NONE;
-        macro_kb_id = kb_id;
-        macro_delay_start = timer_read_ms();
+static uint16_t macro_stack_peek(macro_instance_t XRAM* macro) {
+    return macro->repeat_stack[macro->repeat_stack_ptr];
+}
+
+static uint16_t macro_stack_dec(macro_instance_t XRAM* macro) {
+    macro->repeat_stack[macro->repeat_stack_ptr] -= 1;
+    return macro->repeat_stack[macro->repeat_stack_ptr];
+}
 
-        // set_keyboard_report_mode(KEYBOARD_REPORT_MODE_6KRO);
-        // reset_keyboard_reports();
+static void macro_stack_pop(macro_instance_t XRAM* macro) {
+    if (macro->repeat_stack_ptr > 0) {
+        macro->repeat_stack_ptr--;
     }
 }
 
-static uint8_t macro_get_data(uint8_t* data, uint8_t size) {
-    uint8_t err = get_ekc_data(data, data_offset, size);
-    if (err) {
-        macro_abort();
-        return err;
+/*********************************************************************
+ *                           macro control                           *
+ *********************************************************************/
+
+void macro_init(void) {
+    memset(s_macros, 0, sizeof(s_macros));
+    s_cache_entries_len = 0;
+    s_cache_used = 0;
+}
+
+static void macro_release_clear_kc(macro_instance_t XRAM* macro) {
+    if (macro->clear_kc != KC_NONE) {
+        queue_keycode_event(macro->clear_kc, EVENT_RELEASED, macro->kb_id);
+        macro->clear_kc = KC_NONE;
     }
-    data_offset += size;
-    return 0;
 }
 
-void macro_abort(void) {
-    if (!is_macro_running) {
+/// Remove the keys of the last burst frame from the keyboard report.
+static void macro_burst_release(macro_instance_t XRAM* macro) {
+    uint8_t i;
+
+    if (macro->burst_len == 0) {
         return;
     }
 
+    for (i = 0; i < macro->burst_len; ++i) {
+        del_keycode(macro->burst_keys[i]);
+    }
+    del_fake_mods(macro->burst_mods);
+    apply_mods();
+
+    macro->burst_len = 0;
+}
+
+static void macro_abort(macro_instance_t XRAM* macro) {
+    macro_burst_release(macro);
+
     // reset_keyboard_reports();
     // reset_mouse_report();
 
@@ -100,110 +378,395 @@ void macro_abort(void) {
 
     // // restore the keyboard report mode
 
-    is_macro_running = false;
+    macro->is_running = false;
 }
 
-// returns nonzero if the macro should immediate process the next step
-static uint8_t macro_step(void) REENT {
-    uint8_t err;
-    keycode_t keycode;
-    macro_delay_start = timer_read_ms();
+/// Run the macro program at the given address
+void call_macro(uint16_t ekc_addr, uint8_t kb_id) {
+    macro_instance_t XRAM* macro = NULL;
+    uint8_t i;
+
+    for (i = 0; i < MAX_NUM_MACRO_INSTANCES; ++i) {
+        macro_instance_t XRAM* this_macro = &s_macros[i];
+        if (!this_macro->is_running) {
+            if (macro == NULL) {
+                macro = this_macro;
+            }
+        } else if (this_macro->ekc_addr == ekc_addr &&
+                   this_macro->kb_id == kb_id) {
+            // restart the macro if it is already running
+            macro_release_clear_kc(this_macro);
+            macro_abort(this_macro);
+            macro = this_macro;
+            break;
+        }
+    }
 
-    err = macro_get_data((uint8_t*)&keycode, sizeof(keycode_t));
-    if (err) return 0;
+    if (macro == NULL) {
+        // all the macro instances are in use
+        return;
+    }
 
-    // if (modkey_keycodes.checker(keycode)) {
-    if (keycode < KC_MACRO_CMD_START_ADDR) {
-        queue_keycode_event(keycode, EVENT_PRESSED, macro_kb_id);
-        macro_clear_kc = keycode;
-    } else if (keycode == MACRO_CMD_PRESS) {
-        err = macro_get_data((uint8_t*)&keycode, sizeof(keycode_t));
-        if (err) return 0;
-        queue_keycode_event(keycode, EVENT_PRESSED, macro_kb_id);
-    } else if (keycode == MACRO_CMD_RELEASE) {
-        err = macro_get_data((uint8_t*)&keycode, sizeof(keycode_t));
-        if (err) return 0;
-        queue_keycode_event(keycode, EVENT_RELEASED, macro_kb_id);
-    } else if (keycode == MACRO_CMD_SET_RATE) {
-        err = macro_get_data((uint8_t*)&macro_rate, sizeof(macro_rate));
-        if (err) return 0;
-        return 1;
-    } else if (keycode == MACRO_CMD_SET_CLEAR_RATE) {
-        err = macro_get_data((uint8_t*)&macro_clear_rate, sizeof(macro_clear_rate));
-        if (err) return 0;
-        return 1;
-    } else if (keycode == MACRO_CMD_CLEAR_MOUSE) {
-        reset_mouse_report();
-    } else if (keycode == MACRO_CMD_CLEAR_KEYBOARD) {
-        reset_keyboard_reports();
-    } else if (keycode == MACRO_CMD_REPEAT_BLOCK) {
-        uint16_t repeat_count;
-        err = macro_get_data((uint8_t*)&repeat_count, sizeof(uint16_t));
-        if (err) return 0;
-
-        err = macro_stack_push(repeat_count);
-        if (err) {
-            macro_abort();
-            return 0;
+    macro->cache_entry = macro_cache_load(ekc_addr);
+    macro->ekc_addr = ekc_addr;
+    macro->pc = (macro->cache_entry == MACRO_NOT_CACHED) ? ekc_addr : 0;
+    macro->rate = DEFAULT_MACRO_RATE;
+    macro->clear_rate = DEFAULT_MACRO_CLEAR_RATE;
+    macro->repeat_stack_ptr = 0;
+    macro->clear_kc = KC_NONE;
+    macro->is_burst = false;
+    macro->burst_len = 0;
+    macro->kb_id = kb_id;
+    macro->step_start = timer_read_ms();
+    macro->is_running = true;
+}
+
+void macro_stop(uint16_t ekc_addr, uint8_t kb_id) {
+    uint8_t i;
+    for (i = 0; i < MAX_NUM_MACRO_INSTANCES; ++i) {
+        macro_instance_t XRAM* macro = &s_macros[i];
+        if (macro->is_running &&
+            macro->ekc_addr == ekc_addr &&
+            macro->kb_id == kb_id) {
+            macro_release_clear_kc(macro);
+            macro_abort(macro);
         }
-        return 1;
-    } else if (keycode == MACRO_CMD_REPEAT_JMP) {
-        int16_t rel_jump;
-        err = macro_get_data((uint8_t*)&rel_jump, sizeof(int16_t));
-        if (err) return 0;
-
-        if (macro_stack_peek() == 0) {
-            // jump forever
-            data_offset += rel_jump;
-        } else if (macro_stack_dec() > 0) {
-            // jump
-            data_offset += rel_jump;
-        } else {
-            // no jump, continue at instruction after jmp command
-            macro_stack_pop();
+    }
+}
+
+void macro_cancel_keyboard(uint8_t kb_id) {
+    uint8_t i;
+    for (i = 0; i < MAX_NUM_MACRO_INSTANCES; ++i) {
+        macro_instance_t XRAM* macro = &s_macros[i];
+        if (!macro->is_running || macro->kb_id != kb_id) {
+            continue;
         }
-        return 1;
-    } else if (keycode == MACRO_CMD_MOUSE_MOVE) {
-        err = macro_get_data((uint8_t*)&g_mouse_report.x, sizeof(int16_t)*2);
-        if (err) return 0;
-        g_report_pending_mouse = true;
-    } else if (keycode == MACRO_CMD_MOUSE_WHEEL) {
-        err  = macro_get_data((uint8_t*)&g_mouse_report.wheel_x, sizeof(int8_t));
-        err  = macro_get_data((uint8_t*)&g_mouse_report.wheel_y, sizeof(int8_t));
-        if (err) return 0;
-        g_report_pending_mouse = true;
-    } else if (keycode == MACRO_CMD_FINISH) {
-        macro_abort();
+
+        if (macro->clear_kc != KC_NONE) {
+            keyboard_trigger_event(macro->clear_kc, EVENT_RELEASED);
+            macro->clear_kc = KC_NONE;
+        }
+
+        macro_abort(macro);
+    }
+}
+
+/// Get the next instruction of the macro, from the cache if possible.
+static uint8_t macro_fetch(macro_instance_t XRAM* macro, macro_instr_t *instr) REENT {
+    if (macro->cache_entry != MACRO_NOT_CACHED) {
+        const macro_cache_entry_t XRAM* entry =
+            &s_cache_entries[macro->cache_entry];
+        if (macro->pc >= entry->len) {
+            return 1;
+        }
+        memcpy(instr, &s_instr_cache[entry->start + macro->pc], sizeof(macro_instr_t));
+        macro->pc++;
     } else {
-        // Unknown command
-        register_error(ERROR_MACRO_CMD_ERROR);
-        reset_mouse_report();
-        reset_keyboard_reports();
-        macro_abort();
+        const uint8_t size = macro_decode(macro->pc, instr);
+        if (size == 0) {
+            return 1;
+        }
+        macro->pc += size;
+    }
+    return 0;
+}
+
+// returns nonzero if the macro should immediate process the next step
+static uint8_t macro_step(macro_instance_t XRAM* macro) REENT {
+    macro_instr_t instr;
+
+    if (macro_fetch(macro, &instr)) {
+        macro_abort(macro);
+        return 0;
+    }
+
+    switch (instr.op) {
+        case MACRO_OP_TAP: {
+            queue_keycode_event(instr.arg.keycode, EVENT_PRESSED, macro->kb_id);
+            macro->clear_kc = instr.arg.keycode;
+        } break;
+
+        case MACRO_OP(MACRO_CMD_PRESS): {
+            queue_keycode_event(instr.arg.keycode, EVENT_PRESSED, macro->kb_id);
+        } break;
+
+        case MACRO_OP(MACRO_CMD_RELEASE): {
+            queue_keycode_event(instr.arg.keycode, EVENT_RELEASED, macro->kb_id);
+        } break;
+
+        case MACRO_OP(MACRO_CMD_SET_RATE): {
+            macro->rate = instr.arg.value;
+        } return 1;
+
+        case MACRO_OP(MACRO_CMD_SET_CLEAR_RATE): {
+            macro->clear_rate = instr.arg.value;
+        } return 1;
+
+        case MACRO_OP(MACRO_CMD_SET_BURST): {
+            macro->is_burst = (instr.arg.value != 0);
+        } return 1;
+
+        case MACRO_OP(MACRO_CMD_CLEAR_MOUSE): {
+            reset_mouse_report();
+        } break;
+
+        case MACRO_OP(MACRO_CMD_CLEAR_KEYBOARD): {
+            reset_keyboard_reports();
+        } break;
+
+        case MACRO_OP(MACRO_CMD_REPEAT_BLOCK): {
+            if (macro_stack_push(macro, instr.arg.value)) {
+                macro_abort(macro);
+                return 0;
+            }
+        } return 1;
+
+        case MACRO_OP(MACRO_CMD_REPEAT_JMP): {
+            if (macro_stack_peek(macro) == 0) {
+                // jump forever
+                macro->pc = instr.arg.value;
+            } else if (macro_stack_dec(macro) > 0) {
+                // jump
+                macro->pc = instr.arg.value;
+            } else {
+                // no jump, continue at instruction after jmp command
+                macro_stack_pop(macro);
+            }
+        } return 1;
+
+        case MACRO_OP(MACRO_CMD_MOUSE_MOVE): {
+            g_mouse_report.x = instr.arg.mouse_move.x;
+            g_mouse_report.y = instr.arg.mouse_move.y;
+            g_report_pending_mouse = true;
+        } break;
+
+        case MACRO_OP(MACRO_CMD_MOUSE_WHEEL): {
+            g_mouse_report.wheel_x = instr.arg.mouse_wheel.x;
+            g_mouse_report.wheel_y = instr.arg.mouse_wheel.y;
+            g_report_pending_mouse = true;
+        } break;
+
+        case MACRO_OP(MACRO_CMD_FINISH): {
+            macro_abort(macro);
+        } break;
+
+        default: {
+            // Unknown command
+            register_error(ERROR_MACRO_CMD_ERROR);
+            reset_mouse_report();
+            reset_keyboard_reports();
+            macro_abort(macro);
+        } break;
     }
 
     return 0;
 }
 
-bool macro_task(void) {
-    if (!is_macro_running) {
-        return false;
+/// Get the number of keys a burst frame can add to the 6KRO report.
+///
+/// The keys go in the empty slots, so only these many can be added without
+/// replacing a key or upgrading to the NKRO report in the middle of a frame.
+static uint8_t macro_burst_boot_slots(void) {
+    uint8_t count = 0;
+    uint8_t i;
+    for (i = 0; i < BOOT_REPORT_KEY_COUNT; ++i) {
+        if (g_boot_keyboard_report.keys[i] == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static bit_t macro_burst_has_key(const uint8_t *keys, uint8_t len, uint8_t key) {
+    uint8_t i;
+    for (i = 0; i < len; ++i) {
+        if (keys[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Send the next frame of a macro in burst mode.
+///
+/// The keys pressed in the last frame are released, and as many of the
+/// following keycodes as possible are pressed in the same report. Keys are
+/// only packed together if the host will see them in the same order as they
+/// appear in the macro:
+///
+/// * In the 6KRO report, the keys fill the empty slots in the order they are
+///   added, and the host handles them in slot order. In the NKRO report the
+///   host sees the new keys in ascending order, so there the keycodes must
+///   be increasing.
+/// * The modifiers apply to the whole report, so they must all match.
+/// * A key released in this report, or already pressed by it, can't be
+///   pressed again until the next one.
+///
+/// @return true if the keyboard report was changed
+static bit_t macro_burst_frame(macro_instance_t XRAM* macro) REENT {
+    uint8_t prev_keys[MACRO_BURST_MAX_KEYS];
+    const uint8_t prev_len = macro->burst_len;
+    const uint8_t mode = get_keyboard_report_mode();
+    uint8_t is_bitmap;
+    uint8_t max_len;
+    uint8_t len = 0;
+    uint8_t last_key = 0;
+    uint8_t i;
+
+    memcpy(prev_keys, macro->burst_keys, prev_len);
+    macro_burst_release(macro);
+
+    is_bitmap = (
+        mode == KEYBOARD_REPORT_MODE_NKRO ||
+        mode == KEYBOARD_REPORT_MODE_UPGRADE
+    );
+    max_len = is_bitmap ? MACRO_BURST_MAX_KEYS : macro_burst_boot_slots();
+    if (max_len > MACRO_BURST_MAX_KEYS) {
+        max_len = MACRO_BURST_MAX_KEYS;
     }
 
-    {
-        uint32_t elapsed_time = (uint32_t)(timer_read_ms() - macro_delay_start);
+    while (len < max_len) {
+        const uint16_t pc = macro->pc;
+        macro_instr_t instr;
+        uint8_t key;
+        uint8_t mods;
+
+        if (macro_fetch(macro, &instr)) {
+            macro->pc = pc;
+            break;
+        }
 
-        if (macro_clear_kc != KC_NONE && elapsed_time >= macro_clear_rate) {
-            queue_keycode_event(macro_clear_kc, EVENT_RELEASED, macro_kb_id);
-            macro_clear_kc = KC_NONE;
+        key = (uint8_t)instr.arg.keycode;
+        mods = MODKEY_MODS(instr.arg.keycode);
+
+        if (instr.op != MACRO_OP_TAP ||
+            !IS_MODKEY(instr.arg.keycode) ||
+            key == 0 ||
+            (is_bitmap && key <= last_key) ||
+            (len != 0 && mods != macro->burst_mods)
+        ) {
+            macro->pc = pc;
+            break;
         }
 
-        if (elapsed_time >= macro_rate) {
-            while ( macro_step() );
+        if (macro_burst_has_key(prev_keys, prev_len, key) ||
+            macro_burst_has_key(macro->burst_keys, len, key)
+        ) {
+            // the key needs to be released for one frame first
+            macro->pc = pc;
+            break;
         }
+
+        macro->burst_keys[len++] = key;
+        macro->burst_mods = mods;
+        last_key = key;
+    }
+
+    if (len != 0) {
+        add_fake_mods(macro->burst_mods);
+        apply_mods();
+        for (i = 0; i < len; ++i) {
+            add_keycode(macro->burst_keys[i]);
+        }
+        macro->burst_len = len;
     }
 
-    interpret_all_keyboard_matrices();
+    return (prev_len != 0) || (len != 0);
+}
+
+/// Run a step of a macro in burst mode. Commands are run as normal until a
+/// report frame is produced.
+///
+/// @return true if the macro changed the report or queued key events
+static bit_t macro_burst_step(macro_instance_t XRAM* macro) REENT {
+    // a burst frame is sent as soon as the last one has gone out
+    if (is_keyboard_report_pending()) {
+        return false;
+    }
+
+    macro_release_clear_kc(macro);
+
+    while (macro->is_running && macro->is_burst) {
+        if (macro_burst_frame(macro)) {
+            return true;
+        }
+
+        if (!macro_step(macro)) {
+            return true;
+        }
+    }
 
     return true;
 }
+
+bool macro_task(void) {
+    uint8_t i;
+    bit_t is_running = false;
+    bit_t has_events = false;
+    // burst frames go out as fast as the reports are sent
+    bit_t has_burst = false;
+    // time left until the next step or clear of any macro
+    uint16_t time_left = UINT16_MAX;
+    const uint32_t current_time = timer_read_ms();
+
+    for (i = 0; i < MAX_NUM_MACRO_INSTANCES; ++i) {
+        macro_instance_t XRAM* macro = &s_macros[i];
+        uint32_t elapsed_time;
+
+        if (!macro->is_running) {
+            continue;
+        }
+
+        is_running = true;
+
+        if (macro->is_burst) {
+            has_events |= macro_burst_step(macro);
+            has_burst = true;
+            continue;
+        }
+
+        elapsed_time = (uint32_t)(current_time - macro->step_start);
+
+        if (macro->clear_kc != KC_NONE && elapsed_time >= macro->clear_rate) {
+            macro_release_clear_kc(macro);
+            has_events = true;
+        }
+
+        if (elapsed_time >= macro->rate) {
+            // make sure a tapped key is released before the next step even
+            // if the clear rate is longer than the macro rate
+            macro_release_clear_kc(macro);
+            macro->step_start = current_time;
+            // stop early if the macro switched to burst mode
+            while ( macro_step(macro) && !macro->is_burst );
+            has_events = true;
+            elapsed_time = 0;
+        }
+
+        if (macro->is_burst) {
+            has_burst = true;
+        } else if (macro->is_running) {
+            if (macro->rate - elapsed_time < time_left) {
+                time_left = macro->rate - elapsed_time;
+            }
+            if (
+                macro->clear_kc != KC_NONE &&
+                elapsed_time < macro->clear_rate &&
+                macro->clear_rate - elapsed_time < time_left
+            ) {
+                time_left = macro->clear_rate - elapsed_time;
+            }
+        }
+    }
+
+    // Only need to run the interpreter if a macro generated events
+    if (has_events) {
+        interpret_all_keyboard_matrices();
+    }
+
+    if (is_running && !has_burst) {
+        scheduler_wake_at((uint16_t)current_time + time_left);
+    }
+
+    return is_running;
+}
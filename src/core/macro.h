@@ -24,6 +24,7 @@ enum {
     MACRO_CMD_CLEAR_MOUSE       = KC_MACRO_CMD_START_ADDR | 0x07,
 
     MACRO_CMD_SET_CLEAR_RATE    = KC_MACRO_CMD_START_ADDR | 0x08,
+    MACRO_CMD_SET_BURST         = KC_MACRO_CMD_START_ADDR | 0x09,
 
     // macro mouse control commands
     MACRO_CMD_MOUSE_MOVE        = KC_MACRO_CMD_START_ADDR | 0x10,
@@ -40,6 +41,73 @@ typedef struct macro_cmd_mouse_wheel_t {
     int8_t y;
 } macro_cmd_mouse_wheel_t ;
 
+/// Number of macros that can run at the same time.
+#ifndef MAX_NUM_MACRO_INSTANCES
+    #define MAX_NUM_MACRO_INSTANCES 2
+#endif
+
+/// Number of decoded instructions that can be held in the macro instruction
+/// cache. Each instruction uses `sizeof(macro_instr_t)` bytes of RAM.
+#ifndef MACRO_CACHE_SIZE
+    #define MACRO_CACHE_SIZE 24
+#endif
+
+/// Number of different macro programs that can be held in the cache.
+#ifndef MACRO_CACHE_ENTRIES
+    #define MACRO_CACHE_ENTRIES 4
+#endif
+
+#define MACRO_REPEAT_STACK_SIZE 8
+
+/// Maximum number of keys pressed in a single report frame in burst mode.
+/// This is the size of the 6KRO report, so bursts never force an upgrade
+/// to the NKRO report.
+#define MACRO_BURST_MAX_KEYS 6
+
+/// A decoded macro instruction.
+///
+/// The first time a macro runs its bytecode is decoded into an array of these
+/// in the instruction cache, so running a step doesn't need to read from
+/// flash. Jump offsets are converted to the index of their target instruction.
+typedef struct macro_instr_t {
+    /// The low byte of the `MACRO_CMD_*` value, or `MACRO_OP_TAP`
+    uint8_t op;
+    union {
+        keycode_t keycode;
+        uint16_t value;
+        macro_cmd_mouse_move_t mouse_move;
+        macro_cmd_mouse_wheel_t mouse_wheel;
+    } arg;
+} ATTR_PACKED macro_instr_t;
+
+/// A macro program in the instruction cache
+typedef struct macro_cache_entry_t {
+    uint16_t ekc_addr;
+    /// Index of its first instruction in the cache
+    uint8_t start;
+    /// Number of instructions
+    uint8_t len;
+} macro_cache_entry_t;
+
+/// Reset all running macros and clear the instruction cache. Must be called
+/// when the layout is reloaded.
+void macro_init(void);
+
+/// Run the macros whose next step is due.
+///
+/// @return true if any macros are running
 bool macro_task(void);
+
+/// Start running the macro program at the given address. If the same macro is
+/// already running on this keyboard, it is restarted.
 void call_macro(uint16_t ekc_addr, uint8_t kb_id);
-void macro_abort(void);
+
+/// Stop the macro program at the given address if it is running on the given
+/// keyboard.
+void macro_stop(uint16_t ekc_addr, uint8_t kb_id);
+
+/// Stop all the macros that were started by the given keyboard.
+///
+/// Used when a keyboard is unloaded from its slot, the last key pressed by the
+/// macros is released immediately.
+void macro_cancel_keyboard(uint8_t kb_id);
@@ -24,9 +24,14 @@
 
 #include <string.h>
 
+#include "core/combo.h"
 #include "core/error.h"
 #include "core/layout.h"
+#include "core/macro.h"
+#include "core/matrix_packet.h"
 #include "core/packet.h"
+#include "core/scheduler.h"
+#include "core/static_layout.h"
 #include "core/timer.h"
 // #include "core/usb_commands.h"
 #include "core/util.h"
@@ -34,11 +39,30 @@
 #include "key_handlers/key_handlers.h"
 #include "key_handlers/key_hold.h"
 
-#include "hid_reports/keyboard_report.h"
+#include "hid_reports/hid_reports.h"
+
+KP_STATIC_ASSERT(
+    MAX_NUM_KEYBOARD_SLOTS > 0 && MAX_NUM_KEYBOARD_SLOTS < INVALID_DEVICE_ID,
+    "MAX_NUM_KEYBOARD_SLOTS must be between 1 and 254"
+);
+KP_STATIC_ASSERT(
+    MAX_NUM_LAYOUTS > 0 && MAX_NUM_LAYOUTS <= MAX_NUM_KEYBOARDS,
+    "MAX_NUM_LAYOUTS must be between 1 and MAX_NUM_KEYBOARDS"
+);
+KP_STATIC_ASSERT(
+    MAX_NUM_LAYERS > 0 && MAX_NUM_LAYERS <= 8*sizeof(layer_mask_t),
+    "MAX_NUM_LAYERS must fit in layer_mask_t"
+);
 
 XRAM keyboard_t g_keyboard_slots[MAX_NUM_KEYBOARD_SLOTS];
-XRAM uint8_t s_slot_id_map[MAX_NUM_KEYBOARDS];
-XRAM uint8_t s_slot_fifo_pos;
+XRAM buffered_keys_t g_buffered_keys;
+XRAM uint8_t s_slot_id_map[MAX_NUM_LAYOUTS];
+
+// Slot ids ordered from most recently used to least recently used. When a new
+// keyboard needs a slot, the slot at the end of this list is evicted. Slots
+// that have never been used are never touched, so they always stay behind the
+// used ones and get filled first.
+static XRAM uint8_t s_slot_lru[MAX_NUM_KEYBOARD_SLOTS];
 
 // key event queue are used to trigger events from non-keyboard sources,
 // timers, other keycodes.
@@ -54,7 +78,9 @@ XRAM key_event_queue_t s_key_event_queues[2];
 XRAM uint8_t s_has_dirty_matrix;
 XRAM uint8_t s_has_dirty_event_queue;
 
-XRAM uint8_t s_buffered_key_len;
+// set when the layer queue is applied in the middle of interpreting a matrix,
+// so the interpreter knows to reload the active layer
+static XRAM uint8_t s_layer_applied;
 
 bit_t g_input_disabled = false;
 bit_t dongle_active = true;
@@ -85,7 +111,6 @@ static XRAM layer_mask_t s_sticky_stuck_layer;
 static XRAM uint8_t s_sticky_stuck_kb_id;
 static XRAM uint8_t s_sticky_has_stuck_layer;
 
-static void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT;
 static void keyboard_reset_event_handlers(void);
 static keycode_t get_keycode_from_layer(layer_mask_t layer_mask, uint8_t row, uint8_t col) REENT;
 
@@ -142,6 +167,7 @@ void layer_queue_apply(uint8_t kb_slot_id) {
     }
 
     s_layer_dirty = 0;
+    s_layer_applied = true;
 
     // default layer changes
     if (s_pending_layer_state_set) {
@@ -200,10 +226,9 @@ void queue_keycode_event(keycode_t keycode, uint8_t event_type, uint8_t kb_id) {
         // key events
         // NOTE: This will probably be a rare event, as long as the concurrent
         // number of keyboards used is less than MAX_NUM_KEYBOARD_SLOTS.
-        // If for some reason a large number of concurrent keyboards is used,
-        // we should look into ways to prevent stuck keys as a result of the
-        // keyboard being unloaded from memory before this event could be
-        // handled.
+        // Keys that were down on the keyboard are released when it is
+        // evicted from its slot, so dropping the event here can't leave any
+        // stuck keys.
         register_error(ERROR_KEY_EVENT_QUEUE_UNLOADED_DEVICE);
         return;
     }
@@ -224,29 +249,14 @@ static void apply_event_trigger_queue(uint8_t keyboard_id) REENT {
     key_event_queue_t XRAM* queue = &s_key_event_queues[READ_EVENT_QUEUE()];
 
     for (i = 0; i < queue->length; ++i) {
-        const uint8_t type = queue->events[i].type;
         if (queue->events[i].keyboard_id != keyboard_id) {
             continue;
         }
 
-        if (type == EVENT_BUFFERED_KEY_PRESS0 ||
-            type == EVENT_BUFFERED_KEY_PRESS1) {
-            const uint8_t key_num = queue->events[i].keycode;
-            const layer_mask_t active_layer =
-                keyboard_get_layer_mask(get_slot_id(keyboard_id));
-            const keycode_t keycode =
-                get_keycode_from_layer(active_layer, key_num/8, key_num%8);
-            if (type == EVENT_BUFFERED_KEY_PRESS1) {
-                queue_keycode_event(key_num, EVENT_BUFFERED_KEY_PRESS0, keyboard_id);
-            } else if (type == EVENT_BUFFERED_KEY_PRESS0) {
-                keyboard_trigger_event(keycode, EVENT_PRESSED);
-            }
-        } else {
-            keyboard_trigger_event(
-                queue->events[i].keycode,
-                queue->events[i].type
-            );
-        }
+        keyboard_trigger_event(
+            queue->events[i].keycode,
+            queue->events[i].type
+        );
     }
 }
 
@@ -272,11 +282,17 @@ keycode_t get_keycode_from_layer(layer_mask_t layer_mask, uint8_t row, uint8_t c
     const uint8_t *layer_bytes = (uint8_t*)&layer_mask;
     int8_t i, j;
 
+#if USE_STATIC_LAYOUT
+    const ROM static_layout_t *layout =
+        &g_static_layouts[g_keyboard_slots[s_active_slot].kb_id];
+    const uint8_t key_index = 8*row + col;
+#else
     // sizeof the layers in of this keyboard
     // TODO: store this value in g_keyboard_slots[s_active_slot] ???
     const flash_size_t layer_size = sizeof(keycode_t)*8*g_keyboard_slots[s_active_slot].matrix_size;
     // offset of the key (row,col) pos into a layer
     const flash_size_t key_offset = sizeof(keycode_t)*(8*row + col);
+#endif
 
     for (i = sizeof(layer_mask_t)-1; i >= 0; --i) {
         uint8_t byte = layer_bytes[i];
@@ -287,11 +303,29 @@ keycode_t get_keycode_from_layer(layer_mask_t layer_mask, uint8_t row, uint8_t c
             for (j = 7; j >= 0; --j) {
                 if(is_bitn_set(byte, j)) {
                     uint8_t layer = 8*i+j;
-                    const flash_ptr_t layout = g_keyboard_slots[s_active_slot].layout;
+#if USE_STATIC_LAYOUT
+                    keycode_t code;
 
-                    keycode_t code = flash_read_word(
-                        layout + (layer_size * layer + key_offset)
-                    );
+                    if (layer >= layout->layer_count) {
+                        continue;
+                    }
+                    code = layout->layers[layer][key_index];
+#else
+                    const flash_ptr_t layout = g_keyboard_slots[s_active_slot].layout;
+                    keycode_t code;
+
+                    if (g_keyboard_slots[s_active_slot].sparse_layers) {
+                        code = layout_read_sparse_keycode(
+                            layout,
+                            g_keyboard_slots[s_active_slot].matrix_size,
+                            layer, row, col
+                        );
+                    } else {
+                        code = flash_read_word(
+                            layout + (layer_size * layer + key_offset)
+                        );
+                    }
+#endif
 
                     if( code != KC_TRNS ) {
                         // TODO: don't extract the external keycode type here.
@@ -310,52 +344,197 @@ keycode_t get_keycode_from_layer(layer_mask_t layer_mask, uint8_t row, uint8_t c
 
 static void fill_keyboard_slot(uint8_t kb_slot_id, uint8_t kb_id) {
     g_keyboard_slots[kb_slot_id].kb_id = kb_id;
-    g_keyboard_slots[kb_slot_id].layout = g_layout_storage_pos[kb_id];
+    g_keyboard_slots[kb_slot_id].layout = layout_get_keymap_addr(kb_id);
 
     g_keyboard_slots[kb_slot_id].matrix_size = GET_SETTING(layout.layouts[kb_id].matrix_size);
+#if !USE_STATIC_LAYOUT
+    g_keyboard_slots[kb_slot_id].sparse_layers = layout_has_sparse_layers(kb_id);
+#endif
     g_keyboard_slots[kb_slot_id].input_disabled = false;
     reset_layer_state(kb_slot_id);
 }
 
 uint8_t get_slot_id(uint8_t kb_id) {
+    if (kb_id >= MAX_NUM_LAYOUTS) {
+        return INVALID_DEVICE_ID;
+    }
     return s_slot_id_map[kb_id];
 }
 
+void keyboard_trigger_key_event(uint8_t key_num, key_event_t event) REENT {
+    const layer_mask_t layer_mask = keyboard_get_layer_mask(s_active_slot);
+    keyboard_trigger_event(
+        get_keycode_from_layer(layer_mask, key_num/8, key_num%8),
+        event
+    );
+}
+
+bit_t keyboard_buffer_key(uint8_t owner, uint8_t kb_id, uint8_t key_num) {
+    if (g_buffered_keys.owner == BUFFERED_KEYS_NONE) {
+        g_buffered_keys.owner = owner;
+        g_buffered_keys.kb_id = kb_id;
+        g_buffered_keys.len = 0;
+    } else if (
+        g_buffered_keys.owner != owner ||
+        g_buffered_keys.kb_id != kb_id ||
+        g_buffered_keys.len == MAX_NUM_BUFFERED_KEYS
+    ) {
+        return false;
+    }
+
+    g_buffered_keys.keys[g_buffered_keys.len++] = key_num;
+    return true;
+}
+
+bit_t keyboard_is_key_buffered(uint8_t owner, uint8_t kb_id, uint8_t key_num) {
+    uint8_t i;
+
+    if (g_buffered_keys.owner != owner || g_buffered_keys.kb_id != kb_id) {
+        return false;
+    }
+
+    for (i = 0; i < g_buffered_keys.len; ++i) {
+        if (g_buffered_keys.keys[i] == key_num) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void keyboard_replay_buffered_keys(uint8_t owner) REENT {
+    uint8_t i;
+
+    if (g_buffered_keys.owner != owner) {
+        return;
+    }
+
+    for (i = 0; i < g_buffered_keys.len; ++i) {
+        keyboard_trigger_key_event(g_buffered_keys.keys[i], EVENT_PRESSED);
+    }
+    g_buffered_keys.owner = BUFFERED_KEYS_NONE;
+    g_buffered_keys.len = 0;
+}
+
+void keyboard_drop_buffered_keys(uint8_t owner) {
+    if (g_buffered_keys.owner == owner) {
+        g_buffered_keys.owner = BUFFERED_KEYS_NONE;
+        g_buffered_keys.len = 0;
+    }
+}
+
+void keyboard_request_update(uint8_t kb_id) {
+    const uint8_t kb_slot_id = get_slot_id(kb_id);
+
+    if (kb_slot_id == INVALID_DEVICE_ID) {
+        return;
+    }
+
+    g_keyboard_slots[kb_slot_id].is_dirty = 1;
+    s_has_dirty_matrix = true;
+}
+
 bit_t is_keyboard_active(uint8_t kb_id) {
     return get_slot_id(kb_id) != INVALID_DEVICE_ID;
 }
 
+/// Mark a slot as the most recently used one.
+static void touch_slot(uint8_t kb_slot_id) {
+    uint8_t i;
+
+    // find the slot in the list, then shift all the more recently used slots
+    // back by one
+    for (i = 0; i < MAX_NUM_KEYBOARD_SLOTS-1; ++i) {
+        if (s_slot_lru[i] == kb_slot_id) {
+            break;
+        }
+    }
+    for ( ; i > 0; --i) {
+        s_slot_lru[i] = s_slot_lru[i-1];
+    }
+    s_slot_lru[0] = kb_slot_id;
+}
+
+/// Unload the keyboard in a slot.
+///
+/// Any keys that are still down on the keyboard are released, and any hold
+/// keys or macros that it started are cancelled, so evicting a keyboard can't
+/// leave stuck keys behind.
+static void evict_slot(uint8_t kb_slot_id) {
+    keyboard_t XRAM* keyboard = &g_keyboard_slots[kb_slot_id];
+    const uint8_t kb_id = keyboard->kb_id;
+    const uint8_t saved_active_slot = s_active_slot;
+
+    if (kb_id == INVALID_DEVICE_ID) {
+        return;
+    }
+
+    // The key handlers act on the active slot, so temporarily switch to the
+    // slot that is being evicted.
+    s_active_slot = kb_slot_id;
+
+    hold_key_cancel_keyboard(kb_id);
+    combo_cancel_keyboard(kb_id);
+
+    // release the keys that were last reported as down
+    {
+        const layer_mask_t layer_mask = keyboard_get_layer_mask(kb_slot_id);
+        const uint8_t matrix_size = keyboard->matrix_size;
+        uint8_t byte;
+
+        for (byte = 0; byte < matrix_size; byte += BITSET_WORD_SIZE) {
+            bitset_word_t keys_down = bitset_read_word(
+                &keyboard->matrix_prev[byte],
+                matrix_size - byte
+            );
+
+            while (keys_down) {
+                const uint8_t key_num = byte*8 + bitset_ctz(keys_down);
+                keys_down = bitset_clear_lowest(keys_down);
+                keyboard_trigger_event(
+                    get_keycode_from_layer(layer_mask, key_num/8, key_num%8),
+                    EVENT_RELEASED
+                );
+            }
+        }
+    }
+
+#if SUPPORT_MACRO
+    // Cancel macros after the keys are released, since releasing a macro key
+    // can start its release macro.
+    macro_cancel_keyboard(kb_id);
+#endif
+
+    // Drop any layer changes made by the released keys, since they were meant
+    // for the keyboard that is being unloaded.
+    flush_queues();
+    apply_mods();
+
+    s_slot_id_map[kb_id] = INVALID_DEVICE_ID;
+    keyboard->kb_id = INVALID_DEVICE_ID;
+
+    s_active_slot = saved_active_slot;
+}
+
 uint8_t acquire_slot(uint8_t kb_id) {
     uint8_t kb_slot_id = get_slot_id(kb_id);
-    uint8_t i;
 
     if (kb_slot_id != INVALID_DEVICE_ID) {
+        touch_slot(kb_slot_id);
         return kb_slot_id;
     }
 
-    // We now need to free a slot for the keyboard if all the slots are full.
-    for (i = 0; i < MAX_NUM_KEYBOARDS; ++i) {
-        if (s_slot_id_map[i] == s_slot_fifo_pos) {
-            const uint8_t stale_kb_id = i;
-            s_slot_id_map[stale_kb_id] = INVALID_DEVICE_ID;
-            // TODO: need to perform cleanup for this slot
-            // TODO: release all the keys of the keyboard that we are evicting
-            // from a slot.
-            // TODO: invalidate any tap and hold keys that are pending
-            // for this slot.
-            break;
-        }
-    }
+    // Take the least recently used slot, and free it if it is in use.
+    kb_slot_id = s_slot_lru[MAX_NUM_KEYBOARD_SLOTS-1];
+    evict_slot(kb_slot_id);
 
-    // Use a first-in-first-out queue for the new slot
-    kb_slot_id = s_slot_fifo_pos;
     s_slot_id_map[kb_id] = kb_slot_id;
 
     // load the new keyboard into the slot we found
     fill_keyboard_slot(kb_slot_id, kb_id);
+    memset(g_keyboard_slots[kb_slot_id].matrix, 0, sizeof(g_keyboard_slots[0].matrix));
+    memset(g_keyboard_slots[kb_slot_id].matrix_prev, 0, sizeof(g_keyboard_slots[0].matrix_prev));
 
-    // advance slot FIFO
-    s_slot_fifo_pos = (s_slot_fifo_pos + 1) % MAX_NUM_KEYBOARD_SLOTS;
+    touch_slot(kb_slot_id);
     return kb_slot_id;
 }
 
@@ -368,19 +547,24 @@ void keyboards_init(void) {
     // TODO: probably set default layers
 
     keyboard_layouts_init();
-    memset(s_slot_id_map, INVALID_DEVICE_ID, MAX_NUM_KEYBOARDS);
+    g_buffered_keys.owner = BUFFERED_KEYS_NONE;
+    combo_init();
+#if SUPPORT_MACRO
+    macro_init();
+#endif
+    memset(s_slot_id_map, INVALID_DEVICE_ID, MAX_NUM_LAYOUTS);
 
     {
         uint8_t slot_id;
         for (slot_id = 0; slot_id < MAX_NUM_KEYBOARD_SLOTS; ++slot_id) {
             g_keyboard_slots[slot_id].kb_id = INVALID_DEVICE_ID;
+            s_slot_lru[slot_id] = slot_id;
         }
     }
 
     // Load the default layout into the first slot
     s_active_slot = acquire_slot(GET_SETTING(layout.default_layout_id));
 
-    s_slot_fifo_pos = 0;
     s_has_dirty_matrix = true;
 
     s_key_event_queues[0].length = 0;
@@ -395,30 +579,21 @@ void keyboards_init(void) {
 // NOTE: this should not be called from an interrupt, as it will break
 // how the matrix interpreting step.
 void keyboard_update_device_matrix(uint8_t device_id, const XRAM uint8_t *matrix_packet) REENT {
-    // first figure out what sort of packet was received and
-    const uint8_t packet_type = matrix_packet[0] >> PACKET_MATRIX_TYPE_BIT_POS;
-    const uint8_t packet_data_size = matrix_packet[0] & PACKET_MATRIX_SIZE_MASK;
-
     const uint8_t kb_id = GET_SETTING(layout.devices[device_id].layout_id);
     const uint8_t device_matrix_offset = GET_SETTING(layout.devices[device_id].matrix_offset);
     const uint8_t device_matrix_size = GET_SETTING(layout.devices[device_id].matrix_size);
 
-    // matrix_data now points to the start of the key list
-    const XRAM uint8_t* matrix_data = &matrix_packet[1];
-
     // get matrix slot from kb_id
 
     XRAM uint8_t* matrix_write_pos;
 
-    uint8_t kb_slot_id = get_slot_id(kb_id);
+    uint8_t kb_slot_id;
 
-    if (kb_id >= MAX_NUM_KEYBOARDS) {
+    if (kb_id >= MAX_NUM_LAYOUTS) {
         return;
     }
 
-    if (kb_slot_id == INVALID_DEVICE_ID) {
-        kb_slot_id = acquire_slot(kb_id);
-    }
+    kb_slot_id = acquire_slot(kb_id);
 
     matrix_write_pos = g_keyboard_slots[kb_slot_id].matrix + device_matrix_offset;
 
@@ -434,38 +609,7 @@ void keyboard_update_device_matrix(uint8_t device_id, const XRAM uint8_t *matrix
         return;
     }
 
-    if (packet_type == PACKET_MATRIX_DELTA_LIST) {
-        // A delta list packet lists keys that have change state, so only need
-        // to update those keys.
-        uint8_t key_list_pos = 0;
-
-        while (key_list_pos < packet_data_size) {
-            const uint8_t key_num = matrix_data[key_list_pos] & MATRIX_DELTA_KEY_MASK;
-            const uint8_t delta_type = matrix_data[key_list_pos] & MATRIX_DELTA_TYPE_MASK;
-            if (delta_type) { // key pressed
-                matrix_write_pos[key_num/8] |= (1 << (key_num % 8));
-            } else { // key released
-                matrix_write_pos[key_num/8] &= ~(1 << (key_num % 8));
-            }
-            key_list_pos++;
-        }
-    } else if (packet_type == PACKET_MATRIX_KEY_LIST) {
-        // A key list packet is a list of all the keys that are DOWN in the
-        // matrix. The rest of the keys are assumed to be UP.
-        uint8_t key_list_pos = 0;
-
-        // first clear the matrix area (i.e. make all keys UP)
-        memset(matrix_write_pos, 0, device_matrix_size);
-
-        while (key_list_pos < packet_data_size) {
-            const uint8_t key_num = matrix_data[key_list_pos];
-            matrix_write_pos[key_num/8] |= (1 << (key_num % 8));
-            key_list_pos++;
-        }
-    } else if (packet_type == PACKET_MATRIX_RAW) {
-        // A raw matrix packet, simply contains raw matrix data.
-        memcpy(matrix_write_pos, matrix_data, device_matrix_size);
-    }
+    matrix_packet_decode(matrix_write_pos, device_matrix_size, matrix_packet);
 
     g_keyboard_slots[kb_slot_id].is_dirty = 1;
     s_has_dirty_matrix = true;
@@ -480,15 +624,13 @@ void keyboard_matrix_set_key(uint8_t device_id, int key_num, int value) REENT {
     XRAM uint8_t* matrix_write_pos;
 
     // get matrix slot from kb_id
-    uint8_t kb_slot_id = get_slot_id(kb_id);
+    uint8_t kb_slot_id;
 
-    if (kb_id >= MAX_NUM_KEYBOARDS) {
+    if (kb_id >= MAX_NUM_LAYOUTS) {
         return;
     }
 
-    if (kb_slot_id == INVALID_DEVICE_ID) {
-        kb_slot_id = acquire_slot(kb_id);
-    }
+    kb_slot_id = acquire_slot(kb_id);
 
     matrix_write_pos = g_keyboard_slots[kb_slot_id].matrix + device_matrix_offset;
 
@@ -562,7 +704,7 @@ static void keyboard_reset_event_handlers(void) {
     }
 }
 
-static void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT {
+void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT {
     uint8_t callback_num = 0;
     const keycode_callbacks_t * callback;
     uint16_t keycode_class = get_ekc_type(keycode);
@@ -618,28 +760,25 @@ static void keyboard_interpret_layer_change(
     layer_mask_t old_layer,
     layer_mask_t new_layer
 ) REENT {
-    uint8_t byte, bit;
+    uint8_t byte;
     keyboard_t XRAM* keyboard = &g_keyboard_slots[kb_slot_id];
+    const uint8_t matrix_size = keyboard->matrix_size;
 
-    for (byte = 0; byte < g_keyboard_slots[kb_slot_id].matrix_size; ++byte) {
-        uint8_t row_cur = keyboard->matrix[byte];
+    for (byte = 0; byte < matrix_size; byte += BITSET_WORD_SIZE) {
+        // only keys currently down need to be checked
+        bitset_word_t keys_down = bitset_read_word(
+            &keyboard->matrix[byte],
+            matrix_size - byte
+        );
 
-        // now keys currently down
-        if (!row_cur) {
-            continue;
-        }
-
-        for (bit = 0; bit < 8; ++bit) {
-            const bit_t down = is_bitn_set(row_cur, bit);
+        while (keys_down) {
+            const uint8_t key_num = byte*8 + bitset_ctz(keys_down);
             keycode_t old_keycode, new_keycode;
 
-            if (!down) {
-                continue;
-            }
-
+            keys_down = bitset_clear_lowest(keys_down);
 
-            old_keycode = get_keycode_from_layer(old_layer, byte, bit);
-            new_keycode = get_keycode_from_layer(new_layer, byte, bit);
+            old_keycode = get_keycode_from_layer(old_layer, key_num/8, key_num%8);
+            new_keycode = get_keycode_from_layer(new_layer, key_num/8, key_num%8);
 
             if (old_keycode != new_keycode) {
                 keyboard_trigger_event(old_keycode, EVENT_RELEASED);
@@ -657,7 +796,9 @@ bool sticky_key_task(void) {
         return false;
     }
 
-    if (sticky_relase_timer_done()) {
+    if (!sticky_relase_timer_done()) {
+        scheduler_wake_at(s_sticky_clear_start_time + STICKY_KEY_RELEASE_DELAY + 1);
+    } else {
         if (s_sticky_has_stuck_layer) {
             const layer_mask_t new_layer = get_partial_layer_mask(s_sticky_stuck_kb_id);
             keyboard_interpret_layer_change(
@@ -689,7 +830,7 @@ void keyboard_interpret_matrix(uint8_t kb_slot_id) {
     XRAM layer_mask_t active_layer;
     XRAM layer_mask_t start_layer;
     keyboard_t XRAM* keyboard;
-    uint8_t byte, bit;
+    uint8_t byte;
 
     // bounds check
     if (kb_slot_id >= MAX_NUM_KEYBOARD_SLOTS) {
@@ -711,71 +852,86 @@ void keyboard_interpret_matrix(uint8_t kb_slot_id) {
     keyboard->layer_changed = false;
     keyboard->is_dirty = 0;
 
-    s_buffered_key_len = 0;
     s_active_slot = kb_slot_id;
 
-    active_layer = keyboard_get_layer_mask(kb_slot_id);
     start_layer = get_partial_layer_mask(kb_slot_id);
 
+    // a pending combo or hold key whose term has expired must be resolved
+    // before any new key events so that the buffered keys stay in order
+    combo_check_timeout(keyboard->kb_id);
+    hold_key_check_timeout(keyboard->kb_id);
+
+    s_layer_applied = false;
+    active_layer = keyboard_get_layer_mask(kb_slot_id);
+
     // First interpret the matrix of the keyboard and generate key up and down
     // events
     if (s_has_dirty_matrix) {
         // TODO/NOTE: current notation here is pretty confusing. The matrix is
         // processed in chunks of bytes. However, here a byte is called a row and
         // the bit offset into that byte is called a col.
-        for (byte = 0; byte < keyboard->matrix_size; ++byte) {
-            const uint8_t row_cur = keyboard->matrix[byte];
-            const uint8_t row_prev = keyboard->matrix_prev[byte];
-            const uint8_t changed_keys = row_cur ^ row_prev;
-
-            // skip entire rows that have no keys that changed
-            if (!changed_keys) {
-                continue;
-            }
-
-            for (bit = 0; bit < 8; ++bit) {
-                const bit_t current = is_bitn_set(row_cur, bit);
-                const bit_t previous = is_bitn_set(row_prev, bit);
-
-                const bit_t pressed = current && !previous;
-                const bit_t released = !current && previous;
-                const bit_t up = !current && !previous;
-                // const bit_t down = current && previous;
+        //
+        // The matrix is compared a whole word at a time, and then only the
+        // bits that changed are visited, so the cost of this loop depends on
+        // the number of keys that changed and not the size of the matrix.
+        for (byte = 0; byte < keyboard->matrix_size; byte += BITSET_WORD_SIZE) {
+            const uint8_t bytes_left = keyboard->matrix_size - byte;
+            const bitset_word_t row_cur =
+                bitset_read_word(&keyboard->matrix[byte], bytes_left);
+            const bitset_word_t row_prev =
+                bitset_read_word(&keyboard->matrix_prev[byte], bytes_left);
+            bitset_word_t changed_keys = row_cur ^ row_prev;
+
+            while (changed_keys) {
+                const uint8_t bit = bitset_ctz(changed_keys);
+                const uint8_t key_num = byte*8 + bit;
+                // only changed keys are visited, so the key was either
+                // pressed or released
+                const bit_t pressed = (row_cur >> bit) & 1;
 
                 key_event_t event;
                 keycode_t keycode;
 
-                if (up) {
-                    continue;
-                } else if (pressed) {
+                changed_keys = bitset_clear_lowest(changed_keys);
+
+                if (pressed) {
                     event = EVENT_PRESSED;
                     keyboard->num_keys_down += 1;
 
-                    // TODO: make this a more generic mechanism?
-                    if (hold_key_buffer_other_keys() || (s_buffered_key_len>0)) {
-                        const uint8_t key_num = byte*8 + bit;
-
-                        // If s_buffered_key_len > 0, then that means we have
-                        // already started adding keys to the buffer, and don't
-                        // need to retrigger the hold key task.
-                        if (s_buffered_key_len == 0) {
-                            hold_key_task(true);
-                        }
-                        s_buffered_key_len++;
-                        queue_keycode_event(key_num, EVENT_BUFFERED_KEY_PRESS1, keyboard->kb_id);
+                    // Hold keys are resolved in this pass. Keys buffered by
+                    // permissive hold keys are replayed once the hold key
+                    // has been resolved by `hold_key_other_key_pressed()`.
+                    if (hold_key_is_active() &&
+                        hold_key_other_key_pressed(keyboard->kb_id, key_num)) {
                         continue;
                     }
-                } else if (released) {
+
+                    // keys that might start a combo are held back by the
+                    // combo engine
+                    if (combo_key_pressed(keyboard->kb_id, key_num)) {
+                        continue;
+                    }
+                } else {
                     event = EVENT_RELEASED;
                     keyboard->num_keys_down -= 1;
-                // } else if (down) {
-                //     // TODO: get ride of this event when you add event system
-                //     event = EVENT_DOWN;
-                } else {
-                    continue;
+
+                    if (hold_key_is_active()) {
+                        hold_key_other_key_released(keyboard->kb_id, key_num);
+                    }
+
+                    if (combo_key_released(keyboard->kb_id, key_num)) {
+                        continue;
+                    }
+                }
+
+                // Resolving a hold key applies its layer changes straight
+                // away, so the keys after it need to use the new layer.
+                if (s_layer_applied) {
+                    s_layer_applied = false;
+                    active_layer = keyboard_get_layer_mask(kb_slot_id);
                 }
 
-                keycode = get_keycode_from_layer(active_layer, byte, bit);
+                keycode = get_keycode_from_layer(active_layer, key_num/8, key_num%8);
 
                 keyboard_trigger_event(keycode, event);
             }
@@ -824,9 +980,13 @@ void keyboard_interpret_matrix(uint8_t kb_slot_id) {
     memcpy(keyboard->matrix_prev, keyboard->matrix, keyboard->matrix_size);
 }
 
-void interpret_all_keyboard_matrices(void) {
+bit_t interpret_all_keyboard_matrices(void) {
     if (!s_has_dirty_matrix && !s_has_dirty_event_queue) {
-        return;
+        return false;
+    }
+
+    if (is_hid_report_queue_full()) {
+        return true;
     }
 
     s_has_dirty_event_queue = 0;
@@ -846,4 +1006,6 @@ void interpret_all_keyboard_matrices(void) {
     s_key_event_queues[READ_EVENT_QUEUE()].length = 0;
 
     s_has_dirty_matrix = false;
+
+    return false;
 }
@@ -7,24 +7,48 @@
 
 #include "key_handlers/key_handlers.h"
 
+#include "core/build_config.h"
 #include "core/keycode.h"
 #include "core/util.h"
 #include "core/flash.h"
 
-// Should probably support more.
-#define MAX_NUM_LAYERS 16
-
-typedef uint16_t layer_mask_t;
+/// The number of layers a layout can use, at most 16.
+#ifndef MAX_NUM_LAYERS
+    #define MAX_NUM_LAYERS 16
+#endif
 
-// TODO: calcuate matrix sizes from settings
-#ifdef NO_SPLIT
-    #define MAX_NUM_KEYBOARD_SLOTS 1
+/// One bit for each layer, so the layer masks in `keyboard_t` only use a
+/// single byte when the layouts have at most 8 layers.
+#if MAX_NUM_LAYERS <= 8
+    typedef uint8_t layer_mask_t;
+#elif MAX_NUM_LAYERS <= 16
+    typedef uint16_t layer_mask_t;
 #else
-    #define MAX_NUM_KEYBOARD_SLOTS 4
+    #error "MAX_NUM_LAYERS can be at most 16"
+#endif
+
+/// The number of keyboards that can be active at the same time.
+///
+/// Each slot uses `sizeof(keyboard_t)` bytes of RAM, so ports that have RAM to
+/// spare can raise this with `KEYBOARD_SLOTS=N` in their Makefile. When more
+/// keyboards are active than there are slots, the least recently used keyboard
+/// is unloaded from its slot.
+#ifndef MAX_NUM_KEYBOARD_SLOTS
+    #ifdef NO_SPLIT
+        #define MAX_NUM_KEYBOARD_SLOTS 1
+    #else
+        #define MAX_NUM_KEYBOARD_SLOTS 4
+    #endif
 #endif
 
 #define INVALID_DEVICE_ID 0xff
 
+/// Maximum number of key presses that can be held back at once, see
+/// `keyboard_buffer_key()`.
+#ifndef MAX_NUM_BUFFERED_KEYS
+    #define MAX_NUM_BUFFERED_KEYS 8
+#endif
+
 #if USE_VIRTUAL_MODE
      #define STICKY_KEY_RELEASE_DELAY 5
 #else
@@ -51,7 +75,8 @@ typedef struct keyboard_t {
     uint8_t is_dirty: 1;
     uint8_t input_disabled: 1;
     uint8_t layer_changed: 1;
-    uint8_t _reserved0: 5;
+    uint8_t sparse_layers: 1; ///< the layout uses `LAYOUT_FLAG_SPARSE_LAYERS`
+    uint8_t _reserved0: 4;
     uint8_t num_keys_down;
     layer_mask_t active_layers; // for temporoary layer changes
     layer_mask_t default_layers; // stays active till overridden by something else
@@ -70,7 +95,23 @@ typedef struct key_event_queue_t {
     key_event_trigger_t events[MAX_EVENT_QUEUE_LENGTH];
 } key_event_queue_t;
 
+/// The modules that can hold back key presses with `keyboard_buffer_key()`
+typedef enum {
+    BUFFERED_KEYS_NONE = 0,
+    BUFFERED_KEYS_COMBO,
+    BUFFERED_KEYS_HOLD,
+} buffered_keys_owner_t;
+
+/// Key presses held back while a combo or a permissive hold key is undecided
+typedef struct buffered_keys_t {
+    uint8_t owner; ///< a `buffered_keys_owner_t`
+    uint8_t kb_id;
+    uint8_t len;
+    uint8_t keys[MAX_NUM_BUFFERED_KEYS];
+} buffered_keys_t;
+
 extern XRAM keyboard_t g_keyboard_slots[MAX_NUM_KEYBOARD_SLOTS];
+extern XRAM buffered_keys_t g_buffered_keys;
 
 void keyboards_init(void);
 void keyboard_update_device_matrix(uint8_t device_id, const XRAM uint8_t *matrix_packet) REENT;
@@ -85,11 +126,53 @@ void keyboard_reset_matrix(uint8_t keyboard_id);
 layer_mask_t keyboard_get_layer_mask(uint8_t keyboard_id);
 void reset_layer_state(uint8_t keyboard_id);
 uint8_t get_slot_id(uint8_t kb_id);
-// void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT;
+
+/// Immediately send a keycode event to the key handlers for the active slot.
+///
+/// Key handlers should use `queue_keycode_event()` instead, this is only meant
+/// for cleanup code that has to release keys before a slot is unloaded.
+void keyboard_trigger_event(keycode_t keycode, key_event_t event) REENT;
+
+/// Immediately send an event for the keycode at `key_num` on the current layer
+/// of the active slot.
+void keyboard_trigger_key_event(uint8_t key_num, key_event_t event) REENT;
+
+/// Hold back the press of `key_num` until `owner` replays or drops it.
+///
+/// The combo engine and the hold keys share one buffer. Only one of them can
+/// use it at a time, which they never need to in practice: keys that a
+/// permissive hold key holds back don't reach the combo engine, and a combo
+/// is resolved before a key outside of it is handled.
+///
+/// @return false if the buffer is full, or in use by another owner or
+///     keyboard. The key press should then be handled normally.
+bit_t keyboard_buffer_key(uint8_t owner, uint8_t kb_id, uint8_t key_num);
+
+/// Check if `owner` holds back the press of `key_num` on `kb_id`
+bit_t keyboard_is_key_buffered(uint8_t owner, uint8_t kb_id, uint8_t key_num);
+
+/// Press the keys that `owner` held back, in order and on the current layer
+/// of the active slot, then empty the buffer.
+void keyboard_replay_buffered_keys(uint8_t owner) REENT;
+
+/// Empty the buffer if it is used by `owner`, without pressing the keys
+void keyboard_drop_buffered_keys(uint8_t owner);
+
+/// Make the interpreter process the given keyboard on its next pass, even if
+/// its matrix hasn't changed. Used by modules that need to resolve a timeout.
+void keyboard_request_update(uint8_t kb_id);
 
 bool sticky_key_task(void);
 
-void interpret_all_keyboard_matrices(void);
+/// Process the changed matrices and the queued key events of all keyboards.
+///
+/// Nothing is processed while the queue of the active keyboard report is
+/// full, so that the key states made by the last pass aren't merged with the
+/// next ones. See `is_keyboard_report_queue_full()`.
+///
+/// @return true if there are changes waiting for room in the keyboard report
+/// queue
+bit_t interpret_all_keyboard_matrices(void);
 
 // NOTE: Most of these functions below rely on static state stored by the matrix
 // interpreter. These functions are used in the key handlers, and directly read
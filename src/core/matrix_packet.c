@@ -0,0 +1,317 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/matrix_packet.c
+///
+/// Matrix data encoding, see `core/matrix_packet.h`.
+
+#include "core/matrix_packet.h"
+
+#include <string.h>
+
+/// Largest size that fits in the header
+#define MAX_HEADER_SIZE PACKET_MATRIX_SIZE_MASK
+/// Returned by the encoders when the encoding doesn't fit in the header
+#define NO_FIT 0xff
+
+#define RUN_LENGTH_MAX 0x0f
+
+#define MATRIX_HEADER(type, size) \
+    (((type) << PACKET_MATRIX_TYPE_BIT_POS) | ((size) & PACKET_MATRIX_SIZE_MASK))
+
+static bit_t is_key_down(const XRAM uint8_t *bitmap, uint8_t key_num) {
+    return (bitmap[key_num / 8] >> (key_num % 8)) & 1;
+}
+
+// The encoders return the number of bytes they need after the header. When
+// `dest` is NULL they only measure the encoding.
+
+static uint8_t encode_key_list(uint8_t *dest, const XRAM uint8_t *bitmap, uint8_t bitmap_size) {
+    uint8_t len = 0;
+    uint8_t i;
+
+    for (i = 0; i < bitmap_size; ++i) {
+        uint8_t bit;
+
+        if (!bitmap[i]) {
+            continue;
+        }
+
+        for (bit = 0; bit < 8; ++bit) {
+            if (!(bitmap[i] & (1 << bit))) {
+                continue;
+            }
+            if (len == MAX_HEADER_SIZE) {
+                return NO_FIT;
+            }
+            if (dest) {
+                dest[len] = i*8 + bit;
+            }
+            len++;
+        }
+    }
+
+    return len;
+}
+
+static uint8_t encode_row_mask(uint8_t *dest, const XRAM uint8_t *bitmap, uint8_t bitmap_size) {
+    uint8_t mask_len;
+    uint8_t len;
+    uint8_t i;
+
+    // zero bytes at the end of the bitmap aren't covered by the mask
+    while (bitmap_size && !bitmap[bitmap_size-1]) {
+        bitmap_size--;
+    }
+    mask_len = INT_DIV_ROUND_UP(bitmap_size, 8);
+    len = mask_len;
+
+    if (dest) {
+        memset(dest, 0, mask_len);
+    }
+
+    for (i = 0; i < bitmap_size; ++i) {
+        if (!bitmap[i]) {
+            continue;
+        }
+        if (dest) {
+            dest[i / 8] |= (1 << (i % 8));
+            dest[len] = bitmap[i];
+        }
+        len++;
+    }
+
+    return len;
+}
+
+static uint8_t encode_run_length(uint8_t *dest, const XRAM uint8_t *bitmap, uint8_t bitmap_size) {
+    const uint8_t num_keys = bitmap_size * 8;
+    uint8_t key_num = 0;
+    uint8_t len = 0;
+
+    while (true) {
+        uint8_t skip = 0;
+        uint8_t run = 0;
+
+        while (key_num < num_keys && !is_key_down(bitmap, key_num)) {
+            skip++;
+            key_num++;
+        }
+
+        if (key_num == num_keys) {
+            break;
+        }
+
+        while (skip > RUN_LENGTH_MAX) {
+            if (len == MAX_HEADER_SIZE) {
+                return NO_FIT;
+            }
+            if (dest) {
+                dest[len] = RUN_LENGTH_MAX << 4;
+            }
+            len++;
+            skip -= RUN_LENGTH_MAX;
+        }
+
+        while (
+            key_num < num_keys &&
+            is_key_down(bitmap, key_num) &&
+            run < RUN_LENGTH_MAX
+        ) {
+            run++;
+            key_num++;
+        }
+
+        if (len == MAX_HEADER_SIZE) {
+            return NO_FIT;
+        }
+        if (dest) {
+            dest[len] = (skip << 4) | run;
+        }
+        len++;
+    }
+
+    return len;
+}
+
+uint8_t matrix_packet_encode(uint8_t *dest, const XRAM uint8_t *bitmap, uint8_t bitmap_size) {
+    uint8_t best_type = PACKET_MATRIX_RAW;
+    uint8_t best_len = bitmap_size;
+    uint8_t len;
+
+    if (bitmap_size > KEY_NUMBER_BITMAP_SIZE) {
+        bitmap_size = KEY_NUMBER_BITMAP_SIZE;
+        best_len = bitmap_size;
+    }
+
+    // On a tie the encoding that is cheaper to decode is used
+    len = encode_key_list(NULL, bitmap, bitmap_size);
+    if (len < best_len) {
+        best_type = PACKET_MATRIX_KEY_LIST;
+        best_len = len;
+    }
+
+    len = encode_row_mask(NULL, bitmap, bitmap_size);
+    if (len < best_len) {
+        best_type = PACKET_MATRIX_ROW_MASK;
+        best_len = len;
+    }
+
+    len = encode_run_length(NULL, bitmap, bitmap_size);
+    if (len < best_len) {
+        best_type = PACKET_MATRIX_RUN_LENGTH;
+        best_len = len;
+    }
+
+    switch (best_type) {
+        case PACKET_MATRIX_KEY_LIST: {
+            encode_key_list(dest+1, bitmap, bitmap_size);
+        } break;
+
+        case PACKET_MATRIX_ROW_MASK: {
+            encode_row_mask(dest+1, bitmap, bitmap_size);
+        } break;
+
+        case PACKET_MATRIX_RUN_LENGTH: {
+            encode_run_length(dest+1, bitmap, bitmap_size);
+        } break;
+
+        default: {
+            memcpy(dest+1, (const uint8_t*)bitmap, bitmap_size);
+        } break;
+    }
+
+    dest[0] = MATRIX_HEADER(best_type, best_len);
+    return best_len + MATRIX_PACKET_HEADER_SIZE;
+}
+
+uint8_t matrix_packet_encode_part(
+    uint8_t *dest,
+    const XRAM uint8_t *bitmap,
+    uint8_t bitmap_size,
+    uint8_t offset
+) {
+    uint8_t len = 0;
+
+    if (offset < bitmap_size) {
+        len = bitmap_size - offset;
+    }
+    if (len > MATRIX_PACKET_PART_MAX_LEN) {
+        len = MATRIX_PACKET_PART_MAX_LEN;
+    }
+
+    dest[0] = MATRIX_HEADER(PACKET_MATRIX_RAW_PART, len + 1);
+    dest[1] = offset;
+    memcpy(dest+2, (const uint8_t*)bitmap + offset, len);
+    return len + MATRIX_PACKET_HEADER_SIZE + 1;
+}
+
+static void set_key(XRAM uint8_t *matrix, uint16_t num_keys, uint16_t key_num) {
+    if (key_num < num_keys) {
+        matrix[key_num / 8] |= (1 << (key_num % 8));
+    }
+}
+
+static void clear_key(XRAM uint8_t *matrix, uint16_t num_keys, uint16_t key_num) {
+    if (key_num < num_keys) {
+        matrix[key_num / 8] &= ~(1 << (key_num % 8));
+    }
+}
+
+void matrix_packet_decode(
+    XRAM uint8_t *matrix,
+    uint8_t matrix_size,
+    const XRAM uint8_t *data
+) REENT {
+    const uint8_t packet_type = data[0] >> PACKET_MATRIX_TYPE_BIT_POS;
+    const uint8_t packet_data_size = data[0] & PACKET_MATRIX_SIZE_MASK;
+    const uint16_t num_keys = (uint16_t)matrix_size * 8;
+    uint8_t i;
+
+    // data now points to the start of the key list
+    data += MATRIX_PACKET_HEADER_SIZE;
+
+    switch (packet_type) {
+        case PACKET_MATRIX_DELTA_LIST: {
+            // A delta list packet lists keys that have change state, so only
+            // need to update those keys.
+            for (i = 0; i < packet_data_size; ++i) {
+                const uint8_t key_num = data[i] & MATRIX_DELTA_KEY_MASK;
+                if (data[i] & MATRIX_DELTA_TYPE_MASK) {
+                    set_key(matrix, num_keys, key_num);
+                } else {
+                    clear_key(matrix, num_keys, key_num);
+                }
+            }
+        } break;
+
+        case PACKET_MATRIX_KEY_LIST: {
+            // A key list packet is a list of all the keys that are DOWN in
+            // the matrix. The rest of the keys are assumed to be UP.
+            memset(matrix, 0, matrix_size);
+            for (i = 0; i < packet_data_size; ++i) {
+                set_key(matrix, num_keys, data[i]);
+            }
+        } break;
+
+        case PACKET_MATRIX_RAW: {
+            const uint8_t len = (packet_data_size < matrix_size) ?
+                packet_data_size : matrix_size;
+            memcpy(matrix, data, len);
+            memset(matrix + len, 0, matrix_size - len);
+        } break;
+
+        case PACKET_MATRIX_ROW_MASK: {
+            uint8_t mask_len = 0;
+            uint8_t num_bytes = 0;
+            uint8_t pos;
+
+            // Each mask byte and the bitmap bytes it marks add to the size,
+            // so the mask ends where they add up to the size.
+            while (mask_len + num_bytes < packet_data_size) {
+                num_bytes += bitset_popcount(data[mask_len]);
+                mask_len++;
+            }
+            if (mask_len + num_bytes != packet_data_size) {
+                break; // malformed
+            }
+
+            memset(matrix, 0, matrix_size);
+            pos = mask_len;
+            for (i = 0; i < mask_len*8; ++i) {
+                if (!(data[i / 8] & (1 << (i % 8)))) {
+                    continue;
+                }
+                if (i < matrix_size) {
+                    matrix[i] = data[pos];
+                }
+                pos++;
+            }
+        } break;
+
+        case PACKET_MATRIX_RUN_LENGTH: {
+            uint16_t key_num = 0;
+            memset(matrix, 0, matrix_size);
+            for (i = 0; i < packet_data_size; ++i) {
+                uint8_t run = data[i] & RUN_LENGTH_MAX;
+                key_num += data[i] >> 4;
+                while (run--) {
+                    set_key(matrix, num_keys, key_num);
+                    key_num++;
+                }
+            }
+        } break;
+
+        case PACKET_MATRIX_RAW_PART: {
+            const uint8_t offset = data[0];
+            // the first byte is the offset
+            for (i = 0; i+1 < packet_data_size; ++i) {
+                if ((uint16_t)offset + i < matrix_size) {
+                    matrix[offset + i] = data[1 + i];
+                }
+            }
+        } break;
+
+        default: {
+        } break;
+    }
+}
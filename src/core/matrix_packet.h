@@ -0,0 +1,74 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/matrix_packet.h
+///
+/// Encoding of the matrix data sent by split keyboard devices.
+///
+/// The first byte of the matrix data is a header that holds the encoding in
+/// its top 3 bits (`PACKET_MATRIX_*` in `core/packet.h`) and the number of
+/// bytes that follow it in its low 5 bits. The key state is a bitmap with
+/// one bit per key number. The encodings are:
+///
+/// * `PACKET_MATRIX_RAW`: the bitmap of the whole matrix.
+/// * `PACKET_MATRIX_KEY_LIST`: the key numbers of the keys that are down.
+/// * `PACKET_MATRIX_DELTA_LIST`: the key numbers of the keys that changed,
+///   or'd with `MATRIX_DELTA_TYPE_PRESSED` if the key was pressed.
+/// * `PACKET_MATRIX_ROW_MASK`: mask bytes with one bit per bitmap byte that
+///   is set if that byte isn't zero, then the non zero bytes in order. The
+///   mask stops at the byte that covers the last non zero bitmap byte, and
+///   each mask byte adds at least one byte to the size, so the decoder finds
+///   the end of the mask from the size.
+/// * `PACKET_MATRIX_RUN_LENGTH`: run bytes that each skip the number of
+///   released keys in their high nibble, then set the number of pressed
+///   keys in their low nibble. Keys after the last run are released.
+/// * `PACKET_MATRIX_RAW_PART`: a bitmap offset followed by bitmap bytes that
+///   are copied to the bitmap at that offset. The rest of the matrix is
+///   unchanged. Used when no other encoding fits in one RF packet.
+///
+/// Every encoding except the delta list and raw part holds the full state of
+/// the matrix, so a lost RF packet is fixed by the next one.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/matrix_scanner.h"
+#include "core/packet.h"
+#include "core/util.h"
+
+#define MATRIX_PACKET_HEADER_SIZE 1
+
+/// The largest matrix data `matrix_packet_encode()` produces
+#define MATRIX_PACKET_MAX_SIZE (MATRIX_PACKET_HEADER_SIZE + KEY_NUMBER_BITMAP_SIZE)
+
+/// Bitmap bytes that fit in a `PACKET_MATRIX_RAW_PART` RF packet
+#define MATRIX_PACKET_PART_MAX_LEN (PACKET_PAYLOAD_LENGTH - MATRIX_PACKET_HEADER_SIZE - 1)
+
+/// Encode the full state of a key number bitmap with the encoding that uses
+/// the fewest bytes.
+///
+/// @param dest buffer of at least `MATRIX_PACKET_MAX_SIZE` bytes
+/// @param bitmap bitmap of the keys that are down
+/// @param bitmap_size number of bytes in the bitmap
+///
+/// @return the number of bytes written to `dest`, including the header
+uint8_t matrix_packet_encode(uint8_t *dest, const XRAM uint8_t *bitmap, uint8_t bitmap_size);
+
+/// Encode up to `MATRIX_PACKET_PART_MAX_LEN` bytes of the bitmap that start
+/// at `offset` as a `PACKET_MATRIX_RAW_PART`.
+///
+/// @return the number of bytes written to `dest`, including the header
+uint8_t matrix_packet_encode_part(
+    uint8_t *dest,
+    const XRAM uint8_t *bitmap,
+    uint8_t bitmap_size,
+    uint8_t offset
+);
+
+/// Apply the matrix data in `data` to a device's matrix bitmap. Keys outside
+/// of the `matrix_size` bytes of the bitmap are ignored.
+void matrix_packet_decode(
+    XRAM uint8_t *matrix,
+    uint8_t matrix_size,
+    const XRAM uint8_t *data
+) REENT;
@@ -11,13 +11,17 @@
 #include "core/error.h"
 #include "core/io_map.h"
 #include "core/layout.h"
+#include "core/matrix_packet.h"
 #include "core/packet.h"
 #include "core/settings.h"
 #include "core/timer.h"
 #include "core/usb_commands.h"
 
 #define MAX_UPDATE_LIST 16
-#define MAX_DOWN_LIST 16
+
+/// Number of bit planes in the lockout counters
+#define LOCKOUT_COUNT_BITS 3
+#define LOCKOUT_COUNT_MAX ((1 << LOCKOUT_COUNT_BITS) - 1)
 
 // can probably make this static
 XRAM uint8_t g_matrix[MAX_NUM_ROWS][IO_PORT_COUNT*sizeof(port_mask_t)];
@@ -31,23 +35,42 @@ XRAM uint8_t s_has_updated;
 // XRAM uint8_t g_col_masks[IO_PORT_COUNT];
 // #endif
 
+/// Debouncer state.
+///
+/// A pin that has changed state goes through two windows. In its trigger
+/// window the pin must hold its new state for `trigger_time_press/release`
+/// before the change is registered. This is the only window that needs a per
+/// key timestamp, and for keys with a trigger time of 0 it is skipped. In its
+/// lockout window the pin ignores any changes until `debounce_time_press/release`
+/// is over. The lockout is timed with a 3 bit vertical counter: bit plane `n`
+/// of the counters for every pin in a row is stored in `s_lockout_count[n]`,
+/// so a whole row is advanced and compared with a few bitwise ops per scan.
 static XRAM uint8_t s_is_debouncing[MAX_NUM_ROWS][IO_PORT_COUNT];
+static XRAM uint8_t s_in_trigger[MAX_NUM_ROWS][IO_PORT_COUNT];
+static XRAM uint8_t s_lockout_press[MAX_NUM_ROWS][IO_PORT_COUNT];
+static XRAM uint8_t s_lockout_count[LOCKOUT_COUNT_BITS][MAX_NUM_ROWS][IO_PORT_COUNT];
+static XRAM uint8_t s_row_tick_time[MAX_NUM_ROWS];
+KP_STATIC_ASSERT(MAX_NUM_KEYS % 8 == 0, "MAX_NUM_KEYS must be a multiple of 8");
+
 static XRAM uint8_t s_debounce_time[MAX_NUM_KEYS];
 static XRAM uint8_t s_invalid_key_debounce_time;
-static XRAM uint8_t s_debounce_type[KEY_NUMBER_BITMAP_SIZE];
+/// length of a lockout counter tick in ms
+static XRAM uint8_t s_tick_length;
+static XRAM uint8_t s_lockout_ticks_press;
+static XRAM uint8_t s_lockout_ticks_release;
 static XRAM uint8_t s_matrix_number_keys_down;
 static XRAM uint8_t s_matrix_number_keys_debouncing;
 
 XRAM uint8_t g_key_num_bitmap[KEY_NUMBER_BITMAP_SIZE];
 
 XRAM matrix_scan_plan_t g_scan_plan;
+XRAM matrix_scan_stats_t g_scan_stats;
+
+static XRAM uint8_t s_scan_mode;
 
 XRAM uint8_t g_delta_list[MAX_UPDATE_LIST];
 XRAM uint8_t g_delta_list_len;
 
-XRAM uint8_t g_down_list[MAX_DOWN_LIST];
-XRAM uint8_t g_down_list_len;
-
 static void scanner_init_debouncer(void);
 
 // TODO: probably change this
@@ -97,11 +120,19 @@ int init_matrix_scanner_utils(void) {
         return -1;
     }
 
+    // The debounce times and key number bitmap have room for MAX_NUM_KEYS keys
+    if (g_scan_plan.max_key_num >= MAX_NUM_KEYS) {
+        memset((uint8_t*)&g_scan_plan, 0, sizeof(matrix_scan_plan_t));
+        register_error(ERROR_MAXIMUM_KEY_NUMBER_EXCEEDED);
+        return -1;
+    }
+
     g_delta_list_len = 0;
-    g_down_list_len = 0;
     // TODO: load scan key map
     memset(g_key_num_bitmap, 0, KEY_NUMBER_BITMAP_SIZE);
     s_has_raw_matrix_updated = 0;
+    s_scan_mode = MATRIX_SCAN_MODE_ACTIVE;
+    memset(&g_scan_stats, 0, sizeof(g_scan_stats));
 
     scanner_init_debouncer();
 
@@ -122,11 +153,6 @@ void scanner_add_matrix_key(uint8_t key_num) {
         g_delta_list_len++;
     }
 
-    if (g_down_list_len < MAX_DOWN_LIST) {
-        g_down_list[g_down_list_len] = key_num;
-        g_down_list_len++;
-    }
-
     { // add key code to the key number bitmap
         g_key_num_bitmap[key_num / 8] |= (1 << (key_num % 8));
     }
@@ -145,19 +171,6 @@ void scanner_del_matrix_key(uint8_t key_num) {
         g_delta_list_len++;
     }
 
-    // delete key from the down key list
-    if (g_down_list_len > 0) { // sanity check
-        uint8_t i;
-        // find key, and replace it with the last key in the list
-        for (i = 0; i < g_down_list_len; ++i) {
-            if (g_down_list[i] == key_num) {
-                g_down_list[i] = g_down_list[g_down_list_len - 1];
-                g_down_list_len--;
-                break;
-            }
-        }
-    }
-
     { // delete key code from the key number bitmap
         g_key_num_bitmap[key_num / 8] &= ~(1 << (key_num % 8));
     }
@@ -165,43 +178,128 @@ void scanner_del_matrix_key(uint8_t key_num) {
 
 uint8_t get_matrix_data(uint8_t *dest, bool use_deltas) {
     const uint8_t matrix_size = get_matrix_compressed_size();
-    const uint8_t num_keys_down = get_matrix_num_keys_down();
+    uint8_t len;
 
 #if SCANNER_MATRIX_DELTA != 0
     const uint8_t num_keys_changed = g_delta_list_len;
     g_delta_list_len = 0; // clear update list even if we don't use it
-
-    if (use_deltas || (matrix_size > (PACKET_PAYLOAD_LENGTH-1) && num_keys_down > PACKET_PAYLOAD_LENGTH-1)) {
-        if ( (num_keys_changed < num_keys_down) && (num_keys_changed < matrix_size) ) {
-            *dest = (PACKET_MATRIX_DELTA_LIST << PACKET_MATRIX_TYPE_BIT_POS) | (num_keys_changed & PACKET_MATRIX_SIZE_MASK);
-            dest++;
-            memcpy(dest, g_delta_list, num_keys_changed);
-            return num_keys_changed + 1;
-        }
-    }
 #endif
 
-    // A few keys down, send a list of keys instead of the whole matrix.
-    if (num_keys_down < matrix_size) {
-        *dest = (PACKET_MATRIX_KEY_LIST << PACKET_MATRIX_TYPE_BIT_POS) | (num_keys_down & PACKET_MATRIX_SIZE_MASK);
-        dest++;
-        memcpy(dest, g_down_list, g_down_list_len);
-        return num_keys_down+1;
-    }
+    len = matrix_packet_encode(dest, g_key_num_bitmap, matrix_size);
 
-    // Lots of keys down, more efficient to send the whole matrix.
-    else {
-        *dest = (PACKET_MATRIX_RAW << PACKET_MATRIX_TYPE_BIT_POS) | (matrix_size & PACKET_MATRIX_SIZE_MASK);
+#if SCANNER_MATRIX_DELTA != 0
+    // A full delta list may have missed some changes
+    if (
+        use_deltas &&
+        num_keys_changed < MAX_UPDATE_LIST &&
+        num_keys_changed + MATRIX_PACKET_HEADER_SIZE < len
+    ) {
+        *dest = (PACKET_MATRIX_DELTA_LIST << PACKET_MATRIX_TYPE_BIT_POS) | (num_keys_changed & PACKET_MATRIX_SIZE_MASK);
         dest++;
-        memcpy(dest, g_key_num_bitmap, matrix_size);
-        return matrix_size+1;
+        memcpy(dest, g_delta_list, num_keys_changed);
+        return num_keys_changed + MATRIX_PACKET_HEADER_SIZE;
     }
+#endif
+
+    return len;
+}
+
+/// The lockout window starts once the trigger window is over.
+static uint8_t get_lockout_time(uint8_t debounce_time, uint8_t trigger_time) {
+    return (debounce_time > trigger_time) ? debounce_time - trigger_time : 0;
 }
 
 static void scanner_init_debouncer(void) {
+    const uint8_t lockout_press = get_lockout_time(
+        g_scan_plan.debounce_time_press,
+        g_scan_plan.trigger_time_press
+    );
+    const uint8_t lockout_release = get_lockout_time(
+        g_scan_plan.debounce_time_release,
+        g_scan_plan.trigger_time_release
+    );
+
     memset(s_is_debouncing, 0, sizeof(s_is_debouncing));
+    memset(s_in_trigger, 0, sizeof(s_in_trigger));
+    memset(s_lockout_count, 0, sizeof(s_lockout_count));
+    memset(s_row_tick_time, 0, sizeof(s_row_tick_time));
     s_matrix_number_keys_down = 0;
     s_matrix_number_keys_debouncing = 0;
+
+    // Pick the tick length so that the longest lockout fits in the counter
+    // without saturating. Debounce times are usually no more than
+    // `LOCKOUT_COUNT_MAX` ms, in which case a tick is 1ms.
+    s_tick_length = INT_DIV_ROUND_UP(
+        KP_MAX(lockout_press, lockout_release),
+        LOCKOUT_COUNT_MAX
+    );
+    if (s_tick_length == 0) {
+        s_tick_length = 1;
+    }
+
+    s_lockout_ticks_press = INT_DIV_ROUND_UP(lockout_press, s_tick_length);
+    s_lockout_ticks_release = INT_DIV_ROUND_UP(lockout_release, s_tick_length);
+}
+
+/// Returns a mask of the pins whose lockout counter is >= `ticks`.
+///
+/// Compares the bit planes from the least significant bit up. At each bit, a
+/// counter is greater if its bit is set where `ticks` is clear, smaller if its
+/// bit is clear where `ticks` is set, otherwise the lower bits decide.
+static uint8_t lockout_count_at_least(uint8_t row, uint8_t i, uint8_t ticks) {
+    uint8_t result = 0xff;
+    uint8_t plane;
+    for (plane = 0; plane < LOCKOUT_COUNT_BITS; ++plane) {
+        if (ticks & bitn_mask(plane)) {
+            result &= s_lockout_count[plane][row][i];
+        } else {
+            result |= s_lockout_count[plane][row][i];
+        }
+    }
+    return result;
+}
+
+/// Set the lockout counter of the pins in `mask` to 0.
+static void lockout_count_clear(uint8_t row, uint8_t i, uint8_t mask) {
+    uint8_t plane;
+    for (plane = 0; plane < LOCKOUT_COUNT_BITS; ++plane) {
+        s_lockout_count[plane][row][i] &= ~mask;
+    }
+}
+
+/// Add `ticks` to the lockout counter of the pins in `mask`, saturating at
+/// `LOCKOUT_COUNT_MAX`.
+///
+/// Note: written for `LOCKOUT_COUNT_BITS == 3`
+static void lockout_count_advance(uint8_t row, uint8_t i, uint8_t mask, uint8_t ticks) {
+    uint8_t c0 = s_lockout_count[0][row][i];
+    uint8_t c1 = s_lockout_count[1][row][i];
+    uint8_t c2 = s_lockout_count[2][row][i];
+
+    while (ticks--) {
+        const uint8_t inc = mask & ~(c0 & c1 & c2);
+        if (!inc) {
+            break;
+        }
+        c2 ^= c1 & c0 & inc;
+        c1 ^= c0 & inc;
+        c0 ^= inc;
+    }
+
+    s_lockout_count[0][row][i] = c0;
+    s_lockout_count[1][row][i] = c1;
+    s_lockout_count[2][row][i] = c2;
+}
+
+/// Move a pin from its trigger window to its lockout window.
+static void start_lockout(uint8_t row, uint8_t i, uint8_t pin_mask, bit_t is_press) {
+    s_in_trigger[row][i] &= ~pin_mask;
+    lockout_count_clear(row, i, pin_mask);
+    if (is_press) {
+        s_lockout_press[row][i] |= pin_mask;
+    } else {
+        s_lockout_press[row][i] &= ~pin_mask;
+    }
 }
 
 bool scanner_debounce_row(
@@ -210,132 +308,124 @@ bool scanner_debounce_row(
     uint8_t bytes_per_row
 ) REENT {
     const uint8_t cur_time = timer_read8_ms();
+    uint8_t ticks;
     // Will be set to tru by add_key/del_key
     s_has_updated = false;
 
+    // Number of lockout ticks that have passed since this row was last
+    // debounced.
+    ticks = (uint8_t)(cur_time - s_row_tick_time[row]) / s_tick_length;
+    s_row_tick_time[row] += ticks * s_tick_length;
+    if (ticks > LOCKOUT_COUNT_MAX) {
+        ticks = LOCKOUT_COUNT_MAX;
+    }
+
     for (uint8_t i = 0; i < bytes_per_row; ++i) {
-        uint8_t old_row = g_matrix[row][i];
-        uint8_t changed_pins = old_row ^ new_row[i];
-        uint8_t pin_mask;
-        uint8_t col;
-
-        if (s_is_debouncing[row][i]==0 && !changed_pins) {
-            // not debouncing and nothing changed, so nothing to do for this row
-            continue;
+        const uint8_t old_row = g_matrix[row][i];
+        const uint8_t changed_pins = old_row ^ new_row[i];
+        const uint8_t lockout_pins = s_is_debouncing[row][i] & ~s_in_trigger[row][i];
+        uint8_t trigger_pins = s_in_trigger[row][i];
+        uint8_t new_pins = changed_pins & ~s_is_debouncing[row][i];
+
+        // Lockout windows, done for the whole row at once.
+        if (lockout_pins) {
+            const uint8_t press_pins = lockout_pins & s_lockout_press[row][i];
+            const uint8_t release_pins = lockout_pins & ~press_pins;
+            uint8_t finished_pins;
+
+            lockout_count_advance(row, i, lockout_pins, ticks);
+
+            // A key that bounces back down while its release is locked out
+            // restarts its lockout.
+            lockout_count_clear(row, i, release_pins & new_row[i]);
+
+            finished_pins = (
+                (press_pins & lockout_count_at_least(row, i, s_lockout_ticks_press)) |
+                (release_pins & ~new_row[i] &
+                 lockout_count_at_least(row, i, s_lockout_ticks_release))
+            );
+
+            if (finished_pins) {
+                s_is_debouncing[row][i] &= ~finished_pins;
+                s_matrix_number_keys_debouncing -= bitset_popcount(finished_pins);
+            }
         }
 
-        pin_mask = 0x01;
-        col = i*8;
-        for ( ; pin_mask != 0 ; col++, pin_mask<<=1 ) {
-            if (s_is_debouncing[row][i] & pin_mask) {
-                const uint8_t key_num = get_key_number(row, col);
-
-                // if (key_num == INVALID_KEY_NUMBER) {
-                //     continue;
-                // }
-
-                // key debouncing:
-                // check if the key has finished debouncing
-                if (bitmap_get_bit(s_debounce_type, key_num)) {
-                    // debouncing key press
-                    const uint8_t bounce_duration = (uint8_t)(
-                        cur_time - get_debounce_time(key_num)
-                    );
-                    if (!(old_row & pin_mask)) {
-                        // key press not registered yet
-                        if (bounce_duration >= g_scan_plan.trigger_time_press) {
-                            if (new_row[i] & pin_mask) {
-                                // if still down after DEBOUNCE_PRESS_TRIGGER_TIME
-                                // register the key press
-                                g_matrix[row][i] |= pin_mask;
-                                s_matrix_number_keys_down++;
-                                scanner_add_matrix_key(key_num);
-                            } else {
-                                // reject key press and reset debouncing state
-                                s_is_debouncing[row][i] &= ~pin_mask;
-                                s_matrix_number_keys_debouncing--;
-                            }
-                        }
-                    } else {
-                        // key press has already been registered, wait until the
-                        // debounce time is over
-                        if ( bounce_duration >= g_scan_plan.debounce_time_press) {
-                            // debounce time is now over
-                            s_is_debouncing[row][i] &= ~pin_mask;
-                            s_matrix_number_keys_debouncing--;
-                        }
-                    }
-                } else {
-                    // debouncing key release
+        // Trigger windows, these need the key number and timestamp of each key.
+        while (trigger_pins) {
+            const uint8_t bit = bitset_ctz(trigger_pins);
+            const uint8_t pin_mask = bitn_mask(bit);
+            const uint8_t key_num = get_key_number(row, i*8 + bit);
+            uint8_t bounce_duration;
+
+            trigger_pins = bitset_clear_lowest(trigger_pins);
+
+            if (!(old_row & pin_mask)) {
+                // key press not registered yet
+                bounce_duration = (uint8_t)(cur_time - get_debounce_time(key_num));
+                if (bounce_duration >= g_scan_plan.trigger_time_press) {
                     if (new_row[i] & pin_mask) {
-                        // key bounced back to the down state, reset timer
-                        set_debounce_time(key_num, cur_time);
+                        // if still down after DEBOUNCE_PRESS_TRIGGER_TIME
+                        // register the key press
+                        g_matrix[row][i] |= pin_mask;
+                        s_matrix_number_keys_down++;
+                        scanner_add_matrix_key(key_num);
+                        start_lockout(row, i, pin_mask, true);
                     } else {
-                        // key in up state
-                        const uint8_t bounce_duration = (uint8_t)(
-                            cur_time - get_debounce_time(key_num)
-                        );
-
-                        // if we have triggered the key release
-                        if ((old_row & pin_mask) && bounce_duration >= g_scan_plan.trigger_time_release) {
-                            // key has been in the up state for DEBOUNCE_RELEASE_TRIGGER_TIME,
-                            // accept that the key has actual been release now
-                            g_matrix[row][i] &= ~pin_mask;
-                            s_matrix_number_keys_down--;
-                            scanner_del_matrix_key(key_num);
-                        } else if (bounce_duration >= g_scan_plan.debounce_time_release ) {
-                            // debounce over
-                            s_is_debouncing[row][i] &= ~pin_mask;
-                            s_matrix_number_keys_debouncing--;
-                        }
+                        // reject key press and reset debouncing state
+                        s_in_trigger[row][i] &= ~pin_mask;
+                        s_is_debouncing[row][i] &= ~pin_mask;
+                        s_matrix_number_keys_debouncing--;
                     }
                 }
+            } else if (new_row[i] & pin_mask) {
+                // key bounced back to the down state, reset timer
+                set_debounce_time(key_num, cur_time);
             } else {
-                bool is_key_down;
-                uint8_t key_num;
-                // not debouncing, so a key was pressed/released.
-
-                if (!(changed_pins & pin_mask)) {
-                    // ignore pins in this row that haven't changed
-                    continue;
-                }
-
-                key_num = get_key_number(row, col);
-
-                // If the key press/release trigger time is 0, then that means
-                // we should trigger the key immediately after seeing that it
-                // has changed state.
-                is_key_down = new_row[i] & pin_mask;
-                if (g_scan_plan.trigger_time_press == 0 && is_key_down) {
-                    // debounce press trigger time is 0, so register he key press
-                    // immediately. The debouncing algorithm then waits until
-                    // DEBOUNCE_PRESS_TIME has elapsed before accepting any more
-                    // changes in key state.
-                    // state.
-                    g_matrix[row][i] |= pin_mask;
-                    s_matrix_number_keys_down++;
-                    scanner_add_matrix_key(key_num);
-                } else if (g_scan_plan.trigger_time_release == 0 && !is_key_down) {
-                    // debounce release trigger time is 0, so register the key press
-                    // immediately. The debouncing algorithm then waits until
-                    // DEBOUNCE_RELEASE_TIME has elapsed before accepting any
-                    // more changes in key state.
+                // key in up state
+                bounce_duration = (uint8_t)(cur_time - get_debounce_time(key_num));
+                if (bounce_duration >= g_scan_plan.trigger_time_release) {
+                    // key has been in the up state for DEBOUNCE_RELEASE_TRIGGER_TIME,
+                    // accept that the key has actual been release now
                     g_matrix[row][i] &= ~pin_mask;
                     s_matrix_number_keys_down--;
                     scanner_del_matrix_key(key_num);
+                    start_lockout(row, i, pin_mask, false);
                 }
+            }
+        }
 
-                // this pin has changed, so we start it's debounce timer
-                if (is_key_down) {
-                    bitmap_set_bit(s_debounce_type, key_num); // indicates key press debounce
-
-                } else {
-                    bitmap_clear_bit(s_debounce_type, key_num); // indicates key release debounce
-                }
-
-                s_is_debouncing[row][i] |= pin_mask;
+        // Pins that have changed state and aren't debouncing yet.
+        while (new_pins) {
+            const uint8_t bit = bitset_ctz(new_pins);
+            const uint8_t pin_mask = bitn_mask(bit);
+            const uint8_t key_num = get_key_number(row, i*8 + bit);
+            const bit_t is_key_down = (new_row[i] & pin_mask) != 0;
+
+            new_pins = bitset_clear_lowest(new_pins);
+
+            s_is_debouncing[row][i] |= pin_mask;
+            s_matrix_number_keys_debouncing++;
+
+            // If the key press/release trigger time is 0, then that means
+            // we should trigger the key immediately after seeing that it
+            // has changed state. The debouncing algorithm then waits until
+            // DEBOUNCE_PRESS/RELEASE_TIME has elapsed before accepting any
+            // more changes in key state.
+            if (g_scan_plan.trigger_time_press == 0 && is_key_down) {
+                g_matrix[row][i] |= pin_mask;
+                s_matrix_number_keys_down++;
+                scanner_add_matrix_key(key_num);
+                start_lockout(row, i, pin_mask, true);
+            } else if (g_scan_plan.trigger_time_release == 0 && !is_key_down) {
+                g_matrix[row][i] &= ~pin_mask;
+                s_matrix_number_keys_down--;
+                scanner_del_matrix_key(key_num);
+                start_lockout(row, i, pin_mask, false);
+            } else {
+                // this pin has changed, so we start it's trigger timer
+                s_in_trigger[row][i] |= pin_mask;
                 set_debounce_time(key_num, cur_time);
-                s_matrix_number_keys_debouncing++;
             }
         }
     }
@@ -343,6 +433,60 @@ bool scanner_debounce_row(
     return s_has_updated;
 }
 
+bool matrix_scan_task(void) {
+    bool scan_changed;
+
+    if (s_scan_mode == MATRIX_SCAN_MODE_IDLE) {
+        if (!matrix_scan_irq_has_triggered()) {
+            g_scan_stats.idle_checks++;
+            return false;
+        }
+
+        // A key changed state, go back to full rate scanning
+        matrix_scan_irq_disable();
+        s_scan_mode = MATRIX_SCAN_MODE_ACTIVE;
+        g_scan_stats.wakeups++;
+
+        scan_changed = matrix_scan();
+        g_scan_stats.scans++;
+        if (!scan_changed && get_matrix_num_keys_debouncing() == 0) {
+            g_scan_stats.false_wakeups++;
+        }
+    } else {
+        scan_changed = matrix_scan();
+        g_scan_stats.scans++;
+    }
+
+    if (
+        g_scan_plan.mode != MATRIX_SCANNER_MODE_NO_MATRIX &&
+        s_matrix_number_keys_down == 0 &&
+        s_matrix_number_keys_debouncing == 0
+    ) {
+        matrix_scan_irq_enable();
+
+        // A key might have been pressed between the last scan and the
+        // interrupts being armed, in which case no interrupt will fire.
+        if (matrix_has_active_row()) {
+            matrix_scan_irq_disable();
+        } else {
+            s_scan_mode = MATRIX_SCAN_MODE_IDLE;
+        }
+    }
+
+    return scan_changed;
+}
+
+bit_t matrix_scan_is_idle(void) {
+    return s_scan_mode == MATRIX_SCAN_MODE_IDLE;
+}
+
+void matrix_scan_wakeup(void) {
+    if (s_scan_mode == MATRIX_SCAN_MODE_IDLE) {
+        matrix_scan_irq_disable();
+        s_scan_mode = MATRIX_SCAN_MODE_ACTIVE;
+    }
+}
+
 uint8_t get_matrix_num_keys_down(void) {
     return s_matrix_number_keys_down;
 }
@@ -370,16 +514,21 @@ void passthrough_keycodes_task(void) REENT {
                 // uint8_t col_mask = io_map_get_col_port_mask(col);
                 // uint8_t col_mask = g_col_masks[col];
                 uint8_t col_mask = get_col_mask(col);
-                uint8_t mask = 0x01;
-                while ((uint8_t) mask) {
-                    if (col_mask & mask) {
-                        if (matrix_byte & mask) {
-                            bitmap_set_bit(passthrough_bitmap, logical_col);
-                        }
-                        logical_col += 1;
-                    }
-                    mask <<= 1;
+                uint8_t keys_down = matrix_byte & col_mask;
+
+                // The logical column of a pin is its position among the set
+                // bits of `col_mask`, so only the pins that are down need to
+                // be visited.
+                while (keys_down) {
+                    const uint8_t bit = bitset_ctz(keys_down);
+                    const uint8_t lower_pins = col_mask & (bitn_mask(bit) - 1);
+                    bitmap_set_bit(
+                        passthrough_bitmap,
+                        logical_col + bitset_popcount(lower_pins)
+                    );
+                    keys_down = bitset_clear_lowest(keys_down);
                 }
+                logical_col += bitset_popcount(col_mask);
             }
         }
         // send the raw matrix data to the host
@@ -6,6 +6,7 @@
 
 #include "config.h"
 
+#include "core/build_config.h"
 #include "core/util.h"
 
 #if USE_SCANNER
@@ -19,8 +20,11 @@
 #error "MAX_NUM_ROWS needs to be defined"
 #endif
 
-/// Max number of keys a split keyboard device can use (16 bytes)
-#define MAX_NUM_KEYS 128
+/// Max number of keys a split keyboard device can use (16 bytes). Must be a
+/// multiple of 8.
+#ifndef MAX_NUM_KEYS
+    #define MAX_NUM_KEYS 128
+#endif
 
 /// Size of the bitmap used to store key numbers
 #define KEY_NUMBER_BITMAP_SIZE (MAX_NUM_KEYS/8)
@@ -96,6 +100,27 @@ typedef struct matrix_scan_plan_t {
 } ATTR_PACKED matrix_scan_plan_t;
 
 
+/// Scan modes used by `matrix_scan_task()`
+typedef enum matrix_scan_mode_t {
+    /// The matrix is scanned every time `matrix_scan_task()` is called
+    MATRIX_SCAN_MODE_ACTIVE = 0x00,
+    /// No keys are down or debouncing. All rows are driven and the column
+    /// interrupts are armed, and the matrix is only scanned once a column
+    /// interrupt has fired.
+    MATRIX_SCAN_MODE_IDLE = 0x01,
+} matrix_scan_mode_t;
+
+/// Counters for the scan mode state machine. Scans cost far more than the
+/// interrupt flag checks made while idle, so these can be used to estimate
+/// the average current draw of the scanner. `make matrix-scan-test` in
+/// `ports/linux` does this for a trace of key presses.
+typedef struct matrix_scan_stats_t {
+    uint32_t scans; ///< Number of full matrix scans
+    uint32_t idle_checks; ///< Number of calls that were skipped while idle
+    uint16_t wakeups; ///< Number of times a column interrupt ended idle mode
+    uint16_t false_wakeups; ///< Wakeups whose scan didn't find any key
+} matrix_scan_stats_t;
+
 /*********************************************************************
  *                         global variables                          *
  *********************************************************************/
@@ -109,6 +134,7 @@ extern XRAM uint8_t g_key_num_bitmap[KEY_NUMBER_BITMAP_SIZE];
 
 extern const ROM uint8_t *g_scan_key_map;
 extern XRAM matrix_scan_plan_t g_scan_plan;
+extern XRAM matrix_scan_stats_t g_scan_stats;
 
 /*********************************************************************
  *                    port implemented functions                     *
@@ -152,6 +178,27 @@ uint8_t get_matrix_num_keys_down(void);
 /// Returns the number of keys currently being debounced in the matrix
 uint8_t get_matrix_num_keys_debouncing(void);
 
+/// Scan the matrix if needed, and switch between the active and idle scan modes.
+///
+/// While keys are down or debouncing, this calls `matrix_scan()` each time it
+/// is called. Once the matrix is quiet, it puts the matrix in interrupt mode
+/// with `matrix_scan_irq_enable()`, and then skips scanning until a column
+/// interrupt fires. Ports that use this should call it in place of
+/// `matrix_scan()` in their main loop, and may sleep until the next
+/// interrupt when `matrix_scan_is_idle()` is true and no other work is
+/// pending.
+///
+/// @return true if the matrix state has changed
+bool matrix_scan_task(void);
+
+/// @return true if the scanner is waiting for a column interrupt
+bit_t matrix_scan_is_idle(void);
+
+/// Leave idle mode, so that the next call to `matrix_scan_task()` scans the
+/// matrix. Used by ports after code that changes the matrix interrupt state
+/// itself, such as deep sleep.
+void matrix_scan_wakeup(void);
+
 /// setup for common scanning and debouncing code
 ///
 /// @return returns non zero on error
@@ -161,9 +208,8 @@ int init_matrix_scanner_utils(void);
 /// Get a matrix packet that for the most recent matrix scan.
 ///
 /// This function will generate a matrix packet that contains the key state
-/// for all keys in the matrix. The result may either be a list of keys,
-/// a bitmap of the entire matrix state, or the list of keys that changed in
-/// the most recent matrix scan.
+/// for all keys in the matrix, using whichever encoding from
+/// `core/matrix_packet.h` is the smallest.
 ///
 /// The functions `scanner_add_matrix_key()` and `scanner_del_matrix_key()` are
 /// used to update which keys are pressed in the matrix scanner module.
@@ -172,6 +218,9 @@ int init_matrix_scanner_utils(void);
 /// that is a packet which lists only the keys that changed and not the entire
 /// matrix state. However, the function may choose to ignore the `use_deltas`
 /// flag if it is more efficient to transmit the entire matrix state.
+///
+/// @param dest buffer of at least `MATRIX_PACKET_MAX_SIZE` bytes
+/// @return the size of the matrix packet
 uint8_t get_matrix_data(uint8_t *dest, bool use_deltas);
 
 /// Add a pressed key to the matrix scanner, putting it in the pressed state.
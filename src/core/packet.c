@@ -15,7 +15,7 @@ void set_packet_type(packet_t *packet, uint8_t type) {
 
 bool is_matrix_packet(packet_t *packet) {
     uint8_t type = packet->gen.type >> PACKET_MATRIX_TYPE_BIT_POS;
-    return type <= PACKET_MATRIX_DELTA_LIST;
+    return type <= PACKET_MATRIX_RAW_PART;
 }
 
 /* void set_packet_uid(void) { */
@@ -27,7 +27,7 @@
 
 #define PACKET_SIZE 16
 #define PACKET_PAYLOAD_LENGTH 11
-#define PACKET_SYNC_SALT_LENGTH (PACKET_PAYLOAD_LENGTH-5)
+#define PACKET_SYNC_SALT_LENGTH (PACKET_PAYLOAD_LENGTH-6)
 #define PACKET_ID_MAX_INCREMENT_BITS 16
 #define PACKET_ID_MAX_INCREMENT ((uint32_t)1 << PACKET_ID_MAX_INCREMENT_BITS)
 #define PACKET_ID_MAX_INCREMENT_MASK ((uint32_t)(~((uint32_t)0)<<PACKET_ID_MAX_INCREMENT_BITS))
@@ -44,11 +44,14 @@
 
 #define MATRIX_DELTA_KEY_MASK 0x7f
 
+/// Matrix data encodings, see `core/matrix_packet.h`
 typedef enum {
     PACKET_MATRIX_RAW = 0x00,
     PACKET_MATRIX_KEY_LIST = 0x01,
     PACKET_MATRIX_DELTA_LIST = 0x02,
-    PACKET_MATRIX_RESERVED = 0x03,
+    PACKET_MATRIX_ROW_MASK = 0x03,
+    PACKET_MATRIX_RUN_LENGTH = 0x04,
+    PACKET_MATRIX_RAW_PART = 0x05,
 } wired_packet_type_t;
 
 // 16 bytes
@@ -74,6 +77,7 @@ typedef struct packet_matrix_t {
 typedef struct packet_sync_t {
     uint8_t type;
     uint32_t nonce;
+    uint8_t retransmit_delay; // ARD the receiver assigns to the device
     uint8_t salt[PACKET_SYNC_SALT_LENGTH];
     uint8_t device_id;
     uint32_t packet_id;
@@ -0,0 +1,122 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/ram_budget.c
+///
+/// Compile time check that the sized RAM tables (see `core/build_config.h`)
+/// fit in `RAM_BUDGET` bytes. This file is only built when `RAM_BUDGET` is
+/// given, and contains no code.
+///
+/// `keyplus-cli program --config-header` lists the bytes each table uses for
+/// the layout, at the top of the generated config header.
+
+#include "core/build_config.h"
+#include "core/matrix_scanner.h"
+#include "core/settings.h"
+
+#if USE_USB || USE_BLUETOOTH
+#include "core/matrix_interpret.h"
+#include "key_handlers/key_hold.h"
+#endif
+
+#if SUPPORT_COMBO
+#include "core/combo.h"
+#endif
+
+#if SUPPORT_MACRO
+#include "core/macro.h"
+#endif
+
+#if USE_USB
+#include "hid_reports/report_queue.h"
+#endif
+
+#if USE_NRF24
+#include "core/rf.h"
+#endif
+
+#if USE_SCANNER
+    /// debounce times and key number bitmap
+    #define RAM_SCANNER_TABLES_SIZE (MAX_NUM_KEYS + KEY_NUMBER_BITMAP_SIZE)
+#else
+    #define RAM_SCANNER_TABLES_SIZE 0
+#endif
+
+#if USE_USB || USE_BLUETOOTH
+    /// keyboard slots, slot LRU list, layout -> slot map, hold key list, the
+    /// key presses held back by hold keys and combos, and the sparse layer
+    /// offset cache of `core/layout.c`
+    #define RAM_INTERPRETER_TABLES_SIZE ( \
+        (sizeof(keyboard_t) + 1) * MAX_NUM_KEYBOARD_SLOTS + \
+        MAX_NUM_LAYOUTS + \
+        sizeof(hold_event_t) * MAX_NUM_HOLD_KEYS + \
+        sizeof(buffered_keys_t) + \
+        sizeof(flash_addr_t) * (MAX_NUM_LAYERS + 1) + 2 * sizeof(layer_mask_t) \
+    )
+#else
+    #define RAM_INTERPRETER_TABLES_SIZE 0
+#endif
+
+#if SUPPORT_COMBO
+    /// combo table, combo sizes and per key combo index
+    #define RAM_COMBO_TABLES_SIZE ( \
+        (sizeof(combo_entry_t) + 1) * MAX_NUM_COMBOS + \
+        sizeof(combo_mask_t) * COMBO_MAX_KEY_NUM \
+    )
+#else
+    #define RAM_COMBO_TABLES_SIZE 0
+#endif
+
+#if SUPPORT_MACRO
+    /// decoded macro instructions and the programs they belong to
+    #define RAM_MACRO_CACHE_SIZE ( \
+        sizeof(macro_instr_t) * MACRO_CACHE_SIZE + \
+        sizeof(macro_cache_entry_t) * MACRO_CACHE_ENTRIES \
+    )
+#else
+    #define RAM_MACRO_CACHE_SIZE 0
+#endif
+
+#if USE_USB
+    /// queued reports and the queue of each of the 4 endpoints
+    #define RAM_REPORT_QUEUE_SIZE ( \
+        HID_REPORT_QUEUE_DEPTH * HID_REPORT_QUEUE_FRAME_SIZE + \
+        4 * sizeof(report_queue_t) \
+    )
+#else
+    #define RAM_REPORT_QUEUE_SIZE 0
+#endif
+
+#if USE_NRF24 && !defined(NO_RF_RECEIVE)
+    /// received packets waiting for `rf_task()`, and the link counters of
+    /// each device id
+    #define RAM_RF_RX_QUEUE_SIZE ( \
+        RF_RX_QUEUE_SIZE * sizeof(rf_rx_packet_t) + \
+        RF_MAX_NUM_DEVICES * sizeof(rf_rx_device_stats_t) \
+    )
+#else
+    #define RAM_RF_RX_QUEUE_SIZE 0
+#endif
+
+#if USE_NRF24 && !defined(NO_RF_TRANSMIT)
+    /// matrix and changed keys of each queued packet, and the last matrix sent
+    #define RAM_RF_TX_QUEUE_SIZE ( \
+        (RF_TX_QUEUE_SIZE * 2 + 1) * KEY_NUMBER_BITMAP_SIZE \
+    )
+#else
+    #define RAM_RF_TX_QUEUE_SIZE 0
+#endif
+
+#define RAM_TABLES_SIZE ( \
+    RAM_SCANNER_TABLES_SIZE + \
+    RAM_INTERPRETER_TABLES_SIZE + \
+    RAM_COMBO_TABLES_SIZE + \
+    RAM_MACRO_CACHE_SIZE + \
+    RAM_REPORT_QUEUE_SIZE + \
+    RAM_RF_RX_QUEUE_SIZE + \
+    RAM_RF_TX_QUEUE_SIZE \
+)
+
+KP_STATIC_ASSERT(
+    RAM_TABLES_SIZE <= RAM_BUDGET,
+    "The sized RAM tables need more than RAM_BUDGET bytes"
+);
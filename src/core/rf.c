@@ -6,9 +6,11 @@
 
 #include "core/rf.h"
 
+#include <stddef.h>
 #include <string.h>
 
 #include "core/aes.h"
+#include "core/crc.h"
 #include "core/debug.h"
 #include "core/error.h"
 #include "core/flash.h"
@@ -22,6 +24,7 @@
 #include "core/packet.h"
 #include "core/ring_buf.h"
 #include "core/settings.h"
+#include "core/timer.h"
 #include "core/util.h"
 
 #include "core/usb_commands.h"
@@ -40,18 +43,23 @@ uint8_t device_id_to_pipe_num(const uint8_t device_id) {
     return device_id % NUM_KEYBOARD_PIPES;
 }
 
+static void nrf24_write_retransmit_delay(uint8_t rf_ard) {
+    nrf24_write_reg(SETUP_RETR, ((rf_ard & 0xf) << ARD) | ((g_rf_settings.arc & 0xf) << ARC));
+}
+
 void nrf24_registers_common(void) {
     // When ack payloads > 15bytes are used @2Mbps, need ARD >=500µs.
     // maybe increase the auto matic retransmit delay?
     // The ARD is given by `(ard + 1) * 250µs` with a maximum delay of 4ms.
-    const uint8_t rf_ard = device_id_to_pipe_num(GET_SETTING(device_id)) + 1;
+    // A sender uses this delay until the receiver assigns it one.
+    const uint8_t rf_ard = device_id_to_pipe_num(GET_SETTING(device_id)) + RF_ARD_MIN;
 
     nrf24_write_reg(CONFIG, NRF24_IRQ_MASK_ALL); // need to power down before settings these registers
     nrf24_write_reg(RF_SETUP, RF_DR_2MBPS | PWR_0DB);
     nrf24_write_reg(SETUP_AW, ((RF_ADDR_WIDTH - 2) & 0x3));
     nrf24_write_reg(RF_CH, g_rf_settings.channel);
     nrf24_write_reg(FEATURE, EN_DPL_bm | EN_ACK_PAY_bm);
-    nrf24_write_reg(SETUP_RETR, ((rf_ard & 0xf) << ARD) | ((g_rf_settings.arc & 0xf) << ARC));
+    nrf24_write_retransmit_delay(rf_ard);
 }
 
 /// Check if a buffer is set to zero
@@ -70,14 +78,22 @@ uint8_t is_buffer_zeroed(uint8_t *buffer, uint8_t len) {
 
 #ifndef NO_RF_TRANSMIT
 
+#include "core/matrix_packet.h"
 #include "core/matrix_scanner.h"
-#include "core/matrix_scanner.h"
+
+// The retransmit delay assigned by the receiver in its last session
+// challenge, 0 if none was assigned yet. It isn't cleared by
+// `rf_init_send()`, so it is kept over deep sleep.
+static XRAM uint8_t s_tx_retransmit_delay;
 
 /* TODO: move settings */
 static void nrf_registers_init_sender(void) {
     const uint8_t pipe_num = device_id_to_pipe_num(GET_SETTING(device_id));
     // radio settings
     nrf24_registers_common();
+    if (s_tx_retransmit_delay) {
+        nrf24_write_retransmit_delay(s_tx_retransmit_delay);
+    }
 
     // address settings
     if (pipe_num == 0) {
@@ -103,6 +119,40 @@ static void nrf_registers_init_sender(void) {
     nrf24_write_reg(RX_PW_P0, 32);
 }
 
+// Matrix states wait in the transmit queue while the packet in the TX FIFO
+// is waiting for its ACK. Each entry holds the full matrix state and the keys
+// that changed since the entry before it. A new state is merged into the
+// last entry when none of the keys it changes have changed in that entry, so
+// a key that is tapped while the link is busy still sends its press and its
+// release, in order, once the link recovers.
+#define RF_TX_QUEUE_MASK (RF_TX_QUEUE_SIZE - 1)
+
+#if (RF_TX_QUEUE_SIZE & RF_TX_QUEUE_MASK) != 0
+    #error "RF_TX_QUEUE_SIZE must be a power of two"
+#endif
+
+typedef struct rf_tx_entry_t {
+    uint8_t matrix[KEY_NUMBER_BITMAP_SIZE];
+    uint8_t changed[KEY_NUMBER_BITMAP_SIZE];
+} rf_tx_entry_t;
+
+static XRAM rf_tx_entry_t s_tx_queue[RF_TX_QUEUE_SIZE];
+static XRAM uint8_t s_tx_head;
+static XRAM uint8_t s_tx_count;
+static XRAM uint8_t s_tx_retry_count;
+// The last matrix state written to the TX FIFO
+static XRAM uint8_t s_tx_last_matrix[KEY_NUMBER_BITMAP_SIZE];
+
+XRAM rf_tx_stats_t g_rf_tx_stats;
+
+static void rf_tx_queue_clear(void) {
+    s_tx_head = 0;
+    s_tx_count = 0;
+    s_tx_retry_count = 0;
+    memset(s_tx_last_matrix, 0, KEY_NUMBER_BITMAP_SIZE);
+    memset(&g_rf_tx_stats, 0, sizeof(g_rf_tx_stats));
+}
+
 void rf_init_send(void) {
     if (g_runtime_settings.feature.ctrl.rf_disabled) {
         return;
@@ -127,19 +177,17 @@ void rf_init_send(void) {
 
     nrf24_flush_rx();
     nrf24_flush_tx();
+    rf_tx_queue_clear();
 
     nrf24_write_reg(CONFIG, RF_CRC_MODE | PWR_UP_bm | (0<<PRIM_RX) | NRF24_TX_IRQ_MASK);
     nrf24_ce(0);
 }
 
-void rf_send_matrix_packet(void) {
+static void rf_send_matrix_payload(const XRAM uint8_t *matrix_data, uint8_t len) {
     XRAM packet_matrix_t packet;
 
-    const uint8_t matrix_size = get_matrix_data(packet.matrix_data, false);
-
-    if (matrix_size < PACKET_PAYLOAD_LENGTH) {
-        memset(packet.matrix_data+matrix_size, 0, PACKET_PAYLOAD_LENGTH-matrix_size);
-    }
+    memcpy(packet.matrix_data, matrix_data, len);
+    memset(packet.matrix_data+len, 0, PACKET_PAYLOAD_LENGTH-len);
 
     // TODO: make a function that does this for us
     packet.device_id = GET_SETTING(device_id);
@@ -147,6 +195,131 @@ void rf_send_matrix_packet(void) {
 
     aes_encrypt((uint8_t*)&packet);
     nrf24_write_tx_payload((uint8_t*)&packet, AES_BUF_SIZE);
+    g_rf_tx_stats.sent++;
+}
+
+static void rf_send_matrix_state(const XRAM uint8_t *matrix) {
+    XRAM uint8_t matrix_data[MATRIX_PACKET_MAX_SIZE];
+    const uint8_t size = get_matrix_compressed_size();
+    uint8_t len;
+    uint8_t offset;
+
+    // Deltas aren't used over RF, a lost packet would leave keys stuck
+    len = matrix_packet_encode(matrix_data, matrix, size);
+
+    if (len <= PACKET_PAYLOAD_LENGTH) {
+        rf_send_matrix_payload(matrix_data, len);
+        return;
+    }
+
+    // Too many keys are down for any encoding to fit in one packet, so send
+    // the bitmap in parts.
+    for (offset = 0; offset < size; offset += MATRIX_PACKET_PART_MAX_LEN) {
+        len = matrix_packet_encode_part(matrix_data, matrix, size, offset);
+        rf_send_matrix_payload(matrix_data, len);
+    }
+}
+
+uint8_t rf_tx_queue_depth(void) {
+    return s_tx_count;
+}
+
+void rf_send_matrix_packet(void) {
+    const uint8_t size = get_matrix_compressed_size();
+    XRAM rf_tx_entry_t *entry = NULL;
+    const XRAM uint8_t *prev_matrix = s_tx_last_matrix;
+    bit_t has_changes = false;
+    bit_t overlaps = false;
+    uint8_t i;
+
+    g_rf_tx_stats.states++;
+
+    if (s_tx_count) {
+        entry = &s_tx_queue[(s_tx_head + s_tx_count - 1) & RF_TX_QUEUE_MASK];
+        prev_matrix = entry->matrix;
+    }
+
+    for (i = 0; i < size; ++i) {
+        const uint8_t delta = g_key_num_bitmap[i] ^ prev_matrix[i];
+        if (delta) {
+            has_changes = true;
+            if (entry && (delta & entry->changed[i])) {
+                overlaps = true;
+            }
+        }
+    }
+
+    if (entry && !has_changes) {
+        // The last queued state is already the current one
+        return;
+    }
+
+    if (entry && (!overlaps || s_tx_count == RF_TX_QUEUE_SIZE)) {
+        if (overlaps) {
+            // The queue is full, so a transition of a key is lost
+            g_rf_tx_stats.overflows++;
+        } else {
+            g_rf_tx_stats.coalesced++;
+        }
+    } else {
+        // Also queues a state that hasn't changed when the queue is empty,
+        // the packet is still needed to receive ACK payloads.
+        entry = &s_tx_queue[(s_tx_head + s_tx_count) & RF_TX_QUEUE_MASK];
+        memset(entry->changed, 0, KEY_NUMBER_BITMAP_SIZE);
+        s_tx_count++;
+        g_rf_tx_stats.depth = s_tx_count;
+        if (s_tx_count > g_rf_tx_stats.max_depth) {
+            g_rf_tx_stats.max_depth = s_tx_count;
+        }
+    }
+
+    for (i = 0; i < size; ++i) {
+        entry->changed[i] |= g_key_num_bitmap[i] ^ prev_matrix[i];
+        entry->matrix[i] = g_key_num_bitmap[i];
+    }
+
+    rf_tx_task();
+}
+
+bit_t rf_tx_task(void) {
+    XRAM rf_tx_entry_t *entry;
+
+    if (s_tx_count == 0) {
+        return false;
+    }
+
+    // Keep one matrix packet in flight, so newer states can still be merged
+    if (!(nrf24_read_reg(FIFO_STATUS) & FIFO_TX_EMPTY_bm)) {
+        return true;
+    }
+
+    entry = &s_tx_queue[s_tx_head];
+    rf_send_matrix_state(entry->matrix);
+    memcpy(s_tx_last_matrix, entry->matrix, KEY_NUMBER_BITMAP_SIZE);
+
+    s_tx_head = (s_tx_head + 1) & RF_TX_QUEUE_MASK;
+    s_tx_count--;
+    s_tx_retry_count = 0;
+    g_rf_tx_stats.depth = s_tx_count;
+
+    return s_tx_count != 0;
+}
+
+void rf_tx_handle_max_rt(void) {
+    g_rf_tx_stats.retries++;
+    s_tx_retry_count++;
+
+    if (s_tx_retry_count > RF_TX_MAX_RETRIES) {
+        // Give up on the packet, the queued states hold the full matrix state
+        // so the receiver catches up with the next one.
+        nrf24_flush_tx();
+        s_tx_retry_count = 0;
+        g_rf_tx_stats.dropped++;
+    } else {
+        nrf24_send_one();
+    }
+
+    nrf24_write_reg(NRF_STATUS, STATUS_MAX_RT_bm);
 }
 
 void rf_handle_ack_payloads(void) {
@@ -162,8 +335,18 @@ void rf_handle_ack_payloads(void) {
         aes_decrypt(data_buffer);
         {
             packet_t *packet = (packet_t*)data_buffer;
+            // Devices whose ids map to the same pipe share its ACK payloads,
+            // so only answer the challenges addressed to this device.
             if (get_packet_type(packet) == PACKET_TYPE_SESSION_UPDATE &&
+                    packet->sync.device_id == GET_SETTING(device_id) &&
                     is_buffer_zeroed(packet->sync.salt, PACKET_SYNC_SALT_LENGTH)) {
+                const uint8_t rf_ard = packet->sync.retransmit_delay;
+                if (rf_ard >= RF_ARD_MIN && rf_ard <= RF_ARD_MAX &&
+                        rf_ard != s_tx_retransmit_delay) {
+                    s_tx_retransmit_delay = rf_ard;
+                    nrf24_write_retransmit_delay(rf_ard);
+                }
+
                 set_packet_type(packet, PACKET_TYPE_SESSION_UPDATE);
                 packet->sync.nonce = packet->sync.nonce;
                 packet->sync.device_id = GET_SETTING(device_id);
@@ -174,6 +357,7 @@ void rf_handle_ack_payloads(void) {
                 aes_encrypt(data_buffer);
                 nrf24_write_tx_payload(data_buffer, 16);
                 nrf24_send_all();
+                g_rf_tx_stats.resyncs++;
 
                 rf_send_matrix_packet();
             }
@@ -184,47 +368,60 @@ void rf_handle_ack_payloads(void) {
 
 #ifndef NO_RF_RECEIVE
 
-#define PACKET_BUFFER_MAX_LEN 22
+// Received packets wait in a queue of packet slots. The producer (`rf_isr()`
+// or the ESB event handler) reads each packet straight into a free slot and
+// publishes it with `rf_rx_queue_commit()`. `rf_task()` handles each slot in
+// place, then frees it with `rf_rx_queue_release()`. Slots are handed over
+// by index with an spsc ring, so neither side needs to mask interrupts.
+DEFINE_INLINE_SPSC_RING_VARIANT(RF_RX_QUEUE_SIZE, uint8_t, rf_rx_packet_t, rf_rx_ring);
 
-static XRAM ring_buf128_type s_rx_buffer;
+static XRAM rf_rx_ring_type s_rx_queue;
 
-void packet_buffer_clear(void) {
-    ring_buf128_clear(&s_rx_buffer);
-}
+XRAM rf_rx_stats_t g_rf_rx_stats;
+XRAM rf_rx_device_stats_t g_rf_rx_device_stats[RF_MAX_NUM_DEVICES];
 
-uint8_t packet_buffer_free_space(void) {
-    return ring_buf128_free_space(&s_rx_buffer);
+void rf_rx_queue_clear(void) {
+    rf_rx_ring_clear(&s_rx_queue);
 }
 
-uint8_t packet_buffer_len(void) {
-    return ring_buf128_len(&s_rx_buffer);
+bit_t rf_rx_queue_has_data(void) {
+    return rf_rx_ring_has_data(&s_rx_queue);
 }
 
-bit_t packet_buffer_has_data(void) {
-    return ring_buf128_has_data(&s_rx_buffer);
+XRAM rf_rx_packet_t *rf_rx_queue_reserve(void) {
+    XRAM rf_rx_packet_t *slot;
+    if (rf_rx_ring_write_span(&s_rx_queue, &slot) == 0) {
+        g_rf_rx_stats.dropped++;
+        return NULL;
+    }
+    return slot;
 }
 
-uint8_t packet_buffer_get(void) {
-    return ring_buf128_get(&s_rx_buffer);
+void rf_rx_queue_commit(void) {
+    rf_rx_ring_commit(&s_rx_queue, 1);
 }
 
-void packet_buffer_add_byte(uint8_t byte) {
-    ring_buf128_put(&s_rx_buffer, byte);
+XRAM rf_rx_packet_t *rf_rx_queue_peek(void) {
+    XRAM rf_rx_packet_t *slot;
+    if (rf_rx_ring_read_span(&s_rx_queue, &slot) == 0) {
+        return NULL;
+    }
+    return slot;
 }
 
-void packet_buffer_take(XRAM uint8_t *dest, uint8_t width) {
-    ring_buf128_take(&s_rx_buffer, dest, width);
+void rf_rx_queue_release(void) {
+    rf_rx_ring_skip(&s_rx_queue, 1);
 }
 
 #if NRF24_INBUILT_SPI_HANDLING
 
-static void packet_buffer_load(uint8_t len) {
+static void rf_rx_payload_load(XRAM uint8_t *dest, uint8_t len) {
     uint8_t i;
     const nrf24_spi_command_t cmd = R_RX_PAYLOAD;
     nrf24_csn(0);
     nrf24_spi_send_byte(cmd);
     for (i = 0; i < len; ++i) {
-        packet_buffer_add_byte(nrf24_spi_send_byte(NRF_NOP));
+        dest[i] = nrf24_spi_send_byte(NRF_NOP);
     }
     nrf24_csn(1);
 }
@@ -233,15 +430,8 @@ static void packet_buffer_load(uint8_t len) {
 // If the device doesn't use the inbuilt spi handling in `core/nrf24.c`, then
 // it doesn't provide `nrf24_spi_send_byte()`, so we use `nrf24_read_buf()`
 // here instead
-static void packet_buffer_load(uint8_t len) {
-    uint8_t i;
-    uint8_t s_rx_buf[MAX_PAYLOAD_LENGTH+1];
-
-    nrf24_read_buf(R_RX_PAYLOAD, s_rx_buf, len);
-
-    for (i = 0; i < len; ++i) {
-        packet_buffer_add_byte(s_rx_buf[i]);
-    }
+static void rf_rx_payload_load(XRAM uint8_t *dest, uint8_t len) {
+    nrf24_read_buf(R_RX_PAYLOAD, dest, len);
 }
 #endif
 
@@ -257,13 +447,145 @@ enum {
 
 typedef struct packet_id_t {
     uint8_t sync_state;
+    uint8_t retransmit_delay; // ARD assigned to the device, 0 if unknown
     uint32_t check_id;
 } packet_id_t;
 
 // TODO: put this in an `init` function
-XRAM packet_id_t device_uid_list[MAX_NUM_DEVICES];
+static XRAM packet_id_t device_uid_list[RF_MAX_NUM_DEVICES];
 
+// Only used by the passive listening mode in `read_packet()`, which is
+// disabled with the same `#if`.
+#if 0
 static XRAM uint16_t last_crc[NRF24_NUMBER_PIPES];
+#endif
+
+#if RF_SESSION_TICKET_COUNT
+// A session ticket holds the last valid packet id of a device. Unlike
+// `device_uid_list` the tickets aren't cleared by `rf_init_receive()` or by a
+// reset of the MCU, so a disconnected device can resume its session with a
+// packet id that continues from its ticket. The ticket expires after
+// `RF_SESSION_TICKET_MINUTES`, after that the device has to pass the
+// challenge again.
+//
+// After a power cycle the RAM of the tickets holds random data, which the
+// CRC of each ticket rejects.
+typedef struct session_ticket_t {
+    uint32_t packet_id;
+    uint8_t retransmit_delay;
+    uint8_t minutes_left;
+    uint16_t crc;
+} session_ticket_t;
+
+#define SESSION_TICKET_CRC_LEN offsetof(session_ticket_t, crc)
+#define SESSION_TICKET_MINUTE_MS 60000
+
+#if defined(RF_SESSION_TICKET_ADDR)
+static XRAM session_ticket_t s_session_tickets[RF_SESSION_TICKET_COUNT] AT(RF_SESSION_TICKET_ADDR);
+KP_STATIC_ASSERT(
+    RF_SESSION_TICKET_COUNT * sizeof(session_ticket_t) <= RF_SESSION_TICKET_RAM,
+    "RF_SESSION_TICKET_RAM is too small for RF_SESSION_TICKET_COUNT"
+);
+#else
+static XRAM session_ticket_t s_session_tickets[RF_SESSION_TICKET_COUNT] ATTR_NO_INIT;
+#endif
+static XRAM uint16_t s_session_minute_start;
+
+static uint16_t session_ticket_crc(const XRAM session_ticket_t *ticket) {
+    return crc16_buffer((const uint8_t*)ticket, SESSION_TICKET_CRC_LEN);
+}
+
+static void session_ticket_write(
+    XRAM session_ticket_t *ticket,
+    uint32_t packet_id,
+    uint8_t retransmit_delay,
+    uint8_t minutes_left
+) {
+    ticket->packet_id = packet_id;
+    ticket->retransmit_delay = retransmit_delay;
+    ticket->minutes_left = minutes_left;
+    ticket->crc = session_ticket_crc(ticket);
+}
+
+// Drop the tickets whose RAM wasn't kept over the last reset
+static void session_tickets_init(void) {
+    uint8_t i;
+
+    for (i = 0; i < RF_SESSION_TICKET_COUNT; ++i) {
+        XRAM session_ticket_t *ticket = &s_session_tickets[i];
+        if (ticket->crc != session_ticket_crc(ticket)) {
+            session_ticket_write(ticket, 0, 0, 0);
+        }
+    }
+    s_session_minute_start = timer_read16_ms();
+}
+
+static void session_ticket_update(uint8_t device_id, uint32_t packet_id) {
+    if (device_id < RF_SESSION_TICKET_COUNT) {
+        XRAM session_ticket_t *ticket = &s_session_tickets[device_id];
+        // a resumed session keeps the retransmit delay it was assigned
+        if (device_uid_list[device_id].retransmit_delay == 0) {
+            device_uid_list[device_id].retransmit_delay = ticket->retransmit_delay;
+        }
+        session_ticket_write(
+            ticket,
+            packet_id,
+            device_uid_list[device_id].retransmit_delay,
+            RF_SESSION_TICKET_MINUTES
+        );
+    }
+}
+
+// A device resets its packet counter and starts a new session id when it is
+// reset, so the packet id can move ahead by a few sessions but never back.
+static bit_t can_resume_session(const packet_t *packet, uint8_t pipe_num) {
+    const uint8_t device_id = packet->gen.device_id;
+    const uint32_t pid = packet->gen.packet_id;
+    XRAM session_ticket_t *ticket;
+
+    if (device_id >= RF_SESSION_TICKET_COUNT || device_id >= RF_MAX_NUM_DEVICES) {
+        return false;
+    }
+    ticket = &s_session_tickets[device_id];
+
+    if (ticket->minutes_left == 0 ||
+        device_id_to_pipe_num(device_id) != pipe_num ||
+        device_id > GET_SETTING(layout.number_devices)
+    ) {
+        return false;
+    }
+
+    return pid > ticket->packet_id &&
+        (pid - ticket->packet_id) <=
+        ((uint32_t)RF_SESSION_RESUME_WINDOW << PACKET_ID_MAX_INCREMENT_BITS);
+}
+
+static void session_ticket_task(void) {
+    uint8_t i;
+
+    if ((uint16_t)(timer_read16_ms() - s_session_minute_start) < SESSION_TICKET_MINUTE_MS) {
+        return;
+    }
+    s_session_minute_start += SESSION_TICKET_MINUTE_MS;
+
+    for (i = 0; i < RF_SESSION_TICKET_COUNT; ++i) {
+        XRAM session_ticket_t *ticket = &s_session_tickets[i];
+        if (ticket->minutes_left) {
+            session_ticket_write(
+                ticket,
+                ticket->packet_id,
+                ticket->retransmit_delay,
+                ticket->minutes_left - 1
+            );
+        }
+    }
+}
+#else
+#define session_tickets_init()
+#define session_ticket_update(device_id, packet_id)
+#define can_resume_session(packet, pipe_num) false
+#define session_ticket_task()
+#endif
 
 static void nrf_registers_init_receiver(void) {
     uint8_t i;
@@ -304,7 +626,11 @@ void rf_init_receive(void) {
 
     // setup buffer
     init_uid_buffer_list();
-    packet_buffer_clear();
+    session_tickets_init();
+    rf_rx_queue_clear();
+    memset(&g_rf_rx_stats, 0, sizeof(g_rf_rx_stats));
+    memset(g_rf_rx_device_stats, 0, sizeof(g_rf_rx_device_stats));
+    g_rf_rx_stats.num_devices = RF_MAX_NUM_DEVICES;
     g_rf_enabled = true;
 
 #if USE_NRF52_ESB
@@ -402,16 +728,55 @@ bit_t is_auto_ack_enabled(void) {
 // knows what UID is, they will not be able to construct response packet because
 // they do not hold our preshared encryption key. If they try send a response
 // to the receiver, it will decrypt to junk data and be rejected.
-void rf_nrf24_load_sync_ack_payload(uint8_t device_id) {
-    XRAM uint8_t tmp_buffer[MAX_PAYLOAD_LENGTH];
-    packet_t *packet = (packet_t*)tmp_buffer;
+//
+// Devices whose ids map to the same pipe share its ACK payloads, so the
+// challenge holds the id of the device it is for. It also hands the device a
+// retransmit delay, see `assign_retransmit_delay()`.
+void rf_make_sync_ack_payload(XRAM uint8_t *dest, uint8_t device_id) {
+    packet_t *packet = (packet_t*)dest;
     // consturct the packet
     set_packet_type(packet, PACKET_TYPE_SESSION_UPDATE);
     packet->sync.nonce = device_uid_list[device_id].check_id;
+    packet->sync.retransmit_delay = device_uid_list[device_id].retransmit_delay;
     memset(packet->sync.salt, 0, PACKET_SYNC_SALT_LENGTH);
-    // encrypt and load into ack payload fifo
-    aes_encrypt(tmp_buffer);
+    packet->sync.device_id = device_id;
+    packet->sync.packet_id = 0;
+    // encrypt, ready for the ack payload fifo
+    aes_encrypt(dest);
+}
+
+void rf_nrf24_load_sync_ack_payload(uint8_t device_id) {
+    XRAM uint8_t tmp_buffer[MAX_PAYLOAD_LENGTH];
+
+    rf_make_sync_ack_payload(tmp_buffer, device_id);
+
+    // The receive IRQ also talks to the nRF24 over SPI
+    rf_disable_receive_irq();
     nrf24_write_ack_payload(tmp_buffer, PACKET_SIZE, device_id_to_pipe_num(device_id));
+    rf_enable_receive_irq();
+}
+
+// Devices that send at the same time on the same channel keep colliding when
+// their retransmits use the same delay, so each connected device is given a
+// different one. The lowest free delays are used first since they give the
+// fastest retransmits. With more devices than delays they are shared.
+static uint8_t assign_retransmit_delay(uint8_t device_id) {
+    uint16_t used = 0;
+    uint8_t i;
+
+    for (i = 0; i < RF_MAX_NUM_DEVICES; ++i) {
+        if (i != device_id && device_uid_list[i].sync_state != DEV_STATE_DISCONNECTED) {
+            used |= (uint16_t)1 << device_uid_list[i].retransmit_delay;
+        }
+    }
+
+    for (i = RF_ARD_MIN; i <= RF_ARD_MAX; ++i) {
+        if (!(used & ((uint16_t)1 << i))) {
+            return i;
+        }
+    }
+
+    return RF_ARD_MIN + device_id % (RF_ARD_MAX - RF_ARD_MIN + 1);
 }
 
 // For a packet to be valid:
@@ -444,27 +809,14 @@ bit_t is_valid_packet(const packet_t *packet, uint8_t pipe_num) {
     return true;
 }
 
+// Handles a packet from the receive queue, the payload is decrypted in place.
+//
 // Returns false if not a valid packet
-bit_t read_packet(void) REENT {
-    static XRAM uint8_t packet_payload[PACKET_BUFFER_MAX_LEN];
-
-    // get the packet pipe and size from the buffer
-    uint8_t pipe_num;
-    uint8_t width;
-
-
-    disable_interrupts();
-    pipe_num = packet_buffer_get();
-    width = packet_buffer_get();
-    if (width > PACKET_BUFFER_MAX_LEN || width > packet_buffer_len())  {
-        packet_buffer_clear();
-        return false;
-    }
-
-
-    // read out the packet payload into the buffer
-    packet_buffer_take(packet_payload, width);
-    enable_interrupts();
+static bit_t read_packet(XRAM rf_rx_packet_t *rx_packet) REENT {
+    XRAM uint8_t *packet_payload = rx_packet->payload;
+    const uint8_t pipe_num = rx_packet->pipe_num;
+    const uint8_t width = rx_packet->width;
+    XRAM rf_rx_device_stats_t *device_stats;
 
 #if USE_UNIFYING
     // NOTE: currently mouse pipes are disabled in passive listening mode
@@ -558,6 +910,8 @@ bit_t read_packet(void) REENT {
         return false;
     }
 
+    // only keyboard pipes are left at this point
+
 #if DEBUG_LEVEL >= 8
     // Print the packet before encryption
     usb_print(packet_payload, width);
@@ -579,7 +933,15 @@ bit_t read_packet(void) REENT {
         // this is actually form this device until we call is_valid_packet later.
         const uint8_t device_id = packet->gen.device_id;
         const uint8_t packet_type = get_packet_type(packet);
-        uint8_t state = device_uid_list[device_id].sync_state;
+        uint8_t state;
+        bit_t is_resumed = false;
+
+        if (device_id >= RF_MAX_NUM_DEVICES) {
+            g_rf_rx_stats.bad_device_ids++;
+            return false;
+        }
+        device_stats = &g_rf_rx_device_stats[device_id];
+        state = device_uid_list[device_id].sync_state;
 
         // We received a packet from a disconnected device.  We generate a uid
         // which we will send to the slave in a packet.
@@ -591,10 +953,19 @@ bit_t read_packet(void) REENT {
         //
         // The check_id is then used and updated in is_valid_packet() to
         // validate further packets received from the slave.
-        if (state == DEV_STATE_DISCONNECTED) {
+        //
+        // A disconnected device that still has a session ticket skips the
+        // challenge if its packet continues the session, see
+        // `can_resume_session()`. A device that is already synced has to
+        // pass `is_valid_packet()`.
+        if (state == DEV_STATE_DISCONNECTED && can_resume_session(packet, pipe_num)) {
+            is_resumed = true;
+            g_rf_rx_stats.resumes++;
+        } else if (state == DEV_STATE_DISCONNECTED) {
             device_uid_list[device_id].sync_state = DEV_STATE_SYNCING_0;
             // set the check_id for the challenge-response authentication
             device_uid_list[device_id].check_id = uid_generate();
+            device_uid_list[device_id].retransmit_delay = assign_retransmit_delay(device_id);
             // construct and send a challenge packet for the device
             #if USE_NRF52_ESB && USE_NRF24
                 switch (g_rf_settings.hw_type) {
@@ -614,6 +985,7 @@ bit_t read_packet(void) REENT {
             #else
                 #error "No NRF24 hardware type set"
             #endif
+            device_stats->resyncs++;
 
             // reject all data until we have synced
             return false;
@@ -625,6 +997,7 @@ bit_t read_packet(void) REENT {
                 // valid response to the challenge
                 device_uid_list[device_id].sync_state = DEV_STATE_SYNCED_0;
                 device_uid_list[device_id].check_id = packet->sync.packet_id;
+                session_ticket_update(device_id, packet->sync.packet_id);
 
                 // Got a valid sync packet! Can now accept future packets
                 // but don't have any data to process in the current sync packet
@@ -633,6 +1006,7 @@ bit_t read_packet(void) REENT {
             } else {
                 // incorrect response to the challenge
                 device_uid_list[device_id].sync_state++; // keep track of failed attempts
+                device_stats->rejected++;
                 // TODO: should probably reduce retry attempts to 1?
                 if (state >= DEV_STATE_SYNCING_0 + SYNCING_RETRY_LIMIT) {
                     // too many failed attempts, return to disconnected state
@@ -645,9 +1019,10 @@ bit_t read_packet(void) REENT {
         } // else assume that the claimed device_id is synced
 
         // expecting a normal data packet from the slave.
-        if (!is_valid_packet(packet, pipe_num)) {
+        if (!is_resumed && !is_valid_packet(packet, pipe_num)) {
             // keep track of the number of failed packets received
             device_uid_list[device_id].sync_state++;
+            device_stats->rejected++;
 
             // If we exceed the PACKET_FAIL_LIMIT, the device returns to
             // the disconnected state where it will have a chance to sync
@@ -661,6 +1036,13 @@ bit_t read_packet(void) REENT {
         // the packet we got is valid, so reset the sync state count
         device_uid_list[device_id].sync_state = DEV_STATE_SYNCED_0;
         device_uid_list[device_id].check_id = packet->gen.packet_id;
+        session_ticket_update(device_id, packet->gen.packet_id);
+
+        device_stats->received++;
+        device_stats->latency_last = timer_read16_ms() - rx_packet->timestamp;
+        if (device_stats->latency_last > device_stats->latency_max) {
+            device_stats->latency_max = device_stats->latency_last;
+        }
 
         // finally have a valid data packet ready to be processed
         if (is_matrix_packet(packet)) {
@@ -673,7 +1055,8 @@ bit_t read_packet(void) REENT {
     }
 }
 
-void rf_packet_buffer_add(void) {
+static void rf_packet_buffer_add(void) {
+    XRAM rf_rx_packet_t *slot;
     uint8_t pipe_num;
     uint8_t width;
 
@@ -686,21 +1069,25 @@ void rf_packet_buffer_add(void) {
 
     width = nrf24_read_rx_payload_width();
 
-    if (packet_buffer_free_space() < width+2) {
-        // no space left in buffer
+    slot = rf_rx_queue_reserve();
+    if (slot == NULL) {
+        // no free slot left
         nrf24_flush_rx(); // TODO: could probably handle this better
         return;
     }
 
-    if (width > PACKET_BUFFER_MAX_LEN) {
+    if (width > RF_RX_PAYLOAD_MAX_LEN) {
         // drop packets that are too large
         nrf24_read_rx_payload(NULL, 0);
+        g_rf_rx_stats.dropped++;
         return;
     }
 
-    packet_buffer_add_byte(pipe_num);
-    packet_buffer_add_byte(width);
-    packet_buffer_load(width);
+    slot->pipe_num = pipe_num;
+    slot->width = width;
+    slot->timestamp = timer_read16_ms();
+    rf_rx_payload_load(slot->payload, width);
+    rf_rx_queue_commit();
 }
 
 // NOTE: if other code needs to communicate with the nRF24L01+, it should
@@ -717,33 +1104,41 @@ void rf_isr(void) {
     nrf24_write_reg(NRF_STATUS, STATUS_ALL_IRQ_FLAGS_bm);
 }
 
+static bit_t rf_handle_rx_queue(void) {
+    XRAM rf_rx_packet_t *rx_packet;
+    bit_t has_data = false;
+
+    while ((rx_packet = rf_rx_queue_peek()) != NULL) {
+        has_data |= read_packet(rx_packet);
+        rf_rx_queue_release();
+    }
+
+    return has_data;
+}
+
 // check for radio messages and handle them
 bit_t rf_task(void) {
     // TODO: should probably add an option to make this interrupt based when we
     // have access to the nrf24 IRQ.
     bit_t has_data = false;
 
+    session_ticket_task();
+
     if (g_rf_settings.hw_type == RF_HW_NRF24L01) {
         #if RF_POLLING
             rf_isr();
         #endif
 
-        rf_disable_receive_irq();
-        while (packet_buffer_has_data()) {
-            has_data |= read_packet();
-        }
-        rf_enable_receive_irq();
+        // The receive IRQ stays enabled, the code that uses the SPI bus
+        // while handling a packet masks it itself.
+        has_data = rf_handle_rx_queue();
 #if USE_NRF52_ESB
     } else if (g_rf_settings.hw_type == RF_HW_NRF52_ESB) {
         NVIC_DisableIRQ(ESB_EVT_IRQ);
-        while (packet_buffer_has_data()) {
-            has_data |= read_packet();
-        }
+        has_data = rf_handle_rx_queue();
         NVIC_EnableIRQ(ESB_EVT_IRQ);
     } else if (g_rf_settings.hw_type == RF_HW_BLE_AND_ESB) {
-        while (packet_buffer_has_data()) {
-            has_data |= read_packet();
-        }
+        has_data = rf_handle_rx_queue();
 #endif
     }
 
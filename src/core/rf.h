@@ -8,6 +8,7 @@
 #include "core/matrix_interpret.h"
 #include "core/unifying.h"
 #include "core/nonce.h"
+#include "core/settings.h"
 
 // number of consecutive invalid packets required before a session is terminated
 #define PACKET_FAIL_LIMIT 6
@@ -38,17 +39,157 @@ bit_t is_auto_ack_enabled(void);
 #endif
 
 uint8_t device_id_to_pipe_num(const uint8_t device_id);
-uint8_t packet_buffer_free_space(void);
-void packet_buffer_add_byte(uint8_t byte);
-uint8_t packet_buffer_get(void);
-uint8_t packet_buffer_len(void);
-void packet_buffer_clear(void);
-bit_t packet_buffer_has_data(void);
-void packet_buffer_take(XRAM uint8_t *dest, uint8_t width);
+
+/// Number of device ids the receiver keeps session state for. Devices with a
+/// higher id are rejected.
+#ifndef RF_MAX_NUM_DEVICES
+    #define RF_MAX_NUM_DEVICES MAX_NUM_DEVICES
+#endif
+
+#if RF_MAX_NUM_DEVICES < 1 || RF_MAX_NUM_DEVICES > MAX_NUM_DEVICES
+    #error "RF_MAX_NUM_DEVICES must be between 1 and MAX_NUM_DEVICES"
+#endif
+
+/// Range of the auto retransmit delays (ARD) the receiver hands out, the
+/// delay is `(ard + 1) * 250µs`. ACK payloads longer than 15 bytes need at
+/// least 500µs at 2Mbps.
+#define RF_ARD_MIN 1
+#define RF_ARD_MAX 15
+
+/// Build the session challenge for `device_id` and encrypt it, ready to be
+/// loaded as an ACK payload on the device's pipe.
+///
+/// @param dest buffer of `PACKET_SIZE` bytes
+void rf_make_sync_ack_payload(XRAM uint8_t *dest, uint8_t device_id);
+
+/// Number of received packets that can wait for `rf_task()`, must be a power
+/// of two
+#ifndef RF_RX_QUEUE_SIZE
+    #define RF_RX_QUEUE_SIZE 8
+#endif
+
+/// Devices with an id below this have a session ticket on the receiver. A
+/// device whose session was lost, e.g. because the receiver MCU was reset
+/// while the device was asleep, can then resume it with its next packet
+/// instead of going through the challenge-response sync. Set to 0 to disable.
+///
+/// The tickets are kept in RAM that isn't cleared at start up (see
+/// `ATTR_NO_INIT`), so they survive a reset of the MCU but not a loss of
+/// power. On sdcc ports, `RF_SESSION_TICKET_ADDR` gives their address in
+/// XRAM and `RF_SESSION_TICKET_RAM` the bytes reserved there, which the port
+/// keeps out of the XRAM given to the linker.
+#ifndef RF_SESSION_TICKET_COUNT
+    #define RF_SESSION_TICKET_COUNT 8
+#endif
+
+/// Minutes that a session ticket stays valid after the last valid packet
+#ifndef RF_SESSION_TICKET_MINUTES
+    #define RF_SESSION_TICKET_MINUTES 30
+#endif
+
+/// Number of new session ids a device may start, one for each time it is
+/// reset, and still resume its session
+#define RF_SESSION_RESUME_WINDOW 4
+
+/// Largest packet that is kept in the receive queue, bigger ones are dropped
+#define RF_RX_PAYLOAD_MAX_LEN 22
+
+/// A slot of the receive queue
+typedef struct rf_rx_packet_t {
+    uint8_t pipe_num;
+    uint8_t width;
+    uint16_t timestamp; ///< `timer_read16_ms()` when the packet was received
+    uint8_t payload[RF_RX_PAYLOAD_MAX_LEN];
+} rf_rx_packet_t;
+
+/// Link counters of a device id on the receiver
+typedef struct rf_rx_device_stats_t {
+    uint16_t received; ///< valid packets handled
+    uint16_t rejected; ///< packets that failed to decrypt or had a bad packet id
+    uint16_t resyncs; ///< session challenges sent to the device
+    uint16_t latency_last; ///< ms between receiving and handling the last packet
+    uint16_t latency_max; ///< largest `latency_last` seen
+} rf_rx_device_stats_t;
+
+/// Counters for the receiver, cleared by `rf_init_receive()`
+typedef struct rf_rx_stats_t {
+    uint16_t dropped; ///< packets dropped by a full receive queue or too large
+    uint16_t resumes; ///< sessions resumed from a session ticket
+    uint16_t bad_device_ids; ///< packets with a device id >= `RF_MAX_NUM_DEVICES`
+    uint16_t num_devices; ///< `RF_MAX_NUM_DEVICES`, length of `g_rf_rx_device_stats`
+} rf_rx_stats_t;
+
+extern XRAM rf_rx_stats_t g_rf_rx_stats;
+/// Counters of each device id, cleared by `rf_init_receive()`
+extern XRAM rf_rx_device_stats_t g_rf_rx_device_stats[RF_MAX_NUM_DEVICES];
+
+void rf_rx_queue_clear(void);
+bit_t rf_rx_queue_has_data(void);
+
+/// Producer side: get a free slot to receive a packet into, and publish it
+/// with `rf_rx_queue_commit()` once it is filled in.
+///
+/// @return the free slot, or NULL when the queue is full
+XRAM rf_rx_packet_t *rf_rx_queue_reserve(void);
+void rf_rx_queue_commit(void);
+
+/// Consumer side: get the oldest packet, and free its slot with
+/// `rf_rx_queue_release()` once it has been handled.
+///
+/// @return the oldest packet, or NULL when the queue is empty
+XRAM rf_rx_packet_t *rf_rx_queue_peek(void);
+void rf_rx_queue_release(void);
 
 bit_t rf_task(void);
 
+/// Number of matrix states that can wait while a packet waits for its ACK,
+/// must be a power of two
+#ifndef RF_TX_QUEUE_SIZE
+    #define RF_TX_QUEUE_SIZE 4
+#endif
+
+/// Number of times a packet is resent after `STATUS_MAX_RT` before it is
+/// flushed from the TX FIFO
+#ifndef RF_TX_MAX_RETRIES
+    #define RF_TX_MAX_RETRIES 10
+#endif
+
+/// Counters for the sender, cleared by `rf_init_send()`
+typedef struct rf_tx_stats_t {
+    uint16_t states; ///< calls to `rf_send_matrix_packet()`
+    uint16_t sent; ///< matrix packets written to the TX FIFO
+    uint16_t coalesced; ///< states merged into a state that was still queued
+    uint16_t overflows; ///< merges that lost a key transition, queue was full
+    uint16_t retries; ///< packets resent after `STATUS_MAX_RT`
+    uint16_t dropped; ///< packets flushed after `RF_TX_MAX_RETRIES`
+    uint16_t resyncs; ///< session challenges answered in ACK payloads
+    uint8_t depth; ///< states in the queue now
+    uint8_t max_depth; ///< most states that were queued at once
+} rf_tx_stats_t;
+
+extern XRAM rf_tx_stats_t g_rf_tx_stats;
+
+// The stats are sent as they are in the `INFO_RF_STATS` pages, so they can't
+// have padding.
+KP_STATIC_ASSERT(sizeof(rf_tx_stats_t) == 16, "rf_tx_stats_t has padding");
+KP_STATIC_ASSERT(sizeof(rf_rx_stats_t) == 8, "rf_rx_stats_t has padding");
+KP_STATIC_ASSERT(sizeof(rf_rx_device_stats_t) == 10, "rf_rx_device_stats_t has padding");
+
+/// Queue the current matrix state to be sent, see `rf_tx_task()`.
 void rf_send_matrix_packet(void);
+
+/// Write the oldest queued matrix state to the TX FIFO once it is empty. The
+/// port still starts the transmission with `nrf24_send_one()`.
+///
+/// @return true if matrix states are still waiting to be sent
+bit_t rf_tx_task(void);
+
+/// Resend the packet in the TX FIFO after `STATUS_MAX_RT`, or drop it after
+/// too many retries. Clears `STATUS_MAX_RT`.
+void rf_tx_handle_max_rt(void);
+
+uint8_t rf_tx_queue_depth(void);
+
 void rf_handle_ack_payloads(void);
 
 void rf_receive_buffer_add(void);
@@ -264,4 +264,313 @@ PROTO_BLOCK_RING_TAKE_FUNCTION(ptr_type, data_type, type_name, fn_type) { \
     buf->length++; \
 }
 
+/*********************************************************************
+ *    spsc ring (power of two, single producer / single consumer)     *
+ *********************************************************************/
+
+// A ring buffer that can be shared by one producer and one consumer that
+// interrupt each other (e.g. an ISR and the main loop) without masking
+// interrupts:
+//
+// * `head` is only written by the consumer and `tail` only by the producer.
+//   Both count up freely and are masked with `size-1` when indexing `data`,
+//   so all `size` elements can be used and no division is needed.
+// * The producer writes the elements before it moves `tail`, and the
+//   consumer reads them before it moves `head`. `SPSC_RING_BARRIER()` stops
+//   the compiler from reordering the element accesses across the index update.
+// * Bulk copies use loops rather than `memcpy()`, since the SDCC library
+//   functions aren't reentrant and the producer is often an ISR.
+// * put() and get() publish the index after every element, so moving one
+//   element at a time is a little slower than with `ring_buf128`. Code that
+//   has several elements at once should use put_n()/get_n() or the span
+//   functions, which update the index once.
+// * `ptr_type` must be read and written in one instruction, so it has to be
+//   `uint8_t` on 8-bit parts. It also limits `size`: it must be a power of two
+//   no larger than half the range of `ptr_type`, e.g. 128 for `uint8_t`.
+//
+// Functions that change `tail` (put, put_n, commit) may only be called by the
+// producer, and those that change `head` (get, get_n, skip, clear) only by the
+// consumer. `init()` resets both, so it may only be called while neither side
+// is using the buffer.
+
+#if defined(__GNUC__)
+    #define SPSC_RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+#else
+    // SDCC doesn't move memory accesses across volatile accesses
+    #define SPSC_RING_BARRIER()
+#endif
+
+#define SPSC_RING_MASK(size, x) ((x) & ((size)-1))
+#define SPSC_RING_IS_VALID_SIZE(size, ptr_type) ( \
+    ((size) & ((size)-1)) == 0 && \
+    (size) <= (uint32_t)((ptr_type)~(ptr_type)0) / 2 + 1 \
+)
+
+#define DEFINE_SPSC_RING_TYPE(size, ptr_type, data_type, type_name) \
+typedef struct type_name ## _type { \
+    data_type data[size]; \
+    volatile ptr_type head; \
+    volatile ptr_type tail; \
+} type_name ## _type
+
+// init()
+#define PROTO_SPSC_RING_INIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _init (XRAM type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_INIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_INIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    buf->head = 0; \
+    buf->tail = 0; \
+}
+
+// clear(): consumer side, drops everything that has been put so far
+#define PROTO_SPSC_RING_CLEAR_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _clear (XRAM type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_CLEAR_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_CLEAR_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    buf->head = buf->tail; \
+}
+
+// len()
+#define PROTO_SPSC_RING_LEN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type ptr_type type_name ## _len (XRAM const type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_LEN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_LEN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    return (ptr_type)(buf->tail - buf->head); \
+}
+
+// free_space()
+#define PROTO_SPSC_RING_SPACE_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type ptr_type type_name ## _free_space (XRAM const type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_SPACE_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_SPACE_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    return (size) - (ptr_type)(buf->tail - buf->head); \
+}
+
+// has_data()
+#define PROTO_SPSC_RING_HAS_DATA_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type uint8_t type_name ## _has_data (XRAM const type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_HAS_DATA_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_HAS_DATA_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    return buf->head != buf->tail; \
+}
+
+// put()
+#define PROTO_SPSC_RING_PUT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _put (XRAM type_name ## _type *buf, data_type val)
+
+#define DEFINE_SPSC_RING_PUT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_PUT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type tail = buf->tail; \
+    assert((ptr_type)(tail - buf->head) < (size)); \
+    buf->data[SPSC_RING_MASK(size, tail)] = val; \
+    SPSC_RING_BARRIER(); \
+    buf->tail = tail + 1; \
+}
+
+// write_n(): copy `len` elements after the first `offset` unpublished ones,
+// they are only seen by the consumer after commit()
+#define PROTO_SPSC_RING_WRITE_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _write_n (XRAM type_name ## _type *buf, ptr_type offset, \
+    const data_type *src, ptr_type len)
+
+#define DEFINE_SPSC_RING_WRITE_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_WRITE_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type start = SPSC_RING_MASK(size, (ptr_type)(buf->tail + offset)); \
+    ptr_type first_len = (size) - start; \
+    ptr_type i; \
+    assert((ptr_type)(buf->tail - buf->head) + offset + len <= (size)); \
+    if (first_len > len) { \
+        first_len = len; \
+    } \
+    for (i = 0; i < first_len; ++i) { \
+        buf->data[start + i] = src[i]; \
+    } \
+    for (; i < len; ++i) { \
+        buf->data[i - first_len] = src[i]; \
+    } \
+}
+
+// commit(): publish `len` elements written with write_n() or write_span()
+#define PROTO_SPSC_RING_COMMIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _commit (XRAM type_name ## _type *buf, ptr_type len)
+
+#define DEFINE_SPSC_RING_COMMIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_COMMIT_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    SPSC_RING_BARRIER(); \
+    buf->tail = buf->tail + len; \
+}
+
+// put_n()
+#define PROTO_SPSC_RING_PUT_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _put_n (XRAM type_name ## _type *buf, const data_type *src, \
+    ptr_type len)
+
+#define DEFINE_SPSC_RING_PUT_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_PUT_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    type_name ## _write_n(buf, 0, src, len); \
+    type_name ## _commit(buf, len); \
+}
+
+// get()
+#define PROTO_SPSC_RING_GET_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type data_type type_name ## _get (XRAM type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_GET_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_GET_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type head = buf->head; \
+    data_type data; \
+    assert(head != buf->tail); \
+    data = buf->data[SPSC_RING_MASK(size, head)]; \
+    SPSC_RING_BARRIER(); \
+    buf->head = head + 1; \
+    return data; \
+}
+
+// peek()
+#define PROTO_SPSC_RING_PEEK_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type data_type type_name ## _peek (XRAM const type_name ## _type *buf)
+
+#define DEFINE_SPSC_RING_PEEK_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_PEEK_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    assert(buf->head != buf->tail); \
+    return buf->data[SPSC_RING_MASK(size, buf->head)]; \
+}
+
+// get_n()
+#define PROTO_SPSC_RING_GET_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _get_n (XRAM type_name ## _type *buf, data_type *dest, \
+    ptr_type len)
+
+#define DEFINE_SPSC_RING_GET_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_GET_N_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type head = buf->head; \
+    const ptr_type start = SPSC_RING_MASK(size, head); \
+    ptr_type first_len = (size) - start; \
+    ptr_type i; \
+    assert(len <= (ptr_type)(buf->tail - head)); \
+    if (first_len > len) { \
+        first_len = len; \
+    } \
+    for (i = 0; i < first_len; ++i) { \
+        dest[i] = buf->data[start + i]; \
+    } \
+    for (; i < len; ++i) { \
+        dest[i] = buf->data[i - first_len]; \
+    } \
+    SPSC_RING_BARRIER(); \
+    buf->head = head + len; \
+}
+
+// skip()
+#define PROTO_SPSC_RING_SKIP_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type void type_name ## _skip (XRAM type_name ## _type *buf, ptr_type len)
+
+#define DEFINE_SPSC_RING_SKIP_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_SKIP_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    assert(len <= (ptr_type)(buf->tail - buf->head)); \
+    SPSC_RING_BARRIER(); \
+    buf->head = buf->head + len; \
+}
+
+// read_span(): the elements that can be read in place without wrapping,
+// consume them with skip()
+#define PROTO_SPSC_RING_READ_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type ptr_type type_name ## _read_span (XRAM type_name ## _type *buf, \
+    XRAM data_type **span)
+
+#define DEFINE_SPSC_RING_READ_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_READ_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type len = (ptr_type)(buf->tail - buf->head); \
+    const ptr_type start = SPSC_RING_MASK(size, buf->head); \
+    *span = &buf->data[start]; \
+    return ((size) - start < len) ? (size) - start : len; \
+}
+
+// write_span(): the free elements that can be written in place without
+// wrapping, publish them with commit()
+#define PROTO_SPSC_RING_WRITE_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+fn_type ptr_type type_name ## _write_span (XRAM type_name ## _type *buf, \
+    XRAM data_type **span)
+
+#define DEFINE_SPSC_RING_WRITE_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) \
+PROTO_SPSC_RING_WRITE_SPAN_FUNCTION(size, ptr_type, data_type, type_name, fn_type) { \
+    const ptr_type space = (size) - (ptr_type)(buf->tail - buf->head); \
+    const ptr_type start = SPSC_RING_MASK(size, buf->tail); \
+    *span = &buf->data[start]; \
+    return ((size) - start < space) ? (size) - start : space; \
+}
+
+#define SPSC_RING_FUNCTIONS(macro, size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _INIT_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _CLEAR_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _LEN_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _SPACE_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _HAS_DATA_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _PUT_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _WRITE_N_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _COMMIT_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _PUT_N_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _GET_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _PEEK_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _GET_N_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _SKIP_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _READ_SPAN_FUNCTION(size, ptr_type, data_type, buf_name, fn_type) \
+    macro ## _WRITE_SPAN_FUNCTION(size, ptr_type, data_type, buf_name, fn_type)
+
+// DEFINE_INLINE_SPSC_RING_VARIANT(size, ptr_type, data_type, buf_name) will
+// define the ring buffer type `<buf_name>_type` that holds `size` elements
+// and the following functions:
+//   <buf_name>_init(*buf): reset the buffer before it is used
+//   <buf_name>_clear(*buf): consumer, drop all items in the buffer
+//   <buf_name>_len(*buf): number of items in the buffer
+//   <buf_name>_free_space(*buf): number of items that can still be put
+//   <buf_name>_has_data(*buf): check if the buffer has items
+//   <buf_name>_put(*buf, value): producer, put one item
+//   <buf_name>_put_n(*buf, *src, len): producer, put `len` items
+//   <buf_name>_write_n(*buf, offset, *src, len): producer, copy items
+//       without publishing them
+//   <buf_name>_write_span(*buf, **span): producer, get the free items that
+//       can be written in place
+//   <buf_name>_commit(*buf, len): producer, publish items copied with
+//       write_n() or write_span()
+//   <buf_name>_get(*buf): consumer, take one item
+//   <buf_name>_peek(*buf): read one item without consuming it
+//   <buf_name>_get_n(*buf, *dest, len): consumer, take `len` items
+//   <buf_name>_read_span(*buf, **span): consumer, get the items that can be
+//       read in place
+//   <buf_name>_skip(*buf, len): consumer, discard `len` items
+#define DEFINE_INLINE_SPSC_RING_VARIANT(size, ptr_type, data_type, buf_name) \
+    DEFINE_SPSC_RING_TYPE(size, ptr_type, data_type, buf_name); \
+    KP_STATIC_ASSERT(SPSC_RING_IS_VALID_SIZE(size, ptr_type), \
+        "spsc ring size must be a power of two that fits in ptr_type"); \
+    SPSC_RING_FUNCTIONS(DEFINE_SPSC_RING, size, ptr_type, data_type, buf_name, static inline)
+
+#define DEFINE_PROTO_SPSC_RING_VARIANT(size, ptr_type, data_type, buf_name) \
+    DEFINE_SPSC_RING_TYPE(size, ptr_type, data_type, buf_name); \
+    KP_STATIC_ASSERT(SPSC_RING_IS_VALID_SIZE(size, ptr_type), \
+        "spsc ring size must be a power of two that fits in ptr_type"); \
+    PROTO_SPSC_RING_INIT_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_CLEAR_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_LEN_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_SPACE_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_HAS_DATA_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_PUT_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_WRITE_N_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_COMMIT_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_PUT_N_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_GET_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_PEEK_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_GET_N_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_SKIP_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_READ_SPAN_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY); \
+    PROTO_SPSC_RING_WRITE_SPAN_FUNCTION(size, ptr_type, data_type, buf_name, EMPTY)
+
+#define DEFINE_BODY_SPSC_RING_VARIANT(size, ptr_type, data_type, buf_name) \
+    SPSC_RING_FUNCTIONS(DEFINE_SPSC_RING, size, ptr_type, data_type, buf_name, EMPTY)
+
 DEFINE_PROTO_RING_BUF_VARIANT(127, uint8_t, uint8_t, ring_buf128);
@@ -0,0 +1,127 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/scan_governor.c
+///
+/// Adaptive scan rate governor, see `core/scan_governor.h`.
+
+#include "core/scan_governor.h"
+
+#include <string.h>
+
+#include "core/flash.h"
+#include "core/matrix_scanner.h"
+#include "core/settings.h"
+#include "core/timer.h"
+
+XRAM scan_governor_stats_t g_scan_governor_stats;
+
+static XRAM scan_governor_settings_t s_settings;
+static XRAM uint8_t s_tier;
+static XRAM uint8_t s_battery_level;
+/// Time of the last scan that found a change or a key debouncing
+static XRAM uint16_t s_last_activity;
+static XRAM uint16_t s_last_update;
+static XRAM uint16_t s_next_scan;
+
+void scan_governor_init(void) {
+    flash_read(
+        (uint8_t*)&s_settings,
+        GET_SETTING_ADDR(scan_governor),
+        sizeof(scan_governor_settings_t)
+    );
+
+    if (s_settings.fast_interval == 0 || s_settings.fast_interval == 0xff) {
+        s_settings.fast_interval = SCAN_GOVERNOR_DEFAULT_FAST_INTERVAL;
+    }
+    if (s_settings.slow_interval == 0 || s_settings.slow_interval == 0xff) {
+        s_settings.slow_interval = SCAN_GOVERNOR_DEFAULT_SLOW_INTERVAL;
+    }
+    if (s_settings.fast_timeout == 0 || s_settings.fast_timeout == 0xffff) {
+        s_settings.fast_timeout = SCAN_GOVERNOR_DEFAULT_FAST_TIMEOUT;
+    }
+    if (s_settings.low_battery_level == 0 || s_settings.low_battery_level > 100) {
+        s_settings.low_battery_level = SCAN_GOVERNOR_DEFAULT_LOW_BATTERY_LEVEL;
+    }
+
+    memset(&g_scan_governor_stats, 0, sizeof(g_scan_governor_stats));
+    s_tier = SCAN_TIER_FAST;
+    s_battery_level = 100;
+    s_last_update = timer_read16_ms();
+    s_last_activity = s_last_update;
+    s_next_scan = s_last_update;
+}
+
+void scan_governor_set_battery_level(uint8_t percent) {
+    s_battery_level = percent;
+}
+
+uint8_t scan_governor_get_tier(void) {
+    return s_tier;
+}
+
+static bit_t is_battery_low(void) {
+    return s_battery_level < s_settings.low_battery_level;
+}
+
+/// On a low battery, the fast tier scans at half the rate and is left sooner.
+static uint8_t get_fast_interval(void) {
+    if (is_battery_low()) {
+        return s_settings.fast_interval * 2;
+    }
+    return s_settings.fast_interval;
+}
+
+static uint16_t get_fast_timeout(void) {
+    if (is_battery_low()) {
+        return s_settings.fast_timeout / 4;
+    }
+    return s_settings.fast_timeout;
+}
+
+static void scan_governor_set_tier(uint8_t tier) {
+    if (tier != s_tier) {
+        s_tier = tier;
+        g_scan_governor_stats.tier_changes++;
+    }
+}
+
+bit_t scan_governor_task(void) {
+    const uint16_t current_time = timer_read16_ms();
+    bit_t scan_changed;
+
+    g_scan_governor_stats.tier_time[s_tier] += (uint16_t)(current_time - s_last_update);
+    s_last_update = current_time;
+
+    // While idle, `matrix_scan_task()` only checks the interrupt flag, so it
+    // is always called to react to key presses right away. This also covers
+    // ports that leave idle mode with `matrix_scan_wakeup()`.
+    if (s_tier != SCAN_TIER_IDLE && (int16_t)(current_time - s_next_scan) < 0) {
+        return false;
+    }
+
+    scan_changed = matrix_scan_task();
+
+    if (matrix_scan_is_idle()) {
+        scan_governor_set_tier(SCAN_TIER_IDLE);
+        return scan_changed;
+    }
+
+    if (scan_changed || get_matrix_num_keys_debouncing() != 0 ||
+        s_tier == SCAN_TIER_IDLE) {
+        s_last_activity = current_time;
+        scan_governor_set_tier(SCAN_TIER_FAST);
+    } else if (
+        s_tier == SCAN_TIER_FAST &&
+        (uint16_t)(current_time - s_last_activity) >= get_fast_timeout()
+    ) {
+        scan_governor_set_tier(SCAN_TIER_SLOW);
+    }
+
+    if (s_tier == SCAN_TIER_SLOW) {
+        s_next_scan = current_time + s_settings.slow_interval;
+    } else {
+        s_next_scan = current_time + get_fast_interval();
+    }
+
+    return scan_changed;
+}
@@ -0,0 +1,83 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/scan_governor.h
+///
+/// Picks how often the matrix is scanned based on recent key activity and
+/// the battery level.
+///
+/// The governor steps through these tiers:
+///
+/// * `SCAN_TIER_FAST`: a key changed state recently or is debouncing, the
+///   matrix is scanned every `fast_interval` ms.
+/// * `SCAN_TIER_SLOW`: keys are held down, but nothing changed for
+///   `fast_timeout` ms. The matrix is scanned every `slow_interval` ms.
+/// * `SCAN_TIER_IDLE`: no keys are down, the scanner waits for a column
+///   interrupt (see `matrix_scan_task()`).
+///
+/// Matrix packets are only sent over RF when a scan finds a change, so the
+/// RF transmit cadence follows the scan tier.
+///
+/// Only the battery mode loop of the xmega port uses the governor. The nrf52
+/// port runs `matrix_scan_task()` from the scheduler, and has no battery
+/// mode. `make scan-governor-test` in `ports/linux` checks
+/// the tiers picked for a trace of key presses.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/util.h"
+
+#define SCAN_GOVERNOR_DEFAULT_FAST_INTERVAL 1
+#define SCAN_GOVERNOR_DEFAULT_SLOW_INTERVAL 10
+#define SCAN_GOVERNOR_DEFAULT_FAST_TIMEOUT 250
+/// Battery percentage below which the governor saves power more aggressively
+#define SCAN_GOVERNOR_DEFAULT_LOW_BATTERY_LEVEL 20
+
+/// Governor thresholds stored in the settings section of flash. A value of 0
+/// (or 0xff/0xffff for erased flash) means the default value is used.
+typedef struct scan_governor_settings_t {
+    uint8_t fast_interval; ///< Scan interval while typing (ms)
+    uint8_t slow_interval; ///< Scan interval while keys are held unchanged (ms)
+    /// How long the matrix must be unchanged before using the slow tier (ms)
+    uint16_t fast_timeout;
+    /// Battery percentage below which the fast tier is shortened
+    uint8_t low_battery_level;
+    uint8_t _reserved[3];
+} ATTR_PACKED scan_governor_settings_t; // 8 bytes
+
+typedef enum scan_tier_t {
+    SCAN_TIER_FAST = 0,
+    SCAN_TIER_SLOW = 1,
+    SCAN_TIER_IDLE = 2,
+    SCAN_TIER_COUNT,
+} scan_tier_t;
+
+typedef struct scan_governor_stats_t {
+    /// Time spent in each tier (ms)
+    uint32_t tier_time[SCAN_TIER_COUNT];
+    /// Number of times the tier has changed
+    uint16_t tier_changes;
+} scan_governor_stats_t;
+
+extern XRAM scan_governor_stats_t g_scan_governor_stats;
+
+/// Load the governor thresholds from the settings and reset the statistics.
+///
+/// Must be called after `settings_load_from_flash()`.
+void scan_governor_init(void);
+
+/// Scan the matrix with `matrix_scan_task()` if the interval of the current
+/// tier has passed, then pick the next tier. Ports that use the governor call
+/// this in place of `matrix_scan_task()` in their main loop, at least once
+/// per ms while not idle.
+///
+/// @return true if the matrix state has changed
+bit_t scan_governor_task(void);
+
+/// @return the current scan tier, one of `scan_tier_t`
+uint8_t scan_governor_get_tier(void);
+
+/// Ports that can measure their battery call this with the charge left in
+/// percent. The governor assumes a full battery until this is called.
+void scan_governor_set_battery_level(uint8_t percent);
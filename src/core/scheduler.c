@@ -0,0 +1,229 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/scheduler.c
+///
+/// Cooperative scheduler for the main loop, see `core/scheduler.h`.
+
+#include "core/scheduler.h"
+
+#include <string.h>
+
+#include "core/combo.h"
+#include "core/flash_verify.h"
+#include "core/macro.h"
+#include "core/matrix_interpret.h"
+#include "core/matrix_scanner.h"
+#include "core/settings.h"
+#include "core/timer.h"
+#include "core/usb_commands.h"
+
+#include "hid_reports/keyboard_report.h"
+#include "hid_reports/media_report.h"
+#include "hid_reports/mouse_report.h"
+#include "hid_reports/vendor_report.h"
+
+#include "key_handlers/key_hold.h"
+#include "key_handlers/key_mouse.h"
+
+/// Tasks to run in the current pass, or in the next pass without waiting
+static XRAM uint16_t s_ready;
+/// Tasks to run after the next call to `wait_for_event()`
+static XRAM uint16_t s_ready_after_wake;
+/// Earliest time given to `scheduler_wake_at()` since the last wait
+static XRAM uint16_t s_deadline;
+static XRAM uint8_t s_has_deadline;
+/// The running task called `scheduler_wake_at()`
+static XRAM uint8_t s_task_has_deadline;
+/// A task returned true without a deadline, so it is polled within 1ms
+static XRAM uint8_t s_needs_poll;
+
+#if SCHEDULER_PROFILE
+XRAM scheduler_task_stats_t g_scheduler_stats[SCHEDULER_NUM_TASKS];
+#endif
+
+void scheduler_init(void) {
+    // run everything once at start up
+    s_ready = SCHEDULER_INPUT_TASKS | SCHEDULER_PIPELINE_TASKS;
+    s_ready_after_wake = 0;
+    s_has_deadline = false;
+    s_needs_poll = false;
+#if USE_FLASH_VERIFY
+    flash_verify_init();
+#endif
+#if SCHEDULER_PROFILE
+    memset(g_scheduler_stats, 0, sizeof(g_scheduler_stats));
+#endif
+}
+
+void scheduler_set_ready(uint8_t task) {
+    s_ready |= SCHEDULER_TASK_BIT(task);
+}
+
+void scheduler_wake_at(uint16_t time_ms) {
+    if (!s_has_deadline || (int16_t)(time_ms - s_deadline) < 0) {
+        s_deadline = time_ms;
+        s_has_deadline = true;
+    }
+    s_task_has_deadline = true;
+}
+
+#if USE_SCANNER
+static bit_t scheduler_scan_task(void) {
+    static XRAM uint8_t matrix_data[32];
+
+    if (!matrix_scan_task()) {
+        return false;
+    }
+
+    get_matrix_data(matrix_data, true);
+    keyboard_update_device_matrix(GET_SETTING(device_id), matrix_data);
+    return true;
+}
+#endif
+
+static bit_t scheduler_send_reports(void) {
+    bit_t is_pending = false;
+
+    if (send_keyboard_report()) {
+        is_pending = true;
+    }
+    if (send_media_report()) {
+        is_pending = true;
+    }
+    if (send_mouse_report()) {
+        is_pending = true;
+    }
+#if !USE_VIRTUAL_MODE
+    if (send_vendor_report()) {
+        is_pending = true;
+    }
+#endif
+
+    return is_pending;
+}
+
+/// @return true if the task did some work or still has work pending
+static bit_t scheduler_run_task(uint8_t task) {
+    switch (task) {
+#if USE_SCANNER
+        case TASK_MATRIX_SCAN: {
+            return scheduler_scan_task();
+        }
+#endif
+
+        case TASK_PORT: {
+            return scheduler_port_task();
+        }
+
+        case TASK_INTERPRET: {
+            // Changes left waiting for room in the keyboard report queue are
+            // interpreted again after the next wake up
+            if (interpret_all_keyboard_matrices()) {
+                return true;
+            }
+        } break;
+
+#if SUPPORT_MACRO
+        case TASK_MACRO: {
+            return macro_task();
+        }
+#endif
+
+        case TASK_MOUSE_KEYS: {
+            return mouse_key_task();
+        }
+
+        case TASK_SEND_REPORTS: {
+            return scheduler_send_reports();
+        }
+
+#if USE_USB
+        case TASK_VENDOR_OUT: {
+            handle_vendor_out_reports();
+        } break;
+#endif
+
+        case TASK_STICKY_KEYS: {
+            return sticky_key_task();
+        }
+
+        case TASK_COMBO: {
+            return combo_task();
+        }
+
+        case TASK_HOLD_KEYS: {
+            return hold_key_task(false);
+        }
+
+        default: {
+        } break;
+    }
+
+    return false;
+}
+
+void scheduler_run(void) {
+    uint8_t task;
+
+    for (task = 0; task < SCHEDULER_NUM_TASKS; ++task) {
+        const uint16_t task_bit = SCHEDULER_TASK_BIT(task);
+        bit_t did_work;
+#if SCHEDULER_PROFILE
+        uint16_t start_cycles;
+#endif
+
+        if (!(s_ready & task_bit)) {
+            continue;
+        }
+        s_ready &= ~task_bit;
+
+#if SCHEDULER_PROFILE
+        start_cycles = scheduler_read_cycles();
+#endif
+
+        s_task_has_deadline = false;
+        did_work = scheduler_run_task(task);
+
+#if SCHEDULER_PROFILE
+        g_scheduler_stats[task].runs++;
+        g_scheduler_stats[task].cycles +=
+            (uint16_t)(scheduler_read_cycles() - start_cycles);
+#endif
+
+        if (did_work) {
+            // The pipeline tasks after this one can use its result in this
+            // pass, the ones before it have to wait for the next pass.
+            s_ready |= SCHEDULER_PIPELINE_TASKS & ~((task_bit << 1) - 1);
+            s_ready_after_wake |= task_bit | (SCHEDULER_PIPELINE_TASKS & (task_bit - 1));
+            if (!s_task_has_deadline) {
+                s_needs_poll = true;
+            }
+        } else if (s_task_has_deadline) {
+            s_ready_after_wake |= task_bit;
+        }
+    }
+
+    if (s_ready) {
+        // a task was made ready after its turn in this pass
+        return;
+    }
+
+#if USE_FLASH_VERIFY
+    // Only passes that left no work pending are used to check the flash
+    if (!s_ready_after_wake) {
+        flash_verify_task();
+    }
+#endif
+
+    if (s_needs_poll) {
+        s_deadline = timer_read16_ms() + 1;
+        s_has_deadline = true;
+    }
+
+    wait_for_event(s_deadline, s_has_deadline);
+
+    s_ready |= SCHEDULER_INPUT_TASKS | s_ready_after_wake;
+    s_ready_after_wake = 0;
+    s_has_deadline = false;
+    s_needs_poll = false;
+}
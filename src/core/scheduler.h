@@ -0,0 +1,147 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/scheduler.h
+///
+/// Cooperative scheduler for the main loop.
+///
+/// The main loop stages are tasks that always run in the same order, but a
+/// task is only run when it is ready. Tasks become ready in these ways:
+///
+/// * Input tasks (`SCHEDULER_INPUT_TASKS`) are ready after every wake up,
+///   since they poll for work that was started by an interrupt.
+/// * When a task returns true (it did some work, or still has work pending),
+///   every pipeline task after it is ready in the same pass, and the task
+///   itself and every pipeline task before it are ready after the next wake
+///   up.
+/// * `scheduler_set_ready()` makes a task ready in the current or next pass.
+///
+/// A task whose pending work waits on a timer (macro rate, hold key, sticky
+/// key and combo timeouts, mouse key repeat) calls `scheduler_wake_at()` with
+/// the time it is due. Any other task that returns true needs the next wake
+/// up within 1ms.
+///
+/// When no task is ready at the end of a pass, the scheduler calls the port's
+/// `wait_for_event()` hook with the earliest of these deadlines, so ports
+/// don't need to pace their main loop with fixed delays. Before waiting in a
+/// pass that left no work pending, the scheduler checks the next chunk of
+/// flash with `flash_verify_task()`.
+///
+/// Ports opt in with `USE_SCHEDULER = 1` in their Makefile. The atmega32u4,
+/// efm8, linux and nrf52 main loops and the xmega USB mode main loop run on
+/// the scheduler. The nrf24lu1 loop masks its USB and RF interrupts around
+/// each stage to protect the 8051 stack, and the xmega battery loop only
+/// sends matrix packets over RF at the rate picked by `scan_governor_task()`,
+/// so they keep their own loops.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/util.h"
+
+#ifndef USE_SCHEDULER
+    #define USE_SCHEDULER 0
+#endif
+
+/// Main loop tasks, in the order that they are run
+typedef enum scheduler_task_t {
+    /// Scan the matrix and pass any change to the matrix interpreter
+    TASK_MATRIX_SCAN = 0,
+    /// Port specific work, see `scheduler_port_task()`
+    TASK_PORT,
+    TASK_INTERPRET,
+    TASK_MACRO,
+    TASK_MOUSE_KEYS,
+    /// Send the keyboard, media, mouse and vendor reports
+    TASK_SEND_REPORTS,
+    TASK_VENDOR_OUT,
+    TASK_STICKY_KEYS,
+    TASK_COMBO,
+    TASK_HOLD_KEYS,
+    SCHEDULER_NUM_TASKS,
+} scheduler_task_t;
+
+#define SCHEDULER_TASK_BIT(task) ((uint16_t)1 << (task))
+
+/// Tasks that are run after every wake up
+#define SCHEDULER_INPUT_TASKS ( \
+    SCHEDULER_TASK_BIT(TASK_MATRIX_SCAN) | \
+    SCHEDULER_TASK_BIT(TASK_PORT) | \
+    SCHEDULER_TASK_BIT(TASK_SEND_REPORTS) | \
+    SCHEDULER_TASK_BIT(TASK_VENDOR_OUT) \
+)
+
+/// Tasks that are run when another task has done some work
+#define SCHEDULER_PIPELINE_TASKS ( \
+    SCHEDULER_TASK_BIT(TASK_INTERPRET) | \
+    SCHEDULER_TASK_BIT(TASK_MACRO) | \
+    SCHEDULER_TASK_BIT(TASK_MOUSE_KEYS) | \
+    SCHEDULER_TASK_BIT(TASK_STICKY_KEYS) | \
+    SCHEDULER_TASK_BIT(TASK_COMBO) | \
+    SCHEDULER_TASK_BIT(TASK_HOLD_KEYS) \
+)
+
+/// Per task cost, only measured when built with `SCHEDULER_PROFILE=1`
+typedef struct scheduler_task_stats_t {
+    uint32_t runs; ///< Number of times the task has run
+    uint32_t cycles; ///< Total cost of the task, in `scheduler_read_cycles()` units
+} scheduler_task_stats_t;
+
+#ifndef SCHEDULER_PROFILE
+    #define SCHEDULER_PROFILE 0
+#endif
+
+#if SCHEDULER_PROFILE
+extern XRAM scheduler_task_stats_t g_scheduler_stats[SCHEDULER_NUM_TASKS];
+#endif
+
+/*********************************************************************
+ *                    port implemented functions                     *
+ *********************************************************************/
+
+/// Sleep until an interrupt happens, or until `deadline` (ms, compared with
+/// `timer_read16_ms()`) is reached. If `has_deadline` is false, no task is
+/// waiting on a timer and the mcu can sleep until the next input. The
+/// deadline may already have passed, in which case the hook should return
+/// right away.
+///
+/// It is fine to return early, the scheduler checks for work after each call.
+/// Ports that wake up on a 1ms tick anyway can ignore the deadline.
+void wait_for_event(uint16_t deadline, bit_t has_deadline);
+
+/// Port specific work that is run as `TASK_PORT`, e.g. polling the RF module.
+///
+/// @return true if it did some work, e.g. received a matrix packet
+bit_t scheduler_port_task(void);
+
+#if SCHEDULER_PROFILE
+/// Read a free running counter used to measure the cost of each task
+uint16_t scheduler_read_cycles(void);
+#endif
+
+/*********************************************************************
+ *                         public functions                          *
+ *********************************************************************/
+
+void scheduler_init(void);
+
+/// Run one pass of the ready tasks, then wait for an event if no task is
+/// ready anymore.
+void scheduler_run(void);
+
+/// Make `task` ready. If the task hasn't run yet in the current pass it runs
+/// in this pass, otherwise in the next pass without waiting for an event.
+void scheduler_set_ready(uint8_t task);
+
+#if USE_SCHEDULER
+/// Called by the running task when its pending work waits on a timer, with
+/// the time (ms, from `timer_read16_ms()`) it needs to run again. The task is
+/// then ready after the next wake up, and the port may sleep until then.
+///
+/// Only call this when nothing else is pending, since the tasks before it
+/// don't run until the next wake up either.
+void scheduler_wake_at(uint16_t time_ms);
+#else
+    #define scheduler_wake_at(time_ms)
+#endif
+
@@ -7,11 +7,13 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "core/build_config.h"
 #include "core/chip_id.h"
 #include "core/flash.h"
 #include "core/matrix_scanner.h"
 #include "core/nrf24.h"
 #include "core/packet.h"
+#include "core/scan_governor.h"
 #include "core/util.h"
 
 /// The number of NRF24 ESB pipes used for keyboard communication
@@ -35,6 +37,13 @@
 /// interface.
 #define MAX_NUM_DEVICES 64
 
+/// The number of layouts the firmware keeps RAM state for. The settings
+/// always have room for `MAX_NUM_KEYBOARDS` layouts, but a build can lower
+/// this to the number its layout file uses.
+#ifndef MAX_NUM_LAYOUTS
+    #define MAX_NUM_LAYOUTS MAX_NUM_KEYBOARDS
+#endif
+
 /// Firmware metadata for feature_ctrl that are disabled at compile time
 #define FEATURE_CTRL_FEATURES_DISABLED_AT_BUILD_TIME \
     (!USE_USB * FEATURE_CTRL_USB_DISABLE) | \
@@ -75,7 +84,11 @@ typedef struct ATTR_PACKED layout_settings_t {
     uint8_t number_layouts;
     uint8_t number_devices;
     uint8_t default_layout_id;
-    uint8_t _reserved[29]; // 32
+    /// Number of entries in the combo table, 0 if there are no combos
+    uint8_t combo_count;
+    /// Offset of the combo table in the extended keycode data section
+    uint16_t combo_table_offset;
+    uint8_t _reserved[26]; // 32
     keyboard_info_t layouts[MAX_NUM_KEYBOARDS];
     device_info_t devices[MAX_NUM_DEVICES];
 } layout_settings_t;
@@ -175,8 +188,8 @@ typedef struct ATTR_PACKED settings_t { // 512 bytes
     /// The matrix scanning settings for this device.
     /// TODO/NOTE: maybe this should be moved to the start of the layout section?
     matrix_scan_plan_t scan_plan; // 11 bytes
-    /// These bytes are reserved for future use.
-    uint8_t _reserved0[8];
+    /// Thresholds for the adaptive scan rate used on battery power.
+    scan_governor_settings_t scan_governor; // 8 bytes
     /// Used to enable/disable hardware features like nRF24 wireless/split I2C
     uint8_t feature_ctrl;
     /// These bytes are reserved for future use.
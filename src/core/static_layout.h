@@ -0,0 +1,45 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file core/static_layout.h
+///
+/// Keymaps compiled into the firmware image for builds with
+/// `USE_STATIC_LAYOUT=1`.
+///
+/// The C source for the tables is generated from the layout file by
+/// `keyplus-cli program --static-layout`. With the keymaps in const arrays,
+/// a keycode lookup is an indexed load from the layer's base address instead
+/// of a `flash_read_word()` at an offset from the layout's keymap address.
+/// The rest of the layout (key number map, EKC data) and the settings are
+/// still read from the layout and settings sections in flash.
+///
+/// The generated tables are declared as `keycode_t` arrays, so the compiler
+/// gives them the alignment the indexed loads need. Nothing assumes more
+/// alignment than that, e.g. a layer starting on a flash page.
+///
+/// `make layout-bench` in ports/linux compares the two lookups.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core/keycode.h"
+#include "core/util.h"
+
+#if USE_STATIC_LAYOUT && USE_VIRTUAL_MODE
+    #error "USE_STATIC_LAYOUT can't be used with USE_VIRTUAL_MODE"
+#endif
+
+typedef struct static_layout_t {
+    /// Maps layer -> keycodes of that layer, each layer has `8*matrix_size`
+    /// keycodes.
+    const ROM keycode_t * const ROM *layers;
+    uint8_t matrix_size;
+    uint8_t layer_count;
+    uint8_t has_mouse_layers;
+} static_layout_t;
+
+#if USE_STATIC_LAYOUT
+/// The layouts indexed by layout id
+extern const ROM static_layout_t g_static_layouts[];
+extern const ROM uint8_t g_static_layout_count;
+#endif
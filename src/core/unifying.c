@@ -359,7 +359,7 @@ void unifying_begin_pairing(void) {
             g_rf_settings.pipe_addr_4
         );
 
-        packet_buffer_clear();
+        rf_rx_queue_clear();
 
         memcpy(pairing_target_addr, g_rf_settings.pipe_addr_1, UNIFYING_ADDR_WIDTH);
         pairing_target_addr[0] = g_rf_settings.pipe_addr_4;
@@ -424,15 +424,18 @@ bit_t handle_pairing(uint8_t pipe_num) {
     uint8_t width;
 #if USE_NRF52_ESB
     if (g_rf_settings.hw_type == RF_HW_NRF52_ESB) {
-        pipe_num = packet_buffer_get();
-        width = packet_buffer_get();
-        if (width > UNIFYING_MAX_PACKET_SIZE || width > packet_buffer_len())  {
-            packet_buffer_clear();
+        const rf_rx_packet_t *rx_packet = rf_rx_queue_peek();
+
+        pipe_num = rx_packet->pipe_num;
+        width = rx_packet->width;
+        if (width > UNIFYING_MAX_PACKET_SIZE) {
+            rf_rx_queue_release();
             return false;
         }
 
         // read out the packet payload into the buffer
-        packet_buffer_take(tmp_buffer, width);
+        memcpy(tmp_buffer, rx_packet->payload, width);
+        rf_rx_queue_release();
     } else
 #endif
     {
@@ -498,7 +501,7 @@ void unifying_pairing_poll(void) {
 #if USE_NRF52_ESB
     if (g_rf_settings.hw_type == RF_HW_NRF52_ESB) {
         NVIC_DisableIRQ(ESB_EVT_IRQ);
-        while (packet_buffer_has_data()) {
+        while (rf_rx_queue_has_data()) {
             NRF_LOG_INFO("Unifying handling pairing packet");
             pairing_complete |= handle_pairing(0);
             led_testing_set(1, 0);
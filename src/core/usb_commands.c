@@ -16,12 +16,35 @@
 #include "core/matrix_scanner.h"
 #include "core/timer.h"
 
+#if USE_NRF24
+#  include "core/rf.h"
+#endif
+
 #if USE_UNIFYING
 #  include "core/unifying.h"
 #endif
 
 #include "hid_reports/hid_reports.h"
 
+#if USE_NRF24
+/// An `INFO_RF_STATS` page holds the sender and receiver counters, then the
+/// counters of as many device ids as fit in the rest of the report
+#define RF_STATS_DEVICES_OFFSET (sizeof(rf_tx_stats_t) + sizeof(rf_rx_stats_t))
+#define RF_STATS_DEVICES_PER_PAGE \
+    ((EP_SIZE_VENDOR-2 - RF_STATS_DEVICES_OFFSET) / sizeof(rf_rx_device_stats_t))
+#define INFO_RF_STATS_NUM_PAGES \
+    INT_DIV_ROUND_UP(RF_MAX_NUM_DEVICES, RF_STATS_DEVICES_PER_PAGE)
+
+KP_STATIC_ASSERT(
+    2 + sizeof(rf_tx_stats_t) + sizeof(rf_rx_stats_t) <= EP_SIZE_VENDOR,
+    "The RF counters don't fit in an INFO_RF_STATS page"
+);
+KP_STATIC_ASSERT(
+    RF_STATS_DEVICES_PER_PAGE > 0,
+    "No device counters fit in an INFO_RF_STATS page"
+);
+#endif
+
 /* TODO: abstract mcu specifi usb code */
 
 #ifndef NO_MATRIX
@@ -179,9 +202,15 @@ void cmd_send_layer(uint8_t kb_id) {
     g_vendor_report_in.data[1] = kb_id;
     {
         const uint8_t kb_slot_id = get_slot_id(kb_id);
-        memcpy(g_vendor_report_in.data + 2, (uint8_t*)&g_keyboard_slots[kb_slot_id].active_layers, 2);
-        memcpy(g_vendor_report_in.data + 4, (uint8_t*)&g_keyboard_slots[kb_slot_id].sticky_layers, 2);
-        memcpy(g_vendor_report_in.data + 6, (uint8_t*)&g_keyboard_slots[kb_slot_id].default_layers, 2);
+        // The report has 16 bits for each mask, whatever the size of
+        // `layer_mask_t` in this build
+        uint16_t mask;
+        mask = g_keyboard_slots[kb_slot_id].active_layers;
+        memcpy(g_vendor_report_in.data + 2, (uint8_t*)&mask, 2);
+        mask = g_keyboard_slots[kb_slot_id].sticky_layers;
+        memcpy(g_vendor_report_in.data + 4, (uint8_t*)&mask, 2);
+        mask = g_keyboard_slots[kb_slot_id].default_layers;
+        memcpy(g_vendor_report_in.data + 6, (uint8_t*)&mask, 2);
     }
     g_vendor_report_in.len = 8;
     send_vendor_report();
@@ -286,6 +315,40 @@ static void cmd_get_info(void) {
             (flash_ptr_t)(SETTINGS_ADDR + SETTINGS_LAYOUT_INFO_OFFSET + offset),
             size
         );
+#if USE_NRF24
+    } else if (info_type == INFO_RF_STATS) {
+        // The counters of the side that isn't built in are sent as zeros
+        memset(g_vendor_report_in.data+2, 0, EP_SIZE_VENDOR-2);
+#ifndef NO_RF_TRANSMIT
+        memcpy(g_vendor_report_in.data+2, &g_rf_tx_stats, sizeof(rf_tx_stats_t));
+#endif
+#ifndef NO_RF_RECEIVE
+        {
+            // data[2] is the page, page `n` has the counters of the device ids
+            // from `n * RF_STATS_DEVICES_PER_PAGE` on
+            const uint8_t page = g_vendor_report_out.data[2];
+
+            memcpy(
+                g_vendor_report_in.data+2 + sizeof(rf_tx_stats_t),
+                &g_rf_rx_stats,
+                sizeof(rf_rx_stats_t)
+            );
+            if (page < INFO_RF_STATS_NUM_PAGES) {
+                const uint8_t first_id = page * RF_STATS_DEVICES_PER_PAGE;
+                uint8_t num_ids = RF_STATS_DEVICES_PER_PAGE;
+
+                if (first_id + num_ids > RF_MAX_NUM_DEVICES) {
+                    num_ids = RF_MAX_NUM_DEVICES - first_id;
+                }
+                memcpy(
+                    g_vendor_report_in.data+2 + RF_STATS_DEVICES_OFFSET,
+                    &g_rf_rx_device_stats[first_id],
+                    num_ids * sizeof(rf_rx_device_stats_t)
+                );
+            }
+        }
+#endif
+#endif
     } else {
         g_vendor_report_in.data[1] = INFO_UNSUPPORTED;
     }
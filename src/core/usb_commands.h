@@ -75,6 +75,7 @@ enum {
     INFO_LAYOUT_DATA_3 = 9, // 248
     INFO_LAYOUT_DATA_4 = 10, // 310
     INFO_LAYOUT_DATA_5 = 11, // 372
+    INFO_RF_STATS = 12, // rf_tx_stats_t, rf_rx_stats_t, then device counters
     INFO_UNSUPPORTED = 0xff,
 };
 
@@ -3,6 +3,8 @@
 
 #include "core/util.h"
 
+#include <string.h>
+
 #ifdef __SDCC_mcs51
 ROM const uint8_t bit_mask_lookup_table[8] = {
     (1 << 0),
@@ -35,3 +37,35 @@ void bitmap_clear_bit(uint8_t *array, uint8_t n) {
     array[n / 8] &= ~(bitn_mask(n % 8));
 }
 #endif
+
+#if defined(__SDCC_mcs51) || defined(AVR)
+/// Number of trailing zeros in a nibble, the entry for 0 is unused.
+static ROM const uint8_t ctz_nibble_table[16] = {
+    0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+
+/// Number of set bits in a nibble
+static ROM const uint8_t popcount_nibble_table[16] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+};
+
+uint8_t bitset_ctz(uint8_t word) {
+    if (word & 0x0f) {
+        return ctz_nibble_table[word & 0x0f];
+    } else {
+        return 4 + ctz_nibble_table[word >> 4];
+    }
+}
+
+uint8_t bitset_popcount(uint8_t word) {
+    return popcount_nibble_table[word & 0x0f] + popcount_nibble_table[word >> 4];
+}
+#else
+bitset_word_t bitset_read_word(const uint8_t *ptr, uint8_t len) {
+    // NOTE: all the ports that use a word size larger than 8 bits are little
+    // endian, so byte `i` in the array ends up in bits `8*i..8*i+7`.
+    bitset_word_t word = 0;
+    memcpy(&word, ptr, KP_MIN(len, BITSET_WORD_SIZE));
+    return word;
+}
+#endif
@@ -26,6 +26,9 @@
     // sdcc has no attribute for packed structs, however since the target is 8
     // bit, padding won't be used anyway so it's not needed
     #define ATTR_PACKED
+    // sdcc only clears the XSEG area at start up, so variables that need to
+    // survive a reset are placed with `AT()` at an address outside of it.
+    #define ATTR_NO_INIT
 #elif defined(__arm__) && defined(__GNUC__)
     #define REENT
     #define XRAM
@@ -34,6 +37,7 @@
     #define ROM
     #define WEAK __attribute__((weak))
     #define ATTR_PACKED __attribute__((packed))
+    #define ATTR_NO_INIT __attribute__((section(".noinit")))
     #define AT(address)
     #define NO_RETURN_ATTR __attribute__((noreturn))
 #elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
@@ -44,6 +48,9 @@
     #define ROM
     #define WEAK __attribute__((weak))
     #define ATTR_PACKED __attribute__((packed))
+    // A process doesn't reset, but the host tools can find the section
+    // through `__start_kp_noinit` and `__stop_kp_noinit` to model one.
+    #define ATTR_NO_INIT __attribute__((section("kp_noinit")))
     #define AT(address)
     #define NO_RETURN_ATTR __attribute__((noreturn))
 #elif defined(AVR) && defined(__GNUC__)
@@ -56,6 +63,7 @@
     #define ROM __flash
     #define WEAK __attribute__((weak))
     #define ATTR_PACKED __attribute__((packed))
+    #define ATTR_NO_INIT __attribute__((section(".noinit")))
     #define AT(address)
     #define NO_RETURN_ATTR __attribute__((noreturn))
 #else
@@ -117,6 +125,17 @@
     /// Compiler attribute to specify no padding in C structs
     #define ATTR_PACKED
 
+    /// Place a variable in RAM that the start up code doesn't clear.
+    ///
+    /// The variable keeps its value over a reset of the MCU (watchdog, reset
+    /// pin, software reset), but holds random data after a power cycle, so
+    /// its contents need to be checked before they are used. It must not
+    /// have an initializer.
+    ///
+    /// Supported by: GCC. On sdcc, use `AT()` with an address outside of the
+    /// XRAM that the linker allocates.
+    #define ATTR_NO_INIT
+
     // TODO: probably won't use these
     // #define IRAM
     // #define PRAM
@@ -194,6 +213,61 @@
     #define bitmap_clear_bit(array, n) (array[n / 8] &= ~(bitn_mask(n % 8)))
 #endif
 
+/// Native word type used by the bitset helpers.
+///
+/// Bitmaps (matrix state, NKRO reports, debounce flags) are stored as byte
+/// arrays, with bit `n` stored in byte `n/8`, bit `n%8`. The bitset helpers
+/// load these byte arrays a word at a time, so that loops that look for changed
+/// bits can skip over large unchanged regions in a single compare.
+#if defined(__SDCC_mcs51) || defined(AVR)
+    typedef uint8_t bitset_word_t;
+#elif defined(__x86_64__) && defined(__GNUC__)
+    typedef uint64_t bitset_word_t;
+#else
+    typedef uint32_t bitset_word_t;
+#endif
+
+/// Number of bytes in a `bitset_word_t`
+#define BITSET_WORD_SIZE (sizeof(bitset_word_t))
+
+/// Clear the lowest set bit in `word`.
+///
+/// Used together with `bitset_ctz()` to iterate over only the set bits of a
+/// word:
+///
+///     while (word) {
+///         const uint8_t bit = bitset_ctz(word);
+///         word = bitset_clear_lowest(word);
+///         ...
+///     }
+#define bitset_clear_lowest(word) ((word) & ((word) - 1))
+
+#if defined(__SDCC_mcs51) || defined(AVR) || defined(DOXYGEN)
+    /// Count trailing zeros, i.e. the position of the lowest set bit in `word`.
+    ///
+    /// The result is undefined if `word` is 0. On 8 bit cores there is no
+    /// hardware instruction for this, so a small lookup table is used.
+    uint8_t bitset_ctz(uint8_t word);
+
+    /// Count the number of set bits in `word`.
+    uint8_t bitset_popcount(uint8_t word);
+
+    /// Load a `bitset_word_t` from the byte array at `ptr`.
+    ///
+    /// At most `len` bytes are read, missing bytes are treated as 0.
+    #define bitset_read_word(ptr, len) ((bitset_word_t)(ptr)[0])
+#else
+    #if defined(__x86_64__) && defined(__GNUC__)
+        #define bitset_ctz(word) ((uint8_t)__builtin_ctzll(word))
+        #define bitset_popcount(word) ((uint8_t)__builtin_popcountll(word))
+    #else
+        #define bitset_ctz(word) ((uint8_t)__builtin_ctz(word))
+        #define bitset_popcount(word) ((uint8_t)__builtin_popcount(word))
+    #endif
+
+    bitset_word_t bitset_read_word(const uint8_t *ptr, uint8_t len);
+#endif
+
 #ifdef __SDCC_mcs51
     // Have to make all the compiler optimizations ourself
     #define read_u16le(ptr) (*((uint16_t*)(ptr)))
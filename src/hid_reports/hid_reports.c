@@ -8,6 +8,10 @@
 #endif
 
 void reset_hid_reports(void) {
+    reset_keyboard_report_queues();
+    reset_mouse_report_queue();
+    reset_media_report_queue();
+
     reset_keyboard_reports();
     reset_mouse_report();
     reset_media_report();
@@ -32,3 +36,13 @@ void send_hid_reports(void) {
     send_vendor_report();
 #endif
 }
+
+bit_t has_pending_hid_reports(void) {
+    return is_keyboard_report_pending()
+        || g_report_pending_media
+        || g_report_pending_mouse;
+}
+
+bit_t is_hid_report_queue_full(void) {
+    return is_keyboard_report_queue_full();
+}
@@ -1,6 +1,8 @@
 // Copyright 2019 jem@seethis.link
 // Licensed under the MIT license (http://opensource.org/licenses/MIT)
 
+#pragma once
+
 #include "hid_reports/keyboard_report.h"
 #include "hid_reports/media_report.h"
 #include "hid_reports/mouse_report.h"
@@ -9,3 +11,16 @@
 // Functions
 void reset_hid_reports(void);
 void send_hid_reports(void);
+
+/// Check if any of the keyboard, media or mouse reports have changes that
+/// haven't been sent or queued for the host yet.
+bit_t has_pending_hid_reports(void);
+
+/// @brief Check if the queue of the keyboard endpoint in use is full.
+///
+/// The matrix interpreter waits while this is true, so that the key presses
+/// it makes aren't merged before they can be queued. The mouse and media
+/// queues don't block it: when one of them is full, its report stays pending
+/// and later changes are merged into it, so typing keeps working when the
+/// host doesn't read those endpoints.
+bit_t is_hid_report_queue_full(void);
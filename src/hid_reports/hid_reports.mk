@@ -11,6 +11,14 @@ ifeq ($(USE_HID), 1)
         $(HID_REPORTS_PATH)/vendor_report.c \
         $(HID_REPORTS_PATH)/mouse_report.c \
         $(HID_REPORTS_PATH)/hid_reports.c \
+        $(HID_REPORTS_PATH)/report_queue.c \
 
     CDEFS += -DHAS_MOUSE_SUPPORT
+
+    # RAM in bytes for the queues of reports waiting for their USB endpoint,
+    # shared by the keyboard, NKRO, mouse and media endpoints. Defaults to
+    # 192 when not given. See `hid_reports/report_queue.h`.
+    ifdef HID_REPORT_QUEUE_RAM
+        CDEFS += -DHID_REPORT_QUEUE_RAM=$(HID_REPORT_QUEUE_RAM)
+    endif
 endif
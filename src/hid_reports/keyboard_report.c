@@ -15,6 +15,7 @@
 #include "hid_reports/usb_reports.h"
 #include "hid_reports/ble_reports.h"
 #include "hid_reports/virtual_reports.h"
+#include "hid_reports/report_queue.h"
 
 #define KEY_AGE_LIST_LEN BOOT_REPORT_KEY_COUNT
 
@@ -37,6 +38,61 @@ static XRAM uint8_t retrigger_list[MAX_NUMBER_RETRIGGER_KEYS];
 /// The length of the retrigger list
 static XRAM uint8_t retrigger_list_len;
 
+#if USE_USB
+static XRAM uint8_t s_boot_queue_buffer[
+    HID_REPORT_QUEUE_DEPTH * sizeof(hid_report_boot_keyboard_t)
+];
+static XRAM uint8_t s_nkro_queue_buffer[
+    HID_REPORT_QUEUE_DEPTH * sizeof(hid_report_nkro_keyboard_t)
+];
+
+/// 6KRO reports waiting for their USB endpoint
+XRAM report_queue_t g_boot_keyboard_queue;
+/// NKRO reports waiting for their USB endpoint
+XRAM report_queue_t g_nkro_keyboard_queue;
+#endif
+
+/// @brief Empty the keyboard report queues, e.g. after a USB reset.
+void reset_keyboard_report_queues(void) {
+#if USE_USB
+    report_queue_init(
+        &g_boot_keyboard_queue,
+        s_boot_queue_buffer,
+        sizeof(hid_report_boot_keyboard_t),
+        HID_REPORT_QUEUE_DEPTH,
+        EP_NUM_BOOT_KEYBOARD
+    );
+    report_queue_init(
+        &g_nkro_keyboard_queue,
+        s_nkro_queue_buffer,
+        sizeof(hid_report_nkro_keyboard_t),
+        HID_REPORT_QUEUE_DEPTH,
+        EP_NUM_NKRO_KEYBOARD
+    );
+#endif
+}
+
+/// Check if the queue of a keyboard endpoint used by the current report mode
+/// has no room for the next report.
+///
+/// The queue of the other endpoint is ignored, since a host may never read
+/// it, e.g. a BIOS only reads the 6KRO endpoint.
+bit_t is_keyboard_report_queue_full(void) {
+#if USE_USB
+    switch (s_keyboard_report_mode) {
+        case KEYBOARD_REPORT_MODE_AUTO:
+        case KEYBOARD_REPORT_MODE_6KRO:
+            return report_queue_is_full(&g_boot_keyboard_queue);
+        case KEYBOARD_REPORT_MODE_UPGRADE:
+            return report_queue_is_full(&g_boot_keyboard_queue)
+                || report_queue_is_full(&g_nkro_keyboard_queue);
+        case KEYBOARD_REPORT_MODE_NKRO:
+            return report_queue_is_full(&g_nkro_keyboard_queue);
+    }
+#endif
+    return false;
+}
+
 /// @brief reset the keyboard reports to their start-up state.
 void reset_keyboard_reports(void) {
     memset(s_key_age, 0, KEY_AGE_LIST_LEN);
@@ -64,6 +120,15 @@ void touch_keyboard_report(void) {
     s_keyboard_report_dirty = 1;
 }
 
+/// Check if the keyboard report has changes that haven't been sent or queued
+/// yet.
+///
+/// Queued reports are sent in order, so a change that has been queued will
+/// reach the host before any later change.
+bit_t is_keyboard_report_pending(void) {
+    return s_keyboard_report_dirty;
+}
+
 /// Set the active keyboard report mode.
 ///
 /// @param mode the new keyboard report mode to use
@@ -265,23 +330,13 @@ void clear_keyboard_report(void) {
     clear_nkro_keyboard_report();
 }
 
-/// @brief Send any pending keyboard reports.
-///
-/// This function combines the 6KRO and NKRO reports into one keyboard report.
-/// It will select the correct report based on the current report mode.
-///
-/// If the report has not changed, no data will be sent.
+/// @brief Send or queue the keyboard reports for the current report mode.
 ///
-/// @retval true A keyboard report is ready but could not be sent and was left pending.
-/// @retval false There is no keyboard report left pending.
-bit_t send_keyboard_report(void) {
+/// @retval true A report couldn't be queued and needs to stay pending.
+/// @retval false The reports have been sent or queued.
+static bit_t queue_keyboard_report(void) {
     uint8_t result = 0;
 
-    // don't send the report if it hasn't changed
-    if (!s_keyboard_report_dirty) {
-        return result;
-    }
-
     switch (s_keyboard_report_mode) {
 
         case KEYBOARD_REPORT_MODE_AUTO:
@@ -290,7 +345,9 @@ bit_t send_keyboard_report(void) {
         } break;
 
         case KEYBOARD_REPORT_MODE_UPGRADE: {
-            // transitioning from boot report to nkro report
+            // transitioning from boot report to nkro report. If only one
+            // of them could be queued, it is dropped as a duplicate when
+            // both are queued again.
             result |= send_nkro_keyboard_report();
             result |= send_boot_keyboard_report();
             if (is_boot_report_empty()) {
@@ -303,7 +360,22 @@ bit_t send_keyboard_report(void) {
         } break;
     }
 
-    if (result == 0) {
+    return result;
+}
+
+/// @brief Send any pending keyboard reports.
+///
+/// This function combines the 6KRO and NKRO reports into one keyboard report.
+/// It will select the correct report based on the current report mode.
+///
+/// Over USB, a changed report is added to the queue of its endpoint, and the
+/// queued reports are written to the endpoints one at a time. If the report
+/// has not changed, no data will be queued.
+///
+/// @retval true A keyboard report is still waiting to be sent.
+/// @retval false There is no keyboard report left pending.
+bit_t send_keyboard_report(void) {
+    if (s_keyboard_report_dirty && !queue_keyboard_report()) {
         s_keyboard_report_dirty = 0;
         if (retrigger_list_len) {
             uint8_t i;
@@ -314,7 +386,20 @@ bit_t send_keyboard_report(void) {
         }
     }
 
-    return result;
+#if USE_USB
+    {
+        bit_t is_pending = s_keyboard_report_dirty;
+        if (report_queue_send_usb(&g_boot_keyboard_queue)) {
+            is_pending = true;
+        }
+        if (report_queue_send_usb(&g_nkro_keyboard_queue)) {
+            is_pending = true;
+        }
+        return is_pending;
+    }
+#else
+    return s_keyboard_report_dirty;
+#endif
 }
 
 #if USE_USB
@@ -334,7 +419,10 @@ bit_t is_ready_nkro_keyboard_report(void) {
 }
 #endif
 
-/// Sends the 6KRO report over its USB endpoint
+/// Sends the 6KRO report, or adds it to the queue of its USB endpoint
+///
+/// @retval true The report couldn't be queued.
+/// @retval false The report was sent or queued.
 bit_t send_boot_keyboard_report(void) {
 #if USE_VIRTUAL_MODE
     kp_virtual_hid_boot_keyboard_report_send();
@@ -353,23 +441,18 @@ bit_t send_boot_keyboard_report(void) {
 #endif
 
 #if USE_USB
-    if (is_ready_boot_keyboard_report()) {
-        uint8_t report_size = sizeof(hid_report_boot_keyboard_t);
-
-        usb_write_in_endpoint(
-            EP_NUM_BOOT_KEYBOARD,
-            (uint8_t*)&g_boot_keyboard_report,
-            report_size
-        );
-
-        return false;
-    } else {
-        return true;
-    }
+    return !report_queue_push(
+        &g_boot_keyboard_queue,
+        (XRAM uint8_t*)&g_boot_keyboard_report,
+        true
+    );
 #endif
 }
 
-/// Sends the NKRO report over its USB endpoint
+/// Sends the NKRO report, or adds it to the queue of its USB endpoint
+///
+/// @retval true The report couldn't be queued.
+/// @retval false The report was sent or queued.
 bit_t send_nkro_keyboard_report(void) {
 #if USE_VIRTUAL_MODE
     kp_virtual_hid_nkro_keyboard_report_send();
@@ -389,18 +472,10 @@ bit_t send_nkro_keyboard_report(void) {
 
 
 #if USE_USB
-    if (is_ready_nkro_keyboard_report()) {
-        uint8_t report_size = sizeof(hid_report_nkro_keyboard_t);
-
-        usb_write_in_endpoint(
-            EP_NUM_NKRO_KEYBOARD,
-            (uint8_t*)&g_nkro_keyboard_report,
-            report_size
-        );
-
-        return false;
-    } else {
-        return true;
-    }
+    return !report_queue_push(
+        &g_nkro_keyboard_queue,
+        (XRAM uint8_t*)&g_nkro_keyboard_report,
+        true
+    );
 #endif
 }
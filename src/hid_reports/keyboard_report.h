@@ -83,8 +83,11 @@ void retrigger_keycode(uint8_t kc);
 bool has_keycode(uint8_t kc);
 void clear_keyboard_report(void);
 void touch_keyboard_report(void);
+bit_t is_keyboard_report_pending(void);
 
 void reset_keyboard_reports(void);
+void reset_keyboard_report_queues(void);
+bit_t is_keyboard_report_queue_full(void);
 
 bit_t send_boot_keyboard_report(void);
 bit_t send_nkro_keyboard_report(void);
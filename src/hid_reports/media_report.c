@@ -14,6 +14,7 @@
 #include "hid_reports/usb_reports.h"
 #include "hid_reports/ble_reports.h"
 #include "hid_reports/virtual_reports.h"
+#include "hid_reports/report_queue.h"
 
 #include "core/settings.h"
 
@@ -25,6 +26,15 @@ XRAM hid_report_media_t g_media_report;
 
 bit_t g_report_pending_media = false;
 
+#if USE_USB
+static XRAM uint8_t s_media_queue_buffer[
+    HID_REPORT_QUEUE_DEPTH * sizeof(hid_report_media_t)
+];
+
+/// Media reports waiting for their USB endpoint
+XRAM report_queue_t g_media_report_queue;
+#endif
+
 /// @brief Mark the mouse report as modified and needs an update.
 void touch_media_report(void) {
     g_report_pending_media = true;
@@ -37,15 +47,40 @@ void reset_media_report(void) {
     g_report_pending_media = false;
 }
 
+/// @brief Empty the media report queue, e.g. after a USB reset.
+void reset_media_report_queue(void) {
+#if USE_USB
+    report_queue_init(
+        &g_media_report_queue,
+        s_media_queue_buffer,
+        sizeof(hid_report_media_t),
+        HID_REPORT_QUEUE_DEPTH,
+        EP_NUM_MEDIA
+    );
+#endif
+}
+
 #if USE_USB
 bit_t is_ready_media_report(void) {
     return is_in_endpoint_ready(EP_NUM_MEDIA);
 }
 #endif
 
+/// @brief Send any pending media report.
+///
+/// Over USB, the report is added to the queue of the media endpoint. While
+/// the queue is full, the report stays pending and only its latest state is
+/// sent once there is room.
+///
+/// @retval true A media report is still waiting to be sent.
+/// @retval false No media report was left pending.
 bit_t send_media_report(void) {
     if (!g_report_pending_media) {
+#if USE_USB
+        return report_queue_send_usb(&g_media_report_queue);
+#else
         return false;
+#endif
     }
 
 #if USE_VIRTUAL_MODE
@@ -79,19 +114,17 @@ bit_t send_media_report(void) {
 #endif
 
 #if USE_USB
-    if (is_ready_media_report()) {
-        const uint8_t report_size = sizeof(hid_report_media_t);
-
-        usb_write_in_endpoint(
-            EP_NUM_MEDIA,
-            (uint8_t*)&g_media_report,
-            report_size
-        );
-
+    if (report_queue_push(
+        &g_media_report_queue,
+        (XRAM uint8_t*)&g_media_report,
+        true
+    )) {
         reset_media_report();
-        return false;
-    } else {
+    }
+
+    if (report_queue_send_usb(&g_media_report_queue)) {
         return true;
     }
+    return g_report_pending_media;
 #endif
 }
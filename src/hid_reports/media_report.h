@@ -24,6 +24,7 @@ extern XRAM hid_report_media_t g_media_report;
 extern bit_t g_report_pending_media;
 
 void reset_media_report(void);
+void reset_media_report_queue(void);
 void touch_media_report(void);
 
 bit_t send_media_report(void);
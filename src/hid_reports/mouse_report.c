@@ -12,6 +12,7 @@
 #include "hid_reports/usb_reports.h"
 #include "hid_reports/ble_reports.h"
 #include "hid_reports/virtual_reports.h"
+#include "hid_reports/report_queue.h"
 
 #include <string.h>
 
@@ -21,6 +22,15 @@ XRAM hid_report_mouse_t g_mouse_report;
 /// Set to true if a mouse report is pending.
 bit_t g_report_pending_mouse = false;
 
+#if USE_USB
+static XRAM uint8_t s_mouse_queue_buffer[
+    HID_REPORT_QUEUE_DEPTH * sizeof(hid_report_mouse_t)
+];
+
+/// Mouse reports waiting for their USB endpoint
+XRAM report_queue_t g_mouse_report_queue;
+#endif
+
 /// @brief Convert a 16 bit signed value into a 16 bit signed value.
 ///
 /// @return A 16 bit signed value
@@ -44,6 +54,19 @@ void reset_mouse_report(void) {
 #endif
 }
 
+/// @brief Empty the mouse report queue, e.g. after a USB reset.
+void reset_mouse_report_queue(void) {
+#if USE_USB
+    report_queue_init(
+        &g_mouse_report_queue,
+        s_mouse_queue_buffer,
+        sizeof(hid_report_mouse_t),
+        HID_REPORT_QUEUE_DEPTH,
+        EP_NUM_MOUSE
+    );
+#endif
+}
+
 /// @brief Mark the mouse report as modified and needs an update.
 void touch_mouse_report(void) {
     g_report_pending_mouse = true;
@@ -69,11 +92,19 @@ static void zero_mouse(void) {
 
 /// @brief Send any pending mouse report.
 ///
-/// @retval true A mouse report is ready but could not be sent and was left pending.
+/// Over USB, the report is added to the queue of the mouse endpoint. While
+/// the queue is full, the report stays pending and movement keeps adding up
+/// in it.
+///
+/// @retval true A mouse report is still waiting to be sent.
 /// @retval false No mouse report was left pending.
 bit_t send_mouse_report(void) {
     if (!g_report_pending_mouse) {
+#if USE_USB
+        return report_queue_send_usb(&g_mouse_report_queue);
+#else
         return false;
+#endif
     }
 
 #if USE_VIRTUAL_MODE
@@ -95,18 +126,25 @@ bit_t send_mouse_report(void) {
 #endif
 
 #if USE_USB
-    if (is_ready_mouse_report()) {
-        uint8_t report_size = sizeof(hid_report_mouse_t);
-
-        usb_write_in_endpoint(
-            EP_NUM_MOUSE,
-            (uint8_t*)&g_mouse_report,
-            report_size
-        );
-        zero_mouse();
-        return false;
-    } else {
-        return true;
+    {
+        // Reports with movement in them add to the position, so they are
+        // never duplicates
+        const bit_t has_movement =
+            g_mouse_report.x || g_mouse_report.y ||
+            g_mouse_report.wheel_x || g_mouse_report.wheel_y;
+
+        if (report_queue_push(
+            &g_mouse_report_queue,
+            (XRAM uint8_t*)&g_mouse_report,
+            !has_movement
+        )) {
+            zero_mouse();
+        }
+
+        if (report_queue_send_usb(&g_mouse_report_queue)) {
+            return true;
+        }
+        return g_report_pending_mouse;
     }
 #endif
 }
@@ -33,6 +33,7 @@ extern XRAM hid_report_mouse_t g_mouse_report;
 extern bit_t g_report_pending_mouse;
 
 void reset_mouse_report(void);
+void reset_mouse_report_queue(void);
 void touch_mouse_report(void);
 
 int16_t sign_extend_12(uint16_t x);
@@ -0,0 +1,140 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file
+/// @brief FIFO of HID report states waiting for their USB IN endpoint.
+
+#include "hid_reports/report_queue.h"
+
+#include <string.h>
+
+#include "hid_reports/usb_reports.h"
+
+KP_STATIC_ASSERT(
+    HID_REPORT_QUEUE_DEPTH >= 1 && HID_REPORT_QUEUE_DEPTH <= 0x7f,
+    "HID_REPORT_QUEUE_RAM must fit between 1 and 127 reports per endpoint"
+);
+
+/// Get the slot that is `offset` slots after the head of the queue
+static uint8_t report_queue_slot(const XRAM report_queue_t *queue, uint8_t offset) {
+    uint8_t slot = queue->head + offset;
+    if (slot >= queue->capacity) {
+        slot -= queue->capacity;
+    }
+    return slot;
+}
+
+static XRAM uint8_t *report_queue_slot_ptr(const XRAM report_queue_t *queue, uint8_t slot) {
+    return queue->buffer + (uint16_t)slot * queue->report_size;
+}
+
+/// Free the slot of the report in flight once the host has read it
+static void report_queue_release_sent(XRAM report_queue_t *queue) {
+#if USE_USB
+    if (queue->in_flight && is_in_endpoint_ready(queue->endpoint_num)) {
+        queue->head = report_queue_slot(queue, 1);
+        queue->count--;
+        queue->in_flight = false;
+    }
+#else
+    UNREFERENCED_ARGUMENT(queue);
+#endif
+}
+
+void report_queue_init(
+    XRAM report_queue_t *queue,
+    XRAM uint8_t *buffer,
+    uint8_t report_size,
+    uint8_t capacity,
+    uint8_t endpoint_num
+) {
+    queue->buffer = buffer;
+    queue->report_size = report_size;
+    queue->capacity = capacity;
+    queue->endpoint_num = endpoint_num;
+    memset(&queue->stats, 0, sizeof(report_queue_stats_t));
+    report_queue_clear(queue);
+}
+
+void report_queue_clear(XRAM report_queue_t *queue) {
+    queue->head = 0;
+    queue->count = 0;
+    queue->in_flight = false;
+    queue->has_last = false;
+    queue->is_blocked = false;
+}
+
+bit_t report_queue_push(
+    XRAM report_queue_t *queue,
+    const XRAM uint8_t *report,
+    bit_t drop_duplicate
+) {
+    if (drop_duplicate && queue->has_last) {
+        // The last report pushed is in the slot before the back of the
+        // queue. It is still there after it has been sent, since only a push
+        // can overwrite it.
+        const uint8_t last_slot = report_queue_slot(
+            queue,
+            queue->count ? queue->count - 1 : queue->capacity - 1
+        );
+        if (memcmp(report_queue_slot_ptr(queue, last_slot), report, queue->report_size) == 0) {
+            queue->stats.duplicates++;
+            queue->is_blocked = false;
+            return true;
+        }
+    }
+
+    if (report_queue_is_full(queue)) {
+        if (!queue->is_blocked) {
+            queue->stats.overflows++;
+            queue->is_blocked = true;
+        }
+        return false;
+    }
+
+    memcpy(
+        report_queue_slot_ptr(queue, report_queue_slot(queue, queue->count)),
+        report,
+        queue->report_size
+    );
+    queue->count++;
+    queue->has_last = true;
+    queue->is_blocked = false;
+
+    if (queue->count > queue->stats.max_depth) {
+        queue->stats.max_depth = queue->count;
+    }
+
+    return true;
+}
+
+bit_t report_queue_is_full(XRAM report_queue_t *queue) {
+    if (queue->count == queue->capacity) {
+        report_queue_release_sent(queue);
+    }
+    return queue->count == queue->capacity;
+}
+
+bit_t report_queue_is_pending(const XRAM report_queue_t *queue) {
+    return queue->count > queue->in_flight;
+}
+
+#if USE_USB
+bit_t report_queue_send_usb(XRAM report_queue_t *queue) {
+    report_queue_release_sent(queue);
+
+    if (
+        report_queue_is_pending(queue) &&
+        !queue->in_flight &&
+        is_in_endpoint_ready(queue->endpoint_num)
+    ) {
+        usb_write_in_endpoint(
+            queue->endpoint_num,
+            report_queue_slot_ptr(queue, queue->head),
+            queue->report_size
+        );
+        queue->in_flight = true;
+    }
+
+    return report_queue_is_pending(queue);
+}
+#endif
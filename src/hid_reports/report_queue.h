@@ -0,0 +1,119 @@
+// Copyright 2019 jem@seethis.link
+// Licensed under the MIT license (http://opensource.org/licenses/MIT)
+/// @file
+/// @brief FIFO of HID report states waiting for their USB IN endpoint.
+///
+/// The key handlers change the live reports (e.g. `g_nkro_keyboard_report`).
+/// When the reports are sent, a copy of each changed report is pushed on the
+/// queue of its endpoint, and the oldest report in the queue is written to
+/// the endpoint once the host has read the last one. So a key that is
+/// pressed and released between two USB polls still reaches the host as two
+/// reports, instead of the release overwriting the press.
+///
+/// A report that is the same as the last one pushed is dropped. When a queue
+/// is full, the live report stays pending and the push is counted in
+/// `overflows`. The matrix interpreter only waits for room in the queue of
+/// the keyboard endpoint in use, see `is_hid_report_queue_full()`.
+///
+/// The report being written to the endpoint keeps its slot until the
+/// endpoint is ready again, because some ports hand the buffer to the USB
+/// hardware instead of copying it.
+
+#pragma once
+
+#include "core/util.h"
+
+#include "hid_reports/keyboard_report.h"
+#include "hid_reports/media_report.h"
+#include "hid_reports/mouse_report.h"
+
+/// RAM in bytes used for the queued report states of all the endpoints.
+/// Every endpoint gets the same depth, so this is divided by the size of
+/// one report of each kind.
+#ifndef HID_REPORT_QUEUE_RAM
+    #define HID_REPORT_QUEUE_RAM 192
+#endif
+
+/// The bytes used by one queue slot for every endpoint
+#define HID_REPORT_QUEUE_FRAME_SIZE ( \
+    sizeof(hid_report_boot_keyboard_t) + \
+    sizeof(hid_report_nkro_keyboard_t) + \
+    sizeof(hid_report_mouse_t) + \
+    sizeof(hid_report_media_t) \
+)
+
+/// Number of report states each endpoint can queue, including the one being
+/// sent
+#define HID_REPORT_QUEUE_DEPTH (HID_REPORT_QUEUE_RAM / HID_REPORT_QUEUE_FRAME_SIZE)
+
+typedef struct report_queue_stats_t {
+    /// Reports dropped because they were the same as the last one queued
+    uint16_t duplicates;
+    /// Times a changed report found the queue full and had to stay pending
+    uint16_t overflows;
+    /// Largest number of slots used at once
+    uint8_t max_depth;
+} report_queue_stats_t;
+
+typedef struct report_queue_t {
+    XRAM uint8_t *buffer;
+    uint8_t report_size;
+    uint8_t capacity;
+    uint8_t endpoint_num;
+    /// Slot of the oldest report
+    uint8_t head;
+    /// Slots used, including the report being sent
+    uint8_t count;
+    /// The report at `head` has been written to the endpoint
+    uint8_t in_flight;
+    /// The slot before `head + count` holds the last report pushed
+    uint8_t has_last;
+    /// The last push failed, counted in `overflows` once
+    uint8_t is_blocked;
+    report_queue_stats_t stats;
+} report_queue_t;
+
+/// Set up an empty queue for a USB IN endpoint, using `capacity` reports of
+/// `report_size` bytes in `buffer`.
+void report_queue_init(
+    XRAM report_queue_t *queue,
+    XRAM uint8_t *buffer,
+    uint8_t report_size,
+    uint8_t capacity,
+    uint8_t endpoint_num
+);
+
+/// Empty the queue, without touching its stats
+void report_queue_clear(XRAM report_queue_t *queue);
+
+/// Add a copy of a report to the back of the queue
+///
+/// @param drop_duplicate if true, the report is dropped when it is the same
+///     as the last report pushed
+///
+/// @retval true The report was queued or was a duplicate.
+/// @retval false The queue is full, the report needs to stay pending.
+bit_t report_queue_push(
+    XRAM report_queue_t *queue,
+    const XRAM uint8_t *report,
+    bit_t drop_duplicate
+);
+
+/// Check if the queue has no room for another report
+bit_t report_queue_is_full(XRAM report_queue_t *queue);
+
+/// Check if the queue has reports that haven't been written to the endpoint
+bit_t report_queue_is_pending(const XRAM report_queue_t *queue);
+
+#if USE_USB
+extern XRAM report_queue_t g_boot_keyboard_queue;
+extern XRAM report_queue_t g_nkro_keyboard_queue;
+extern XRAM report_queue_t g_mouse_report_queue;
+extern XRAM report_queue_t g_media_report_queue;
+
+/// Write the next queued report to the USB IN endpoint if it is ready.
+///
+/// @retval true Reports are still waiting to be written.
+/// @retval false All queued reports have been written.
+bit_t report_queue_send_usb(XRAM report_queue_t *queue);
+#endif
@@ -7,10 +7,13 @@
 
 #include "core/keycode.h"
 #include "core/matrix_interpret.h"
+#include "core/scheduler.h"
 #include "core/timer.h"
 #include "core/usb_commands.h"
 #include "core/util.h"
 
+#include "hid_reports/hid_reports.h"
+
 // external keycode table structure:
 // offset 0: delay
 // offset 2: settings
@@ -21,12 +24,8 @@
 #define EKC_OFFSET_HELD_KEYCODE 4
 #define EKC_OFFSET_TAP_KEYCODE 6
 
-#define HOLD_KEY_TAP_AUTO_RELEASE_TIME 3
-
 XRAM hold_event_t hold_event_list[MAX_NUM_HOLD_KEYS];
 
-static XRAM uint8_t s_buffer_other_keys;
-
 uint8_t hold_event_list_len;
 
 void handle_hold_keycode(keycode_t keycode, key_event_t event) REENT;
@@ -45,97 +44,281 @@ void hold_key_delete_event(uint8_t i) {
     }
 
     hold_event_list_len--;
+
+    if (hold_event_list_len == 0) {
+        hold_keycodes.is_timer_task_active = false;
+    }
 }
 
-bool hold_key_task(uint8_t other_key_pressed) REENT {
+static bit_t is_hold_undecided(const hold_event_t *hold) {
+    return !hold->has_been_held && !hold->has_been_tapped;
+}
+
+static keycode_t get_hold_keycode(const hold_event_t *hold, uint8_t offset) REENT {
+    keycode_t keycode;
+    get_ekc_data(&keycode, hold->ekc_addr + offset, sizeof(keycode_t));
+    return keycode;
+}
+
+/// Press the held keycode. The press is sent straight to the key handlers so
+/// that any keys that follow it in the same pass see its effects.
+static void hold_key_press_held(hold_event_t *hold) REENT {
+#if DEBUG_LEVEL >= 3
+    USB_PRINT_TEXT("hold->held");
+#endif
+    hold->has_been_held = true;
+    keyboard_trigger_event(
+        get_hold_keycode(hold, EKC_OFFSET_HELD_KEYCODE),
+        EVENT_PRESSED
+    );
+}
+
+/// Press the tap keycode. It is released by `hold_key_task()` after the
+/// report containing the press has been sent.
+static void hold_key_press_tap(hold_event_t *hold) REENT {
+#if DEBUG_LEVEL >= 3
+    USB_PRINT_TEXT("hold->tap");
+#endif
+    hold->has_been_tapped = true;
+    keyboard_trigger_event(
+        get_hold_keycode(hold, EKC_OFFSET_TAP_KEYCODE),
+        EVENT_PRESSED
+    );
+}
+
+static bit_t has_undecided_permissive_hold(uint8_t kb_id) {
     uint8_t i;
-    uint16_t current_time;
+    for (i = 0; i < hold_event_list_len; ++i) {
+        const hold_event_t *hold = &hold_event_list[i];
+        if (hold->kb_id == kb_id &&
+            hold->permissive_hold &&
+            is_hold_undecided(hold)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (hold_event_list_len == 0) {
-        return false;
+/// Called after some hold keys on `kb_id` were resolved. Applies the layer
+/// changes of the keycodes that were just pressed, then replays the keys
+/// pressed while a permissive hold key was undecided on the new layer, once
+/// no permissive hold key is left undecided.
+static void hold_key_finish_resolve(uint8_t kb_id) REENT {
+    layer_queue_apply(get_active_slot_id());
+
+    if (g_buffered_keys.owner != BUFFERED_KEYS_HOLD ||
+        g_buffered_keys.kb_id != kb_id ||
+        has_undecided_permissive_hold(kb_id)
+    ) {
+        return;
     }
 
-    current_time = timer_read16_ms();
+    keyboard_replay_buffered_keys(BUFFERED_KEYS_HOLD);
+}
 
-    // Check hold key events
+/// Resolve all the undecided permissive hold keys on `kb_id` as held.
+static void hold_key_resolve_permissive(uint8_t kb_id) REENT {
+    uint8_t i;
     for (i = 0; i < hold_event_list_len; ++i) {
         hold_event_t *hold = &hold_event_list[i];
-        keycode_t keycode;
-        bool timer_passed = has_passed_time16(current_time, hold->end_time);
+        if (hold->kb_id == kb_id &&
+            hold->permissive_hold &&
+            is_hold_undecided(hold)) {
+            hold_key_press_held(hold);
+        }
+    }
+    hold_key_finish_resolve(kb_id);
+}
+
+bit_t hold_key_other_key_pressed(uint8_t kb_id, uint8_t key_num) REENT {
+    uint8_t i;
+    bit_t resolved = false;
+    bit_t should_buffer = false;
+
+    for (i = 0; i < hold_event_list_len; ++i) {
+        hold_event_t *hold = &hold_event_list[i];
+
+        if (hold->kb_id != kb_id) {
+            continue;
+        }
 
-        if (hold->has_generated_event) {
+        hold->has_been_interrupted = true;
+
+        if (!is_hold_undecided(hold)) {
             continue;
         }
 
-        if (hold->activate_on_other_key && other_key_pressed && !hold->has_been_held) {
+        if (hold->activate_on_other_key) {
 #if DEBUG_LEVEL >= 3
             USB_PRINT_TEXT("hold->pressed, other key");
 #endif
+            hold_key_press_held(hold);
+            resolved = true;
+        } else if (hold->permissive_hold) {
+            should_buffer = true;
+        }
+    }
 
-            // this code is used to press held keys
-            get_ekc_data(
-                (uint8_t*)&keycode,
-                hold->ekc_addr + EKC_OFFSET_HELD_KEYCODE,
-                sizeof(keycode_t)
-            );
-            hold->has_been_held = true;
-            hold->has_generated_event = true;
-            queue_keycode_event(keycode, EVENT_PRESSED, hold->kb_id);
-            s_buffer_other_keys = false;
+    if (should_buffer) {
+        if (keyboard_buffer_key(BUFFERED_KEYS_HOLD, kb_id, key_num)) {
+            return true;
         }
 
-        if (other_key_pressed) {
+        // No room to buffer the key, so resolve the hold keys now instead of
+        // losing it.
+        hold_key_resolve_permissive(kb_id);
+        return false;
+    }
+
+    if (resolved) {
+        hold_key_finish_resolve(kb_id);
+    }
+
+    return false;
+}
+
+void hold_key_other_key_released(uint8_t kb_id, uint8_t key_num) REENT {
+    // A key that was pressed after the hold key was released before it, so
+    // permissive hold keys are resolved as held.
+    if (keyboard_is_key_buffered(BUFFERED_KEYS_HOLD, kb_id, key_num)) {
+        hold_key_resolve_permissive(kb_id);
+    }
+}
+
+void hold_key_check_timeout(uint8_t kb_id) REENT {
+    uint8_t i;
+    bit_t resolved = false;
+    const uint16_t current_time = timer_read16_ms();
+
+    for (i = 0; i < hold_event_list_len; ++i) {
+        hold_event_t *hold = &hold_event_list[i];
+
+        if (hold->kb_id != kb_id || !is_hold_undecided(hold)) {
+            continue;
+        }
+
+        if ((hold->activate_on_delay &&
+             has_passed_time16(current_time, hold->end_time)) ||
+            (hold->activate_on_other_key && hold->has_been_interrupted)
+        ) {
+            hold_key_press_held(hold);
+            resolved = true;
+        }
+    }
+
+    if (resolved) {
+        hold_key_finish_resolve(kb_id);
+    }
+}
+
+bool hold_key_task(uint8_t other_key_pressed) REENT {
+    uint8_t i;
+    uint16_t current_time;
+    uint16_t next_timeout = 0;
+    bit_t has_timeout = false;
+    bit_t needs_poll = false;
+    bit_t reports_pending;
+
+    if (hold_event_list_len == 0) {
+        return false;
+    }
+
+    current_time = timer_read16_ms();
+    reports_pending = has_pending_hid_reports();
+
+    for (i = 0; i < hold_event_list_len; ++i) {
+        hold_event_t *hold = &hold_event_list[i];
+
+        if (hold->has_been_tapped) {
+            // The tap keycode is released once the report that has the tap
+            // press in it has been sent, instead of waiting a fixed time.
+            if (!reports_pending) {
 #if DEBUG_LEVEL >= 3
-            USB_PRINT_TEXT("other key done");
+                USB_PRINT_TEXT("hold->tap_release");
 #endif
+                queue_keycode_event(
+                    get_hold_keycode(hold, EKC_OFFSET_TAP_KEYCODE),
+                    EVENT_RELEASED,
+                    hold->kb_id
+                );
+                hold_key_delete_event(i);
+                // since we deleted an event from the list we are processing and
+                // the new event is now at the current list position, need to
+                // decrement here.
+                i--;
+            }
+            needs_poll = true;
             continue;
         }
 
-        if (hold->activate_on_delay) {
-            if (!timer_passed) {
-                // if its using the delay activation method, then there's nothing
-                // to do until the delay time has passed
-                continue;
-            }
+        if (other_key_pressed) {
+            hold->has_been_interrupted = true;
+        }
 
-            if (!hold->has_been_held && !hold->has_been_tapped) {
-                // this code is used to press held keys
-                get_ekc_data(
-                    (uint8_t*)&keycode,
-                    hold->ekc_addr + EKC_OFFSET_HELD_KEYCODE,
-                    sizeof(keycode_t)
-                );
-                hold->has_been_held = true;
-                hold->has_generated_event = true;
-                queue_keycode_event(keycode, EVENT_PRESSED, hold->kb_id);
+        if (!is_hold_undecided(hold)) {
+            continue;
+        }
+
+        // The hold key is resolved by the matrix interpreter so that buffered
+        // keys are replayed in the same pass, here we just need to wake it.
+        if ((hold->activate_on_delay &&
+             has_passed_time16(current_time, hold->end_time)) ||
+            (hold->activate_on_other_key && hold->has_been_interrupted)
+        ) {
+            keyboard_request_update(hold->kb_id);
+            needs_poll = true;
+        } else if (hold->activate_on_delay) {
+            // has_passed_time16() is true from the ms after `end_time`
+            const uint16_t timeout = hold->end_time + 1;
+            if (!has_timeout || (int16_t)(timeout - next_timeout) < 0) {
+                next_timeout = timeout;
+                has_timeout = true;
             }
         }
+    }
+
+    // Hold keys that wait for a key press or release are woken by the
+    // matrix scan, so only timeouts need the scheduler to wake up.
+    if (needs_poll) {
+        return true;
+    }
+    if (has_timeout) {
+        scheduler_wake_at(next_timeout);
+        return true;
+    }
+    return false;
+}
+
+void hold_key_cancel_keyboard(uint8_t kb_id) REENT {
+    uint8_t i;
+
+    for (i = 0; i < hold_event_list_len; ++i) {
+        hold_event_t *hold = &hold_event_list[i];
+
+        if (hold->kb_id != kb_id) {
+            continue;
+        }
 
-        if (hold->has_been_tapped && timer_passed) {
-#if DEBUG_LEVEL >= 3
-            USB_PRINT_TEXT("tapped task...");
-#endif
-            // this code is used to release tapped keys
-            get_ekc_data(
-                &keycode,
-                hold->ekc_addr + EKC_OFFSET_TAP_KEYCODE,
-                sizeof(keycode_t)
+        if (hold->has_been_held || hold->has_been_tapped) {
+            keyboard_trigger_event(
+                get_hold_keycode(hold, (hold->has_been_held ?
+                    EKC_OFFSET_HELD_KEYCODE : EKC_OFFSET_TAP_KEYCODE)),
+                EVENT_RELEASED
             );
-            queue_keycode_event(keycode, EVENT_RELEASED, hold->kb_id);
-            // need to delete tap event now that it is finished.
-            hold_key_delete_event(i);
-            // since we deleted an event from the list we are processing and
-            // the new event is now at the current list position, need to
-            // decrement here.
-            i--;
         }
+
+        hold_key_delete_event(i);
+        i--; // account for deleted element from this list
     }
 
-    return true;
+    // the buffered keys were never pressed, so they can just be dropped
+    if (g_buffered_keys.kb_id == kb_id) {
+        keyboard_drop_buffered_keys(BUFFERED_KEYS_HOLD);
+    }
 }
 
-bit_t hold_key_buffer_other_keys(void) {
-    return s_buffer_other_keys;
+bit_t hold_key_is_active(void) {
+    return hold_event_list_len != 0;
 }
 
 // The keycode should be the unique address of the key in the external keycode
@@ -149,13 +332,9 @@ void handle_hold_keycode(keycode_t keycode, key_event_t event) REENT {
     if (event == EVENT_RESET) {
         hold_event_list_len = 0;
         hold_keycodes.is_timer_task_active = false;
-        s_buffer_other_keys = false;
+        keyboard_drop_buffered_keys(BUFFERED_KEYS_HOLD);
         return;
     }
-    // } else if (event == EVENT_TIMER_TASK) {
-    //     hold_key_task();
-    // }
-
 
     { // handle press and release events
         uint16_t this_ekc_addr = EKC_DATA_ADDR(keycode);
@@ -180,23 +359,22 @@ void handle_hold_keycode(keycode_t keycode, key_event_t event) REENT {
             hold_key->kb_id = kb_id;
             hold_key->activate_on_delay = (bool)(settings & HOLD_KEY_ACTIVATE_DELAY);
             hold_key->activate_on_other_key = (bool)(settings & HOLD_KEY_ACTIVATE_OTHER_KEY);
+            hold_key->permissive_hold = (bool)(settings & HOLD_KEY_PERMISSIVE_HOLD);
+            hold_key->retro_tap = (bool)(settings & HOLD_KEY_RETRO_TAP);
 
-            if (hold_key->activate_on_other_key) {
 #if DEBUG_LEVEL >= 3
+            if (hold_key->activate_on_other_key) {
                 USB_PRINT_TEXT("on_other_key");
-#endif
-                s_buffer_other_keys = true;
             }
 
             if (hold_key->activate_on_delay) {
-#if DEBUG_LEVEL >= 3
                 USB_PRINT_TEXT("on_delay");
-#endif
             }
+#endif
 
             hold_key->has_been_held = false;
             hold_key->has_been_tapped = false;
-            hold_key->has_generated_event = false;
+            hold_key->has_been_interrupted = false;
 
             hold_event_list_len++;
             hold_keycodes.is_timer_task_active = true;
@@ -204,51 +382,36 @@ void handle_hold_keycode(keycode_t keycode, key_event_t event) REENT {
             uint8_t i;
             for (i = 0; i < hold_event_list_len; ++i) {
                 hold_event_t *hold_key = &hold_event_list[i];
-                keycode_t keycode;
                 if (!(hold_key->ekc_addr == this_ekc_addr &&
-                      hold_key->kb_id == kb_id)) {
+                      hold_key->kb_id == kb_id) ||
+                    hold_key->has_been_tapped
+                ) {
                     continue;
                 }
 
-                if (hold_key->activate_on_delay ||
-                    hold_key->activate_on_other_key
-                ) {
-                    if (hold_key->has_been_held) {
+                if (hold_key->has_been_held) {
 #if DEBUG_LEVEL >= 3
-                        USB_PRINT_TEXT("hold->held_release");
+                    USB_PRINT_TEXT("hold->held_release");
 #endif
-                        get_ekc_data(
-                            &keycode,
-                            this_ekc_addr + EKC_OFFSET_HELD_KEYCODE,
-                            sizeof(keycode_t)
-                        );
-                        // held key
-                        queue_keycode_event(keycode, EVENT_RELEASED, kb_id);
+                    keyboard_trigger_event(
+                        get_hold_keycode(hold_key, EKC_OFFSET_HELD_KEYCODE),
+                        EVENT_RELEASED
+                    );
+
+                    if (hold_key->retro_tap && !hold_key->has_been_interrupted) {
+                        // nothing else was pressed while the key was held,
+                        // so treat it as a tap
+                        hold_key_press_tap(hold_key);
+                    } else {
                         hold_key_delete_event(i);
                         i--; // account for deleted element from this list
-                    } else {
-                        // tapped key
-#if DEBUG_LEVEL >= 3
-                        USB_PRINT_TEXT("hold->tap_release");
-#endif
-                        hold_key->has_been_tapped = true;
-                        hold_key->end_time = timer_read16_ms() + HOLD_KEY_TAP_AUTO_RELEASE_TIME;
-                        get_ekc_data(
-                            &keycode,
-                            this_ekc_addr + EKC_OFFSET_TAP_KEYCODE,
-                            sizeof(keycode_t)
-                        );
-
-                        // NOTE: other fields for this event have were already
-                        // filled in when the press event was handled.
-                        queue_keycode_event(keycode, EVENT_PRESSED, kb_id);
                     }
+                } else {
+                    // released before it was resolved, so it's a tap
+                    hold_key_press_tap(hold_key);
+                    hold_key_finish_resolve(kb_id);
                 }
             }
-
-            if (hold_event_list_len == 0) {
-                hold_keycodes.is_timer_task_active = false;
-            }
         }
     }
 }
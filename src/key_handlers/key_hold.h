@@ -3,13 +3,24 @@
 
 #pragma once
 
+#include "core/build_config.h"
+
 #include "key_handlers/key_handlers.h"
 
-#define MAX_NUM_HOLD_KEYS 4
+/// Number of hold keys that can be waiting to be decided at the same time
+#ifndef MAX_NUM_HOLD_KEYS
+    #define MAX_NUM_HOLD_KEYS 4
+#endif
 
 // hold key settings in external keycode table
 #define HOLD_KEY_ACTIVATE_DELAY      (1 << 0)
 #define HOLD_KEY_ACTIVATE_OTHER_KEY  (1 << 1)
+/// Hold if another key is pressed and released while the hold key is down.
+/// Keys pressed while the hold key is undecided are buffered.
+#define HOLD_KEY_PERMISSIVE_HOLD     (1 << 2)
+/// If the hold key was held without any other key being pressed, send the
+/// tap keycode when it is released.
+#define HOLD_KEY_RETRO_TAP           (1 << 3)
 
 // NOTE: since we use `uint16_t` for `end_time`, we are limit to a hold duration
 // of (UINT16_MAX/2) ms ≈ 32s
@@ -19,13 +30,49 @@ typedef struct {
     uint8_t kb_id;
     uint8_t activate_on_delay: 1;
     uint8_t activate_on_other_key: 1;
+    uint8_t permissive_hold: 1;
+    uint8_t retro_tap: 1;
     uint8_t has_been_held: 1;
     uint8_t has_been_tapped: 1;
-    uint8_t has_generated_event: 1;
-    uint8_t reserved: 5;
+    uint8_t has_been_interrupted: 1;
+    uint8_t reserved: 1;
 } hold_event_t;
 
 extern XRAM keycode_callbacks_t hold_keycodes;
 
-bool hold_key_task(uint8_t other_key_pressed);
-bit_t hold_key_buffer_other_keys(void);
+/// Releases tapped keycodes once the report with the tap press has been sent,
+/// and wakes the matrix interpreter when a hold key's delay expires.
+///
+/// @param other_key_pressed set when an input that isn't part of the key
+/// matrix (e.g. a mouse button) was pressed.
+///
+/// @return true if hold keys are waiting on a timeout or a tap release, false
+/// if they only wait for other keys
+bool hold_key_task(uint8_t other_key_pressed) REENT;
+
+/// Returns true if any hold keys are down or waiting for their tap release.
+bit_t hold_key_is_active(void);
+
+/// Called by the matrix interpreter when a key is pressed on `kb_id` while a
+/// hold key is active. Hold keys that activate on other keys are resolved as
+/// held, and their layer changes are applied before returning.
+///
+/// @return true if the key was buffered by a permissive hold key, in which
+/// case the interpreter should not generate a press event for it.
+bit_t hold_key_other_key_pressed(uint8_t kb_id, uint8_t key_num) REENT;
+
+/// Called by the matrix interpreter when a key is released on `kb_id` while a
+/// hold key is active. If the key was buffered by a permissive hold key, the
+/// hold key is resolved as held and the buffered keys are replayed.
+void hold_key_other_key_released(uint8_t kb_id, uint8_t key_num) REENT;
+
+/// Resolve hold keys whose delay has expired. Called by the matrix
+/// interpreter before it processes the keyboard.
+void hold_key_check_timeout(uint8_t kb_id) REENT;
+
+/// Cancel all the hold keys that were pressed on the given keyboard.
+///
+/// Held or tapped keycodes that were already pressed are released immediately
+/// with `keyboard_trigger_event()`, so this must be called while the keyboard
+/// is still loaded in the active slot.
+void hold_key_cancel_keyboard(uint8_t kb_id) REENT;
@@ -39,7 +39,7 @@ void handle_macro_keycodes(keycode_t keycode, key_event_t event) REENT {
                 return;
             } else {
                 // Stop the press macro if it is still running.
-                macro_abort();
+                macro_stop(ekc_addr + PRESS_MARCO_ADDR, kb_id);
 
                 if (!err) {
                     call_macro(ekc_addr + release_macro_offset, kb_id);
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "core/matrix_interpret.h"
+#include "core/scheduler.h"
 #include "core/timer.h"
 
 #if USE_MOUSE
@@ -124,10 +125,16 @@ void handle_mouse_keycode(keycode_t ekc, key_event_t event) REENT {
 }
 
 bool mouse_key_task(void) {
-    if (
-        s_num_mouse_keys_down &&
-        ((uint8_t)(timer_read8_ms() - s_report_time) > MOUSE_REPORT_RATE)
-    ) {
+    const uint8_t elapsed_time = timer_read8_ms() - s_report_time;
+
+    if (s_num_mouse_keys_down && elapsed_time <= MOUSE_REPORT_RATE) {
+        // held movement keys repeat once the report rate has passed
+        if (s_mouse_keys) {
+            scheduler_wake_at(
+                timer_read16_ms() + (MOUSE_REPORT_RATE + 1 - elapsed_time)
+            );
+        }
+    } else if (s_num_mouse_keys_down) {
         // Calulate mouse speed based of current mouse key button state
         if (s_mouse_keys & MOUSE_KEY_LEFT)  { g_mouse_report.x += -MOUSE_SPEED; }
         if (s_mouse_keys & MOUSE_KEY_RIGHT) { g_mouse_report.x += +MOUSE_SPEED; }
@@ -21,7 +21,7 @@ SETTINGS_HEX=$(basename $(TARGET_HEX))-$(LAYOUT_NAME)-settings-only.hex
 
 all: hex $(MERGED_HEX)
 
-hex: print_keyplus_info create_build_dirs $(EXTRA_TARGET) $(TARGET_HEX)
+hex: print_keyplus_info create_build_dirs $(GENERATED_CONFIG_H) $(EXTRA_TARGET) $(TARGET_HEX)
 
 hex_settings: $(SETTINGS_HEX)
 
@@ -41,9 +41,24 @@ print_keyplus_info:
 	@echo "compiler c flags: $(ALL_CFLAGS)"
 	@echo ""
 
+ifeq ($(USE_STATIC_LAYOUT), 1)
+# The keymap C file is written together with the settings hex
+STATIC_LAYOUT_FLAGS = --static-layout "$(STATIC_LAYOUT_C)"
+$(STATIC_LAYOUT_C): $(SETTINGS_HEX) ;
+endif
+
+ifeq ($(USE_GENERATED_CONFIG), 1)
+# The config header is written together with the settings hex
+GENERATED_CONFIG_FLAGS = --config-header "$(GENERATED_CONFIG_H)"
+$(GENERATED_CONFIG_H): $(SETTINGS_HEX) ;
+endif
+
 $(SETTINGS_HEX): $(LAYOUT_FILE) $(RF_FILE)
+	@mkdir -p $(BUILD_TARGET_DIR)
 	$(KEYPLUS_CLI) program \
 		$(KEYPLUS_CLI_EXTRA) \
+		$(STATIC_LAYOUT_FLAGS) \
+		$(GENERATED_CONFIG_FLAGS) \
 		--new-id $(ID) \
 		--layout "$(LAYOUT_FILE)" \
 		--rf "$(RF_FILE)" \
@@ -29,8 +29,10 @@ endef
 # $1: source file to manipulate
 # $2: recipe code
 # $3: obj file extension
+#
+# When the build uses a generated config header, it is created first.
 define define_compile_rule
-$(call obj_file_name,$(1),$(3)): $(1)
+$(call obj_file_name,$(1),$(3)): $(1) | $(GENERATED_CONFIG_H)
 	@mkdir -p $$(dir $$@)
 $(call $(2))
 endef